@@ -0,0 +1,162 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * bench-arena.c - arena and pool allocators versus malloc.
+ *
+ * Usage: bench-arena [nallocs]
+ *
+ * Request sizes are drawn from 16 to 256 bytes, the range of the
+ * nodes and entries in this library's containers.  The "bulk" phases
+ * allocate everything and then free it all; the arena frees with a
+ * single reset.  The "churn" phases keep a window of live blocks,
+ * freeing the oldest for each new one.  The "hashtbl" phases build a
+ * table with each allocator plugged into its hooks and delete it.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "bench.h"
+
+#include <c-hacks/arena.h>
+#include <c-hacks/hashtbl.h>
+#include <c-hacks/hashtbl-funcs.h>
+
+#define WINDOW 1024
+
+static unsigned long long rand_state = 1;
+
+static uint32_t next_rand(void)
+{
+	rand_state = rand_state * 6364136223846793005ULL +
+	    1442695040888963407ULL;
+	return (uint32_t)(rand_state >> 32);
+}
+
+static void bulk(const char *name, void *(*alloc_fn)(size_t),
+		 void (*free_fn)(void *), const size_t *sizes, void **ptrs,
+		 unsigned long n)
+{
+	unsigned long i;
+	struct bench b;
+
+	bench_start(&b, name);
+	for (i = 0; i < n; i++) {
+		ptrs[i] = alloc_fn(sizes[i]);
+		*(char *)ptrs[i] = 1;
+	}
+	for (i = 0; i < n; i++)
+		free_fn(ptrs[i]);
+	bench_stop(&b, n);
+}
+
+static void churn(const char *name, void *(*alloc_fn)(size_t),
+		  void (*free_fn)(void *), const size_t *sizes,
+		  unsigned long n)
+{
+	void *window[WINDOW];
+	unsigned long i;
+	struct bench b;
+
+	for (i = 0; i < WINDOW; i++)
+		window[i] = alloc_fn(sizes[i]);
+
+	bench_start(&b, name);
+	for (i = 0; i < n; i++) {
+		free_fn(window[i % WINDOW]);
+		window[i % WINDOW] = alloc_fn(sizes[i]);
+		*(char *)window[i % WINDOW] = 1;
+	}
+	bench_stop(&b, n);
+
+	for (i = 0; i < WINDOW; i++)
+		free_fn(window[i]);
+}
+
+static void table(const char *name, void *(*alloc_fn)(size_t),
+		  void (*free_fn)(void *), unsigned long n)
+{
+	struct hashtbl *h;
+	unsigned long i;
+	struct bench b;
+
+	bench_start(&b, name);
+	h = hashtbl_create(16, 0.75, 1, hashtbl_direct_hash,
+			   hashtbl_direct_equals, NULL, NULL, alloc_fn,
+			   free_fn);
+	for (i = 1; i <= n; i++)
+		hashtbl_insert(h, (void *)(uintptr_t)i, NULL);
+	bench_consume(hashtbl_count(h));
+	hashtbl_delete(h);
+	bench_stop(&b, n);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long i, n = bench_arg_count(argc, argv, 1000000);
+	size_t *sizes = malloc(n * sizeof(*sizes));
+	void **ptrs = malloc(n * sizeof(*ptrs));
+	struct arena *a = arena_create(0, NULL, NULL);
+	struct bench b;
+	int round;
+
+	for (i = 0; i < n; i++)
+		sizes[i] = 16 + next_rand() % 241;
+
+	/* The second round runs on memory the first has warmed up. */
+
+	for (round = 0; round < 2; round++) {
+		bulk("malloc/bulk", malloc, free, sizes, ptrs, n);
+		bulk("pool/bulk", pool_malloc, pool_free, sizes, ptrs, n);
+
+		bench_start(&b, "arena/bulk");
+		for (i = 0; i < n; i++) {
+			ptrs[i] = arena_alloc(a, sizes[i]);
+			*(char *)ptrs[i] = 1;
+		}
+		arena_reset(a);
+		bench_stop(&b, n);
+	}
+
+	churn("malloc/churn", malloc, free, sizes, n);
+	churn("pool/churn", pool_malloc, pool_free, sizes, n);
+
+	arena_select(a);
+	table("malloc/hashtbl", malloc, free, n);
+	table("pool/hashtbl", pool_malloc, pool_free, n);
+	table("arena/hashtbl", arena_malloc, arena_free, n);
+	arena_reset(a);
+
+	arena_delete(a);
+	free(ptrs);
+	free(sizes);
+
+	return 0;
+}
@@ -0,0 +1,202 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * bench-art.c - art versus hashtbl for string keys.
+ *
+ * Usage: bench-art [nkeys]
+ *
+ * Runs insert, lookup and remove phases against an art and a hashtbl
+ * with string keys, first short "key:" keys and then URL-like keys
+ * that share a 28 byte prefix.  The art also times an ordered walk and
+ * prefix scans that each match about 1/256 of the keys, which the
+ * hashtbl can only answer by visiting every entry.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "bench.h"
+
+#include <c-hacks/art.h>
+#include <c-hacks/hashtbl.h>
+#include <c-hacks/hashtbl-funcs.h>
+
+#define KEY(X)	((void *)(intptr_t)(X))
+#define NSCANS 256
+
+static char **make_string_keys(const char *fmt, unsigned long n)
+{
+	char **keys = malloc(n * sizeof(*keys));
+	unsigned long i;
+
+	for (i = 0; i < n; i++) {
+		char buf[64];
+		sprintf(buf, fmt, (i * 2654435761UL) & 0xffffffff);
+		keys[i] = strdup(buf);
+	}
+
+	return keys;
+}
+
+static int count_entry(const unsigned char *key, size_t len, void *val,
+		       void *client_data)
+{
+	bench_consume((unsigned long)(uintptr_t) val);
+	return 1;
+}
+
+static int match_prefix(const void *key, const void *val,
+			const void *client_data)
+{
+	const char *prefix = client_data;
+
+	bench_consume(strncmp(key, prefix, strlen(prefix)) == 0);
+	return 1;
+}
+
+static void bench_art(const char *label, const char *scan_fmt, char **keys,
+		      char **probe, unsigned long n)
+{
+	struct bench b;
+	struct art *t = art_create(NULL, NULL, NULL);
+	unsigned long i, nfound = 0;
+	char name[64], prefix[64];
+
+	sprintf(name, "art/%s/insert", label);
+	bench_start(&b, name);
+	for (i = 0; i < n; i++)
+		art_insert(t, keys[i], strlen(keys[i]), KEY(i + 1));
+	bench_stop(&b, n);
+
+	sprintf(name, "art/%s/lookup", label);
+	bench_start(&b, name);
+	for (i = 0; i < n; i++)
+		nfound += art_lookup(t, probe[i], strlen(probe[i])) != NULL;
+	bench_stop(&b, n);
+
+	sprintf(name, "art/%s/iterate", label);
+	bench_start(&b, name);
+	i = art_apply(t, count_entry, NULL);
+	bench_stop(&b, i);
+
+	/* Counted per scan rather than per entry visited. */
+
+	sprintf(name, "art/%s/prefix-scan", label);
+	bench_start(&b, name);
+	for (i = 0; i < NSCANS; i++) {
+		sprintf(prefix, scan_fmt, (unsigned long)i);
+		art_prefix_scan(t, prefix, strlen(prefix), count_entry, NULL);
+	}
+	bench_stop(&b, NSCANS);
+
+	sprintf(name, "art/%s/remove", label);
+	bench_start(&b, name);
+	for (i = 0; i < n; i++)
+		art_remove(t, probe[i], strlen(probe[i]));
+	bench_stop(&b, n);
+
+	bench_consume(nfound);
+	art_delete(t);
+}
+
+static void bench_hashtbl(const char *label, const char *scan_fmt,
+			  char **keys, char **probe, unsigned long n)
+{
+	struct bench b;
+	struct hashtbl *h = hashtbl_create(16, 0.75, 1, hashtbl_string_hash,
+					   hashtbl_string_equals, NULL, NULL,
+					   NULL, NULL);
+	unsigned long i, nfound = 0;
+	char name[64], prefix[64];
+
+	sprintf(name, "hashtbl/%s/insert", label);
+	bench_start(&b, name);
+	for (i = 0; i < n; i++)
+		hashtbl_insert(h, keys[i], KEY(i + 1));
+	bench_stop(&b, n);
+
+	sprintf(name, "hashtbl/%s/lookup", label);
+	bench_start(&b, name);
+	for (i = 0; i < n; i++)
+		nfound += hashtbl_lookup(h, probe[i]) != NULL;
+	bench_stop(&b, n);
+
+	/* A handful of scans is enough: each one visits every entry. */
+
+	sprintf(name, "hashtbl/%s/prefix-scan (full)", label);
+	bench_start(&b, name);
+	for (i = 0; i < 4; i++) {
+		sprintf(prefix, scan_fmt, (unsigned long)i);
+		hashtbl_apply(h, match_prefix, prefix);
+	}
+	bench_stop(&b, 4);
+
+	sprintf(name, "hashtbl/%s/remove", label);
+	bench_start(&b, name);
+	for (i = 0; i < n; i++)
+		hashtbl_remove(h, probe[i]);
+	bench_stop(&b, n);
+
+	bench_consume(nfound);
+	hashtbl_delete(h);
+}
+
+static void run(const char *label, const char *fmt, const char *scan_fmt,
+		unsigned long n)
+{
+	char **keys = make_string_keys(fmt, n);
+	char **probe = malloc(n * sizeof(*probe));
+	unsigned long i;
+
+	/* Probe in a different order to the one used for inserts. */
+
+	for (i = 0; i < n; i++)
+		probe[i] = keys[(i * 7919) % n];
+
+	bench_art(label, scan_fmt, keys, probe, n);
+	bench_hashtbl(label, scan_fmt, keys, probe, n);
+
+	for (i = 0; i < n; i++)
+		free(keys[i]);
+	free(keys);
+	free(probe);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long n = bench_arg_count(argc, argv, 1000000);
+
+	run("string", "key:%08lx", "key:%02lx", n);
+	run("url", "https://example.com/objects/%08lx",
+	    "https://example.com/objects/%02lx", n);
+
+	return 0;
+}
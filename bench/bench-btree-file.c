@@ -0,0 +1,158 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * bench-btree-file.c - btree-file versus an in-memory btree.
+ *
+ * Usage: bench-btree-file [nkeys] [path]
+ *
+ * Builds a tree file of nkeys scrambled integer keys, committing
+ * every COMMIT_EVERY inserts without msync(2), and then times lookups
+ * and a full scan with the file's pages already mapped and cached.
+ * This runs for 4 KB and 16 KB pages, followed by SYNC_COMMITS small
+ * durable commits to show the price of msync(2).  The same lookups
+ * are timed against a btree for reference.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "bench.h"
+
+#include <c-hacks/btree.h>
+#include <c-hacks/btree-file.h>
+
+#define KEY(X)		((void *)(intptr_t)(X))
+#define COMMIT_EVERY	1000
+#define SYNC_COMMITS	100
+#define SYNC_BATCH	10
+
+static void bench_file(const char *path, size_t page_size,
+		       int64_t *keys, int64_t *probe,
+		       unsigned long n)
+{
+	struct bench b;
+	struct btree_file_iter iter;
+	struct btree_file *f;
+	unsigned long i, nfound = 0;
+	char name[64];
+	uint64_t v;
+
+	unlink(path);
+	if ((f = btree_file_open(path, page_size, BTREE_FILE_NOSYNC, NULL,
+				 NULL)) == NULL) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	sprintf(name, "btree-file/%zuk/insert", page_size / 1024);
+	bench_start(&b, name);
+	for (i = 0; i < n; i++) {
+		btree_file_insert(f, keys[i], (uint64_t)keys[i]);
+		if ((i + 1) % COMMIT_EVERY == 0)
+			btree_file_commit(f);
+	}
+	btree_file_commit(f);
+	bench_stop(&b, n);
+
+	sprintf(name, "btree-file/%zuk/lookup", page_size / 1024);
+	bench_start(&b, name);
+	for (i = 0; i < n; i++)
+		nfound += btree_file_lookup(f, probe[i], &v) == 0;
+	bench_stop(&b, n);
+
+	sprintf(name, "btree-file/%zuk/iterate", page_size / 1024);
+	bench_start(&b, name);
+	btree_file_iter_init(f, &iter);
+	for (i = 0; btree_file_iter_next(&iter); i++)
+		bench_consume((unsigned long)iter.val);
+	bench_stop(&b, i);
+
+	btree_file_close(f);
+
+	/* Reopen with msync(2) on every commit. */
+
+	f = btree_file_open(path, 0, 0, NULL, NULL);
+	sprintf(name, "btree-file/%zuk/sync-commit", page_size / 1024);
+	bench_start(&b, name);
+	for (i = 0; i < SYNC_COMMITS * SYNC_BATCH; i++) {
+		btree_file_insert(f, probe[i % n], i);
+		if ((i + 1) % SYNC_BATCH == 0)
+			btree_file_commit(f);
+	}
+	bench_stop(&b, SYNC_COMMITS);
+
+	bench_consume(nfound);
+	btree_file_close(f);
+	unlink(path);
+}
+
+static void bench_btree(int64_t *keys, int64_t *probe,
+			unsigned long n)
+{
+	struct bench b;
+	struct btree *t = btree_create(NULL, NULL, NULL, NULL, NULL);
+	unsigned long i, nfound = 0;
+
+	for (i = 0; i < n; i++)
+		btree_insert(t, KEY(keys[i]), KEY(keys[i]));
+
+	bench_start(&b, "btree/lookup");
+	for (i = 0; i < n; i++)
+		nfound += btree_lookup(t, KEY(probe[i])) != NULL;
+	bench_stop(&b, n);
+
+	bench_consume(nfound);
+	btree_delete(t);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long i, n = bench_arg_count(argc, argv, 1000000);
+	const char *path = (argc > 2) ? argv[2] : "bench-btree-file.db";
+	int64_t *keys = malloc(n * sizeof(*keys));
+	int64_t *probe = malloc(n * sizeof(*probe));
+
+	/* Scrambled, nonzero keys; probe in a different order. */
+
+	for (i = 0; i < n; i++)
+		keys[i] = (int64_t)(((i + 1) * 2654435761UL) & 0x7fffffff);
+	for (i = 0; i < n; i++)
+		probe[i] = keys[(i * 7919) % n];
+
+	bench_file(path, 4096, keys, probe, n);
+	bench_file(path, 16384, keys, probe, n);
+	bench_btree(keys, probe, n);
+
+	free(keys);
+	free(probe);
+
+	return 0;
+}
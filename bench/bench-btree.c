@@ -0,0 +1,368 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * bench-btree.c - btree versus hashtbl.
+ *
+ * Usage: bench-btree [nkeys]
+ *
+ * Runs the same insert, lookup, iterate and remove phases against a
+ * btree and a hashtbl, first with integer keys stored directly in the
+ * key pointer and then with string keys.  The "int" btree run uses the
+ * comparator-free integer search; "int-cmp" orders the same keys via
+ * btree_direct_compare() and a binary search for comparison.  The
+ * "sorted" runs build a tree from presorted keys, first one insert at
+ * a time and then with btree_bulk_load().  The "persistent" runs show
+ * the cost of path copying: values are updated while a snapshot is
+ * taken, and the previous one dropped, every SNAPSHOT_EVERY writes.
+ * The rank and select phases time btree_rank() and btree_select().
+ * The "prefix" runs use btree_set_string_keys() for the string keys,
+ * and for URL-like keys that share a 28 byte prefix.  The "range" runs
+ * merge a sorted batch into a tree of even keys, and remove half of
+ * the keys, first one key at a time and then in a single call.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "bench.h"
+
+#include <c-hacks/btree.h>
+#include <c-hacks/btree-funcs.h>
+#include <c-hacks/hashtbl.h>
+#include <c-hacks/hashtbl-funcs.h>
+
+#define KEY(X)	((void *)(intptr_t)(X))
+#define SNAPSHOT_EVERY 1000
+
+/*
+ * Returns n distinct keys in a scrambled order: multiplying by an odd
+ * constant is a bijection modulo 2^31.
+ */
+static intptr_t *make_int_keys(unsigned long n, unsigned long seed)
+{
+	intptr_t *keys = malloc(n * sizeof(*keys));
+	unsigned long i;
+
+	for (i = 0; i < n; i++)
+		keys[i] = (intptr_t)(((i + seed) * 2654435761UL) & 0x7fffffff);
+
+	return keys;
+}
+
+static char **make_string_keys(const char *fmt, intptr_t *ints,
+			       unsigned long n)
+{
+	char **keys = malloc(n * sizeof(*keys));
+	unsigned long i;
+
+	for (i = 0; i < n; i++) {
+		char buf[64];
+		sprintf(buf, fmt, (unsigned long)ints[i]);
+		keys[i] = strdup(buf);
+	}
+
+	return keys;
+}
+
+static void bench_btree(const char *label, BTREE_COMPARE_FN cmp,
+			int string_keys, void **keys, void **probe,
+			unsigned long n)
+{
+	struct bench b;
+	struct btree_iter iter;
+	struct btree *t = btree_create(cmp, NULL, NULL, NULL, NULL);
+	unsigned long i, nfound = 0;
+	char name[64];
+
+	if (string_keys)
+		btree_set_string_keys(t);
+
+	sprintf(name, "btree/%s/insert", label);
+	bench_start(&b, name);
+	for (i = 0; i < n; i++)
+		btree_insert(t, keys[i], keys[i]);
+	bench_stop(&b, n);
+
+	sprintf(name, "btree/%s/lookup", label);
+	bench_start(&b, name);
+	for (i = 0; i < n; i++)
+		nfound += btree_lookup(t, probe[i]) != NULL;
+	bench_stop(&b, n);
+
+	sprintf(name, "btree/%s/iterate", label);
+	bench_start(&b, name);
+	btree_iter_init(t, &iter);
+	for (i = 0; btree_iter_next(&iter); i++)
+		bench_consume((unsigned long)(uintptr_t) iter.val);
+	bench_stop(&b, i);
+
+	sprintf(name, "btree/%s/rank", label);
+	bench_start(&b, name);
+	for (i = 0; i < n; i++)
+		bench_consume(btree_rank(t, probe[i]));
+	bench_stop(&b, n);
+
+	sprintf(name, "btree/%s/select", label);
+	bench_start(&b, name);
+	for (i = 0; i < n; i++) {
+		btree_select(t, (i * 7919) % n, &iter);
+		btree_iter_next(&iter);
+		bench_consume((unsigned long)(uintptr_t) iter.val);
+	}
+	bench_stop(&b, n);
+
+	sprintf(name, "btree/%s/remove", label);
+	bench_start(&b, name);
+	for (i = 0; i < n; i++)
+		btree_remove(t, probe[i]);
+	bench_stop(&b, n);
+
+	bench_consume(nfound);
+	btree_delete(t);
+}
+
+static void bench_btree_build(void **sorted, void **probe, unsigned long n)
+{
+	static const double fills[] = { 1.0, 0.7 };
+	struct bench b;
+	struct btree *t = btree_create(NULL, NULL, NULL, NULL, NULL);
+	unsigned long i, nfound = 0;
+	char name[64];
+
+	bench_start(&b, "btree/sorted/insert");
+	for (i = 0; i < n; i++)
+		btree_insert(t, sorted[i], sorted[i]);
+	bench_stop(&b, n);
+
+	bench_start(&b, "btree/sorted/lookup");
+	for (i = 0; i < n; i++)
+		nfound += btree_lookup(t, probe[i]) != NULL;
+	bench_stop(&b, n);
+
+	for (i = 0; i < sizeof(fills) / sizeof(fills[0]); i++) {
+		unsigned long j;
+
+		btree_clear(t);
+		sprintf(name, "btree/sorted/bulk-load %.1f", fills[i]);
+		bench_start(&b, name);
+		btree_bulk_load(t, sorted, sorted, n, fills[i]);
+		bench_stop(&b, n);
+
+		sprintf(name, "btree/sorted/lookup %.1f", fills[i]);
+		bench_start(&b, name);
+		for (j = 0; j < n; j++)
+			nfound += btree_lookup(t, probe[j]) != NULL;
+		bench_stop(&b, n);
+	}
+
+	bench_consume(nfound);
+	btree_delete(t);
+}
+
+static void bench_btree_persistent(void **keys, void **probe,
+				   unsigned long n)
+{
+	struct bench b;
+	struct btree_iter iter;
+	struct btree *snap = NULL, *t = btree_create(NULL, NULL, NULL, NULL,
+						      NULL);
+	unsigned long i;
+
+	btree_set_persistent(t);
+
+	bench_start(&b, "btree/persistent/insert");
+	for (i = 0; i < n; i++)
+		btree_insert(t, keys[i], keys[i]);
+	bench_stop(&b, n);
+
+	bench_start(&b, "btree/persistent/update+snapshot");
+	for (i = 0; i < n; i++) {
+		if (i % SNAPSHOT_EVERY == 0) {
+			if (snap != NULL)
+				btree_delete(snap);
+			snap = btree_snapshot(t);
+		}
+		btree_insert(t, probe[i], probe[i]);
+	}
+	bench_stop(&b, n);
+
+	bench_start(&b, "btree/persistent/iterate");
+	btree_iter_init(t, &iter);
+	for (i = 0; btree_iter_next(&iter); i++)
+		bench_consume((unsigned long)(uintptr_t) iter.val);
+	bench_stop(&b, i);
+
+	btree_delete(snap);
+	btree_delete(t);
+}
+
+static void bench_btree_range(void **sorted, unsigned long n)
+{
+	struct bench b;
+	struct btree *t = btree_create(NULL, NULL, NULL, NULL, NULL);
+	struct btree *u = btree_create(NULL, NULL, NULL, NULL, NULL);
+	void **batch = malloc(n / 2 * sizeof(void *));
+	unsigned long i;
+
+	/* An odd key between each pair of even keys in the lower half. */
+
+	for (i = 0; i < n / 2; i++)
+		batch[i] = KEY(2 * i + 1);
+
+	btree_bulk_load(t, sorted, sorted, n, 1.0);
+	btree_bulk_load(u, sorted, sorted, n, 1.0);
+
+	bench_start(&b, "btree/range/insert");
+	for (i = 0; i < n / 2; i++)
+		btree_insert(t, batch[i], batch[i]);
+	bench_stop(&b, n / 2);
+
+	bench_start(&b, "btree/range/merge-sorted");
+	btree_merge_sorted(u, batch, batch, n / 2);
+	bench_stop(&b, n / 2);
+
+	bench_start(&b, "btree/range/remove");
+	for (i = n / 2; i < 3 * n / 2; i++)
+		btree_remove(t, KEY(i));
+	bench_stop(&b, n);
+
+	bench_start(&b, "btree/range/delete-range");
+	bench_consume(btree_delete_range(u, KEY(n / 2), KEY(3 * n / 2)));
+	bench_stop(&b, n);
+
+	bench_consume(btree_count(t) + btree_count(u));
+	free(batch);
+	btree_delete(t);
+	btree_delete(u);
+}
+
+static void bench_hashtbl(const char *label, HASHTBL_HASH_FN hash,
+			  HASHTBL_EQUALS_FN equals, void **keys, void **probe,
+			  unsigned long n)
+{
+	struct bench b;
+	struct hashtbl_iter iter;
+	struct hashtbl *h = hashtbl_create(16, 0.75, 1, hash, equals,
+					   NULL, NULL, NULL, NULL);
+	unsigned long i, nfound = 0;
+	char name[64];
+
+	sprintf(name, "hashtbl/%s/insert", label);
+	bench_start(&b, name);
+	for (i = 0; i < n; i++)
+		hashtbl_insert(h, keys[i], keys[i]);
+	bench_stop(&b, n);
+
+	sprintf(name, "hashtbl/%s/lookup", label);
+	bench_start(&b, name);
+	for (i = 0; i < n; i++)
+		nfound += hashtbl_lookup(h, probe[i]) != NULL;
+	bench_stop(&b, n);
+
+	/* Unordered: the hashtbl can't offer a sorted walk. */
+	sprintf(name, "hashtbl/%s/iterate (unordered)", label);
+	bench_start(&b, name);
+	hashtbl_iter_init(h, &iter);
+	for (i = 0; hashtbl_iter_next(h, &iter); i++)
+		bench_consume((unsigned long)(uintptr_t) iter.val);
+	bench_stop(&b, i);
+
+	sprintf(name, "hashtbl/%s/remove", label);
+	bench_start(&b, name);
+	for (i = 0; i < n; i++)
+		hashtbl_remove(h, probe[i]);
+	bench_stop(&b, n);
+
+	bench_consume(nfound);
+	hashtbl_delete(h);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long i, n = bench_arg_count(argc, argv, 1000000);
+	intptr_t *ints = make_int_keys(n, 0);
+	void **keys = malloc(n * sizeof(void *));
+	void **probe = malloc(n * sizeof(void *));
+	char **strings = make_string_keys("key:%016lx", ints, n);
+	char **urls = make_string_keys("https://example.com/objects/%lu",
+				       ints, n);
+
+	/* Probe in a different order to the one used for inserts. */
+
+	for (i = 0; i < n; i++) {
+		keys[i] = KEY(ints[i]);
+		probe[i] = KEY(ints[(i * 7919) % n]);
+	}
+
+	bench_btree("int", NULL, 0, keys, probe, n);
+	bench_btree("int-cmp", btree_direct_compare, 0, keys, probe, n);
+	bench_btree_persistent(keys, probe, n);
+	bench_hashtbl("int", hashtbl_direct_hash, hashtbl_direct_equals,
+		      keys, probe, n);
+
+	for (i = 0; i < n; i++) {
+		keys[i] = KEY(i * 2);
+		probe[i] = KEY(((i * 7919) % n) * 2);
+	}
+
+	bench_btree_build(keys, probe, n);
+	bench_btree_range(keys, n);
+
+	for (i = 0; i < n; i++) {
+		keys[i] = strings[i];
+		probe[i] = strings[(i * 7919) % n];
+	}
+
+	bench_btree("string", btree_string_compare, 0, keys, probe, n);
+	bench_btree("string-prefix", btree_string_compare, 1, keys, probe, n);
+	bench_hashtbl("string", hashtbl_string_hash, hashtbl_string_equals,
+		      keys, probe, n);
+
+	for (i = 0; i < n; i++) {
+		keys[i] = urls[i];
+		probe[i] = urls[(i * 7919) % n];
+	}
+
+	bench_btree("url", btree_string_compare, 0, keys, probe, n);
+	bench_btree("url-prefix", btree_string_compare, 1, keys, probe, n);
+
+	for (i = 0; i < n; i++) {
+		free(strings[i]);
+		free(urls[i]);
+	}
+	free(strings);
+	free(urls);
+	free(ints);
+	free(keys);
+	free(probe);
+
+	return 0;
+}
@@ -0,0 +1,235 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * bench-cbtree.c - concurrent range scans.
+ *
+ * Usage: bench-cbtree [nkeys] [nthreads]
+ *
+ * Loads nkeys integer keys and then runs range scans of SCAN_LEN keys
+ * from 1 up to nthreads threads at once, first with readers only and
+ * then with one of the threads inserting and removing keys.  The same
+ * phases run against a cbtree and against a btree behind a
+ * pthread_rwlock_t.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "bench.h"
+
+#include <c-hacks/btree.h>
+#include <c-hacks/cbtree.h>
+#include <c-hacks/epoch.h>
+
+#define KEY(X)		((void *)(intptr_t)(X))
+#define SCAN_LEN	100
+#define SCANS_PER_THREAD 20000
+#define MAX_THREADS	64
+
+struct locked_btree {
+	pthread_rwlock_t lock;
+	struct btree *t;
+};
+
+struct worker {
+	pthread_t thread;
+	int writer;
+	unsigned long seed;
+	unsigned long nkeys;
+	unsigned long nops;
+	unsigned long sum;
+	struct cbtree *ct;
+	struct epoch *e;
+	struct locked_btree *lt;
+};
+
+static volatile int stop_writers;
+
+static unsigned long next_rand(unsigned long *x)
+{
+	/* splitmix64 */
+	unsigned long z = (*x += 0x9e3779b97f4a7c15UL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+	return z ^ (z >> 31);
+}
+
+static int sum_cbtree(intptr_t k, void *v, void *client_data)
+{
+	*(unsigned long *)client_data += (unsigned long)k + (uintptr_t) v;
+	return 1;
+}
+
+static void *cbtree_worker(void *arg)
+{
+	struct worker *w = arg;
+	struct epoch_thread *self = epoch_register(w->e);
+	unsigned long i;
+
+	if (w->writer) {
+		for (i = 0; !stop_writers; i++) {
+			intptr_t k = next_rand(&w->seed) % w->nkeys;
+			if (i % 2)
+				cbtree_remove(w->ct, self, k);
+			else
+				cbtree_insert(w->ct, self, k, KEY(k));
+		}
+	} else {
+		for (i = 0; i < SCANS_PER_THREAD; i++) {
+			intptr_t lo = next_rand(&w->seed) % w->nkeys;
+			cbtree_range(w->ct, self, lo, lo + SCAN_LEN,
+				     sum_cbtree, &w->sum);
+		}
+	}
+
+	w->nops = i;
+	epoch_unregister(self);
+	return NULL;
+}
+
+static void *btree_worker(void *arg)
+{
+	struct worker *w = arg;
+	struct btree_iter iter;
+	unsigned long i;
+
+	if (w->writer) {
+		for (i = 0; !stop_writers; i++) {
+			intptr_t k = next_rand(&w->seed) % w->nkeys;
+			pthread_rwlock_wrlock(&w->lt->lock);
+			if (i % 2)
+				btree_remove(w->lt->t, KEY(k));
+			else
+				btree_insert(w->lt->t, KEY(k), KEY(k));
+			pthread_rwlock_unlock(&w->lt->lock);
+		}
+	} else {
+		for (i = 0; i < SCANS_PER_THREAD; i++) {
+			intptr_t lo = next_rand(&w->seed) % w->nkeys;
+			pthread_rwlock_rdlock(&w->lt->lock);
+			btree_lower_bound(w->lt->t, KEY(lo), &iter);
+			while (btree_iter_next(&iter) &&
+			       (intptr_t) iter.key < lo + SCAN_LEN)
+				w->sum += (uintptr_t) iter.key +
+				    (uintptr_t) iter.val;
+			pthread_rwlock_unlock(&w->lt->lock);
+		}
+	}
+
+	w->nops = i;
+	return NULL;
+}
+
+/*
+ * Runs nthreads workers, the last of which is a writer if with_writer
+ * is set, and reports the cost per scan.
+ */
+static void run(const char *label, void *(*fn) (void *), struct worker *proto,
+		int nthreads, int with_writer)
+{
+	static struct worker workers[MAX_THREADS];
+	unsigned long nscans = 0, sum = 0;
+	struct bench b;
+	char name[64];
+	int i, nreaders = nthreads - with_writer;
+
+	sprintf(name, "%s/scan %d%s", label, nreaders, with_writer ? "+w" : "");
+	stop_writers = 0;
+
+	bench_start(&b, name);
+
+	for (i = 0; i < nthreads; i++) {
+		workers[i] = *proto;
+		workers[i].writer = with_writer && i == nthreads - 1;
+		workers[i].seed = i + 1;
+		pthread_create(&workers[i].thread, NULL, fn, &workers[i]);
+	}
+
+	for (i = 0; i < nreaders; i++) {
+		pthread_join(workers[i].thread, NULL);
+		nscans += workers[i].nops;
+		sum += workers[i].sum;
+	}
+
+	bench_stop(&b, nscans);
+
+	if (with_writer) {
+		stop_writers = 1;
+		pthread_join(workers[nthreads - 1].thread, NULL);
+		printf("%-36s %10lu writes\n", "", workers[nthreads - 1].nops);
+	}
+
+	bench_consume(sum);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long i, n = bench_arg_count(argc, argv, 1000000);
+	int nthreads = (argc > 2) ? atoi(argv[2]) : 4;
+	struct epoch *e = epoch_create(NULL, NULL);
+	struct epoch_thread *self = epoch_register(e);
+	struct locked_btree lt;
+	struct worker proto = { 0 };
+	int t;
+
+	if (nthreads < 1 || nthreads > MAX_THREADS)
+		nthreads = 4;
+
+	proto.nkeys = n;
+	proto.e = e;
+	proto.ct = cbtree_create(e, NULL, NULL, NULL);
+	proto.lt = &lt;
+	pthread_rwlock_init(&lt.lock, NULL);
+	lt.t = btree_create(NULL, NULL, NULL, NULL, NULL);
+
+	for (i = 0; i < n; i++) {
+		cbtree_insert(proto.ct, self, i, KEY(i));
+		btree_insert(lt.t, KEY(i), KEY(i));
+	}
+
+	for (t = 1; t <= nthreads; t *= 2) {
+		run("cbtree", cbtree_worker, &proto, t, 0);
+		run("btree+rwlock", btree_worker, &proto, t, 0);
+	}
+
+	for (t = 2; t <= nthreads + 1; t *= 2) {
+		run("cbtree", cbtree_worker, &proto, t, 1);
+		run("btree+rwlock", btree_worker, &proto, t, 1);
+	}
+
+	cbtree_delete(proto.ct);
+	btree_delete(lt.t);
+	pthread_rwlock_destroy(&lt.lock);
+	epoch_unregister(self);
+	epoch_delete(e);
+
+	return 0;
+}
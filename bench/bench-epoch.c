@@ -0,0 +1,79 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * bench-epoch.c - read- and write-side costs of epoch reclamation.
+ *
+ * Usage: bench-epoch [nops]
+ *
+ * The "read" phases time an empty critical section, and a quiescent
+ * state, with a second registered thread idle; the "retire" phase
+ * times retiring, and eventually freeing, small allocations.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+
+#include <c-hacks/epoch.h>
+
+int main(int argc, char *argv[])
+{
+	unsigned long i, n = bench_arg_count(argc, argv, 10000000);
+	struct epoch *e = epoch_create(NULL, NULL);
+	struct epoch_thread *self = epoch_register(e);
+	struct epoch_thread *other = epoch_register(e);
+	struct bench b;
+
+	bench_start(&b, "epoch/read/enter+leave");
+	for (i = 0; i < n; i++) {
+		epoch_enter(self);
+		epoch_leave(self);
+	}
+	bench_stop(&b, n);
+
+	bench_start(&b, "epoch/read/quiescent");
+	for (i = 0; i < n; i++)
+		epoch_quiescent(self);
+	bench_stop(&b, n);
+	epoch_offline(self);
+
+	bench_start(&b, "epoch/retire");
+	for (i = 0; i < n / 10; i++)
+		epoch_retire(self, malloc(32), free);
+	while (epoch_reclaim(self) != 0)
+		;
+	bench_stop(&b, n / 10);
+
+	epoch_unregister(other);
+	epoch_unregister(self);
+	epoch_delete(e);
+
+	return 0;
+}
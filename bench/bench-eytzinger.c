@@ -0,0 +1,121 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * bench-eytzinger.c - Eytzinger layout versus binary search and btree.
+ *
+ * Usage: bench-eytzinger [nkeys]
+ *
+ * Looks up nkeys sorted integer keys in a scrambled order, half of
+ * them absent, in an eytzinger set, in the sorted array itself with a
+ * textbook binary search, and in a bulk loaded btree.  With the
+ * default of 4M keys none of the three fits in the last level cache.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "bench.h"
+
+#include <c-hacks/btree.h>
+#include <c-hacks/eytzinger.h>
+
+#define KEY(X)	((void *)(intptr_t)(X))
+
+/* Returns the index of the first key not less than k. */
+
+static size_t binary_search(void **keys, size_t n, intptr_t k)
+{
+	size_t lo = 0, hi = n;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if ((intptr_t) keys[mid] < k)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long i, nfound, n = bench_arg_count(argc, argv, 4000000);
+	void **keys = malloc(n * sizeof(void *));
+	void **probe = malloc(n * sizeof(void *));
+	struct btree *t = btree_create(NULL, NULL, NULL, NULL, NULL);
+	struct eytzinger *e;
+	struct bench b;
+
+	/* Even keys are present; probes alternate present and absent. */
+
+	for (i = 0; i < n; i++) {
+		keys[i] = KEY(i * 2);
+		probe[i] = KEY(((i * 7919) % n) * 2 + (i & 1));
+	}
+
+	bench_start(&b, "eytzinger/create");
+	e = eytzinger_create(NULL, keys, keys, n, NULL, NULL);
+	bench_stop(&b, n);
+	eytzinger_delete(e);
+
+	btree_bulk_load(t, keys, keys, n, 1.0);
+
+	bench_start(&b, "eytzinger/create-from-btree");
+	e = eytzinger_create_from_btree(t, NULL, NULL, NULL);
+	bench_stop(&b, n);
+
+	bench_start(&b, "eytzinger/lookup");
+	for (i = 0, nfound = 0; i < n; i++)
+		nfound += eytzinger_lookup(e, probe[i]) != NULL;
+	bench_stop(&b, n);
+	bench_consume(nfound);
+
+	bench_start(&b, "sorted-array/binary-search");
+	for (i = 0, nfound = 0; i < n; i++) {
+		size_t pos = binary_search(keys, n, (intptr_t) probe[i]);
+		nfound += pos < n && keys[pos] == probe[i];
+	}
+	bench_stop(&b, n);
+	bench_consume(nfound);
+
+	bench_start(&b, "btree/lookup");
+	for (i = 0, nfound = 0; i < n; i++)
+		nfound += btree_lookup(t, probe[i]) != NULL;
+	bench_stop(&b, n);
+	bench_consume(nfound);
+
+	eytzinger_delete(e);
+	btree_delete(t);
+	free(keys);
+	free(probe);
+
+	return 0;
+}
@@ -0,0 +1,215 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * bench-flatmap.c - flatmap versus btree and hashtbl for small maps.
+ *
+ * Usage: bench-flatmap [nkeys]
+ *
+ * For each map size, builds nkeys / size maps of integer keys, looks
+ * up every key of each map LOOKUPS times, then deletes the maps.  The
+ * build and delete phases include creating and deleting the maps, and
+ * all phases are reported per key.  The "batch" phases fill a single
+ * map of nkeys / 10 keys one key at a time, and then with
+ * flatmap_insert_batch().
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "bench.h"
+
+#include <c-hacks/btree.h>
+#include <c-hacks/flatmap.h>
+#include <c-hacks/hashtbl.h>
+#include <c-hacks/hashtbl-funcs.h>
+
+#define KEY(X)		((void *)(intptr_t)(X))
+#define LOOKUPS		8
+
+/* Returns key j of map i: distinct within a map, scrambled. */
+
+static void *key_of(unsigned long i, unsigned long j)
+{
+	return KEY(((i + j) * 2654435761UL) & 0xffffffff);
+}
+
+static void bench_flatmap(unsigned long size, unsigned long nmaps)
+{
+	struct flatmap **maps = malloc(nmaps * sizeof(*maps));
+	unsigned long i, j, r, nfound = 0;
+	struct bench b;
+	char name[64];
+
+	sprintf(name, "flatmap/%lu/build", size);
+	bench_start(&b, name);
+	for (i = 0; i < nmaps; i++) {
+		maps[i] = flatmap_create(NULL, NULL, NULL, NULL, NULL);
+		for (j = 0; j < size; j++)
+			flatmap_insert(maps[i], key_of(i, j), KEY(j + 1));
+	}
+	bench_stop(&b, nmaps * size);
+
+	sprintf(name, "flatmap/%lu/lookup", size);
+	bench_start(&b, name);
+	for (i = 0; i < nmaps; i++) {
+		for (r = 0; r < LOOKUPS; r++) {
+			for (j = 0; j < size; j++)
+				nfound += flatmap_lookup(maps[i],
+							 key_of(i, j)) != NULL;
+		}
+	}
+	bench_stop(&b, nmaps * size * LOOKUPS);
+
+	sprintf(name, "flatmap/%lu/delete", size);
+	bench_start(&b, name);
+	for (i = 0; i < nmaps; i++)
+		flatmap_delete(maps[i]);
+	bench_stop(&b, nmaps * size);
+
+	bench_consume(nfound);
+	free(maps);
+}
+
+static void bench_btree(unsigned long size, unsigned long nmaps)
+{
+	struct btree **maps = malloc(nmaps * sizeof(*maps));
+	unsigned long i, j, r, nfound = 0;
+	struct bench b;
+	char name[64];
+
+	sprintf(name, "btree/%lu/build", size);
+	bench_start(&b, name);
+	for (i = 0; i < nmaps; i++) {
+		maps[i] = btree_create(NULL, NULL, NULL, NULL, NULL);
+		for (j = 0; j < size; j++)
+			btree_insert(maps[i], key_of(i, j), KEY(j + 1));
+	}
+	bench_stop(&b, nmaps * size);
+
+	sprintf(name, "btree/%lu/lookup", size);
+	bench_start(&b, name);
+	for (i = 0; i < nmaps; i++) {
+		for (r = 0; r < LOOKUPS; r++) {
+			for (j = 0; j < size; j++)
+				nfound += btree_lookup(maps[i],
+						       key_of(i, j)) != NULL;
+		}
+	}
+	bench_stop(&b, nmaps * size * LOOKUPS);
+
+	sprintf(name, "btree/%lu/delete", size);
+	bench_start(&b, name);
+	for (i = 0; i < nmaps; i++)
+		btree_delete(maps[i]);
+	bench_stop(&b, nmaps * size);
+
+	bench_consume(nfound);
+	free(maps);
+}
+
+static void bench_hashtbl(unsigned long size, unsigned long nmaps)
+{
+	struct hashtbl **maps = malloc(nmaps * sizeof(*maps));
+	unsigned long i, j, r, nfound = 0;
+	struct bench b;
+	char name[64];
+
+	sprintf(name, "hashtbl/%lu/build", size);
+	bench_start(&b, name);
+	for (i = 0; i < nmaps; i++) {
+		maps[i] = hashtbl_create(16, 0.75, 1, hashtbl_direct_hash,
+					 hashtbl_direct_equals, NULL, NULL,
+					 NULL, NULL);
+		for (j = 0; j < size; j++)
+			hashtbl_insert(maps[i], key_of(i, j), KEY(j + 1));
+	}
+	bench_stop(&b, nmaps * size);
+
+	sprintf(name, "hashtbl/%lu/lookup", size);
+	bench_start(&b, name);
+	for (i = 0; i < nmaps; i++) {
+		for (r = 0; r < LOOKUPS; r++) {
+			for (j = 0; j < size; j++)
+				nfound += hashtbl_lookup(maps[i],
+							 key_of(i, j)) != NULL;
+		}
+	}
+	bench_stop(&b, nmaps * size * LOOKUPS);
+
+	sprintf(name, "hashtbl/%lu/delete", size);
+	bench_start(&b, name);
+	for (i = 0; i < nmaps; i++)
+		hashtbl_delete(maps[i]);
+	bench_stop(&b, nmaps * size);
+
+	bench_consume(nfound);
+	free(maps);
+}
+
+static void bench_batch(unsigned long n)
+{
+	void **keys = malloc(n * sizeof(void *));
+	struct flatmap *m = flatmap_create(NULL, NULL, NULL, NULL, NULL);
+	unsigned long i;
+	struct bench b;
+
+	for (i = 0; i < n; i++)
+		keys[i] = key_of(0, i);
+
+	bench_start(&b, "flatmap/batch/insert");
+	for (i = 0; i < n; i++)
+		flatmap_insert(m, keys[i], keys[i]);
+	bench_stop(&b, n);
+
+	flatmap_clear(m);
+
+	bench_start(&b, "flatmap/batch/insert_batch");
+	flatmap_insert_batch(m, keys, keys, n);
+	bench_stop(&b, n);
+
+	flatmap_delete(m);
+	free(keys);
+}
+
+int main(int argc, char *argv[])
+{
+	static const unsigned long sizes[] = { 4, 16, 64, 256 };
+	unsigned long i, n = bench_arg_count(argc, argv, 1000000);
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		bench_flatmap(sizes[i], n / sizes[i]);
+		bench_btree(sizes[i], n / sizes[i]);
+		bench_hashtbl(sizes[i], n / sizes[i]);
+	}
+
+	bench_batch(n / 10);
+
+	return 0;
+}
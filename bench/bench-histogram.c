@@ -0,0 +1,193 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * bench-histogram.c - latency histograms and what they cost.
+ *
+ * Usage: bench-histogram [nkeys]
+ *
+ * The "record" phases time histogram_record() and the clock on their
+ * own.  The hashtbl and l_hashtbl phases run inserts and lookups with
+ * latency recording off, timing every operation, and timing one in
+ * 64, then print each table's percentiles.  The insert maximum is
+ * where the resizes show up; the l_hashtbl table evicts once it holds
+ * half the keys.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "bench.h"
+
+#include <c-hacks/histogram.h>
+#include <c-hacks/hashtbl.h>
+#include <c-hacks/hashtbl-funcs.h>
+#include <c-hacks/linked-hashtbl.h>
+
+static unsigned long evict_limit;
+
+static void print_summary(const char *name, const struct histogram *h)
+{
+	struct histogram_summary s;
+
+	histogram_summary(h, &s);
+	printf("  %-16s %8llu samples  p50 %5llu  p99 %6llu  "
+	       "p99.9 %7llu  max %8llu ns\n", name,
+	       (unsigned long long)s.count, (unsigned long long)s.p50,
+	       (unsigned long long)s.p99, (unsigned long long)s.p999,
+	       (unsigned long long)s.max);
+}
+
+static void record(unsigned long n)
+{
+	struct histogram *h = malloc(sizeof(*h));
+	struct histogram_summary s;
+	unsigned long i;
+	uint64_t t0 = 0;
+	struct bench b;
+
+	histogram_init(h);
+
+	bench_start(&b, "histogram/record");
+	for (i = 0; i < n; i++)
+		histogram_record(h, (i * 2654435761UL) & 0xfffff);
+	bench_stop(&b, n);
+
+	bench_start(&b, "histogram/clock");
+	for (i = 0; i < n; i++)
+		t0 += histogram_clock_ns(histogram_clock() - t0) & 1;
+	bench_stop(&b, n);
+	bench_consume((unsigned long)t0);
+
+	bench_start(&b, "histogram/summary");
+	histogram_summary(h, &s);
+	bench_stop(&b, 1);
+	bench_consume((unsigned long)s.p999);
+
+	free(h);
+}
+
+static void table(const char *name, int shift, unsigned long n)
+{
+	char phase[64];
+	struct hashtbl *h;
+	struct histogram hist;
+	unsigned long i;
+	struct bench b;
+
+	h = hashtbl_create(16, 0.75, 1, hashtbl_direct_hash,
+			   hashtbl_direct_equals, NULL, NULL, NULL, NULL);
+	if (shift >= 0)
+		hashtbl_latency_enable(h, (unsigned int)shift);
+
+	snprintf(phase, sizeof(phase), "hashtbl/insert/%s", name);
+	bench_start(&b, phase);
+	for (i = 1; i <= n; i++)
+		hashtbl_insert(h, (void *)(uintptr_t)i, NULL);
+	bench_stop(&b, n);
+
+	snprintf(phase, sizeof(phase), "hashtbl/lookup/%s", name);
+	bench_start(&b, phase);
+	for (i = 1; i <= n; i++)
+		bench_consume((unsigned long)(uintptr_t)
+			      hashtbl_lookup(h, (void *)(uintptr_t)i));
+	bench_stop(&b, n);
+
+	histogram_init(&hist);
+	if (hashtbl_latency(h, HASHTBL_LATENCY_INSERT, &hist) == 0)
+		print_summary("insert", &hist);
+	histogram_init(&hist);
+	if (hashtbl_latency(h, HASHTBL_LATENCY_LOOKUP, &hist) == 0)
+		print_summary("lookup", &hist);
+
+	hashtbl_delete(h);
+}
+
+static int evict_half(const struct l_hashtbl *h, unsigned long count)
+{
+	(void)h;
+	return count > evict_limit;
+}
+
+static void linked_table(const char *name, int shift, unsigned long n)
+{
+	char phase[64];
+	struct l_hashtbl *h;
+	struct histogram hist;
+	unsigned long i;
+	struct bench b;
+
+	evict_limit = n / 2;
+	h = l_hashtbl_create(16, 0.75, 1, 1, hashtbl_direct_hash,
+			     hashtbl_direct_equals, NULL, NULL, NULL, NULL,
+			     evict_half);
+	if (shift >= 0)
+		l_hashtbl_latency_enable(h, (unsigned int)shift);
+
+	snprintf(phase, sizeof(phase), "l_hashtbl/insert/%s", name);
+	bench_start(&b, phase);
+	for (i = 1; i <= n; i++)
+		l_hashtbl_insert(h, (void *)(uintptr_t)i, NULL);
+	bench_stop(&b, n);
+
+	snprintf(phase, sizeof(phase), "l_hashtbl/lookup/%s", name);
+	bench_start(&b, phase);
+	for (i = 1; i <= n; i++)
+		bench_consume((unsigned long)(uintptr_t)
+			      l_hashtbl_lookup(h, (void *)(uintptr_t)i));
+	bench_stop(&b, n);
+
+	histogram_init(&hist);
+	if (l_hashtbl_latency(h, LINKED_HASHTBL_LATENCY_INSERT, &hist) == 0)
+		print_summary("insert", &hist);
+	histogram_init(&hist);
+	if (l_hashtbl_latency(h, LINKED_HASHTBL_LATENCY_LOOKUP, &hist) == 0)
+		print_summary("lookup", &hist);
+
+	l_hashtbl_delete(h);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long n = bench_arg_count(argc, argv, 1000000);
+
+	histogram_clock_calibrate();
+
+	record(n);
+
+	table("off", -1, n);
+	table("every", 0, n);
+	table("1-in-64", 6, n);
+
+	linked_table("off", -1, n);
+	linked_table("every", 0, n);
+	linked_table("1-in-64", 6, n);
+
+	return 0;
+}
@@ -0,0 +1,157 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * bench-itree.c - interval tree versus a linear scan.
+ *
+ * Usage: bench-itree [nranges]
+ *
+ * Models an IP range table: ranges of up to 4096 addresses in a 32-bit
+ * space, with one in a hundred up to 16M wide.  The "build" phases
+ * time inserting the ranges one at a time against itree_build().  The
+ * "stab" phases look up the ranges containing random addresses, and
+ * the "overlap" phases the ranges overlapping random 64K blocks; the
+ * scan runs a thousandth as many queries since each visits every
+ * range.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "bench.h"
+
+#include <c-hacks/itree.h>
+
+struct range {
+	uint32_t gateway;
+	struct itree_node node;
+};
+
+static unsigned long long rand_state = 1;
+
+static uint32_t next_rand(void)
+{
+	rand_state = rand_state * 6364136223846793005ULL +
+	    1442695040888963407ULL;
+	return (uint32_t)(rand_state >> 32);
+}
+
+static unsigned long query_tree(const struct itree *t, int64_t lo,
+				int64_t hi)
+{
+	struct itree_node *n;
+	unsigned long found = 0;
+
+	for (n = itree_first_overlap(t, lo, hi); n != NULL;
+	     n = itree_next_overlap(n, lo, hi))
+		found += ITREE_ENTRY(n, struct range, node)->gateway & 1;
+
+	return found;
+}
+
+static unsigned long query_scan(const struct range *ranges,
+				unsigned long n, int64_t lo, int64_t hi)
+{
+	unsigned long i, found = 0;
+
+	for (i = 0; i < n; i++) {
+		if (ranges[i].node.start <= hi && ranges[i].node.last >= lo)
+			found += ranges[i].gateway & 1;
+	}
+
+	return found;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long i, n = bench_arg_count(argc, argv, 1000000);
+	unsigned long nqueries = 100000, nscans = nqueries / 1000;
+	struct range *ranges = malloc(n * sizeof(*ranges));
+	struct itree_node **nodes = malloc(n * sizeof(*nodes));
+	int64_t *points = malloc(nqueries * sizeof(*points));
+	struct itree t;
+	struct bench b;
+
+	for (i = 0; i < n; i++) {
+		int64_t start = next_rand();
+		int64_t len = (i % 100 == 0) ? next_rand() % (1 << 24) :
+		    next_rand() % 4096;
+
+		ranges[i].gateway = next_rand();
+		ranges[i].node.start = start;
+		ranges[i].node.last = start + len;
+		nodes[i] = &ranges[i].node;
+	}
+
+	for (i = 0; i < nqueries; i++)
+		points[i] = next_rand();
+
+	itree_init(&t);
+	bench_start(&b, "itree/build/insert");
+	for (i = 0; i < n; i++)
+		itree_insert(&t, &ranges[i].node);
+	bench_stop(&b, n);
+
+	bench_start(&b, "itree/build/itree_build");
+	itree_init(&t);
+	itree_build(&t, nodes, n);
+	bench_stop(&b, n);
+
+	bench_start(&b, "itree/stab");
+	for (i = 0; i < nqueries; i++)
+		bench_consume(query_tree(&t, points[i], points[i]));
+	bench_stop(&b, nqueries);
+
+	bench_start(&b, "scan/stab");
+	for (i = 0; i < nscans; i++)
+		bench_consume(query_scan(ranges, n, points[i], points[i]));
+	bench_stop(&b, nscans);
+
+	bench_start(&b, "itree/overlap");
+	for (i = 0; i < nqueries; i++)
+		bench_consume(query_tree(&t, points[i], points[i] + 65535));
+	bench_stop(&b, nqueries);
+
+	bench_start(&b, "scan/overlap");
+	for (i = 0; i < nscans; i++)
+		bench_consume(query_scan(ranges, n, points[i],
+					 points[i] + 65535));
+	bench_stop(&b, nscans);
+
+	bench_start(&b, "itree/remove");
+	for (i = 0; i < n; i++)
+		itree_remove(&t, &ranges[i].node);
+	bench_stop(&b, n);
+
+	free(points);
+	free(nodes);
+	free(ranges);
+
+	return 0;
+}
@@ -0,0 +1,178 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * bench-rbtree.c - intrusive rbtree versus btree.
+ *
+ * Usage: bench-rbtree [nkeys]
+ *
+ * Runs insert, lookup, iterate and remove phases with integer keys
+ * against an rbtree whose nodes are embedded in a preallocated array
+ * of items, and against a btree mapping the same keys to the items.
+ * The "timers" phases model a timer queue: the earliest entry is
+ * repeatedly taken off and put back with a later expiry time.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "bench.h"
+
+#include <c-hacks/btree.h>
+#include <c-hacks/rbtree.h>
+
+#define KEY(X)	((void *)(intptr_t)(X))
+
+struct item {
+	unsigned long key;
+	struct rbtree_node node;
+};
+
+static int item_compare(const struct rbtree_node *a,
+			const struct rbtree_node *b)
+{
+	unsigned long x = RBTREE_ENTRY(a, struct item, node)->key;
+	unsigned long y = RBTREE_ENTRY(b, struct item, node)->key;
+
+	return (x > y) - (x < y);
+}
+
+static void bench_rbtree(struct item *items, unsigned long n)
+{
+	struct bench b;
+	struct rbtree t;
+	struct rbtree_node *node;
+	struct item probe;
+	unsigned long i, nfound = 0;
+
+	rbtree_init(&t, item_compare);
+
+	bench_start(&b, "rbtree/insert");
+	for (i = 0; i < n; i++)
+		rbtree_insert(&t, &items[i].node);
+	bench_stop(&b, n);
+
+	bench_start(&b, "rbtree/lookup");
+	for (i = 0; i < n; i++) {
+		probe.key = items[(i * 7919) % n].key;
+		nfound += rbtree_lookup(&t, &probe.node) != NULL;
+	}
+	bench_stop(&b, n);
+
+	bench_start(&b, "rbtree/iterate");
+	for (node = rbtree_first(&t), i = 0; node != NULL;
+	     node = rbtree_next(node), i++)
+		bench_consume(RBTREE_ENTRY(node, struct item, node)->key);
+	bench_stop(&b, i);
+
+	bench_start(&b, "rbtree/timers");
+	for (i = 0; i < n; i++) {
+		struct item *it;
+
+		node = rbtree_first(&t);
+		rbtree_remove(&t, node);
+		it = RBTREE_ENTRY(node, struct item, node);
+		it->key += 1UL << 32;
+		rbtree_insert(&t, node);
+	}
+	bench_stop(&b, n);
+
+	bench_start(&b, "rbtree/remove");
+	for (i = 0; i < n; i++)
+		rbtree_remove(&t, &items[(i * 7919) % n].node);
+	bench_stop(&b, n);
+
+	bench_consume(nfound);
+}
+
+static void bench_btree(struct item *items, unsigned long n)
+{
+	struct bench b;
+	struct btree_iter iter;
+	struct btree *t = btree_create(NULL, NULL, NULL, NULL, NULL);
+	unsigned long i, nfound = 0;
+
+	bench_start(&b, "btree/insert");
+	for (i = 0; i < n; i++)
+		btree_insert(t, KEY(items[i].key), &items[i]);
+	bench_stop(&b, n);
+
+	bench_start(&b, "btree/lookup");
+	for (i = 0; i < n; i++)
+		nfound += btree_lookup(t, KEY(items[(i * 7919) % n].key)) != NULL;
+	bench_stop(&b, n);
+
+	bench_start(&b, "btree/iterate");
+	btree_iter_init(t, &iter);
+	for (i = 0; btree_iter_next(&iter); i++)
+		bench_consume(((struct item *)iter.val)->key);
+	bench_stop(&b, i);
+
+	bench_start(&b, "btree/timers");
+	for (i = 0; i < n; i++) {
+		struct item *it;
+
+		btree_iter_init(t, &iter);
+		btree_iter_next(&iter);
+		it = iter.val;
+		btree_remove(t, iter.key);
+		it->key += 1UL << 32;
+		btree_insert(t, KEY(it->key), it);
+	}
+	bench_stop(&b, n);
+
+	bench_start(&b, "btree/remove");
+	for (i = 0; i < n; i++)
+		btree_remove(t, KEY(items[(i * 7919) % n].key));
+	bench_stop(&b, n);
+
+	bench_consume(nfound);
+	btree_delete(t);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long i, n = bench_arg_count(argc, argv, 1000000);
+	struct item *items = malloc(n * sizeof(*items));
+
+	for (i = 0; i < n; i++)
+		items[i].key = (i * 2654435761UL) & 0xffffffff;
+
+	bench_rbtree(items, n);
+
+	/* The timer phase moved every key on by the same amount. */
+
+	for (i = 0; i < n; i++)
+		items[i].key &= 0xffffffff;
+
+	bench_btree(items, n);
+	free(items);
+
+	return 0;
+}
@@ -0,0 +1,238 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * bench-skiplist.c - concurrent writes.
+ *
+ * Usage: bench-skiplist [nkeys] [nthreads]
+ *
+ * Loads nkeys integer keys and then runs OPS_PER_THREAD operations on
+ * each of 1 up to nthreads threads at once: half of them lookups and
+ * the other half inserts and removes.  The "mixed" phases pick keys
+ * uniformly; the "zipf" phases favour a few hot keys, with a skew of
+ * 0.99, so the threads contend for them.  The same phases run against
+ * a skiplist, a cbtree and a btree behind a mutex.  Each thread's
+ * operations are generated before the clock starts.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "bench.h"
+#include "workload.h"
+
+#include <c-hacks/btree.h>
+#include <c-hacks/cbtree.h>
+#include <c-hacks/epoch.h>
+#include <c-hacks/skiplist.h>
+
+#define KEY(X)		((void *)(intptr_t)(X))
+#define OPS_PER_THREAD	200000
+#define MAX_THREADS	64
+
+struct locked_btree {
+	pthread_mutex_t lock;
+	struct btree *t;
+};
+
+struct worker {
+	pthread_t thread;
+	const struct workload *w;
+	unsigned long nfound;
+	struct skiplist *sl;
+	struct cbtree *ct;
+	struct epoch *e;
+	struct locked_btree *lt;
+};
+
+static void *skiplist_worker(void *arg)
+{
+	struct worker *w = arg;
+	struct epoch_thread *self = epoch_register(w->e);
+	unsigned long i;
+
+	for (i = 0; i < w->w->nops; i++) {
+		intptr_t k = (intptr_t) w->w->keys[i];
+
+		if (w->w->ops[i] == WORKLOAD_WRITE)
+			skiplist_insert(w->sl, self, k, KEY(k + 1));
+		else if (w->w->ops[i] == WORKLOAD_DELETE)
+			skiplist_remove(w->sl, self, k);
+		else
+			w->nfound += skiplist_lookup(w->sl, self, k) != NULL;
+	}
+
+	epoch_unregister(self);
+	return NULL;
+}
+
+static void *cbtree_worker(void *arg)
+{
+	struct worker *w = arg;
+	struct epoch_thread *self = epoch_register(w->e);
+	unsigned long i;
+
+	for (i = 0; i < w->w->nops; i++) {
+		intptr_t k = (intptr_t) w->w->keys[i];
+
+		if (w->w->ops[i] == WORKLOAD_WRITE)
+			cbtree_insert(w->ct, self, k, KEY(k + 1));
+		else if (w->w->ops[i] == WORKLOAD_DELETE)
+			cbtree_remove(w->ct, self, k);
+		else
+			w->nfound += cbtree_lookup(w->ct, self, k) != NULL;
+	}
+
+	epoch_unregister(self);
+	return NULL;
+}
+
+static void *btree_worker(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long i;
+
+	for (i = 0; i < w->w->nops; i++) {
+		intptr_t k = (intptr_t) w->w->keys[i];
+
+		pthread_mutex_lock(&w->lt->lock);
+		if (w->w->ops[i] == WORKLOAD_WRITE)
+			btree_insert(w->lt->t, KEY(k), KEY(k + 1));
+		else if (w->w->ops[i] == WORKLOAD_DELETE)
+			btree_remove(w->lt->t, KEY(k));
+		else
+			w->nfound += btree_lookup(w->lt->t, KEY(k)) != NULL;
+		pthread_mutex_unlock(&w->lt->lock);
+	}
+
+	return NULL;
+}
+
+/* Runs nthreads workers and reports the cost per operation. */
+
+static void run(const char *label, const char *dist, void *(*fn) (void *),
+		struct worker *proto, const struct workload *w, int nthreads)
+{
+	static struct worker workers[MAX_THREADS];
+	unsigned long nfound = 0;
+	struct bench b;
+	char name[64];
+	int i;
+
+	sprintf(name, "%s/%s %d", label, dist, nthreads);
+	bench_start(&b, name);
+
+	for (i = 0; i < nthreads; i++) {
+		workers[i] = *proto;
+		workers[i].w = &w[i];
+		pthread_create(&workers[i].thread, NULL, fn, &workers[i]);
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		nfound += workers[i].nfound;
+	}
+
+	bench_stop(&b, (unsigned long)nthreads * OPS_PER_THREAD);
+	bench_consume(nfound);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long i, n = bench_arg_count(argc, argv, 1000000);
+	int nthreads = (argc > 2) ? atoi(argv[2]) : 4;
+	struct epoch *e = epoch_create(NULL, NULL);
+	struct epoch_thread *self = epoch_register(e);
+	struct locked_btree lt;
+	struct worker proto = { 0 };
+	static struct workload uniform[MAX_THREADS], zipf[MAX_THREADS];
+	struct workload_spec spec = { 0 };
+	int t;
+
+	if (nthreads < 1 || nthreads > MAX_THREADS)
+		nthreads = 4;
+
+	spec.nkeys = n;
+	spec.nops = OPS_PER_THREAD;
+	spec.write_pct = 25;
+	spec.delete_pct = 25;
+	spec.zipf_skew = 0.99;
+
+	for (t = 0; t < nthreads; t++) {
+		spec.seed = t + 1;
+		spec.dist = WORKLOAD_UNIFORM;
+		if (workload_generate(&uniform[t], &spec) != 0)
+			return 1;
+		spec.dist = WORKLOAD_ZIPF;
+		if (workload_generate(&zipf[t], &spec) != 0)
+			return 1;
+	}
+
+	proto.e = e;
+	proto.sl = skiplist_create(e, NULL, NULL, NULL);
+	proto.ct = cbtree_create(e, NULL, NULL, NULL);
+	proto.lt = &lt;
+	pthread_mutex_init(&lt.lock, NULL);
+	lt.t = btree_create(NULL, NULL, NULL, NULL, NULL);
+
+	/* Start half full so that inserts and removes stay balanced. */
+
+	for (i = 0; i < n; i += 2) {
+		skiplist_insert(proto.sl, self, i, KEY(i + 1));
+		cbtree_insert(proto.ct, self, i, KEY(i + 1));
+		btree_insert(lt.t, KEY(i), KEY(i + 1));
+	}
+
+	for (t = 1; t <= nthreads; t *= 2) {
+		run("skiplist", "mixed", skiplist_worker, &proto, uniform, t);
+		run("cbtree", "mixed", cbtree_worker, &proto, uniform, t);
+		run("btree+mutex", "mixed", btree_worker, &proto, uniform, t);
+	}
+
+	for (t = 1; t <= nthreads; t *= 2) {
+		run("skiplist", "zipf", skiplist_worker, &proto, zipf, t);
+		run("cbtree", "zipf", cbtree_worker, &proto, zipf, t);
+		run("btree+mutex", "zipf", btree_worker, &proto, zipf, t);
+	}
+
+	for (t = 0; t < nthreads; t++) {
+		workload_free(&uniform[t]);
+		workload_free(&zipf[t]);
+	}
+
+	skiplist_delete(proto.sl);
+	cbtree_delete(proto.ct);
+	btree_delete(lt.t);
+	pthread_mutex_destroy(&lt.lock);
+	epoch_unregister(self);
+	epoch_delete(e);
+
+	return 0;
+}
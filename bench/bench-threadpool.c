@@ -0,0 +1,151 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * bench-threadpool.c - overhead and scaling of the work-stealing pool.
+ *
+ * Usage: bench-threadpool [nelements]
+ *
+ * The "sum" phases add up an array with a plain loop and with
+ * threadpool_parallel_for() at several grain sizes, on the default
+ * pool; the cost per element shows the splitting overhead on one CPU
+ * and the speedup on several.  The "fib" phases compute fib(25) with
+ * a fork for every call above a cutoff, against plain recursion, to
+ * show the cost of a fork and join.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "bench.h"
+
+#include <c-hacks/threadpool.h>
+
+struct sum {
+	const unsigned long *v;
+	atomic_ulong total;
+};
+
+static void sum_range(size_t begin, size_t end, void *arg)
+{
+	struct sum *s = arg;
+	unsigned long total = 0;
+	size_t i;
+
+	for (i = begin; i < end; i++)
+		total += s->v[i];
+
+	atomic_fetch_add_explicit(&s->total, total, memory_order_relaxed);
+}
+
+static long fib(int n)
+{
+	return (n < 2) ? n : fib(n - 1) + fib(n - 2);
+}
+
+struct fib {
+	struct threadpool *p;
+	int n, cutoff;
+	long result;
+};
+
+static void fib_task(void *arg)
+{
+	struct fib *f = arg;
+	struct fib a = *f, b = *f;
+	struct threadpool_task t;
+
+	if (f->n <= f->cutoff) {
+		f->result = fib(f->n);
+		return;
+	}
+
+	a.n = f->n - 1;
+	b.n = f->n - 2;
+	threadpool_fork(f->p, &t, fib_task, &a);
+	fib_task(&b);
+	threadpool_join(f->p, &t);
+	f->result = a.result + b.result;
+}
+
+int main(int argc, char *argv[])
+{
+	static const size_t grains[] = { 1000, 10000, 100000 };
+	static const int cutoffs[] = { 1, 10, 15 };
+	unsigned long i, n = bench_arg_count(argc, argv, 10000000);
+	unsigned long *v = malloc(n * sizeof(*v));
+	struct threadpool *p = threadpool_default();
+	struct sum s;
+	struct bench b;
+	char name[64];
+
+	printf("%d worker threads\n", threadpool_nthreads(p));
+
+	for (i = 0; i < n; i++)
+		v[i] = i;
+	s.v = v;
+
+	bench_start(&b, "serial/sum");
+	atomic_init(&s.total, 0);
+	sum_range(0, n, &s);
+	bench_consume(atomic_load(&s.total));
+	bench_stop(&b, n);
+
+	for (i = 0; i < sizeof(grains) / sizeof(grains[0]); i++) {
+		snprintf(name, sizeof(name), "parallel_for/sum/grain=%zu",
+			 grains[i]);
+		bench_start(&b, name);
+		atomic_init(&s.total, 0);
+		threadpool_parallel_for(p, 0, n, grains[i], sum_range, &s);
+		bench_consume(atomic_load(&s.total));
+		bench_stop(&b, n);
+	}
+
+	bench_start(&b, "serial/fib(25)");
+	bench_consume(fib(25));
+	bench_stop(&b, 1);
+
+	for (i = 0; i < sizeof(cutoffs) / sizeof(cutoffs[0]); i++) {
+		struct fib f;
+
+		f.p = p;
+		f.n = 25;
+		f.cutoff = cutoffs[i];
+		snprintf(name, sizeof(name), "fork_join/fib(25)/cutoff=%d",
+			 cutoffs[i]);
+		bench_start(&b, name);
+		threadpool_run(p, fib_task, &f);
+		bench_consume(f.result);
+		bench_stop(&b, 1);
+	}
+
+	free(v);
+
+	return 0;
+}
@@ -0,0 +1,222 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * bench-workload.c - hashtbl, l_hashtbl and btree under synthetic
+ * workloads.
+ *
+ * Usage: bench-workload [nkeys]
+ *
+ * Each container is loaded with nkeys random integer keys and then
+ * runs nkeys operations from each workload below, generated before
+ * the clock starts.  "read" mixes are 90% lookups with 5% inserts and
+ * 5% removes; "write" mixes are 50% lookups, 40% inserts and 10%
+ * removes.  The l_hashtbl is in access order, so its lookups also
+ * move entries.  The last runs repeat the Zipf read mix with string
+ * keys of 8 to 24 characters.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "bench.h"
+#include "workload.h"
+
+#include <c-hacks/btree.h>
+#include <c-hacks/btree-funcs.h>
+#include <c-hacks/hashtbl.h>
+#include <c-hacks/hashtbl-funcs.h>
+#include <c-hacks/linked-hashtbl.h>
+
+struct run {
+	const char *name;
+	enum workload_dist dist;
+	double skew;
+	unsigned int write_pct;
+	unsigned int delete_pct;
+};
+
+static const struct run runs[] = {
+	{ "uniform/read", WORKLOAD_UNIFORM, 0.0, 5, 5 },
+	{ "zipf-0.99/read", WORKLOAD_ZIPF, 0.99, 5, 5 },
+	{ "zipf-1.2/write", WORKLOAD_ZIPF, 1.2, 40, 10 },
+	{ "hotset/read", WORKLOAD_HOTSET, 0.0, 5, 5 },
+	{ "sequential/write", WORKLOAD_SEQUENTIAL, 0.0, 40, 10 },
+};
+
+static void bench_hashtbl(const char *name, HASHTBL_HASH_FN hash_fn,
+			  HASHTBL_EQUALS_FN equals_fn, void **keys,
+			  uint64_t nkeys, const struct workload *w)
+{
+	struct hashtbl *h = hashtbl_create(16, 0.75, 1, hash_fn, equals_fn,
+					   NULL, NULL, NULL, NULL);
+	unsigned long i, nfound = 0;
+	struct bench b;
+
+	for (i = 0; i < nkeys; i++)
+		hashtbl_insert(h, keys[i], keys[i]);
+
+	bench_start(&b, name);
+	for (i = 0; i < w->nops; i++) {
+		void *k = keys[w->keys[i]];
+
+		if (w->ops[i] == WORKLOAD_WRITE)
+			hashtbl_insert(h, k, k);
+		else if (w->ops[i] == WORKLOAD_DELETE)
+			hashtbl_remove(h, k);
+		else
+			nfound += hashtbl_lookup(h, k) != NULL;
+	}
+	bench_stop(&b, w->nops);
+	bench_consume(nfound);
+
+	hashtbl_delete(h);
+}
+
+static void bench_l_hashtbl(const char *name, LINKED_HASHTBL_HASH_FN hash_fn,
+			    LINKED_HASHTBL_EQUALS_FN equals_fn, void **keys,
+			    uint64_t nkeys, const struct workload *w)
+{
+	struct l_hashtbl *h = l_hashtbl_create(16, 0.75, 1, 1, hash_fn,
+					       equals_fn, NULL, NULL, NULL,
+					       NULL, NULL);
+	unsigned long i, nfound = 0;
+	struct bench b;
+
+	for (i = 0; i < nkeys; i++)
+		l_hashtbl_insert(h, keys[i], keys[i]);
+
+	bench_start(&b, name);
+	for (i = 0; i < w->nops; i++) {
+		void *k = keys[w->keys[i]];
+
+		if (w->ops[i] == WORKLOAD_WRITE)
+			l_hashtbl_insert(h, k, k);
+		else if (w->ops[i] == WORKLOAD_DELETE)
+			l_hashtbl_remove(h, k);
+		else
+			nfound += l_hashtbl_lookup(h, k) != NULL;
+	}
+	bench_stop(&b, w->nops);
+	bench_consume(nfound);
+
+	l_hashtbl_delete(h);
+}
+
+static void bench_btree(const char *name, BTREE_COMPARE_FN cmp, void **keys,
+			uint64_t nkeys, const struct workload *w)
+{
+	struct btree *t = btree_create(cmp, NULL, NULL, NULL, NULL);
+	unsigned long i, nfound = 0;
+	struct bench b;
+
+	for (i = 0; i < nkeys; i++)
+		btree_insert(t, keys[i], keys[i]);
+
+	bench_start(&b, name);
+	for (i = 0; i < w->nops; i++) {
+		void *k = keys[w->keys[i]];
+
+		if (w->ops[i] == WORKLOAD_WRITE)
+			btree_insert(t, k, k);
+		else if (w->ops[i] == WORKLOAD_DELETE)
+			btree_remove(t, k);
+		else
+			nfound += btree_lookup(t, k) != NULL;
+	}
+	bench_stop(&b, w->nops);
+	bench_consume(nfound);
+
+	btree_delete(t);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long n = bench_arg_count(argc, argv, 1000000);
+	void **ints = malloc(n * sizeof(*ints));
+	void **strings = malloc(n * sizeof(*strings));
+	struct workload_strings sk;
+	struct workload_spec spec = { 0 };
+	struct workload w;
+	uint64_t i, seed = 1;
+	char name[64];
+	size_t r;
+
+	/* Random keys, so hot keys aren't neighbours in the tree. */
+	for (i = 0; i < n; i++)
+		ints[i] = (void *)(uintptr_t)
+		    ((workload_splitmix64(&seed) >> 2) | 1);
+
+	if (workload_string_keys(&sk, n, 8, 24, 1) != 0)
+		return 1;
+	for (i = 0; i < n; i++)
+		strings[i] = sk.keys[i];
+
+	spec.nkeys = n;
+	spec.nops = n;
+	spec.seed = 42;
+	spec.hot_fraction = 0.01;
+	spec.hot_probability = 0.9;
+	spec.shift_every = n / 10;
+
+	for (r = 0; r < sizeof(runs) / sizeof(runs[0]); r++) {
+		spec.dist = runs[r].dist;
+		spec.zipf_skew = runs[r].skew;
+		spec.write_pct = runs[r].write_pct;
+		spec.delete_pct = runs[r].delete_pct;
+		if (workload_generate(&w, &spec) != 0)
+			return 1;
+
+		sprintf(name, "hashtbl/%s", runs[r].name);
+		bench_hashtbl(name, hashtbl_direct_hash, hashtbl_direct_equals,
+			      ints, n, &w);
+		sprintf(name, "l_hashtbl/%s", runs[r].name);
+		bench_l_hashtbl(name, hashtbl_direct_hash,
+				hashtbl_direct_equals, ints, n, &w);
+		sprintf(name, "btree/%s", runs[r].name);
+		bench_btree(name, NULL, ints, n, &w);
+
+		if (runs[r].dist == WORKLOAD_ZIPF && runs[r].write_pct == 5) {
+			sprintf(name, "hashtbl/string/%s", runs[r].name);
+			bench_hashtbl(name, hashtbl_string_hash,
+				      hashtbl_string_equals, strings, n, &w);
+			sprintf(name, "btree/string/%s", runs[r].name);
+			bench_btree(name, btree_string_compare, strings, n,
+				    &w);
+		}
+
+		workload_free(&w);
+	}
+
+	workload_strings_free(&sk);
+	free(strings);
+	free(ints);
+
+	return 0;
+}
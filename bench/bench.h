@@ -0,0 +1,263 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Helpers shared by the benchmark programs.
+ *
+ * A workload phase is bracketed by bench_start() and bench_stop(),
+ * which prints the phase name and its cost per operation.
+ *
+ * On Linux the process's hardware counters (cycles, instructions,
+ * L1d and last level cache misses, dTLB misses and branch misses) are
+ * read around each phase too, and bench_stop() prints them per
+ * operation on a second line.  The counters are opened before main()
+ * and inherited by every thread created after that, so a phase that
+ * runs its work on other threads (including a pool's workers started
+ * before the phase) is counted in full, not just the calling thread's
+ * share.  Counters the kernel or the CPU won't provide are left out;
+ * if none can be opened, or BENCH_PERF=0 is set in the environment,
+ * only the time is printed.  Counters that were multiplexed onto the
+ * PMU are scaled up by the fraction of the phase they were actually
+ * counting.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__linux__) && defined(__GNUC__) && !defined(BENCH_NO_PERF)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define BENCH_HAVE_PERF 1
+#endif
+
+enum {
+	BENCH_CYCLES,
+	BENCH_INSNS,
+	BENCH_L1D_MISSES,
+	BENCH_LLC_MISSES,
+	BENCH_DTLB_MISSES,
+	BENCH_BRANCH_MISSES,
+	BENCH_NCOUNTERS
+};
+
+struct bench_count {
+	unsigned long long value;
+	unsigned long long enabled;
+	unsigned long long running;
+};
+
+struct bench {
+	const char *name;
+	unsigned long long start_ns;
+	struct bench_count start[BENCH_NCOUNTERS];
+};
+
+#if defined(BENCH_HAVE_PERF)
+
+#define BENCH_HW_CACHE(CACHE)						\
+	((CACHE) | (PERF_COUNT_HW_CACHE_OP_READ << 8) |			\
+	 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static int bench_perf_fd[BENCH_NCOUNTERS];
+
+/*
+ * Opens the counters, before main() so that no thread has been
+ * created yet: each thread inherits them and its counts are included
+ * when they are read.  An fd is left at -1 where the counter isn't
+ * available.
+ */
+__attribute__ ((constructor))
+static void bench_perf_open(void)
+{
+	static const struct {
+		unsigned int type;
+		unsigned long long config;
+	} events[BENCH_NCOUNTERS] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HW_CACHE,
+		  BENCH_HW_CACHE(PERF_COUNT_HW_CACHE_L1D) },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+		{ PERF_TYPE_HW_CACHE,
+		  BENCH_HW_CACHE(PERF_COUNT_HW_CACHE_DTLB) },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	};
+	const char *env = getenv("BENCH_PERF");
+	int i;
+
+	for (i = 0; i < BENCH_NCOUNTERS; i++)
+		bench_perf_fd[i] = -1;
+
+	if (env != NULL && strcmp(env, "0") == 0)
+		return;
+
+	for (i = 0; i < BENCH_NCOUNTERS; i++) {
+		struct perf_event_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = events[i].type;
+		attr.config = events[i].config;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.inherit = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+		    PERF_FORMAT_TOTAL_TIME_RUNNING;
+		bench_perf_fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0,
+						-1, -1, 0);
+	}
+}
+
+static inline void bench_read_counters(struct bench_count *c)
+{
+	int i;
+
+	for (i = 0; i < BENCH_NCOUNTERS; i++) {
+		if (bench_perf_fd[i] < 0 ||
+		    read(bench_perf_fd[i], &c[i], sizeof(c[i])) !=
+		    (ssize_t) sizeof(c[i]))
+			memset(&c[i], 0, sizeof(c[i]));
+	}
+}
+
+#else
+
+static inline void bench_read_counters(struct bench_count *c)
+{
+	memset(c, 0, BENCH_NCOUNTERS * sizeof(*c));
+}
+
+#endif
+
+/*
+ * Returns the number of events counted between start and end, scaled
+ * for multiplexing, or -1 if the counter didn't run.
+ */
+static inline double bench_count_delta(const struct bench_count *start,
+				       const struct bench_count *end)
+{
+	unsigned long long enabled = end->enabled - start->enabled;
+	unsigned long long running = end->running - start->running;
+	double value = (double)(end->value - start->value);
+
+	if (running == 0)
+		return -1.0;
+
+	return (running < enabled) ? value * enabled / running : value;
+}
+
+static inline void bench_print_counters(const struct bench_count *start,
+					unsigned long nops)
+{
+	static const char *const names[BENCH_NCOUNTERS] = {
+		"cycles", "insns", "L1d-miss", "LLC-miss", "dTLB-miss",
+		"br-miss",
+	};
+	struct bench_count end[BENCH_NCOUNTERS];
+	double per_op[BENCH_NCOUNTERS];
+	int i, n = 0;
+
+	bench_read_counters(end);
+
+	if (nops == 0)
+		return;
+
+	for (i = 0; i < BENCH_NCOUNTERS; i++) {
+		per_op[i] = bench_count_delta(&start[i], &end[i]);
+		if (per_op[i] >= 0.0) {
+			per_op[i] /= (double)nops;
+			n++;
+		}
+	}
+
+	if (n == 0)
+		return;
+
+	printf("   ");
+	for (i = 0; i < BENCH_NCOUNTERS; i++) {
+		if (per_op[i] >= 0.0)
+			printf(" %s %.*f", names[i], i <= BENCH_INSNS ? 1 : 2,
+			       per_op[i]);
+		if (i == BENCH_INSNS && per_op[BENCH_CYCLES] > 0.0 &&
+		    per_op[BENCH_INSNS] >= 0.0)
+			printf(" IPC %.2f",
+			       per_op[BENCH_INSNS] / per_op[BENCH_CYCLES]);
+	}
+	printf("\n");
+}
+
+static inline unsigned long long bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL +
+	    (unsigned long long)ts.tv_nsec;
+}
+
+static inline void bench_start(struct bench *b, const char *name)
+{
+	b->name = name;
+	bench_read_counters(b->start);
+	b->start_ns = bench_now_ns();
+}
+
+static inline void bench_stop(struct bench *b, unsigned long nops)
+{
+	unsigned long long ns = bench_now_ns() - b->start_ns;
+
+	printf("%-36s %10lu ops %10.1f ns/op\n", b->name, nops,
+	       nops ? (double)ns / (double)nops : 0.0);
+	bench_print_counters(b->start, nops);
+}
+
+/* Returns the first command line argument as a count, or def. */
+
+static inline unsigned long bench_arg_count(int argc, char *argv[],
+					    unsigned long def)
+{
+	return (argc > 1) ? strtoul(argv[1], NULL, 0) : def;
+}
+
+/*
+ * Stops the compiler from discarding a result that is otherwise
+ * unused.
+ */
+static inline void bench_consume(unsigned long x)
+{
+	static volatile unsigned long sink;
+
+	sink += x;
+}
+
+#endif
@@ -0,0 +1,294 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * workload.c - synthetic workloads for the benchmark programs.
+ *
+ * The Zipf sampler follows W. Hormann and G. Derflinger, "Rejection-
+ * inversion to generate variates from monotone discrete
+ * distributions", ACM TOMACS 6(3), 1996: it inverts the integral of a
+ * continuous hat function over [0.5, n + 0.5] and accepts the nearest
+ * integer unless it falls in the small sliver where the hat exceeds
+ * the true probability.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "workload.h"
+
+static const char key_chars[] =
+    "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+#define NKEY_CHARS (sizeof(key_chars) - 1)
+
+void workload_rng_seed(struct workload_rng *r, uint64_t seed)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		r->s[i] = workload_splitmix64(&seed);
+}
+
+/* log1p(x) / x, accurate near 0. */
+static double helper1(double x)
+{
+	if (fabs(x) > 1e-8)
+		return log1p(x) / x;
+	return 1.0 - x * (0.5 - x * (1.0 / 3.0 - 0.25 * x));
+}
+
+/* expm1(x) / x, accurate near 0. */
+static double helper2(double x)
+{
+	if (fabs(x) > 1e-8)
+		return expm1(x) / x;
+	return 1.0 + x * 0.5 * (1.0 + x * (1.0 / 3.0) * (1.0 + 0.25 * x));
+}
+
+/* The hat function, x^-skew. */
+static double zipf_h(const struct workload_zipf *z, double x)
+{
+	return exp(-z->skew * log(x));
+}
+
+/* Integral of the hat function, (x^(1-skew) - 1) / (1 - skew). */
+static double zipf_h_integral(const struct workload_zipf *z, double x)
+{
+	double log_x = log(x);
+
+	return helper2((1.0 - z->skew) * log_x) * log_x;
+}
+
+static double zipf_h_integral_inverse(const struct workload_zipf *z,
+				      double x)
+{
+	double t = x * (1.0 - z->skew);
+
+	if (t < -1.0)
+		t = -1.0;
+	return exp(helper1(t) * x);
+}
+
+void workload_zipf_init(struct workload_zipf *z, uint64_t n, double skew)
+{
+	z->n = n;
+	z->skew = skew;
+	z->h_x1 = zipf_h_integral(z, 1.5) - 1.0;
+	z->h_n = zipf_h_integral(z, (double)n + 0.5);
+	z->s = 2.0 - zipf_h_integral_inverse(z, zipf_h_integral(z, 2.5) -
+					     zipf_h(z, 2.0));
+}
+
+uint64_t workload_zipf_next(const struct workload_zipf *z,
+			    struct workload_rng *r)
+{
+	for (;;) {
+		double u = z->h_n + workload_rng_double(r) * (z->h_x1 - z->h_n);
+		double x = zipf_h_integral_inverse(z, u);
+		uint64_t k = (uint64_t)(x + 0.5);
+
+		if (k < 1)
+			k = 1;
+		else if (k > z->n)
+			k = z->n;
+
+		if ((double)k - x <= z->s ||
+		    u >= zipf_h_integral(z, (double)k + 0.5) -
+		    zipf_h(z, (double)k))
+			return k - 1;
+	}
+}
+
+static int valid_spec(const struct workload_spec *spec)
+{
+	if (spec->nkeys == 0 || spec->write_pct + spec->delete_pct > 100)
+		return 0;
+
+	switch (spec->dist) {
+	case WORKLOAD_UNIFORM:
+	case WORKLOAD_SEQUENTIAL:
+		return 1;
+	case WORKLOAD_ZIPF:
+		return spec->zipf_skew > 0.0;
+	case WORKLOAD_HOTSET:
+		return spec->hot_fraction > 0.0 && spec->hot_fraction <= 1.0 &&
+		    spec->hot_probability >= 0.0 &&
+		    spec->hot_probability <= 1.0;
+	}
+
+	return 0;
+}
+
+int workload_generate(struct workload *w, const struct workload_spec *spec)
+{
+	struct workload_rng r;
+	struct workload_zipf z;
+	uint64_t hot_n = 1, hot_start = 0;
+	unsigned long i;
+
+	w->nops = 0;
+	w->keys = NULL;
+	w->ops = NULL;
+
+	if (!valid_spec(spec))
+		return 1;
+
+	if ((w->keys = malloc(spec->nops * sizeof(*w->keys) + 1)) == NULL ||
+	    (w->ops = malloc(spec->nops * sizeof(*w->ops) + 1)) == NULL) {
+		workload_free(w);
+		return 1;
+	}
+
+	workload_rng_seed(&r, spec->seed);
+
+	if (spec->dist == WORKLOAD_ZIPF)
+		workload_zipf_init(&z, spec->nkeys, spec->zipf_skew);
+
+	if (spec->dist == WORKLOAD_HOTSET) {
+		hot_n = (uint64_t)(spec->hot_fraction * (double)spec->nkeys);
+		if (hot_n == 0)
+			hot_n = 1;
+	}
+
+	for (i = 0; i < spec->nops; i++) {
+		uint64_t k = 0;
+		unsigned int pct;
+
+		switch (spec->dist) {
+		case WORKLOAD_UNIFORM:
+			k = workload_rng_below(&r, spec->nkeys);
+			break;
+		case WORKLOAD_ZIPF:
+			k = workload_zipf_next(&z, &r);
+			break;
+		case WORKLOAD_SEQUENTIAL:
+			k = i % spec->nkeys;
+			break;
+		case WORKLOAD_HOTSET:
+			if (spec->shift_every != 0 && i != 0 &&
+			    i % spec->shift_every == 0)
+				hot_start = (hot_start + hot_n) % spec->nkeys;
+			if (workload_rng_double(&r) < spec->hot_probability) {
+				k = hot_start + workload_rng_below(&r, hot_n);
+				k %= spec->nkeys;
+			} else {
+				k = workload_rng_below(&r, spec->nkeys);
+			}
+			break;
+		}
+
+		pct = (unsigned int)workload_rng_below(&r, 100);
+		w->keys[i] = k;
+		if (pct < spec->write_pct)
+			w->ops[i] = WORKLOAD_WRITE;
+		else if (pct < spec->write_pct + spec->delete_pct)
+			w->ops[i] = WORKLOAD_DELETE;
+		else
+			w->ops[i] = WORKLOAD_READ;
+	}
+
+	w->nops = spec->nops;
+
+	return 0;
+}
+
+void workload_free(struct workload *w)
+{
+	free(w->keys);
+	free(w->ops);
+	w->keys = NULL;
+	w->ops = NULL;
+	w->nops = 0;
+}
+
+int workload_string_keys(struct workload_strings *k, uint64_t n,
+			 size_t min_len, size_t max_len, uint64_t seed)
+{
+	struct workload_rng r, lengths;
+	size_t ndigits = 1, total = 0, span;
+	uint64_t i, x;
+	char *p;
+
+	if (max_len < min_len)
+		max_len = min_len;
+	span = max_len - min_len + 1;
+
+	for (x = n; x >= NKEY_CHARS; x /= NKEY_CHARS)
+		ndigits++;
+
+	k->n = 0;
+	k->buf = NULL;
+	if ((k->keys = malloc(n * sizeof(*k->keys) + 1)) == NULL)
+		return 1;
+
+	/* Two passes over the same lengths: size, then fill. */
+
+	workload_rng_seed(&lengths, seed);
+
+	for (i = 0; i < n; i++) {
+		size_t len = min_len + workload_rng_below(&lengths, span);
+		total += ((len > ndigits) ? len : ndigits) + 1;
+	}
+
+	if ((k->buf = malloc(total + 1)) == NULL) {
+		workload_strings_free(k);
+		return 1;
+	}
+
+	workload_rng_seed(&lengths, seed);
+	workload_rng_seed(&r, ~seed);
+
+	for (i = 0, p = k->buf; i < n; i++) {
+		size_t len = min_len + workload_rng_below(&lengths, span);
+		size_t j;
+
+		if (len < ndigits)
+			len = ndigits;
+
+		k->keys[i] = p;
+		for (j = 0; j < len - ndigits; j++)
+			p[j] = key_chars[workload_rng_below(&r, NKEY_CHARS)];
+		for (j = len, x = i; j > len - ndigits; j--, x /= NKEY_CHARS)
+			p[j - 1] = key_chars[x % NKEY_CHARS];
+		p[len] = '\0';
+		p += len + 1;
+	}
+
+	k->n = n;
+
+	return 0;
+}
+
+void workload_strings_free(struct workload_strings *k)
+{
+	free(k->keys);
+	free(k->buf);
+	k->keys = NULL;
+	k->buf = NULL;
+	k->n = 0;
+}
@@ -0,0 +1,244 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Synthetic workloads for the benchmark programs.
+ *
+ * A workload is a pregenerated stream of operations, each a key index
+ * in [0, nkeys) and whether to read, write or delete it, so that the
+ * cost of generating keys is excluded from timing.  A benchmark maps
+ * the indices onto its own keys, typically an array of random
+ * integers or of strings from workload_string_keys().  Index 0 is the
+ * most popular under the Zipf distribution, so if that array is
+ * sorted the hot keys are also adjacent in key order.
+ *
+ * The distributions are:
+ *
+ *   WORKLOAD_UNIFORM	 - every key equally likely
+ *   WORKLOAD_ZIPF	 - key i with probability proportional to
+ *			   1 / (i + 1)^zipf_skew
+ *   WORKLOAD_SEQUENTIAL - 0, 1, 2, ... wrapping at nkeys
+ *   WORKLOAD_HOTSET	 - hot_fraction of the keys receive
+ *			   hot_probability of the operations; the hot
+ *			   set moves on to the next keys every
+ *			   shift_every operations
+ *
+ * The random numbers come from xoshiro256**, seeded by splitmix64.
+ * The same spec always generates the same workload.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum workload_dist {
+	WORKLOAD_UNIFORM,
+	WORKLOAD_ZIPF,
+	WORKLOAD_SEQUENTIAL,
+	WORKLOAD_HOTSET
+};
+
+enum workload_op {
+	WORKLOAD_READ,
+	WORKLOAD_WRITE,
+	WORKLOAD_DELETE
+};
+
+struct workload_spec {
+	enum workload_dist dist;
+	uint64_t nkeys;
+	unsigned long nops;
+	uint64_t seed;
+	double zipf_skew;		/* WORKLOAD_ZIPF, e.g. 0.99 */
+	double hot_fraction;		/* WORKLOAD_HOTSET, e.g. 0.1 */
+	double hot_probability;		/* WORKLOAD_HOTSET, e.g. 0.9 */
+	unsigned long shift_every;	/* WORKLOAD_HOTSET, 0 never moves */
+	unsigned int write_pct;		/* the rest are reads */
+	unsigned int delete_pct;
+};
+
+struct workload {
+	unsigned long nops;
+	uint64_t *keys;			/* key index of each operation */
+	unsigned char *ops;		/* enum workload_op of each */
+};
+
+struct workload_strings {
+	uint64_t n;
+	char **keys;
+	/* The remaining fields are private. */
+	char *buf;
+};
+
+struct workload_rng {
+	uint64_t s[4];
+};
+
+/* The Zipf sampler; the fields are private. */
+struct workload_zipf {
+	uint64_t n;
+	double skew;
+	double h_x1;
+	double h_n;
+	double s;
+};
+
+/* Returns the next splitmix64 value, advancing *state. */
+static inline uint64_t workload_splitmix64(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/* Returns the next xoshiro256** value. */
+static inline uint64_t workload_rng_next(struct workload_rng *r)
+{
+	uint64_t *s = r->s;
+	uint64_t x = s[1] * 5;
+	uint64_t result = ((x << 7) | (x >> 57)) * 9;
+	uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = (s[3] << 45) | (s[3] >> 19);
+
+	return result;
+}
+
+/*
+ * Returns a value in [0, n), n > 0, without bias: Lemire's multiply
+ * and shift, redrawing the few products that would favour some values.
+ */
+static inline uint64_t workload_rng_below(struct workload_rng *r,
+					  uint64_t n)
+{
+#if defined(__SIZEOF_INT128__)
+	unsigned __int128 m = (unsigned __int128)workload_rng_next(r) * n;
+
+	if ((uint64_t)m < n) {
+		uint64_t t = -n % n;	/* 2^64 mod n */
+
+		while ((uint64_t)m < t)
+			m = (unsigned __int128)workload_rng_next(r) * n;
+	}
+	return (uint64_t)(m >> 64);
+#else
+	uint64_t t = -n % n, x;
+
+	do {
+		x = workload_rng_next(r);
+	} while (x < t);
+	return x % n;
+#endif
+}
+
+/* Returns a value in [0, 1). */
+static inline double workload_rng_double(struct workload_rng *r)
+{
+	return (double)(workload_rng_next(r) >> 11) * 0x1.0p-53;
+}
+
+/*
+ * Seeds a generator.
+ *
+ * @param r    - generator
+ * @param seed - any value, including 0
+ */
+void workload_rng_seed(struct workload_rng *r, uint64_t seed);
+
+/*
+ * Prepares to draw from a Zipf distribution over [0, n).
+ *
+ * Sampling is by rejection-inversion (Hormann and Derflinger), so
+ * setup and each sample take constant time whatever n is.
+ *
+ * @param z    - sampler
+ * @param n    - number of keys, n > 0
+ * @param skew - exponent, skew > 0; larger is more skewed
+ */
+void workload_zipf_init(struct workload_zipf *z, uint64_t n, double skew);
+
+/*
+ * Returns a key index in [0, n); 0 is the most likely.
+ *
+ * @param z - sampler
+ * @param r - generator
+ */
+uint64_t workload_zipf_next(const struct workload_zipf *z,
+			    struct workload_rng *r);
+
+/*
+ * Generates the operations described by spec.
+ *
+ * @param w    - workload to fill in
+ * @param spec - what to generate
+ *
+ * Returns 0 on success, or 1 if spec is invalid or no memory could be
+ * allocated.
+ */
+int workload_generate(struct workload *w, const struct workload_spec *spec);
+
+/*
+ * Frees the operations of a workload.
+ *
+ * @param w - workload
+ */
+void workload_free(struct workload *w);
+
+/*
+ * Generates n distinct, NUL terminated string keys of random
+ * printable characters, each between min_len and max_len characters
+ * long.  A key is made long enough to hold a unique suffix, so very
+ * short lengths with a large n come out longer than asked.
+ *
+ * @param k	  - keys to fill in
+ * @param n	  - number of keys
+ * @param min_len - shortest length
+ * @param max_len - longest length
+ * @param seed	  - random seed
+ *
+ * Returns 0 on success, or 1 if no memory could be allocated.
+ */
+int workload_string_keys(struct workload_strings *k, uint64_t n,
+			 size_t min_len, size_t max_len, uint64_t seed);
+
+/*
+ * Frees keys made by workload_string_keys().
+ *
+ * @param k - keys
+ */
+void workload_strings_free(struct workload_strings *k);
+
+#endif
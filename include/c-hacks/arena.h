@@ -0,0 +1,205 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Two allocators for the containers in this library: a bump-pointer
+ * arena and a size-class pool.
+ *
+ * SYNOPSIS
+ *
+ * 1. An arena is created with arena_create().
+ * 2. To allocate from it use arena_alloc().  There is no way to free
+ *    a single allocation.
+ * 3. To free everything allocated since a point in time, take a mark
+ *    with arena_mark() and later pass it to arena_rewind().
+ * 4. To free everything use arena_reset().
+ * 5. Delete the arena with arena_delete().
+ * 6. The pool needs no setup: use pool_malloc() and pool_free() as
+ *    you would malloc() and free(), from any thread.
+ *
+ * An arena hands out memory by bumping a pointer through a chunk,
+ * allocating a new chunk, twice the size of the last, when one runs
+ * out.  It suits data that dies all at once: the entries of a table
+ * built for one request, say.
+ *
+ * The pool rounds each request up to one of 24 size classes, between
+ * 16 and 2048 bytes, and carves blocks of that size out of 64K slabs.
+ * Every thread keeps a cache of free blocks per class, so most calls
+ * touch neither a lock nor memory shared with another thread; a cache
+ * is refilled from, or overflows into, the shared list for its class
+ * a batch at a time.  Larger requests get a slab of their own.
+ *
+ * Both plug into hashtbl_create() and l_hashtbl_create().  The hooks
+ * there take no context, so arena_malloc() allocates from the arena
+ * the calling thread selected with arena_select(), and arena_free()
+ * does nothing; the memory comes back when the arena is reset.
+ *
+ * arena_select(a);
+ * h = hashtbl_create(16, 0.75, 1, hashtbl_int_hash, hashtbl_int_equals,
+ *		      NULL, NULL, arena_malloc, arena_free);
+ * ...
+ * arena_reset(a);		(h is gone)
+ *
+ * h = hashtbl_create(16, 0.75, 1, hashtbl_int_hash, hashtbl_int_equals,
+ *		      NULL, NULL, pool_malloc, pool_free);
+ *
+ * Note: an arena is not thread safe.  Memory in the pool's size
+ * classes is kept for reuse and never returned to the system.
+ */
+
+#include <stddef.h>		/* size_t */
+
+/* Opaque types. */
+struct arena;
+
+/* A position in an arena to rewind to. */
+struct arena_mark {
+	/* The fields are private: don't modify them. */
+	void *chunk;
+	size_t used;
+};
+
+/* Functions for allocating and freeing memory. */
+typedef void *(*ARENA_MALLOC_FN) (size_t n);
+typedef void (*ARENA_FREE_FN) (void *ptr);
+
+/*
+ * Creates a new arena.
+ *
+ * @param chunk_size  - size of the first chunk (0 uses a default value)
+ * @param malloc_func - function to allocate memory (e.g., malloc)
+ * @param free_func   - function to free memory (e.g., free)
+ *
+ * Returns non-null if the arena was created successfully.
+ */
+struct arena *arena_create(size_t chunk_size, ARENA_MALLOC_FN malloc_func,
+			   ARENA_FREE_FN free_func);
+
+/*
+ * Deletes the arena and everything allocated from it.
+ *
+ * @param a - arena instance
+ */
+void arena_delete(struct arena *a);
+
+/*
+ * Allocates memory, aligned as malloc() would align it.
+ *
+ * @param a - arena instance
+ * @param n - number of bytes
+ *
+ * Returns NULL if no memory is available.
+ */
+void *arena_alloc(struct arena *a, size_t n);
+
+/*
+ * Returns the current position of the arena.
+ *
+ * @param a - arena instance
+ */
+struct arena_mark arena_mark(const struct arena *a);
+
+/*
+ * Frees everything allocated since the mark was taken.  Marks taken
+ * after m are no longer valid.
+ *
+ * @param a - arena instance
+ * @param m - mark returned by arena_mark() for a
+ */
+void arena_rewind(struct arena *a, struct arena_mark m);
+
+/*
+ * Frees everything allocated from the arena.  The largest chunk is
+ * kept for reuse.
+ *
+ * @param a - arena instance
+ */
+void arena_reset(struct arena *a);
+
+/*
+ * Returns the number of bytes handed out since the arena was created
+ * or reset, including padding.
+ *
+ * @param a - arena instance
+ */
+size_t arena_used(const struct arena *a);
+
+/*
+ * Selects the arena that arena_malloc() allocates from in the calling
+ * thread.
+ *
+ * @param a - arena instance, or NULL
+ *
+ * Returns the arena that was selected before.
+ */
+struct arena *arena_select(struct arena *a);
+
+/*
+ * Allocates from the calling thread's selected arena; the signature
+ * matches HASHTBL_MALLOC_FN.
+ *
+ * @param n - number of bytes
+ *
+ * Returns NULL if no arena is selected or no memory is available.
+ */
+void *arena_malloc(size_t n);
+
+/*
+ * Does nothing; the signature matches HASHTBL_FREE_FN.
+ *
+ * @param ptr - pointer returned by arena_malloc()
+ */
+void arena_free(void *ptr);
+
+/*
+ * Allocates memory from the pool, aligned as malloc() would align it.
+ *
+ * @param n - number of bytes
+ *
+ * Returns NULL if no memory is available.
+ */
+void *pool_malloc(size_t n);
+
+/*
+ * Returns memory to the pool.  It can be freed by any thread, not
+ * just the one that allocated it.
+ *
+ * @param ptr - pointer returned by pool_malloc(), or NULL
+ */
+void pool_free(void *ptr);
+
+/*
+ * Moves the free blocks cached by the calling thread to the shared
+ * lists, where other threads can reuse them.  This happens anyway
+ * when the thread exits.
+ */
+void pool_thread_flush(void);
+
+#endif				/* ARENA_H */
@@ -0,0 +1,200 @@
+#ifndef ART_H
+#define ART_H
+
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * An adaptive radix tree: an ordered map from byte string keys to
+ * values.
+ *
+ * SYNOPSIS
+ *
+ * 1. A tree is created with art_create().
+ * 2. To insert an entry use art_insert().
+ * 3. To lookup a key use art_lookup().
+ * 4. To remove a key use art_remove().
+ * 5. To apply a function to all entries, in key order, use art_apply().
+ * 6. To apply a function to the entries whose keys start with a given
+ *    prefix, in key order, use art_prefix_scan().
+ * 7. To delete a tree instance use art_delete().
+ *
+ * Keys are arbitrary byte strings, ordered as by memcmp() with a key
+ * that is a prefix of another ordered first.  Integer keys can be
+ * encoded with art_key_uint64() and art_key_int64(), which preserve
+ * numeric order.
+ *
+ * Each inner node branches on one byte of the key and comes in four
+ * sizes, for up to 4, 16, 48 and 256 children, so that sparse nodes
+ * stay small while dense ones are direct arrays.  A node is replaced
+ * by the next size up or down as children come and go.  Runs of
+ * nodes with a single child are collapsed into a prefix stored in the
+ * node below (path compression), and a subtree holding a single key
+ * is just a leaf (lazy expansion), so the height depends on how much
+ * keys differ rather than on their length.  A lookup touches one node
+ * per distinguishing byte and never compares whole keys except once,
+ * at the leaf.
+ *
+ * Note: keys are copied into the tree but values are not.
+ */
+
+#include <stddef.h>		/* size_t */
+#include <stdint.h>		/* uint64_t, int64_t */
+
+#if defined(_MSC_VER)
+#define INLINE __inline
+#else
+#define INLINE inline
+#endif
+
+/* Opaque types. */
+struct art;
+
+/* Apply function: return 0 to terminate the enumeration early. */
+typedef int (*ART_APPLY_FN) (const unsigned char *key, size_t len,
+			     void *val, void *client_data);
+
+/* Function for deleting values. */
+typedef void (*ART_VAL_FREE_FN) (void *v);
+
+/* Functions for allocating and freeing memory. */
+typedef void *(*ART_MALLOC_FN) (size_t n);
+typedef void (*ART_FREE_FN) (void *ptr);
+
+/* Encodes x as an 8 byte key that sorts in numeric order. */
+
+static INLINE void art_key_uint64(uint64_t x, unsigned char key[8])
+{
+	int i;
+
+	for (i = 7; i >= 0; i--, x >>= 8)
+		key[i] = (unsigned char)x;
+}
+
+static INLINE void art_key_int64(int64_t x, unsigned char key[8])
+{
+	art_key_uint64((uint64_t)x ^ 0x8000000000000000ULL, key);
+}
+
+/*
+ * Creates a new tree.
+ *
+ * @param val_free_func	   - function to delete values
+ * @param malloc_func	   - function to allocate memory (e.g., malloc)
+ * @param free_func	   - function to free memory (e.g., free)
+ *
+ * Returns non-null if the tree was created successfully.
+ */
+struct art *art_create(ART_VAL_FREE_FN val_free_func,
+		       ART_MALLOC_FN malloc_func, ART_FREE_FN free_func);
+
+/*
+ * Deletes the tree instance, and every value if there is a value free
+ * function.
+ *
+ * @param t - tree
+ */
+void art_delete(struct art *t);
+
+/*
+ * Inserts a new key with associated value.
+ *
+ * If the key already exists its value is replaced.
+ *
+ * @param t - tree instance
+ * @param key - key to insert, which is copied
+ * @param len - length of key in bytes
+ * @param v - value associated with key
+ *
+ * Returns 0 on success, or 1 if a new entry cannot be created; the
+ * tree is left unchanged.
+ */
+int art_insert(struct art *t, const void *key, size_t len, void *v);
+
+/*
+ * Removes a key and value from the tree.
+ *
+ * @param t - tree instance
+ * @param key - key to remove
+ * @param len - length of key in bytes
+ *
+ * Returns 0 if key was found, otherwise 1.
+ */
+int art_remove(struct art *t, const void *key, size_t len);
+
+/*
+ * Lookup an existing key.
+ *
+ * @param t - tree instance
+ * @param key - the search key
+ * @param len - length of key in bytes
+ *
+ * Returns the value associated with key, or NULL if key is not present.
+ */
+void *art_lookup(const struct art *t, const void *key, size_t len);
+
+/*
+ * Returns the number of entries in the tree.
+ *
+ * @param t - tree instance
+ */
+unsigned long art_count(const struct art *t);
+
+/*
+ * Apply a function to all entries in key order.
+ *
+ * The apply function should return 0 to terminate the enumeration
+ * early.  The tree must not be modified during the enumeration.
+ *
+ * @param t - tree instance
+ * @param fn - function to apply to each entry
+ * @param client_data - arbitrary user data
+ *
+ * Returns the number of entries the function was applied to.
+ */
+unsigned long art_apply(const struct art *t, ART_APPLY_FN fn,
+			void *client_data);
+
+/*
+ * Apply a function, in key order, to all entries whose key starts with
+ * the given prefix.
+ *
+ * The search descends straight to the subtree that holds the matching
+ * keys, so the cost is that of a lookup plus the matches.
+ *
+ * @param t - tree instance
+ * @param prefix - leading bytes of the keys to visit
+ * @param len - length of prefix in bytes; 0 visits every entry
+ * @param fn - function to apply to each entry
+ * @param client_data - arbitrary user data
+ *
+ * Returns the number of entries the function was applied to.
+ */
+unsigned long art_prefix_scan(const struct art *t, const void *prefix,
+			      size_t len, ART_APPLY_FN fn, void *client_data);
+
+#endif				/* ART_H */
@@ -0,0 +1,205 @@
+#ifndef BTREE_FILE_H
+#define BTREE_FILE_H
+
+
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * A B+tree stored in the pages of a memory-mapped file.
+ *
+ * SYNOPSIS
+ *
+ * 1. Open, or create, a tree file with btree_file_open().
+ * 2. To insert an entry use btree_file_insert().
+ * 3. To lookup a key use btree_file_lookup().
+ * 4. To remove a key use btree_file_remove().
+ * 5. To make the changes since the last commit durable use
+ *    btree_file_commit(); to discard them use btree_file_rollback().
+ * 6. To iterate over all entries in key order use
+ *    btree_file_iter_init(), btree_file_iter_next().
+ * 7. To iterate from the first key not less than a given key use
+ *    btree_file_lower_bound(), btree_file_iter_next().
+ * 8. To close the file, discarding uncommitted changes, use
+ *    btree_file_close().
+ *
+ * Keys are int64_t and values uint64_t, both stored in the file in
+ * native byte order; a value would typically be the offset of a
+ * record elsewhere.
+ *
+ * File format
+ * -----------
+ *
+ * The file is an array of pages of 4 KB, 16 KB or any other power of
+ * two from 1 KB to 64 KB.  Pages refer to each other by page number.
+ * Page 0 holds two checksummed meta records, 512 bytes apart, each
+ * naming a root page, the file's length in pages and the run of pages
+ * that lists the free pages.  Every other page is a node, a free list
+ * page or free.
+ *
+ * Committed pages are never written to.  A write copies each page it
+ * changes (shadow paging) into a free page, so a batch of writes
+ * builds a new tree alongside the committed one.  btree_file_commit()
+ * flushes the new pages and then writes the meta record that the
+ * previous commit didn't use, which atomically swaps in the new root.
+ * Opening a file picks the valid meta record with the newest commit,
+ * so a crash at any point leaves the last complete commit.  Pages
+ * replaced by a batch join the free list once it has been committed.
+ *
+ * Nodes are not rebalanced on removal; an empty leaf is unlinked and
+ * its page freed.  A file must not be used by more than one thread or
+ * process at a time.
+ */
+
+#include <stddef.h>		/* size_t */
+#include <stdint.h>		/* int64_t, uint64_t */
+
+/* Flags for btree_file_open(). */
+#define BTREE_FILE_NOSYNC	0x1	/* commit without msync(2) */
+
+/* Opaque types. */
+struct btree_file;
+
+/* Functions for allocating and freeing memory. */
+typedef void *(*BTREE_FILE_MALLOC_FN) (size_t n);
+typedef void (*BTREE_FILE_FREE_FN) (void *ptr);
+
+struct btree_file_iter {
+	int64_t key;
+	uint64_t val;
+	/* The remaining fields are private: don't modify them. */
+	const struct btree_file *const file;
+	const uint64_t page;
+	const int pos;
+};
+
+/*
+ * Opens a tree file, creating it if it doesn't exist or is empty.
+ *
+ * @param path		   - file name
+ * @param page_size	   - page size for a new file, or 0 for 4096; an
+ *			     existing file keeps its own page size
+ * @param flags		   - BTREE_FILE_NOSYNC or 0
+ * @param malloc_func	   - function to allocate memory (e.g., malloc)
+ * @param free_func	   - function to free memory (e.g., free)
+ *
+ * Returns non-null if the file was opened successfully, otherwise
+ * NULL with errno set (EINVAL for a bad page size and EILSEQ for a
+ * file with no valid meta record).
+ */
+struct btree_file *btree_file_open(const char *path, size_t page_size,
+				   int flags,
+				   BTREE_FILE_MALLOC_FN malloc_func,
+				   BTREE_FILE_FREE_FN free_func);
+
+/*
+ * Closes the file.  Changes that were not committed are lost.
+ *
+ * Returns 0 on success or -1 with errno set.
+ */
+int btree_file_close(struct btree_file *f);
+
+/*
+ * Inserts a new key with associated value, replacing the value of an
+ * existing key.
+ *
+ * @param f - tree file
+ * @param k - key to insert
+ * @param v - value associated with key
+ *
+ * Returns 0 on success, or 1 with errno set if the file could not be
+ * extended or no memory is available; the tree is left unchanged.
+ */
+int btree_file_insert(struct btree_file *f, int64_t k, uint64_t v);
+
+/*
+ * Removes a key.
+ *
+ * @param f - tree file
+ * @param k - key to remove
+ *
+ * Returns 0 if key was found, otherwise 1.  Also returns 1, with
+ * errno set and the tree unchanged, if the file could not be extended
+ * to hold the copies of the pages that change.
+ */
+int btree_file_remove(struct btree_file *f, int64_t k);
+
+/*
+ * Lookup an existing key.
+ *
+ * @param f - tree file
+ * @param k - the search key
+ * @param v - set to the value associated with key if it is present
+ *
+ * Returns 0 if the key was found, otherwise 1.
+ */
+int btree_file_lookup(const struct btree_file *f, int64_t k, uint64_t *v);
+
+/*
+ * Returns the number of entries in the tree, including uncommitted
+ * changes.
+ */
+unsigned long btree_file_count(const struct btree_file *f);
+
+/*
+ * Makes all changes since the last commit durable.
+ *
+ * Returns 0 on success or -1 with errno set.  If the new pages could
+ * not be written the previous commit is still the one a reopen would
+ * see and the changes are kept for another attempt; if only the final
+ * flush of the meta record failed, the changes count as committed but
+ * may not survive a crash.
+ */
+int btree_file_commit(struct btree_file *f);
+
+/*
+ * Discards all changes since the last commit.
+ */
+void btree_file_rollback(struct btree_file *f);
+
+/*
+ * Initialize an iterator at the smallest key.
+ */
+void btree_file_iter_init(const struct btree_file *f,
+			  struct btree_file_iter *iter);
+
+/*
+ * Initialize an iterator at the smallest key not less than k.
+ */
+void btree_file_lower_bound(const struct btree_file *f, int64_t k,
+			    struct btree_file_iter *iter);
+
+/*
+ * Advances the iterator.
+ *
+ * Returns 1 while there more entries, otherwise 0.  The key and value
+ * for each entry can be accessed through the iterator structure.  The
+ * iterator is invalidated by any insert, remove or rollback.
+ */
+int btree_file_iter_next(struct btree_file_iter *iter);
+
+#endif				/* BTREE_FILE_H */
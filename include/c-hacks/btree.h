@@ -1,20 +1,365 @@
-#ifndef INC_chacks_btree_H
-#define INC_chacks_btree_H
+#ifndef BTREE_H
+#define BTREE_H
 
-struct btree_node {
-	void *data;
-	struct btree_node *l;
-	struct btree_node *r;
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * A B+tree: an ordered map from keys to values.
+ *
+ * SYNOPSIS
+ *
+ * 1. A tree is created with btree_create().
+ * 2. To insert an entry use btree_insert().
+ * 3. To lookup a key use btree_lookup().
+ * 4. To remove a key use btree_remove().
+ * 5. To apply a function to all entries, in key order, use btree_apply().
+ * 6. To clear all keys use btree_clear().
+ * 7. To delete a tree instance use btree_delete().
+ * 8. To iterate over all entries in key order use btree_iter_init(),
+ *    btree_iter_next().
+ * 9. To iterate from the first key not less than a given key use
+ *    btree_lower_bound(), btree_iter_next().
+ * 10. To build a tree from keys that are already sorted use
+ *     btree_bulk_load().
+ * 11. To take O(1) point-in-time snapshots, make the tree persistent
+ *     with btree_set_persistent() and use btree_snapshot().
+ * 12. For string keys that share long prefixes, such as URLs or paths,
+ *     switch the tree to prefix-compressed nodes with
+ *     btree_set_string_keys().
+ * 13. To find the position of a key in key order use btree_rank(), to
+ *     find the key at a position use btree_select() and to count the
+ *     keys in a range use btree_count_range(); all are O(log n).
+ * 14. To remove every key in a range use btree_delete_range() and to
+ *     insert a sorted batch of keys use btree_merge_sorted().
+ *
+ * Note: neither the keys or the values are copied so their lifetime
+ * must match that of the tree.
+ */
+
+#include <stddef.h>		/* size_t */
+
+/* Opaque types. */
+struct btree;
+struct btree_node;
+
+/* Key comparison function: returns <0, 0 or >0 like strcmp(). */
+typedef int (*BTREE_COMPARE_FN) (const void *a, const void *b);
+
+/* Apply function. */
+typedef int (*BTREE_APPLY_FN) (const void *key, const void *val,
+			       const void *client_data);
+
+/* Functions for deleting keys and values. */
+typedef void (*BTREE_KEY_FREE_FN) (void *k);
+typedef void (*BTREE_VAL_FREE_FN) (void *v);
+
+/* Functions for allocating and freeing memory. */
+typedef void *(*BTREE_MALLOC_FN) (size_t n);
+typedef void (*BTREE_FREE_FN) (void *ptr);
+
+struct btree_iter {
+	void *key;
+	void *val;
+	/* The remaining fields are private: don't modify them. */
+	const struct btree *const tree;
+	const struct btree_node *const node;
+	const int pos;
 };
 
-typedef int (*BTREE_NODE_EQUALS) (const void *a, const void *b);
+/*
+ * Creates a new tree.
+ *
+ * @param compare_func	   - function that orders keys; if NULL, keys
+ *			     are compared as intptr_t values
+ * @param key_free_func	   - function to delete keys
+ * @param val_free_func	   - function to delete values
+ * @param malloc_func	   - function to allocate memory (e.g., malloc)
+ * @param free_func	   - function to free memory (e.g., free)
+ *
+ * Returns non-null if the tree was created successfully.
+ */
+struct btree *btree_create(BTREE_COMPARE_FN compare_func,
+			   BTREE_KEY_FREE_FN key_free_func,
+			   BTREE_VAL_FREE_FN val_free_func,
+			   BTREE_MALLOC_FN malloc_func,
+			   BTREE_FREE_FN free_func);
+
+/*
+ * Deletes the tree instance.
+ *
+ * All the entries are removed via btree_clear().
+ *
+ * @param t - tree
+ */
+void btree_delete(struct btree *t);
+
+/*
+ * Removes a key and value from the tree.
+ *
+ * @param t - tree instance
+ * @param k - key to remove
+ *
+ * Returns 0 if key was found, otherwise 1.  A persistent tree also
+ * returns 1, leaving the tree unchanged, if it cannot allocate the
+ * copies of shared nodes that the removal requires.
+ */
+int btree_remove(struct btree *t, const void *k);
+
+/*
+ * Clears all entries and reclaims memory used by each entry.
+ *
+ * A persistent tree that cannot allocate a new root, and whose root
+ * is shared with a snapshot, is left unchanged.
+ */
+void btree_clear(struct btree *t);
+
+/*
+ * Inserts a new key with associated value.
+ *
+ * If the key already exists its value is replaced; the existing key
+ * is kept.
+ *
+ * @param t - tree instance
+ * @param k - key to insert
+ * @param v - value associated with key
+ *
+ * Returns 0 on success, or 1 if a new entry cannot be created.
+ */
+int btree_insert(struct btree *t, void *k, void *v);
+
+/*
+ * Switches an empty tree to persistent mode.
+ *
+ * A persistent tree shares unchanged nodes with its snapshots; a write
+ * copies the nodes it changes along with the path to them, so neither
+ * the tree nor any snapshot sees the other's later changes.  Nodes are
+ * reference counted and freed once no tree refers to them.  The tree
+ * doesn't own its keys or values, since any number of versions may
+ * share them, so it must have been created without key and value free
+ * functions.
+ *
+ * @param t - tree instance, which must be empty
+ *
+ * Returns 0 on success, or 1 if the tree isn't empty or has a key or
+ * value free function.
+ */
+int btree_set_persistent(struct btree *t);
+
+/*
+ * Switches an empty tree to NUL-terminated string keys ordered by
+ * strcmp(), whatever comparator it was created with.
+ *
+ * Each node records how many leading bytes its keys share and, for
+ * each key, the next 8 bytes as an integer.  Most comparisons within
+ * a node are then between integers held in the node, and keys are
+ * only dereferenced to check the shared prefix, once per node, or to
+ * break a tie.  Nodes are 8 bytes per key larger.  The mode can be
+ * combined with btree_set_persistent() and btree_bulk_load().
+ *
+ * @param t - tree instance, which must be empty
+ *
+ * Returns 0 on success, or 1 if the tree isn't empty or no memory is
+ * available.
+ */
+int btree_set_string_keys(struct btree *t);
+
+/*
+ * Takes a snapshot of a persistent tree in O(1).
+ *
+ * The snapshot is an independent persistent tree holding the entries
+ * of t at the time of the call.  It can be read, or modified, by
+ * another thread while t continues to be modified, and is deleted with
+ * btree_delete().  Taking a snapshot must not race with writes to t.
+ *
+ * @param t - persistent tree instance
+ *
+ * Returns the snapshot, or NULL if t isn't persistent or no memory is
+ * available.
+ */
+struct btree *btree_snapshot(struct btree *t);
 
 /*
- * Find node which matches data.
+ * Builds the tree from an array of keys in strictly ascending order.
+ *
+ * The nodes are packed bottom-up, left to right, in O(n) without any
+ * splitting, which is much faster than inserting the keys one at a
+ * time and yields fuller nodes.  A fill factor below 1.0 leaves room
+ * in every node for later inserts.  On success the tree owns the keys
+ * and values just as if they had been inserted.
+ *
+ * @param t - tree instance, which must be empty
+ * @param keys - keys to load, in ascending order
+ * @param vals - values for each key, or NULL for all NULL values
+ * @param n - number of keys
+ * @param fill_factor - fraction of each node to fill, clamped to the
+ *			range 0.5 to 1.0
+ *
+ * Returns 0 on success, or 1 if the tree isn't empty, the keys are
+ * not in ascending order, contain duplicates, or there is no memory;
+ * the tree is left unchanged.
  */
-extern int btree_find(const struct btree_node *n, const void *data,
-		      BTREE_NODE_EQUALS fn);
+int btree_bulk_load(struct btree *t, void **keys, void **vals, size_t n,
+		    double fill_factor);
 
-extern struct btree_node *btree_insert(struct btree_node *n, void *data);
+/*
+ * Inserts a batch of keys in strictly ascending order, as if each were
+ * passed to btree_insert().
+ *
+ * Rather than descending from the root once per key, the batch is
+ * walked in order and each descent merges a run of keys into the leaf
+ * it reaches, as many as belong in that leaf and fit in it.  Only a
+ * full leaf costs a descent for a single key, which splits it.  The
+ * tree can hold entries anywhere in the range of the batch.
+ *
+ * @param t - tree instance
+ * @param keys - keys to insert, in ascending order
+ * @param vals - values for each key, or NULL for all NULL values
+ * @param n - number of keys
+ *
+ * Returns 0 on success, or 1 if the keys are not in ascending order or
+ * contain duplicates, in which case the tree is left unchanged, or if
+ * no memory is available, in which case the keys before the one that
+ * failed have been inserted.
+ */
+int btree_merge_sorted(struct btree *t, void **keys, void **vals, size_t n);
+
+/*
+ * Removes every key in the half-open range [a, b) along with its value.
+ *
+ * Whole subtrees that lie within the range are unlinked and freed in
+ * one step each, rebalancing once per subtree rather than once per
+ * key, so the cost depends on the height of the tree and the number
+ * of subtrees rather than the number of keys removed.  Only keys that
+ * share a leaf with keys outside the range are removed one at a time.
+ *
+ * @param t - tree instance
+ * @param a - lowest key to remove
+ * @param b - first key past the range
+ *
+ * Returns the number of entries removed, which is 0 if b is not greater
+ * than a.  A persistent tree stops early, leaving the remaining keys in
+ * place, if it cannot allocate the copies of shared nodes it needs.
+ */
+unsigned long btree_delete_range(struct btree *t, const void *a,
+				 const void *b);
+
+/*
+ * Lookup an existing key.
+ *
+ * @param t - tree instance
+ * @param k - the search key
+ *
+ * Returns the value associated with key, or NULL if key is not present.
+ */
+void *btree_lookup(const struct btree *t, const void *k);
+
+/*
+ * Returns the number of entries in the tree.
+ *
+ * @param t - tree instance
+ */
+unsigned long btree_count(const struct btree *t);
+
+/*
+ * Returns the number of keys in the tree that are less than k, which
+ * is the index k has, or would have, in key order.
+ *
+ * @param t - tree instance
+ * @param k - the search key
+ */
+unsigned long btree_rank(const struct btree *t, const void *k);
+
+/*
+ * Returns the number of keys in the half-open range [a, b), or 0 if b
+ * is not greater than a.
+ *
+ * @param t - tree instance
+ * @param a - lowest key to count
+ * @param b - first key past the range
+ */
+unsigned long btree_count_range(const struct btree *t, const void *a,
+				const void *b);
+
+/*
+ * Initialize an iterator at the key with index i in key order, where
+ * 0 is the smallest key, so that the first btree_iter_next() returns
+ * that entry.  If i is not less than btree_count() the iterator is
+ * already exhausted.  For example, the median of n keys is selected by
+ * i = n / 2.
+ *
+ * @param t - tree instance
+ * @param i - index of the key
+ * @param iter - iterator to initialize
+ */
+void btree_select(const struct btree *t, unsigned long i,
+		  struct btree_iter *iter);
+
+/*
+ * Apply a function to all entries in key order.
+ *
+ * The apply function should return 0 to terminate the enumeration
+ * early.
+ *
+ * @param t - tree instance
+ * @param fn - function to apply to each entry
+ * @param client_data - arbitrary user data
+ *
+ * Returns the number of entries the function was applied to.
+ */
+unsigned long btree_apply(const struct btree *t, BTREE_APPLY_FN fn,
+			  void *client_data);
+
+/*
+ * Initialize an iterator at the smallest key.
+ *
+ * @param t - tree instance
+ * @param iter - iterator to initialize
+ */
+void btree_iter_init(const struct btree *t, struct btree_iter *iter);
+
+/*
+ * Initialize an iterator at the smallest key not less than k.
+ *
+ * @param t - tree instance
+ * @param k - the search key
+ * @param iter - iterator to initialize
+ */
+void btree_lower_bound(const struct btree *t, const void *k,
+		       struct btree_iter *iter);
+
+/*
+ * Advances the iterator.
+ *
+ * Returns 1 while there more entries, otherwise 0.  The key and value
+ * for each entry can be accessed through the iterator structure.
+ * Iteration walks the linked leaves so it is invalidated by any
+ * insert or remove.
+ */
+int btree_iter_next(struct btree_iter *iter);
 
-#endif
+#endif				/* BTREE_H */
@@ -0,0 +1,172 @@
+#ifndef CBTREE_H
+#define CBTREE_H
+
+
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * A concurrent B+tree with optimistic lock coupling.
+ *
+ * SYNOPSIS
+ *
+ * 1. Create an epoch domain with epoch_create() and a tree with
+ *    cbtree_create().
+ * 2. Each thread using the tree registers with epoch_register() and
+ *    passes the handle to every call.
+ * 3. To insert an entry use cbtree_insert().
+ * 4. To lookup a key use cbtree_lookup().
+ * 5. To remove a key use cbtree_remove().
+ * 6. To visit a range of keys in order use cbtree_range().
+ * 7. To delete a tree instance use cbtree_delete().
+ *
+ * Every node carries a version lock.  Readers never write to shared
+ * memory: they note a node's version, read it, and restart from the
+ * root if the version has changed in the meantime.  Writers lock only
+ * the leaf they modify, or a node and its parent when the node is
+ * split or an empty leaf is unlinked.  Full nodes are split on the way
+ * down so a split never has to propagate upwards.  Nodes and values
+ * that may still be seen by a reader are freed through the epoch
+ * domain.
+ *
+ * Keys are intptr_t values, as with a btree created without a
+ * comparator, so that readers never dereference a key that a writer
+ * could free.  Nodes are not merged: a leaf is unlinked once it is
+ * empty, but inner nodes only go away with the tree.
+ */
+
+#include <stddef.h>		/* size_t */
+#include <stdint.h>		/* intptr_t */
+#include <c-hacks/epoch.h>
+
+/* Opaque types. */
+struct cbtree;
+
+/* Range function: return 0 to stop the scan. */
+typedef int (*CBTREE_APPLY_FN) (intptr_t key, void *val, void *client_data);
+
+/* Function for deleting values. */
+typedef void (*CBTREE_VAL_FREE_FN) (void *v);
+
+/* Functions for allocating and freeing memory. */
+typedef void *(*CBTREE_MALLOC_FN) (size_t n);
+typedef void (*CBTREE_FREE_FN) (void *ptr);
+
+/*
+ * Creates a new tree.
+ *
+ * @param e		   - epoch domain used to free nodes and values
+ * @param val_free_func	   - function to delete values
+ * @param malloc_func	   - function to allocate memory (e.g., malloc)
+ * @param free_func	   - function to free memory (e.g., free)
+ *
+ * Returns non-null if the tree was created successfully.
+ */
+struct cbtree *cbtree_create(struct epoch *e,
+			     CBTREE_VAL_FREE_FN val_free_func,
+			     CBTREE_MALLOC_FN malloc_func,
+			     CBTREE_FREE_FN free_func);
+
+/*
+ * Deletes the tree instance and all its entries.  No other thread may
+ * be using the tree.
+ *
+ * @param t - tree
+ */
+void cbtree_delete(struct cbtree *t);
+
+/*
+ * Inserts a new key with associated value.
+ *
+ * If the key already exists its value is replaced and the old value is
+ * retired.
+ *
+ * @param t - tree instance
+ * @param self - epoch handle of the calling thread
+ * @param k - key to insert
+ * @param v - value associated with key
+ *
+ * Returns 0 on success, or 1 if a new entry cannot be created.
+ */
+int cbtree_insert(struct cbtree *t, struct epoch_thread *self, intptr_t k,
+		  void *v);
+
+/*
+ * Removes a key and retires its value.
+ *
+ * @param t - tree instance
+ * @param self - epoch handle of the calling thread
+ * @param k - key to remove
+ *
+ * Returns 0 if key was found, otherwise 1.
+ */
+int cbtree_remove(struct cbtree *t, struct epoch_thread *self, intptr_t k);
+
+/*
+ * Lookup an existing key.
+ *
+ * A concurrent remove may retire the value as soon as this returns;
+ * callers that dereference it should hold their own critical section
+ * with epoch_enter() and epoch_leave() around the lookup and its use.
+ *
+ * @param t - tree instance
+ * @param self - epoch handle of the calling thread
+ * @param k - the search key
+ *
+ * Returns the value associated with key, or NULL if key is not present.
+ */
+void *cbtree_lookup(struct cbtree *t, struct epoch_thread *self,
+		    intptr_t k);
+
+/*
+ * Visits the keys in [lo, hi) in ascending order.
+ *
+ * The scan reads one leaf at a time so it is not a snapshot: an entry
+ * inserted or removed concurrently may or may not be seen, but no key
+ * is visited twice.  The function should return 0 to stop the scan.
+ *
+ * @param t - tree instance
+ * @param self - epoch handle of the calling thread
+ * @param lo - smallest key to visit
+ * @param hi - key to stop at
+ * @param fn - function to apply to each entry
+ * @param client_data - arbitrary user data
+ *
+ * Returns the number of entries the function was applied to.
+ */
+unsigned long cbtree_range(struct cbtree *t, struct epoch_thread *self,
+			   intptr_t lo, intptr_t hi, CBTREE_APPLY_FN fn,
+			   void *client_data);
+
+/*
+ * Returns the number of entries in the tree.
+ *
+ * @param t - tree instance
+ */
+unsigned long cbtree_count(const struct cbtree *t);
+
+#endif				/* CBTREE_H */
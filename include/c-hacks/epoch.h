@@ -0,0 +1,164 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Epoch-based reclamation for concurrent containers.
+ *
+ * SYNOPSIS
+ *
+ * 1. Create a reclamation domain with epoch_create(); it can be
+ *    shared by any number of containers.
+ * 2. Each thread that touches a container registers with
+ *    epoch_register() and keeps the returned handle.
+ * 3. Accesses to shared nodes are bracketed by epoch_enter() and
+ *    epoch_leave().  Critical sections may nest.
+ * 4. Alternatively, in the quiescent-state style (QSBR), a thread
+ *    calls epoch_quiescent() whenever it holds no references to
+ *    shared nodes, between operations say, and no enter or leave is
+ *    needed.  Before blocking for a long time it calls
+ *    epoch_offline(); the next epoch_quiescent() brings it back.
+ * 5. A node that has been unlinked is passed to epoch_retire(); it is
+ *    freed once no thread can still hold a reference to it.
+ * 6. A thread calls epoch_unregister() before it exits.
+ * 7. Delete the domain with epoch_delete().
+ *
+ * A thread in a critical section, or online in the QSBR style,
+ * announces the global epoch it saw on entry or at its last quiescent
+ * state.  The global epoch only advances once every such thread has
+ * seen the current one, so anything retired in epoch e is unreachable
+ * by all readers once the epoch reaches e + 2.  Retired pointers are
+ * queued per thread in bags of EPOCH_RETIRE_BATCH and reclaimed a bag
+ * at a time.
+ *
+ * The read side writes only to the calling thread's own record.  On
+ * Linux, where membarrier() is available, epoch_enter() is a load,
+ * two plain stores and a compiler barrier: the memory fence it would
+ * otherwise need is paid for by the thread that advances the epoch.
+ * epoch_quiescent() on a thread already online is a load and, once
+ * per epoch, a store.  QSBR is the cheaper of the two but
+ * reclamation waits on every online thread, busy or not.
+ *
+ * Note: a thread uses one style or the other.  epoch_leave() takes a
+ * QSBR thread offline, and epoch_quiescent() must not be called
+ * inside a critical section.
+ */
+
+#include <stddef.h>		/* size_t */
+
+/* Opaque types. */
+struct epoch;
+struct epoch_thread;
+
+/* Function to free a retired pointer. */
+typedef void (*EPOCH_RETIRE_FN) (void *ptr);
+
+/* Functions for allocating and freeing memory. */
+typedef void *(*EPOCH_MALLOC_FN) (size_t n);
+typedef void (*EPOCH_FREE_FN) (void *ptr);
+
+/*
+ * Creates a new reclamation domain.
+ *
+ * @param malloc_func - function to allocate memory (e.g., malloc)
+ * @param free_func   - function to free memory (e.g., free)
+ *
+ * Returns non-null if the domain was created successfully.
+ */
+struct epoch *epoch_create(EPOCH_MALLOC_FN malloc_func,
+			   EPOCH_FREE_FN free_func);
+
+/*
+ * Deletes the domain, freeing everything still waiting to be
+ * reclaimed.  No thread may be inside a critical section.
+ */
+void epoch_delete(struct epoch *e);
+
+/*
+ * Registers the calling thread.
+ *
+ * Returns the thread's handle, or NULL if no memory is available.
+ */
+struct epoch_thread *epoch_register(struct epoch *e);
+
+/*
+ * Unregisters a thread.  Anything it retired that cannot be freed yet
+ * is handed over to the domain.
+ */
+void epoch_unregister(struct epoch_thread *self);
+
+/*
+ * Enters a critical section.
+ */
+void epoch_enter(struct epoch_thread *self);
+
+/*
+ * Leaves a critical section.
+ */
+void epoch_leave(struct epoch_thread *self);
+
+/*
+ * Announces a quiescent state: the calling thread holds no references
+ * to shared nodes, and stays online, so that reclamation waits for it,
+ * until its next quiescent state.
+ *
+ * @param self - handle of the calling thread, outside any critical
+ *               section
+ */
+void epoch_quiescent(struct epoch_thread *self);
+
+/*
+ * Takes the calling thread offline: reclamation no longer waits for
+ * it.  It must not touch shared nodes until epoch_quiescent().
+ */
+void epoch_offline(struct epoch_thread *self);
+
+/*
+ * Queues ptr to be freed by free_func once no thread can reference it.
+ *
+ * @param self - handle of the calling thread
+ * @param ptr - pointer that is no longer reachable from shared memory
+ * @param free_func - function that frees ptr
+ *
+ * Returns 0 on success, or 1 if no memory is available; ptr is then
+ * leaked rather than freed early.
+ */
+int epoch_retire(struct epoch_thread *self, void *ptr,
+		 EPOCH_RETIRE_FN free_func);
+
+/*
+ * Tries to advance the global epoch and frees whatever the calling
+ * thread retired that is now safe to free.
+ *
+ * Returns the number of pointers freed.
+ */
+unsigned long epoch_reclaim(struct epoch_thread *self);
+
+#endif				/* EPOCH_H */
@@ -0,0 +1,145 @@
+#ifndef EYTZINGER_H
+#define EYTZINGER_H
+
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * A read-only sorted set, or map, in Eytzinger layout.
+ *
+ * SYNOPSIS
+ *
+ * 1. Build the set from keys in ascending order with
+ *    eytzinger_create(), or from a btree with
+ *    eytzinger_create_from_btree().
+ * 2. To lookup a key use eytzinger_lookup().
+ * 3. To find the smallest key not less than a given key use
+ *    eytzinger_lower_bound().
+ * 4. To delete the set use eytzinger_delete().
+ *
+ * The keys are stored in a single array in the order of a breadth
+ * first walk of a complete binary search tree: the root at index 1
+ * and the children of index i at 2i and 2i + 1.  The first levels of
+ * the tree, which every search visits, share a few cache lines, and
+ * the 16 descendants four levels below any key occupy two adjacent
+ * cache lines that a search prefetches while it is still comparing
+ * keys above them.  Each step picks a child with arithmetic on the
+ * comparison instead of a branch, so there are no mispredictions to
+ * stall on and several levels of loads can be in flight at once.
+ * Values live in a parallel array that only a successful search
+ * touches.
+ *
+ * Note: neither the keys or the values are copied so their lifetime
+ * must match that of the set.
+ */
+
+#include <stddef.h>		/* size_t */
+#include <c-hacks/btree.h>
+
+/* Opaque types. */
+struct eytzinger;
+
+/* Key comparison function: returns <0, 0 or >0 like strcmp(). */
+typedef int (*EYTZINGER_COMPARE_FN) (const void *a, const void *b);
+
+/* Functions for allocating and freeing memory. */
+typedef void *(*EYTZINGER_MALLOC_FN) (size_t n);
+typedef void (*EYTZINGER_FREE_FN) (void *ptr);
+
+/*
+ * Creates a set from an array of keys in strictly ascending order.
+ *
+ * @param compare_func	   - function that orders keys; if NULL, keys
+ *			     are compared as intptr_t values
+ * @param keys		   - keys, in ascending order
+ * @param vals		   - values for each key, or NULL for all NULL
+ *			     values
+ * @param n		   - number of keys
+ * @param malloc_func	   - function to allocate memory (e.g., malloc)
+ * @param free_func	   - function to free memory (e.g., free)
+ *
+ * Returns non-null if the set was created successfully, or NULL if
+ * the keys are not in ascending order, contain duplicates, or there
+ * is no memory.
+ */
+struct eytzinger *eytzinger_create(EYTZINGER_COMPARE_FN compare_func,
+				   void *const *keys, void *const *vals,
+				   size_t n,
+				   EYTZINGER_MALLOC_FN malloc_func,
+				   EYTZINGER_FREE_FN free_func);
+
+/*
+ * Creates a set holding the entries of a btree.
+ *
+ * @param t		   - tree to copy
+ * @param compare_func	   - the tree's comparator, or NULL if the tree
+ *			     was created without one
+ * @param malloc_func	   - function to allocate memory (e.g., malloc)
+ * @param free_func	   - function to free memory (e.g., free)
+ *
+ * Returns non-null if the set was created successfully.
+ */
+struct eytzinger *eytzinger_create_from_btree(const struct btree *t,
+					      EYTZINGER_COMPARE_FN
+					      compare_func,
+					      EYTZINGER_MALLOC_FN malloc_func,
+					      EYTZINGER_FREE_FN free_func);
+
+/*
+ * Deletes the set.
+ */
+void eytzinger_delete(struct eytzinger *e);
+
+/*
+ * Lookup an existing key.
+ *
+ * @param e - set instance
+ * @param k - the search key
+ *
+ * Returns the value associated with key, or NULL if key is not present.
+ */
+void *eytzinger_lookup(const struct eytzinger *e, const void *k);
+
+/*
+ * Finds the smallest key that is not less than k.
+ *
+ * @param e - set instance
+ * @param k - the search key
+ * @param key - set to the key found, if not NULL
+ * @param val - set to its value, if not NULL
+ *
+ * Returns 0 if there is such a key, otherwise 1.
+ */
+int eytzinger_lower_bound(const struct eytzinger *e, const void *k,
+			  void **key, void **val);
+
+/*
+ * Returns the number of keys in the set.
+ */
+size_t eytzinger_count(const struct eytzinger *e);
+
+#endif				/* EYTZINGER_H */
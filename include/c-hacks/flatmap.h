@@ -0,0 +1,228 @@
+#ifndef FLATMAP_H
+#define FLATMAP_H
+
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * A sorted flat map: an ordered map held in two sorted arrays, for
+ * maps with a few dozen entries.
+ *
+ * SYNOPSIS
+ *
+ * 1. A map is created with flatmap_create().
+ * 2. To insert an entry use flatmap_insert().
+ * 3. To insert many entries at once use flatmap_insert_batch().
+ * 4. To lookup a key use flatmap_lookup().
+ * 5. To remove a key use flatmap_remove().
+ * 6. To apply a function to all entries, in key order, use
+ *    flatmap_apply().
+ * 7. To clear all keys use flatmap_clear().
+ * 8. To delete a map instance use flatmap_delete().
+ * 9. To iterate over all entries in key order use flatmap_iter_init(),
+ *    flatmap_iter_next().
+ * 10. To iterate from the first key not less than a given key use
+ *     flatmap_lower_bound(), flatmap_iter_next().
+ *
+ * Keys are ordered by a comparator with the same interface as the one
+ * a btree takes, so the functions in btree-funcs.h work with either.
+ * A map costs three allocations whatever its size: the map and an
+ * array each for keys and values.  An empty map allocates no arrays
+ * at all.  A lookup is a branch-free binary search of the keys array.
+ * An insert or remove moves the entries after it, so it is O(n); a
+ * batch of inserts is sorted and merged in a single O(n + m log m)
+ * pass.
+ *
+ * Note: neither the keys or the values are copied so their lifetime
+ * must match that of the map.
+ */
+
+#include <stddef.h>		/* size_t */
+
+/* Opaque types. */
+struct flatmap;
+
+/* Key comparison function: returns <0, 0 or >0 like strcmp(). */
+typedef int (*FLATMAP_COMPARE_FN) (const void *a, const void *b);
+
+/* Apply function. */
+typedef int (*FLATMAP_APPLY_FN) (const void *key, const void *val,
+				 const void *client_data);
+
+/* Functions for deleting keys and values. */
+typedef void (*FLATMAP_KEY_FREE_FN) (void *k);
+typedef void (*FLATMAP_VAL_FREE_FN) (void *v);
+
+/* Functions for allocating and freeing memory. */
+typedef void *(*FLATMAP_MALLOC_FN) (size_t n);
+typedef void (*FLATMAP_FREE_FN) (void *ptr);
+
+struct flatmap_iter {
+	void *key;
+	void *val;
+	/* The remaining fields are private: don't modify them. */
+	const struct flatmap *const map;
+	const size_t pos;
+};
+
+/*
+ * Creates a new map.
+ *
+ * @param compare_func	   - function that orders keys; if NULL, keys
+ *			     are compared as intptr_t values
+ * @param key_free_func	   - function to delete keys
+ * @param val_free_func	   - function to delete values
+ * @param malloc_func	   - function to allocate memory (e.g., malloc)
+ * @param free_func	   - function to free memory (e.g., free)
+ *
+ * Returns non-null if the map was created successfully.
+ */
+struct flatmap *flatmap_create(FLATMAP_COMPARE_FN compare_func,
+			       FLATMAP_KEY_FREE_FN key_free_func,
+			       FLATMAP_VAL_FREE_FN val_free_func,
+			       FLATMAP_MALLOC_FN malloc_func,
+			       FLATMAP_FREE_FN free_func);
+
+/*
+ * Deletes the map instance.
+ *
+ * All the entries are removed via flatmap_clear().
+ *
+ * @param m - map
+ */
+void flatmap_delete(struct flatmap *m);
+
+/*
+ * Clears all entries and reclaims memory used by each entry.
+ */
+void flatmap_clear(struct flatmap *m);
+
+/*
+ * Inserts a new key with associated value.
+ *
+ * If the key already exists its value is replaced; the existing key
+ * is kept.
+ *
+ * @param m - map instance
+ * @param k - key to insert
+ * @param v - value associated with key
+ *
+ * Returns 0 on success, or 1 if a new entry cannot be created.
+ */
+int flatmap_insert(struct flatmap *m, void *k, void *v);
+
+/*
+ * Inserts a batch of keys, in any order, with associated values.
+ *
+ * The batch is sorted and then merged with the map's entries in one
+ * pass, so inserting m keys into a map of n costs O(n + m log m)
+ * rather than the O(n * m) of inserting them one at a time.  Each key
+ * behaves as if it had been inserted with flatmap_insert() in batch
+ * order: a key already in the map, or repeated in the batch, keeps
+ * the first key and takes the last value.
+ *
+ * @param m - map instance
+ * @param keys - keys to insert
+ * @param vals - values for each key, or NULL for all NULL values
+ * @param n - number of keys
+ *
+ * Returns 0 on success, or 1 if no memory is available; the map is
+ * left unchanged.
+ */
+int flatmap_insert_batch(struct flatmap *m, void **keys, void **vals,
+			 size_t n);
+
+/*
+ * Removes a key and value from the map.
+ *
+ * @param m - map instance
+ * @param k - key to remove
+ *
+ * Returns 0 if key was found, otherwise 1.
+ */
+int flatmap_remove(struct flatmap *m, const void *k);
+
+/*
+ * Lookup an existing key.
+ *
+ * @param m - map instance
+ * @param k - the search key
+ *
+ * Returns the value associated with key, or NULL if key is not present.
+ */
+void *flatmap_lookup(const struct flatmap *m, const void *k);
+
+/*
+ * Returns the number of entries in the map.
+ *
+ * @param m - map instance
+ */
+size_t flatmap_count(const struct flatmap *m);
+
+/*
+ * Apply a function to all entries in key order.
+ *
+ * The apply function should return 0 to terminate the enumeration
+ * early.
+ *
+ * @param m - map instance
+ * @param fn - function to apply to each entry
+ * @param client_data - arbitrary user data
+ *
+ * Returns the number of entries the function was applied to.
+ */
+size_t flatmap_apply(const struct flatmap *m, FLATMAP_APPLY_FN fn,
+		     void *client_data);
+
+/*
+ * Initialize an iterator at the smallest key.
+ *
+ * @param m - map instance
+ * @param iter - iterator to initialize
+ */
+void flatmap_iter_init(const struct flatmap *m, struct flatmap_iter *iter);
+
+/*
+ * Initialize an iterator at the smallest key not less than k.
+ *
+ * @param m - map instance
+ * @param k - the search key
+ * @param iter - iterator to initialize
+ */
+void flatmap_lower_bound(const struct flatmap *m, const void *k,
+			 struct flatmap_iter *iter);
+
+/*
+ * Advances the iterator.
+ *
+ * Returns 1 while there more entries, otherwise 0.  The key and value
+ * for each entry can be accessed through the iterator structure.  The
+ * iterator is invalidated by any insert or remove.
+ */
+int flatmap_iter_next(struct flatmap_iter *iter);
+
+#endif				/* FLATMAP_H */
@@ -0,0 +1,224 @@
+#ifndef HASHTBL_FEED_H
+#define HASHTBL_FEED_H
+
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * A change feed for replicating a hash table to follower processes.
+ *
+ * SYNOPSIS
+ *
+ * Leader:
+ *
+ * 1. Attach a feed to a table with hashtbl_feed_create().
+ * 2. Mutate the table as normal; each insert, remove and clear is
+ *    encoded into the feed's ring buffer.
+ * 3. Ship pending records with hashtbl_feed_flush() (e.g., to a pipe
+ *    or a Unix socket) or hashtbl_feed_read().
+ * 4. Detach and delete the feed with hashtbl_feed_delete().
+ *
+ * Follower:
+ *
+ * 1. Create an applier for the replica with hashtbl_feed_applier_create().
+ * 2. Feed it bytes with hashtbl_feed_apply() or hashtbl_feed_apply_fd().
+ *    All complete records are applied in one batch; a trailing partial
+ *    record is buffered until the rest of it arrives.
+ * 3. Delete the applier with hashtbl_feed_applier_delete().
+ *
+ * Record format
+ * -------------
+ *
+ * Each record is an op byte followed by LEB128 fields:
+ *
+ *   INSERT: op seqno keylen key[keylen] vallen val[vallen]
+ *   REMOVE: op seqno keylen key[keylen]
+ *   CLEAR:  op seqno
+ *
+ * Sequence numbers start at 1 and increase by one per record; an
+ * applier rejects any record that is not the one it expects.  If the
+ * ring fills up before it is drained, records are dropped, the feed is
+ * marked as overflowed and the follower must be reseeded with a full
+ * copy before the feed is reset with hashtbl_feed_reset().
+ */
+
+#include <stddef.h>		/* size_t */
+#include <c-hacks/hashtbl.h>
+
+/* Opaque types. */
+struct hashtbl_feed;
+struct hashtbl_feed_applier;
+
+/*
+ * Serialises a key or value.
+ *
+ * Writes at most len bytes of the encoding of obj into buf and
+ * returns the number of bytes the complete encoding requires.  The
+ * feed first calls the function with a len of 0 to size the encoding.
+ */
+typedef size_t (*HASHTBL_FEED_ENCODE_FN) (const void *obj, void *buf,
+					  size_t len);
+
+/*
+ * Deserialises a key or value from len bytes at buf into *obj.
+ *
+ * Returns 0 on success, having set *obj to the new object, which may
+ * be NULL if NULL is what was encoded.  Returns non-zero if the bytes
+ * can't be decoded or memory can't be allocated; the record then fails
+ * to apply.  Ownership of the object passes to the replica table, so
+ * the replica's key/val free functions should release it.
+ */
+typedef int (*HASHTBL_FEED_DECODE_FN) (const void *buf, size_t len,
+				       void **obj);
+
+/*
+ * Creates a feed and installs it as the observer of h.
+ *
+ * @param h		  - hash table to replicate
+ * @param ring_size	  - capacity of the ring buffer in bytes (pow2)
+ * @param key_encode_func - function to serialise keys
+ * @param val_encode_func - function to serialise values
+ * @param malloc_func	  - function to allocate memory (e.g., malloc)
+ * @param free_func	  - function to free memory (e.g., free)
+ *
+ * Returns non-null if the feed was created successfully.
+ */
+struct hashtbl_feed *hashtbl_feed_create(struct hashtbl *h, size_t ring_size,
+					 HASHTBL_FEED_ENCODE_FN key_encode_func,
+					 HASHTBL_FEED_ENCODE_FN val_encode_func,
+					 HASHTBL_MALLOC_FN malloc_func,
+					 HASHTBL_FREE_FN free_func);
+
+/*
+ * Removes the feed as the table's observer and deletes it.
+ */
+void hashtbl_feed_delete(struct hashtbl_feed *feed);
+
+/*
+ * Returns the number of encoded bytes waiting to be drained.
+ */
+size_t hashtbl_feed_pending(const struct hashtbl_feed *feed);
+
+/*
+ * Returns the sequence number of the last record produced.
+ */
+unsigned long long hashtbl_feed_seqno(const struct hashtbl_feed *feed);
+
+/*
+ * Returns non-zero if records were dropped because the ring was full.
+ */
+int hashtbl_feed_overflowed(const struct hashtbl_feed *feed);
+
+/*
+ * Discards pending records and clears the overflow state.
+ *
+ * The sequence number is not reset; a follower reseeded with a full
+ * copy should be told to expect hashtbl_feed_seqno() + 1 next.
+ */
+void hashtbl_feed_reset(struct hashtbl_feed *feed);
+
+/*
+ * Copies and consumes up to len pending bytes into buf.
+ *
+ * Returns the number of bytes copied.
+ */
+size_t hashtbl_feed_read(struct hashtbl_feed *feed, void *buf, size_t len);
+
+/*
+ * Writes pending bytes to fd, consuming whatever was written.
+ *
+ * Returns 0 once everything is written or if fd would block, or -1
+ * (with errno set) on a write error.
+ */
+int hashtbl_feed_flush(struct hashtbl_feed *feed, int fd);
+
+/*
+ * Creates an applier that replays a feed into h.
+ *
+ * @param h		  - replica hash table
+ * @param next_seqno	  - sequence number of the first expected record
+ * @param key_decode_func - function to deserialise keys
+ * @param val_decode_func - function to deserialise values
+ * @param key_free_func	  - function to delete decoded keys not kept
+ * @param val_free_func	  - function to delete decoded values not kept
+ * @param malloc_func	  - function to allocate memory (e.g., malloc)
+ * @param free_func	  - function to free memory (e.g., free)
+ *
+ * Returns non-null if the applier was created successfully.
+ */
+struct hashtbl_feed_applier *hashtbl_feed_applier_create(struct hashtbl *h,
+							 unsigned long long
+							 next_seqno,
+							 HASHTBL_FEED_DECODE_FN
+							 key_decode_func,
+							 HASHTBL_FEED_DECODE_FN
+							 val_decode_func,
+							 HASHTBL_KEY_FREE_FN
+							 key_free_func,
+							 HASHTBL_VAL_FREE_FN
+							 val_free_func,
+							 HASHTBL_MALLOC_FN
+							 malloc_func,
+							 HASHTBL_FREE_FN
+							 free_func);
+
+/*
+ * Deletes the applier.  The replica table is left untouched.
+ */
+void hashtbl_feed_applier_delete(struct hashtbl_feed_applier *a);
+
+/*
+ * Applies all complete records found in the previously buffered bytes
+ * followed by len bytes at buf.
+ *
+ * Returns the number of records applied, or -1 if the stream is
+ * corrupt, out of sequence or memory could not be allocated.  The
+ * applier is unusable after an error.  A record that fails to apply
+ * leaves the replica as it was before that record.
+ */
+long hashtbl_feed_apply(struct hashtbl_feed_applier *a, const void *buf,
+			size_t len);
+
+/*
+ * Performs a single read(2) from fd and applies the result.
+ *
+ * @param napplied - if non-null, receives the number of records applied
+ *
+ * Returns the read(2) result: the number of bytes read, 0 on end of
+ * file, or -1 on error (errno is set to EPROTO if the stream itself is
+ * bad).
+ */
+long hashtbl_feed_apply_fd(struct hashtbl_feed_applier *a, int fd,
+			   unsigned long *napplied);
+
+/*
+ * Returns the sequence number of the next record the applier expects.
+ */
+unsigned long long hashtbl_feed_applier_seqno(const struct
+					      hashtbl_feed_applier *a);
+
+#endif				/* HASHTBL_FEED_H */
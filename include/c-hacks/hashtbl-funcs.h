@@ -91,4 +91,59 @@ static INLINE int hashtbl_direct_equals(const void *a, const void *b)
 	return a == b;
 }
 
+/*
+ * A second family, for keys the functions above spread badly: they
+ * mix every input bit into every output bit, at some cost in speed.
+ * Each hashes the same key representation as its namesake above, so
+ * it can be used with the same equals function.
+ */
+
+static INLINE unsigned int hashtbl_mix32(unsigned int h)
+{
+	/* MurmurHash3 finalizer. */
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	return h ^ (h >> 16);
+}
+
+static INLINE unsigned int hashtbl_mix64(unsigned long long h)
+{
+	/* MurmurHash3 64-bit finalizer, folded to 32 bits. */
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return (unsigned int)(h ^ (h >> 32));
+}
+
+static INLINE unsigned int hashtbl_string_fnv1a_hash(const void *k)
+{
+	const unsigned char *str = (const unsigned char *)k;
+	unsigned int hash = 2166136261U;
+
+	while (*str != '\0') {
+		hash ^= *str++;
+		hash *= 16777619U;
+	}
+	return hashtbl_mix32(hash);
+}
+
+static INLINE unsigned int hashtbl_int_mix_hash(const void *k)
+{
+	return hashtbl_mix32(*(const unsigned int *)k);
+}
+
+static INLINE unsigned int hashtbl_int64_mix_hash(const void *k)
+{
+	return hashtbl_mix64(*(const unsigned long long *)k);
+}
+
+static INLINE unsigned int hashtbl_direct_mix_hash(const void *k)
+{
+	return hashtbl_mix64((unsigned long long)(uintptr_t) k);
+}
+
 #endif
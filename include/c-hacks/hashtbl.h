@@ -41,6 +41,11 @@
  * 5. To clear all keys use hashtbl_clear().
  * 6. To delete a hash table instance use hashtbl_delete().
  * 7. To iterate over all entries use hashtbl_iter_init(), hashtbl_iter_next().
+ * 8. To observe inserts, removes and clears use hashtbl_set_observer().
+ * 9. To record how long inserts, lookups and removes take use
+ *    hashtbl_latency_enable(), and read them with hashtbl_latency().
+ * 10. To have the table choose its own hash function use
+ *     hashtbl_select_hash().
  *
  * Note: neither the keys or the values are copied so their lifetime
  * must match that of the hash table.  NULL keys are not permitted.
@@ -52,6 +57,7 @@
 /* Opaque types. */
 struct hashtbl;
 struct hashtbl_entry;
+struct histogram;
 
 /* Hash function. */
 typedef unsigned int (*HASHTBL_HASH_FN) (const void *k);
@@ -75,6 +81,25 @@ typedef void (*HASHTBL_FREE_FN) (void *ptr);
 typedef int (*HASHTBL_EVICTOR_FN) (const struct hashtbl * h,
 				   unsigned long count);
 
+/* Mutations reported to an observer. */
+enum hashtbl_op {
+	HASHTBL_OP_INSERT = 1,
+	HASHTBL_OP_REMOVE = 2,
+	HASHTBL_OP_CLEAR = 3
+};
+
+/* Operations whose latency can be recorded. */
+enum hashtbl_latency_op {
+	HASHTBL_LATENCY_INSERT,
+	HASHTBL_LATENCY_LOOKUP,
+	HASHTBL_LATENCY_REMOVE
+};
+
+/* Function called after each successful insert, remove or clear. */
+typedef void (*HASHTBL_OBSERVER_FN) (const struct hashtbl * h,
+				     enum hashtbl_op op, const void *key,
+				     const void *val, void *client_data);
+
 struct hashtbl_iter {
 	void *key;
 	void *val;
@@ -109,7 +134,8 @@ struct hashtbl *hashtbl_create(int initial_capacity, double max_load_factor,
 /*
  * Deletes the hash table instance.
  *
- * All the entries are removed via hashtbl_clear().
+ * All the entries are removed as per hashtbl_clear() but any
+ * observer is not notified.
  *
  * @param h - hash table
  */
@@ -214,4 +240,104 @@ void hashtbl_iter_init(struct hashtbl *h, struct hashtbl_iter *iter);
  */
 int hashtbl_iter_next(struct hashtbl *h, struct hashtbl_iter *iter);
 
+/*
+ * Install a mutation observer.
+ *
+ * The observer is called after every insert (including replacing the
+ * value of an existing key), before the key and value of a removed
+ * entry are freed, and before a clear.  For HASHTBL_OP_CLEAR both key
+ * and val are NULL.  hashtbl_delete() does not notify the observer.
+ * Passing a NULL fn removes the current observer.
+ *
+ * @param h	      - hash table instance
+ * @param fn	      - function to call for each mutation
+ * @param client_data - arbitrary user data passed to fn
+ */
+void hashtbl_set_observer(struct hashtbl *h, HASHTBL_OBSERVER_FN fn,
+			  void *client_data);
+
+/*
+ * Start recording the latency of inserts, lookups and removes.
+ *
+ * One operation in every 2^sample_shift is timed, so 0 times them
+ * all.  Each kind of operation gets its own histogram, allocated with
+ * the table's malloc_func.  An insert's time includes any resize it
+ * triggers.  Calling this again empties the histograms.
+ *
+ * @param h	       - hash table instance
+ * @param sample_shift - log2 of the sampling interval
+ *
+ * Returns 0 on success, or 1 if no memory could be allocated.
+ */
+int hashtbl_latency_enable(struct hashtbl *h, unsigned int sample_shift);
+
+/*
+ * Stop recording latencies and free the histograms.
+ *
+ * @param h - hash table instance
+ */
+void hashtbl_latency_disable(struct hashtbl *h);
+
+/*
+ * Adds the latencies recorded for one kind of operation, in
+ * nanoseconds, to a histogram (see histogram.h).  Several tables, or
+ * threads, can be merged into the same histogram.
+ *
+ * @param h    - hash table instance
+ * @param op   - operation
+ * @param hist - histogram to add to
+ *
+ * Returns 0 on success, or 1 if latencies aren't being recorded or op
+ * is not a hashtbl_latency_op.
+ */
+int hashtbl_latency(const struct hashtbl *h, enum hashtbl_latency_op op,
+		    struct histogram *hist);
+
+/* How keys are represented, for hashtbl_select_hash(). */
+enum hashtbl_key_kind {
+	HASHTBL_KEY_STRING,	/* NUL-terminated strings */
+	HASHTBL_KEY_INT,	/* pointers to unsigned int */
+	HASHTBL_KEY_INT64,	/* pointers to unsigned long long */
+	HASHTBL_KEY_DIRECT	/* the pointers themselves */
+};
+
+/*
+ * Let the table choose its hash function from the keys inserted.
+ *
+ * The choice is made during a resize that grows the table, but not
+ * necessarily the first: it waits for the first such resize at which
+ * the table holds at least nsamples keys, so that there is a full
+ * sample to judge by.  Up to nsamples keys are then drawn evenly from
+ * the table.  The table's current hash function and the two built-in
+ * functions for kind from hashtbl-funcs.h (e.g. hashtbl_int_hash and
+ * hashtbl_int_mix_hash) are each timed on the sample and used to
+ * place it in a table of about the sample's size.  Of the functions
+ * whose mean chain position is within 5% of the best, the fastest
+ * becomes the table's hash function, and the entries are rehashed as
+ * part of the resize.  A function must be at least 5% faster to
+ * displace the one chosen before it, the current one first.  The
+ * choice is made once; call this again to choose again.
+ *
+ * The keys must be of the given kind and the table's equals_func must
+ * agree with all of the candidates, as the built-in equals functions
+ * do.  Calls to hashtbl_resize() count, so a table created without
+ * auto_resize can choose too.
+ *
+ * @param h	   - hash table instance
+ * @param kind	   - how the keys are represented
+ * @param nsamples - number of keys to sample, or 0 to cancel
+ *
+ * Returns 0 on success, or 1 if kind is not a hashtbl_key_kind.
+ */
+int hashtbl_select_hash(struct hashtbl *h, enum hashtbl_key_kind kind,
+			unsigned int nsamples);
+
+/*
+ * Returns the table's hash function: the one it was created with, or
+ * the one chosen by hashtbl_select_hash().
+ *
+ * @param h - hash table instance
+ */
+HASHTBL_HASH_FN hashtbl_hash_fn(const struct hashtbl *h);
+
 #endif				/* HASHTBL_H */
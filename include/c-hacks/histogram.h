@@ -0,0 +1,169 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * A log-linear latency histogram, in the style of HdrHistogram.
+ *
+ * SYNOPSIS
+ *
+ * 1. Initialize a histogram with histogram_init().
+ * 2. To record a value use histogram_record().
+ * 3. To time something, take histogram_clock() before and after and
+ *    record histogram_clock_ns() of the difference.
+ * 4. To combine histograms, e.g. one per thread, use
+ *    histogram_merge().
+ * 5. To read it use histogram_percentile(), or histogram_summary()
+ *    for the count, min, max, mean, p50, p99 and p99.9 at once.
+ *
+ * Values from 0 to 2^64-1 are recorded in a fixed number of buckets:
+ * each power of two range is split into HISTOGRAM_SUB_BUCKETS
+ * equal buckets, so a value is only ever lost to within 1 part in
+ * HISTOGRAM_SUB_BUCKETS (about 3%).  Values below that count are
+ * exact.  A percentile is reported as the highest value that shares
+ * its bucket, and never more than the largest value recorded.
+ *
+ * struct histogram lat;
+ * uint64_t t0;
+ *
+ * histogram_init(&lat);
+ * for (...) {
+ *	t0 = histogram_clock();
+ *	...
+ *	histogram_record(&lat, histogram_clock_ns(histogram_clock() - t0));
+ * }
+ * printf("p99 %llu ns\n", (unsigned long long)histogram_percentile(&lat,
+ *								  99.0));
+ *
+ * Note: recording is not thread safe; give each thread its own
+ * histogram and merge them.
+ */
+
+#include <stdint.h>		/* uint64_t */
+
+#define HISTOGRAM_SUB_BITS	5
+#define HISTOGRAM_SUB_BUCKETS	(1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_NBUCKETS	((64 - HISTOGRAM_SUB_BITS + 1) *	\
+				 HISTOGRAM_SUB_BUCKETS)
+
+struct histogram {
+	/* The fields are private. */
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[HISTOGRAM_NBUCKETS];
+};
+
+struct histogram_summary {
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	double mean;
+	uint64_t p50;
+	uint64_t p99;
+	uint64_t p999;
+};
+
+/*
+ * Initializes, or empties, a histogram.
+ *
+ * @param h - histogram
+ */
+void histogram_init(struct histogram *h);
+
+/*
+ * Records one value.
+ *
+ * @param h	- histogram
+ * @param value - value to record
+ */
+void histogram_record(struct histogram *h, uint64_t value);
+
+/*
+ * Adds all the values recorded in src to dst.
+ *
+ * @param dst - histogram to add to
+ * @param src - histogram to add
+ */
+void histogram_merge(struct histogram *dst, const struct histogram *src);
+
+/*
+ * Returns the number of values recorded.
+ *
+ * @param h - histogram
+ */
+uint64_t histogram_count(const struct histogram *h);
+
+/*
+ * Returns the value at or below which pct percent of the recorded
+ * values fall, or 0 if the histogram is empty.
+ *
+ * @param h   - histogram
+ * @param pct - percentile, from 0.0 to 100.0
+ */
+uint64_t histogram_percentile(const struct histogram *h, double pct);
+
+/*
+ * Fills in the count, min, max, mean, p50, p99 and p99.9 of the
+ * histogram.  All are 0 if it is empty.
+ *
+ * @param h - histogram
+ * @param s - summary to fill in
+ */
+void histogram_summary(const struct histogram *h,
+		       struct histogram_summary *s);
+
+/*
+ * Returns a timestamp in clock ticks.  Only the difference between
+ * two timestamps means anything; histogram_clock_ns() converts it.
+ *
+ * This is the time stamp counter on x86-64 and a monotonic clock in
+ * nanoseconds elsewhere.
+ */
+uint64_t histogram_clock(void);
+
+/*
+ * Converts a difference between two histogram_clock() timestamps to
+ * nanoseconds.
+ *
+ * The tick rate is measured, which takes a millisecond, the first
+ * time this or histogram_clock_calibrate() is called.
+ *
+ * @param ticks - clock ticks
+ */
+uint64_t histogram_clock_ns(uint64_t ticks);
+
+/*
+ * Measures the tick rate now, if that hasn't been done yet, so that
+ * the first histogram_clock_ns() is as cheap as the rest.
+ */
+void histogram_clock_calibrate(void);
+
+#endif				/* HISTOGRAM_H */
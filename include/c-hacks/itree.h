@@ -0,0 +1,158 @@
+#ifndef ITREE_H
+#define ITREE_H
+
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * An intrusive interval tree: a set of closed integer intervals that
+ * can be searched for those containing a point or overlapping a range.
+ *
+ * SYNOPSIS
+ *
+ * 1. Embed a struct itree_node in each structure that describes an
+ *    interval and set its start and last fields.
+ * 2. A tree is initialized with itree_init().
+ * 3. To insert a node use itree_insert(); equal intervals are allowed.
+ * 4. To remove a node use itree_remove().
+ * 5. To build a tree from many intervals at once use itree_build().
+ * 6. To visit the intervals that overlap [lo, hi], in order of their
+ *    start, use itree_first_overlap() and itree_next_overlap().  A
+ *    stabbing query for the intervals that contain x is the overlap
+ *    query [x, x].
+ * 7. To get back the enclosing structure use ITREE_ENTRY().
+ *
+ * The tree is an rbtree ordered by start, augmented so that every node
+ * also records the largest last of any interval in its subtree.  A
+ * search skips any subtree whose largest last is below lo, or whose
+ * smallest start is above hi, so that it doesn't have to look at every
+ * interval as a linear scan would: finding the first overlap is
+ * O(log n) and finding each further one is at most O(log n), and much
+ * less when they are close together in start order.
+ *
+ * struct route {
+ *	uint32_t gateway;
+ *	struct itree_node range;
+ * };
+ *
+ * for (n = itree_first_overlap(&t, addr, addr); n != NULL;
+ *      n = itree_next_overlap(n, addr, addr))
+ *	use(ITREE_ENTRY(n, struct route, range)->gateway);
+ *
+ * Note: as with rbtree, the tree never allocates and a node must stay
+ * at the same address, with the same interval, until it is removed.
+ */
+
+#include <stddef.h>		/* size_t, offsetof */
+#include <stdint.h>		/* int64_t */
+#include <c-hacks/rbtree.h>
+
+struct itree_node {
+	int64_t start;		/* the interval is [start, last] */
+	int64_t last;
+	/* The remaining fields are private: don't modify them. */
+	int64_t max_last;	/* largest last in the subtree */
+	struct rbtree_node rb;
+};
+
+struct itree {
+	/* The fields are private: don't modify them. */
+	struct rbtree rb;
+};
+
+/* Returns the structure of type TYPE whose member FIELD is at PTR. */
+#define ITREE_ENTRY(PTR, TYPE, FIELD)				\
+	((TYPE *)((char *)(PTR) - offsetof(TYPE, FIELD)))
+
+/*
+ * Initializes an empty tree.
+ *
+ * @param t - tree to initialize
+ */
+void itree_init(struct itree *t);
+
+/*
+ * Inserts a node.  An interval equal to one already in the tree is
+ * placed after it.
+ *
+ * @param t - tree instance
+ * @param n - node to insert, with start <= last
+ */
+void itree_insert(struct itree *t, struct itree_node *n);
+
+/*
+ * Removes a node from the tree.
+ *
+ * @param t - tree instance
+ * @param n - node to remove, which must be in t
+ */
+void itree_remove(struct itree *t, struct itree_node *n);
+
+/*
+ * Builds an empty tree from an array of nodes.
+ *
+ * The array is sorted in place by start, and then last, unless it is
+ * already in that order, and the tree is built from it bottom up with
+ * rbtree_build(): O(n) for sorted input and O(n log n) otherwise,
+ * against O(n log n) rotations and comparisons for n inserts.
+ *
+ * @param t - tree instance, which must be empty
+ * @param nodes - nodes to insert, each with start <= last
+ * @param n - number of nodes
+ */
+void itree_build(struct itree *t, struct itree_node **nodes, size_t n);
+
+/*
+ * Returns the interval with the smallest start that overlaps [lo, hi],
+ * that is, with start <= hi and last >= lo, or NULL if there is none.
+ *
+ * @param t - tree instance
+ * @param lo - start of the query range
+ * @param hi - end of the query range, inclusive
+ */
+struct itree_node *itree_first_overlap(const struct itree *t, int64_t lo,
+				       int64_t hi);
+
+/*
+ * Returns the interval after n, in start order, that overlaps [lo, hi],
+ * or NULL if there are no more.
+ *
+ * @param n - interval returned by the previous call for [lo, hi]
+ * @param lo - start of the query range
+ * @param hi - end of the query range, inclusive
+ */
+struct itree_node *itree_next_overlap(const struct itree_node *n,
+				      int64_t lo, int64_t hi);
+
+/*
+ * Returns the number of intervals in the tree.
+ *
+ * @param t - tree instance
+ */
+unsigned long itree_count(const struct itree *t);
+
+#endif				/* ITREE_H */
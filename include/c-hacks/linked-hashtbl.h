@@ -42,6 +42,8 @@
  * 6. To delete a hash table instance use l_hashtbl_delete().
  * 7. To iterate over all entries use l_hashtbl_iter_init(),
  * l_hashtbl_iter_next().
+ * 8. To record how long inserts, lookups and removes take use
+ *    l_hashtbl_latency_enable(), and read them with l_hashtbl_latency().
  *
  * Note: neither the keys or the values are copied so their lifetime
  * must match that of the hash table.  NULL keys are not permitted.
@@ -53,6 +55,7 @@
 /* Opaque types. */
 struct l_hashtbl;
 struct l_hashtbl_list_head;
+struct histogram;
 
 /* Hash function. */
 typedef unsigned int (*LINKED_HASHTBL_HASH_FN) (const void *k);
@@ -76,6 +79,13 @@ typedef void (*LINKED_HASHTBL_FREE_FN) (void *ptr);
 typedef int (*LINKED_HASHTBL_EVICTOR_FN) (const struct l_hashtbl * h,
 					  unsigned long count);
 
+/* Operations whose latency can be recorded. */
+enum l_hashtbl_latency_op {
+	LINKED_HASHTBL_LATENCY_INSERT,
+	LINKED_HASHTBL_LATENCY_LOOKUP,
+	LINKED_HASHTBL_LATENCY_REMOVE
+};
+
 struct l_hashtbl_iter {
 	void *key;
 	void *val;
@@ -222,4 +232,41 @@ void l_hashtbl_iter_init(struct l_hashtbl *h, struct l_hashtbl_iter *iter,
  */
 int l_hashtbl_iter_next(struct l_hashtbl_iter *iter);
 
+/*
+ * Start recording the latency of inserts, lookups and removes.
+ *
+ * One operation in every 2^sample_shift is timed, so 0 times them
+ * all.  Each kind of operation gets its own histogram, allocated with
+ * the table's malloc_func.  An insert's time includes any eviction
+ * and resize it triggers.  Calling this again empties the histograms.
+ *
+ * @param h	       - hash table instance
+ * @param sample_shift - log2 of the sampling interval
+ *
+ * Returns 0 on success, or 1 if no memory could be allocated.
+ */
+int l_hashtbl_latency_enable(struct l_hashtbl *h, unsigned int sample_shift);
+
+/*
+ * Stop recording latencies and free the histograms.
+ *
+ * @param h - hash table instance
+ */
+void l_hashtbl_latency_disable(struct l_hashtbl *h);
+
+/*
+ * Adds the latencies recorded for one kind of operation, in
+ * nanoseconds, to a histogram (see histogram.h).  Several tables, or
+ * threads, can be merged into the same histogram.
+ *
+ * @param h    - hash table instance
+ * @param op   - operation
+ * @param hist - histogram to add to
+ *
+ * Returns 0 on success, or 1 if latencies aren't being recorded or op
+ * is not an l_hashtbl_latency_op.
+ */
+int l_hashtbl_latency(const struct l_hashtbl *h,
+		      enum l_hashtbl_latency_op op, struct histogram *hist);
+
 #endif				/* LINKED_HASHTBL_H */
@@ -0,0 +1,263 @@
+#ifndef RBTREE_H
+#define RBTREE_H
+
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * An intrusive red-black tree: an ordered collection of nodes that are
+ * embedded in the caller's own structures.
+ *
+ * SYNOPSIS
+ *
+ * 1. Embed a struct rbtree_node in each structure to be kept in order
+ *    and write a function that compares two of them.
+ * 2. A tree is initialized with rbtree_init().
+ * 3. To insert a node use rbtree_insert(), or rbtree_insert_multi() to
+ *    allow equal nodes.
+ * 4. To remove a node use rbtree_remove().
+ * 5. To find a node use rbtree_lookup(), rbtree_lower_bound() or
+ *    rbtree_upper_bound() with a probe node holding the search key.
+ * 6. To get the smallest or largest node, in O(1), use rbtree_first()
+ *    or rbtree_last().
+ * 7. To iterate in order use rbtree_next() and rbtree_prev().
+ * 8. To get back the enclosing structure use RBTREE_ENTRY().
+ * 9. To build a tree from nodes that are already in order, in O(n),
+ *    use rbtree_build().
+ * 10. To cache a value per node that summarizes its subtree, such as a
+ *     count or a maximum, initialize the tree with
+ *     rbtree_init_augmented().
+ *
+ * The tree never allocates: it only links and unlinks the nodes it is
+ * given, so inserts and removes cannot fail and cost no more than
+ * O(log n) pointer updates.  This suits structures such as timer
+ * queues or order books, where a node lives inside an object that
+ * already exists and allocating a separate map entry for it is
+ * unwanted.
+ *
+ * struct timer {
+ *	unsigned long expires;
+ *	struct rbtree_node node;
+ * };
+ *
+ * static int timer_compare(const struct rbtree_node *a,
+ *			    const struct rbtree_node *b)
+ * {
+ *	unsigned long x = RBTREE_ENTRY(a, struct timer, node)->expires;
+ *	unsigned long y = RBTREE_ENTRY(b, struct timer, node)->expires;
+ *
+ *	return (x > y) - (x < y);
+ * }
+ *
+ * Note: a node must stay at the same address, and must not be inserted
+ * into a second tree, until it has been removed.
+ */
+
+#include <stddef.h>		/* offsetof */
+#include <stdint.h>		/* uintptr_t */
+
+struct rbtree_node {
+	/* The fields are private: don't modify them. */
+	uintptr_t parent_color;	/* parent, with the colour in bit 0 */
+	struct rbtree_node *left;
+	struct rbtree_node *right;
+};
+
+/* Node comparison function: returns <0, 0 or >0 like strcmp(). */
+typedef int (*RBTREE_COMPARE_FN) (const struct rbtree_node *a,
+				  const struct rbtree_node *b);
+
+/*
+ * Augment function: recomputes the value cached in n's enclosing
+ * structure from n itself and the values cached in its children.
+ */
+typedef void (*RBTREE_AUGMENT_FN) (struct rbtree_node *n);
+
+/* Returns the next node for rbtree_build(). */
+typedef struct rbtree_node *(*RBTREE_NEXT_FN) (void *client_data);
+
+struct rbtree {
+	/* The fields are private: don't modify them. */
+	struct rbtree_node *root;
+	struct rbtree_node *first;
+	struct rbtree_node *last;
+	unsigned long nentries;
+	RBTREE_COMPARE_FN compare_fn;
+	RBTREE_AUGMENT_FN augment_fn;
+};
+
+/* Returns the structure of type TYPE whose member FIELD is at PTR. */
+#define RBTREE_ENTRY(PTR, TYPE, FIELD)				\
+	((TYPE *)((char *)(PTR) - offsetof(TYPE, FIELD)))
+
+/*
+ * Initializes an empty tree.
+ *
+ * @param t - tree to initialize
+ * @param compare_func - function that orders nodes
+ */
+void rbtree_init(struct rbtree *t, RBTREE_COMPARE_FN compare_func);
+
+/*
+ * Initializes an empty augmented tree.
+ *
+ * The augment function is called for every node whose subtree changes:
+ * for a node being linked, for each of its ancestors and for the nodes
+ * a rotation moves, always after any children it has were updated.
+ * It reads the cached values of the children, found with the left and
+ * right fields of the node, and must not change the tree.  An insert
+ * or remove makes O(log n) calls.
+ *
+ * @param t - tree to initialize
+ * @param compare_func - function that orders nodes
+ * @param augment_func - function that recomputes a node's cached value
+ */
+void rbtree_init_augmented(struct rbtree *t, RBTREE_COMPARE_FN compare_func,
+			   RBTREE_AUGMENT_FN augment_func);
+
+/*
+ * Builds an empty tree from n nodes in O(n), without comparing them.
+ *
+ * The nodes are fetched in order with next_func, which must return
+ * them in ascending order; equal nodes keep that order as if they were
+ * added with rbtree_insert_multi().  The result is balanced as well as
+ * possible, with every node on the deepest level red if that level
+ * isn't full.
+ *
+ * @param t - tree instance, which must be empty
+ * @param next_func - function that returns the next node
+ * @param client_data - arbitrary user data passed to next_func
+ * @param n - number of nodes
+ */
+void rbtree_build(struct rbtree *t, RBTREE_NEXT_FN next_func,
+		  void *client_data, unsigned long n);
+
+/*
+ * Inserts a node unless the tree already holds an equal one.
+ *
+ * @param t - tree instance
+ * @param n - node to insert
+ *
+ * Returns NULL if n was inserted, otherwise the existing equal node;
+ * n is then left untouched.
+ */
+struct rbtree_node *rbtree_insert(struct rbtree *t, struct rbtree_node *n);
+
+/*
+ * Inserts a node, placing it after any equal nodes so that equal nodes
+ * are visited in the order they were inserted.
+ *
+ * @param t - tree instance
+ * @param n - node to insert
+ */
+void rbtree_insert_multi(struct rbtree *t, struct rbtree_node *n);
+
+/*
+ * Removes a node from the tree.
+ *
+ * @param t - tree instance
+ * @param n - node to remove, which must be in t
+ */
+void rbtree_remove(struct rbtree *t, struct rbtree_node *n);
+
+/*
+ * Lookup a node equal to a probe.
+ *
+ * @param t - tree instance
+ * @param probe - node, not necessarily in the tree, holding the key
+ *
+ * Returns the first node equal to probe, or NULL if there is none.
+ */
+struct rbtree_node *rbtree_lookup(const struct rbtree *t,
+				  const struct rbtree_node *probe);
+
+/*
+ * Returns the first node not less than probe, or NULL if there is none.
+ *
+ * @param t - tree instance
+ * @param probe - node, not necessarily in the tree, holding the key
+ */
+struct rbtree_node *rbtree_lower_bound(const struct rbtree *t,
+				       const struct rbtree_node *probe);
+
+/*
+ * Returns the first node greater than probe, or NULL if there is none.
+ *
+ * @param t - tree instance
+ * @param probe - node, not necessarily in the tree, holding the key
+ */
+struct rbtree_node *rbtree_upper_bound(const struct rbtree *t,
+				       const struct rbtree_node *probe);
+
+/*
+ * Returns the smallest node, or NULL if the tree is empty.
+ *
+ * @param t - tree instance
+ */
+struct rbtree_node *rbtree_first(const struct rbtree *t);
+
+/*
+ * Returns the largest node, or NULL if the tree is empty.
+ *
+ * @param t - tree instance
+ */
+struct rbtree_node *rbtree_last(const struct rbtree *t);
+
+/*
+ * Returns the node after n in order, or NULL if n is the last.
+ *
+ * A loop over the whole tree visits each edge twice so the cost is
+ * O(1) per node on average.  Removing the current node is allowed if
+ * its successor was fetched first.
+ *
+ * @param n - node in a tree
+ */
+struct rbtree_node *rbtree_next(const struct rbtree_node *n);
+
+/*
+ * Returns the node before n in order, or NULL if n is the first.
+ *
+ * @param n - node in a tree
+ */
+struct rbtree_node *rbtree_prev(const struct rbtree_node *n);
+
+/*
+ * Returns the parent of n, or NULL if n is the root.  Together with the
+ * left and right fields this lets an augmented tree be searched.
+ *
+ * @param n - node in a tree
+ */
+struct rbtree_node *rbtree_parent(const struct rbtree_node *n);
+
+/*
+ * Returns the number of nodes in the tree.
+ *
+ * @param t - tree instance
+ */
+unsigned long rbtree_count(const struct rbtree *t);
+
+#endif				/* RBTREE_H */
@@ -0,0 +1,174 @@
+#ifndef SKIPLIST_H
+#define SKIPLIST_H
+
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * A lock-free concurrent skip list.
+ *
+ * SYNOPSIS
+ *
+ * 1. Create an epoch domain with epoch_create() and a list with
+ *    skiplist_create().
+ * 2. Each thread using the list registers with epoch_register() and
+ *    passes the handle to every call.
+ * 3. To insert an entry use skiplist_insert().
+ * 4. To lookup a key use skiplist_lookup().
+ * 5. To remove a key use skiplist_remove().
+ * 6. To visit a range of keys in order use skiplist_range().
+ * 7. To delete a list instance use skiplist_delete().
+ *
+ * Writers never block each other: an insert links a node in with a
+ * compare-and-swap per level, and a remove claims the entry by
+ * swapping out its value and then marks the node's links so that any
+ * thread passing by helps to unlink it.  Lookups and range scans never
+ * write to shared memory or retry, so they finish in a bounded number
+ * of steps whatever the writers do.  Nodes and values that may still
+ * be seen by another thread are freed through the epoch domain.
+ *
+ * Towers are drawn with a branching factor of 4, so three quarters of
+ * the nodes have one level and almost every node, with its key, value
+ * and links, fits in a 64 byte cache line.
+ *
+ * Keys are intptr_t values, as in cbtree, so that no thread ever
+ * dereferences a key that another could free.
+ */
+
+#include <stddef.h>		/* size_t */
+#include <stdint.h>		/* intptr_t */
+#include <c-hacks/epoch.h>
+
+/* Opaque types. */
+struct skiplist;
+
+/* Range function: return 0 to stop the scan. */
+typedef int (*SKIPLIST_APPLY_FN) (intptr_t key, void *val,
+				  void *client_data);
+
+/* Function for deleting values. */
+typedef void (*SKIPLIST_VAL_FREE_FN) (void *v);
+
+/* Functions for allocating and freeing memory. */
+typedef void *(*SKIPLIST_MALLOC_FN) (size_t n);
+typedef void (*SKIPLIST_FREE_FN) (void *ptr);
+
+/*
+ * Creates a new list.
+ *
+ * @param e		   - epoch domain used to free nodes and values
+ * @param val_free_func	   - function to delete values
+ * @param malloc_func	   - function to allocate memory (e.g., malloc)
+ * @param free_func	   - function to free memory (e.g., free)
+ *
+ * Returns non-null if the list was created successfully.
+ */
+struct skiplist *skiplist_create(struct epoch *e,
+				 SKIPLIST_VAL_FREE_FN val_free_func,
+				 SKIPLIST_MALLOC_FN malloc_func,
+				 SKIPLIST_FREE_FN free_func);
+
+/*
+ * Deletes the list instance and all its entries.  No other thread may
+ * be using the list.
+ *
+ * @param sl - list
+ */
+void skiplist_delete(struct skiplist *sl);
+
+/*
+ * Inserts a new key with associated value.
+ *
+ * If the key already exists its value is replaced and the old value is
+ * retired.
+ *
+ * @param sl - list instance
+ * @param self - epoch handle of the calling thread
+ * @param k - key to insert
+ * @param v - value associated with key
+ *
+ * Returns 0 on success, or 1 if a new entry cannot be created.
+ */
+int skiplist_insert(struct skiplist *sl, struct epoch_thread *self,
+		    intptr_t k, void *v);
+
+/*
+ * Removes a key and retires its value.
+ *
+ * @param sl - list instance
+ * @param self - epoch handle of the calling thread
+ * @param k - key to remove
+ *
+ * Returns 0 if key was found, otherwise 1.
+ */
+int skiplist_remove(struct skiplist *sl, struct epoch_thread *self,
+		    intptr_t k);
+
+/*
+ * Lookup an existing key.
+ *
+ * A concurrent remove may retire the value as soon as this returns;
+ * callers that dereference it should hold their own critical section
+ * with epoch_enter() and epoch_leave() around the lookup and its use.
+ *
+ * @param sl - list instance
+ * @param self - epoch handle of the calling thread
+ * @param k - the search key
+ *
+ * Returns the value associated with key, or NULL if key is not present.
+ */
+void *skiplist_lookup(struct skiplist *sl, struct epoch_thread *self,
+		      intptr_t k);
+
+/*
+ * Visits the keys in [lo, hi) in ascending order.
+ *
+ * The scan is not a snapshot: an entry inserted or removed
+ * concurrently may or may not be seen, but no key is visited twice.
+ * The function should return 0 to stop the scan.
+ *
+ * @param sl - list instance
+ * @param self - epoch handle of the calling thread
+ * @param lo - smallest key to visit
+ * @param hi - key to stop at
+ * @param fn - function to apply to each entry
+ * @param client_data - arbitrary user data
+ *
+ * Returns the number of entries the function was applied to.
+ */
+unsigned long skiplist_range(struct skiplist *sl, struct epoch_thread *self,
+			     intptr_t lo, intptr_t hi, SKIPLIST_APPLY_FN fn,
+			     void *client_data);
+
+/*
+ * Returns the number of entries in the list.
+ *
+ * @param sl - list instance
+ */
+unsigned long skiplist_count(const struct skiplist *sl);
+
+#endif				/* SKIPLIST_H */
@@ -0,0 +1,187 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * A work-stealing thread pool for fork/join parallelism.
+ *
+ * SYNOPSIS
+ *
+ * 1. A pool is created with threadpool_create(), or the process-wide
+ *    pool shared by the library is fetched with threadpool_default().
+ * 2. To run a function over a range of indices in parallel use
+ *    threadpool_parallel_for().
+ * 3. To run a function as a participant in the pool, so that the
+ *    tasks it forks are cheap, use threadpool_run().
+ * 4. To start a task that may run in parallel with the caller use
+ *    threadpool_fork(); to wait for it use threadpool_join().  Every
+ *    task forked must be joined, most recent first.
+ * 5. Delete the pool with threadpool_delete().
+ *
+ * Each worker owns a Chase-Lev deque of tasks.  It pushes and pops
+ * the tasks it forks at the bottom, with no atomic read-modify-write
+ * unless a thief races for the last one, while idle workers steal the
+ * oldest, and so typically the largest, task from the top of a random
+ * victim's deque.  A thread waiting in threadpool_join() runs other
+ * tasks rather than blocking, and workers with nothing to steal sleep
+ * until something is forked.
+ *
+ * One thread outside the pool at a time gets a deque of its own for
+ * the duration of threadpool_run(), and with it threadpool_parallel_for();
+ * tasks forked by any other thread outside the pool go through a
+ * locked queue.
+ *
+ * static void half(void *arg)
+ * {
+ *	struct job *j = arg;
+ *	...
+ * }
+ *
+ * threadpool_fork(p, &t, half, &right);
+ * half(&left);
+ * threadpool_join(p, &t);
+ *
+ * Note: a task's storage, and its argument, must stay valid until it
+ * has been joined, so both can live on the forking thread's stack.
+ */
+
+#include <stddef.h>		/* size_t */
+#include <stdatomic.h>
+
+/* Opaque types. */
+struct threadpool;
+
+/* Function run by a task. */
+typedef void (*THREADPOOL_TASK_FN) (void *arg);
+
+/* Function run over the subrange [begin, end) by a parallel for. */
+typedef void (*THREADPOOL_RANGE_FN) (size_t begin, size_t end, void *arg);
+
+/* Functions for allocating and freeing memory. */
+typedef void *(*THREADPOOL_MALLOC_FN) (size_t n);
+typedef void (*THREADPOOL_FREE_FN) (void *ptr);
+
+struct threadpool_task {
+	/* The fields are private: don't modify them. */
+	THREADPOOL_TASK_FN fn;
+	void *arg;
+	atomic_int done;
+	struct threadpool_task *next;
+};
+
+/*
+ * Creates a new pool.
+ *
+ * @param nthreads    - number of worker threads, or -1 for one fewer
+ *                      than the number of CPUs online
+ * @param malloc_func - function to allocate memory (e.g., malloc)
+ * @param free_func   - function to free memory (e.g., free)
+ *
+ * A pool with no workers is valid: its tasks run on the threads that
+ * join them.
+ *
+ * Returns non-null if the pool was created successfully.
+ */
+struct threadpool *threadpool_create(int nthreads,
+				     THREADPOOL_MALLOC_FN malloc_func,
+				     THREADPOOL_FREE_FN free_func);
+
+/*
+ * Stops the workers and deletes the pool.  Every task forked must
+ * have been joined.
+ *
+ * @param p - pool instance
+ */
+void threadpool_delete(struct threadpool *p);
+
+/*
+ * Returns the pool shared by the library, creating it, with one
+ * worker fewer than the number of CPUs online, on first use.  It is
+ * never deleted.
+ *
+ * Returns NULL if the pool could not be created.
+ */
+struct threadpool *threadpool_default(void);
+
+/*
+ * Returns the number of worker threads.
+ *
+ * @param p - pool instance
+ */
+int threadpool_nthreads(const struct threadpool *p);
+
+/*
+ * Calls fn(arg) on the calling thread, as a participant in the pool,
+ * and returns when it does.  If another thread outside the pool is
+ * already participating, fn is run as a task instead.
+ *
+ * @param p - pool instance, or NULL for threadpool_default()
+ * @param fn - function to run
+ * @param arg - argument to pass to fn
+ */
+void threadpool_run(struct threadpool *p, THREADPOOL_TASK_FN fn, void *arg);
+
+/*
+ * Starts a task that calls fn(arg), possibly on another thread.
+ *
+ * @param p - pool instance
+ * @param t - storage for the task
+ * @param fn - function to run
+ * @param arg - argument to pass to fn
+ */
+void threadpool_fork(struct threadpool *p, struct threadpool_task *t,
+		     THREADPOOL_TASK_FN fn, void *arg);
+
+/*
+ * Waits for a task to finish, running it, or other tasks, on the
+ * calling thread in the meantime.
+ *
+ * @param p - pool instance
+ * @param t - task passed to threadpool_fork()
+ */
+void threadpool_join(struct threadpool *p, struct threadpool_task *t);
+
+/*
+ * Calls fn over [begin, end) in parallel, split into subranges of at
+ * most grain indices, and returns when all of them are done.
+ *
+ * The range is halved recursively, forking one half each time, so a
+ * thief takes half of what is left rather than a single subrange.
+ *
+ * @param p - pool instance, or NULL for threadpool_default()
+ * @param begin - first index
+ * @param end - one past the last index
+ * @param grain - largest subrange passed to fn (0 is treated as 1)
+ * @param fn - function to run over each subrange
+ * @param arg - argument to pass to fn
+ */
+void threadpool_parallel_for(struct threadpool *p, size_t begin, size_t end,
+			     size_t grain, THREADPOOL_RANGE_FN fn, void *arg);
+
+#endif				/* THREADPOOL_H */
@@ -0,0 +1,157 @@
+#ifndef USDT_H
+#define USDT_H
+
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Optional USDT (user-level statically defined tracing) probes.
+ *
+ * SYNOPSIS
+ *
+ * 1. Mark a point of interest with USDT_PROBE0(provider, name), or
+ *    USDT_PROBE1() to USDT_PROBE4() to pass up to four arguments.
+ * 2. Build with CHACKS_USDT defined (cmake -DBUILD_USDT=ON) to
+ *    compile the probes in; otherwise they compile to nothing.
+ * 3. Attach to a running process with any tool that reads SystemTap
+ *    SDT notes, e.g.:
+ *
+ *    bpftrace -p PID -e 'usdt:*:hashtbl:resize_end { @[arg1] = count(); }'
+ *
+ * A probe compiles to a single nop, and to an ELF note that records
+ * its address and how to find its arguments.  A tracer attaching to
+ * the probe replaces the nop with a breakpoint; until then the only
+ * cost is the nop and having the arguments in registers or memory.
+ *
+ * With <sys/sdt.h> available the probes are defined by it.  Without
+ * it they are defined here, emitting the same notes, on x86-64 ELF
+ * targets; elsewhere they compile to nothing.  Arguments are passed
+ * as long, so a pointer or an integer up to that size will do.
+ *
+ * The containers in this library define these probes:
+ *
+ *   hashtbl:resize_start		(table, old capacity, new capacity)
+ *   hashtbl:resize_end		(table, new capacity, entries)
+ *   hashtbl:chain		(table, hash, entries walked)
+ *   hashtbl:alloc_fail		(table, bytes)
+ *
+ * and the same for the l_hashtbl provider, which also has
+ *
+ *   l_hashtbl:evict		(table, key, entries)
+ *
+ * while only hashtbl has
+ *
+ *   hashtbl:select_hash	(table, keys sampled, old fn, new fn)
+ */
+
+#if defined(CHACKS_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define USDT_HAVE_SDT_H 1
+#endif
+#endif
+
+#if defined(CHACKS_USDT) && defined(USDT_HAVE_SDT_H)
+
+#define USDT_PROBE0(P, N)		STAP_PROBE(P, N)
+#define USDT_PROBE1(P, N, A1)		STAP_PROBE1(P, N, (long)(A1))
+#define USDT_PROBE2(P, N, A1, A2)					\
+	STAP_PROBE2(P, N, (long)(A1), (long)(A2))
+#define USDT_PROBE3(P, N, A1, A2, A3)					\
+	STAP_PROBE3(P, N, (long)(A1), (long)(A2), (long)(A3))
+#define USDT_PROBE4(P, N, A1, A2, A3, A4)				\
+	STAP_PROBE4(P, N, (long)(A1), (long)(A2), (long)(A3), (long)(A4))
+
+#elif defined(CHACKS_USDT) && defined(__x86_64__) && defined(__ELF__)
+
+/*
+ * The note layout, and the shared _.stapsdt.base symbol that lets a
+ * tracer correct for prelinking, follow <sys/sdt.h>.  No semaphore is
+ * defined: the probes are cheap enough to be always on.
+ */
+#define USDT_ASM_(P, N, ARGS)						\
+	"990:	nop\n"							\
+	"	.pushsection .note.stapsdt,\"?\",\"note\"\n"		\
+	"	.balign 4\n"						\
+	"	.4byte 992f-991f, 994f-993f, 3\n"			\
+	"991:	.asciz \"stapsdt\"\n"					\
+	"992:	.balign 4\n"						\
+	"993:	.8byte 990b\n"						\
+	"	.8byte _.stapsdt.base\n"				\
+	"	.8byte 0\n"						\
+	"	.asciz \"" #P "\"\n"					\
+	"	.asciz \"" #N "\"\n"					\
+	"	.asciz \"" ARGS "\"\n"					\
+	"994:	.balign 4\n"						\
+	"	.popsection\n"						\
+	"	.ifndef _.stapsdt.base\n"				\
+	"	.pushsection .stapsdt.base,\"aG\",\"progbits\","	\
+	".stapsdt.base,comdat\n"					\
+	"	.weak _.stapsdt.base\n"					\
+	"	.hidden _.stapsdt.base\n"				\
+	"_.stapsdt.base: .space 1\n"					\
+	"	.size _.stapsdt.base, 1\n"				\
+	"	.popsection\n"						\
+	"	.endif\n"
+
+#define USDT_ARG_(X)	"nor" ((long)(X))
+
+#define USDT_PROBE0(P, N)						\
+	__asm__ __volatile__(USDT_ASM_(P, N, "") : :)
+#define USDT_PROBE1(P, N, A1)						\
+	__asm__ __volatile__(USDT_ASM_(P, N, "-8@%[a1]")		\
+			     : : [a1] USDT_ARG_(A1))
+#define USDT_PROBE2(P, N, A1, A2)					\
+	__asm__ __volatile__(USDT_ASM_(P, N, "-8@%[a1] -8@%[a2]")	\
+			     : : [a1] USDT_ARG_(A1), [a2] USDT_ARG_(A2))
+#define USDT_PROBE3(P, N, A1, A2, A3)					\
+	__asm__ __volatile__(USDT_ASM_(P, N,				\
+				       "-8@%[a1] -8@%[a2] -8@%[a3]")	\
+			     : : [a1] USDT_ARG_(A1), [a2] USDT_ARG_(A2), \
+			       [a3] USDT_ARG_(A3))
+#define USDT_PROBE4(P, N, A1, A2, A3, A4)				\
+	__asm__ __volatile__(USDT_ASM_(P, N,				\
+				       "-8@%[a1] -8@%[a2] -8@%[a3] "	\
+				       "-8@%[a4]")			\
+			     : : [a1] USDT_ARG_(A1), [a2] USDT_ARG_(A2), \
+			       [a3] USDT_ARG_(A3), [a4] USDT_ARG_(A4))
+
+#else
+
+/* Probes are compiled out; the arguments are still type checked. */
+#define USDT_PROBE0(P, N)		do { } while (0)
+#define USDT_PROBE1(P, N, A1)		do { (void)(A1); } while (0)
+#define USDT_PROBE2(P, N, A1, A2)					\
+	do { (void)(A1); (void)(A2); } while (0)
+#define USDT_PROBE3(P, N, A1, A2, A3)					\
+	do { (void)(A1); (void)(A2); (void)(A3); } while (0)
+#define USDT_PROBE4(P, N, A1, A2, A3, A4)				\
+	do { (void)(A1); (void)(A2); (void)(A3); (void)(A4); } while (0)
+
+#endif
+
+#endif				/* USDT_H */
@@ -0,0 +1,500 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Arena and pool allocators.
+ *
+ * An arena is a list of chunks, newest first, each bumped from the
+ * front.  A chunk records how many bytes were handed out from all the
+ * chunks before it, so a mark is just the newest chunk and its offset.
+ *
+ * The pool's slabs are aligned on their size, so masking off the low
+ * bits of any block finds the slab header and with it the block's
+ * size class.  An allocation too big for the largest class is a slab
+ * to itself, with a header saying so.  Slabs in the size classes are
+ * never freed; their blocks move between the per-thread caches and
+ * the per-class shared lists.
+ */
+
+#define _GNU_SOURCE
+
+#include <stddef.h>		/* size_t, NULL, max_align_t */
+#include <stdlib.h>		/* malloc, free, posix_memalign */
+#include <stdint.h>		/* uintptr_t, SIZE_MAX */
+#include <pthread.h>
+#include <c-hacks/arena.h>
+
+#if defined(_MSC_VER)
+#define INLINE __inline
+#else
+#define INLINE inline
+#endif
+
+/* Default size of an arena's first chunk. */
+#ifndef ARENA_CHUNK_SIZE
+#define ARENA_CHUNK_SIZE 4096
+#endif
+
+/* Chunks stop doubling in size once they reach this. */
+#ifndef ARENA_MAX_CHUNK_SIZE
+#define ARENA_MAX_CHUNK_SIZE (1 << 20)
+#endif
+
+/* Size and alignment of a slab; must be a power of two. */
+#ifndef POOL_SLAB_SIZE
+#define POOL_SLAB_SIZE (64 * 1024)
+#endif
+
+/* Blocks moved between a thread cache and a shared list at a time. */
+#ifndef POOL_BATCH
+#define POOL_BATCH 32
+#endif
+
+/* A thread cache that grows past this gives half of it back. */
+#ifndef POOL_CACHE_MAX
+#define POOL_CACHE_MAX 64
+#endif
+
+#define ALIGN		_Alignof(max_align_t)
+#define ROUND_UP(N, A)	(((N) + (A) - 1) & ~((size_t)(A) - 1))
+
+struct chunk {
+	struct chunk *prev;
+	size_t size;		/* bytes of data */
+	size_t used;
+	size_t base;		/* bytes used in the older chunks */
+};
+
+#define CHUNK_HDR	ROUND_UP(sizeof(struct chunk), ALIGN)
+#define CHUNK_DATA(C)	((char *)(C) + CHUNK_HDR)
+
+struct arena {
+	struct chunk *head;	/* newest chunk */
+	struct chunk *spare;	/* largest chunk released */
+	size_t chunk_size;
+	ARENA_MALLOC_FN malloc_fn;
+	ARENA_FREE_FN free_fn;
+};
+
+static _Thread_local struct arena *selected;
+
+struct arena *arena_create(size_t chunk_size, ARENA_MALLOC_FN malloc_fn,
+			   ARENA_FREE_FN free_fn)
+{
+	struct arena *a;
+
+	malloc_fn = (malloc_fn != NULL) ? malloc_fn : malloc;
+	free_fn = (free_fn != NULL) ? free_fn : free;
+
+	if (chunk_size == 0)
+		chunk_size = ARENA_CHUNK_SIZE;
+
+	if (chunk_size > SIZE_MAX / 2)
+		return NULL;
+
+	if ((a = malloc_fn(sizeof(*a))) == NULL)
+		return NULL;
+
+	a->head = NULL;
+	a->spare = NULL;
+	a->chunk_size = ROUND_UP(chunk_size, ALIGN);
+	a->malloc_fn = malloc_fn;
+	a->free_fn = free_fn;
+
+	return a;
+}
+
+/* Keeps c as the spare if it is the largest seen, else frees it. */
+
+static void release(struct arena *a, struct chunk *c)
+{
+	if (a->spare != NULL && a->spare->size >= c->size) {
+		a->free_fn(c);
+		return;
+	}
+
+	if (a->spare != NULL)
+		a->free_fn(a->spare);
+	a->spare = c;
+}
+
+/* Starts a new chunk with room for at least n bytes. */
+
+static struct chunk *new_chunk(struct arena *a, size_t n)
+{
+	struct chunk *c, *prev = a->head;
+	size_t size = a->chunk_size;
+
+	if (prev != NULL && prev->size < ARENA_MAX_CHUNK_SIZE)
+		size = prev->size * 2;
+	else if (prev != NULL)
+		size = ARENA_MAX_CHUNK_SIZE;
+
+	if (size < a->chunk_size)
+		size = a->chunk_size;
+	if (size < n)
+		size = n;
+
+	if (a->spare != NULL && a->spare->size >= size) {
+		c = a->spare;
+		a->spare = NULL;
+	} else {
+		if (size > SIZE_MAX - CHUNK_HDR)
+			return NULL;
+		if ((c = a->malloc_fn(CHUNK_HDR + size)) == NULL)
+			return NULL;
+		c->size = size;
+	}
+
+	c->prev = prev;
+	c->used = 0;
+	c->base = (prev != NULL) ? prev->base + prev->used : 0;
+	a->head = c;
+
+	return c;
+}
+
+void *arena_alloc(struct arena *a, size_t n)
+{
+	struct chunk *c = a->head;
+	void *p;
+
+	if (n > SIZE_MAX - ALIGN)
+		return NULL;
+
+	n = (n == 0) ? ALIGN : ROUND_UP(n, ALIGN);
+
+	if (c == NULL || c->size - c->used < n) {
+		if ((c = new_chunk(a, n)) == NULL)
+			return NULL;
+	}
+
+	p = CHUNK_DATA(c) + c->used;
+	c->used += n;
+
+	return p;
+}
+
+struct arena_mark arena_mark(const struct arena *a)
+{
+	struct arena_mark m;
+
+	m.chunk = a->head;
+	m.used = (a->head != NULL) ? a->head->used : 0;
+
+	return m;
+}
+
+void arena_rewind(struct arena *a, struct arena_mark m)
+{
+	while (a->head != m.chunk) {
+		struct chunk *c = a->head;
+		a->head = c->prev;
+		release(a, c);
+	}
+
+	if (a->head != NULL)
+		a->head->used = m.used;
+}
+
+void arena_reset(struct arena *a)
+{
+	struct arena_mark m = { NULL, 0 };
+
+	arena_rewind(a, m);
+}
+
+void arena_delete(struct arena *a)
+{
+	arena_reset(a);
+	if (a->spare != NULL)
+		a->free_fn(a->spare);
+	a->free_fn(a);
+}
+
+size_t arena_used(const struct arena *a)
+{
+	return (a->head != NULL) ? a->head->base + a->head->used : 0;
+}
+
+struct arena *arena_select(struct arena *a)
+{
+	struct arena *prev = selected;
+
+	selected = a;
+
+	return prev;
+}
+
+void *arena_malloc(size_t n)
+{
+	return (selected != NULL) ? arena_alloc(selected, n) : NULL;
+}
+
+void arena_free(void *ptr)
+{
+	(void)ptr;
+}
+
+/*
+ * Size classes: multiples of 16 up to 128, then four to each doubling
+ * up to 2048, so that no more than a fifth of a block is wasted.
+ */
+#define NCLASSES	24
+#define MAX_SMALL	2048
+#define LARGE		NCLASSES
+
+static const unsigned short class_size[NCLASSES] = {
+	16, 32, 48, 64, 80, 96, 112, 128,
+	160, 192, 224, 256, 320, 384, 448, 512,
+	640, 768, 896, 1024, 1280, 1536, 1792, 2048,
+};
+
+struct block {
+	struct block *next;
+};
+
+struct slab {
+	unsigned int class;	/* LARGE for a single allocation */
+};
+
+#define SLAB_HDR	ROUND_UP(sizeof(struct slab), ALIGN)
+#define SLAB_OF(P)							\
+	((struct slab *)((uintptr_t)(P) & ~((uintptr_t)POOL_SLAB_SIZE - 1)))
+
+struct size_class {
+	pthread_mutex_t lock;	/* protects the rest */
+	struct block *free;
+	char *bump;		/* uncarved part of the newest slab */
+	size_t left;
+};
+
+struct cache {
+	struct block *head;
+	unsigned int count;
+};
+
+static struct size_class classes[NCLASSES];
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t pool_key;
+static int have_key;
+
+static _Thread_local struct cache caches[NCLASSES];
+static _Thread_local int registered;
+
+static INLINE unsigned int class_of(size_t n)
+{
+	size_t m = n - 1;
+	unsigned int shift;
+
+	if (n <= 128)
+		return (n != 0) ? (unsigned int)(m / 16) : 0;
+
+	/* m >> shift is 4 to 7 for the four classes in m's doubling. */
+	shift = (m >= 1024) ? 8 : (m >= 512) ? 7 : (m >= 256) ? 6 : 5;
+
+	return 8 + (shift - 5) * 4 + (unsigned int)(m >> shift) - 4;
+}
+
+static void thread_exit(void *arg)
+{
+	(void)arg;
+	registered = 0;
+	pool_thread_flush();
+}
+
+static void pool_init(void)
+{
+	int i;
+
+	for (i = 0; i < NCLASSES; i++)
+		pthread_mutex_init(&classes[i].lock, NULL);
+
+	have_key = (pthread_key_create(&pool_key, thread_exit) == 0);
+}
+
+/* Arranges for the calling thread's caches to be flushed on exit. */
+
+static void register_thread(void)
+{
+	pthread_once(&pool_once, pool_init);
+	if (have_key)
+		pthread_setspecific(pool_key, &registered);
+	registered = 1;
+}
+
+/* Moves all but keep of the blocks in cc to the shared list. */
+
+static void flush(unsigned int c, struct cache *cc, unsigned int keep)
+{
+	struct size_class *sc = &classes[c];
+	struct block *first, *last;
+	unsigned int i;
+
+	if (cc->count <= keep)
+		return;
+
+	first = last = cc->head;
+	for (i = keep + 1; i < cc->count; i++)
+		last = last->next;
+
+	cc->head = last->next;
+	cc->count = keep;
+
+	pthread_mutex_lock(&sc->lock);
+	last->next = sc->free;
+	sc->free = first;
+	pthread_mutex_unlock(&sc->lock);
+}
+
+/*
+ * Moves up to a batch of blocks from the shared list, or a slab, to
+ * cc.  Returns 0 on success, or 1 if no memory is available.
+ */
+static int refill(unsigned int c, struct cache *cc)
+{
+	struct size_class *sc = &classes[c];
+	size_t size = class_size[c];
+	unsigned int n = 0;
+
+	if (!registered)
+		register_thread();
+
+	pthread_mutex_lock(&sc->lock);
+
+	while (n < POOL_BATCH) {
+		struct block *b;
+
+		if (sc->free != NULL) {
+			b = sc->free;
+			sc->free = b->next;
+		} else if (sc->left >= size) {
+			b = (struct block *)sc->bump;
+			sc->bump += size;
+			sc->left -= size;
+		} else if (n == 0) {
+			void *s;
+			if (posix_memalign(&s, POOL_SLAB_SIZE,
+					   POOL_SLAB_SIZE) != 0)
+				break;
+			((struct slab *)s)->class = c;
+			sc->bump = (char *)s + SLAB_HDR;
+			sc->left = POOL_SLAB_SIZE - SLAB_HDR;
+			continue;
+		} else {
+			break;
+		}
+
+		b->next = cc->head;
+		cc->head = b;
+		n++;
+	}
+
+	pthread_mutex_unlock(&sc->lock);
+
+	cc->count += n;
+
+	return n == 0;
+}
+
+/*
+ * Unlike aligned_alloc(), posix_memalign() doesn't need the size to
+ * be a multiple of the alignment, which would waste most of a slab.
+ */
+static void *large_alloc(size_t n)
+{
+	void *p;
+	struct slab *s;
+
+	if (n > SIZE_MAX - SLAB_HDR)
+		return NULL;
+
+	if (posix_memalign(&p, POOL_SLAB_SIZE, SLAB_HDR + n) != 0)
+		return NULL;
+
+	s = p;
+	s->class = LARGE;
+
+	return (char *)s + SLAB_HDR;
+}
+
+void *pool_malloc(size_t n)
+{
+	struct cache *cc;
+	struct block *b;
+	unsigned int c;
+
+	if (n > MAX_SMALL)
+		return large_alloc(n);
+
+	c = class_of(n);
+	cc = &caches[c];
+
+	if (cc->head == NULL && refill(c, cc) != 0)
+		return NULL;
+
+	b = cc->head;
+	cc->head = b->next;
+	cc->count--;
+
+	return b;
+}
+
+void pool_free(void *ptr)
+{
+	struct slab *s;
+	struct cache *cc;
+	struct block *b = ptr;
+
+	if (ptr == NULL)
+		return;
+
+	s = SLAB_OF(ptr);
+
+	if (s->class == LARGE) {
+		free(s);
+		return;
+	}
+
+	if (!registered)
+		register_thread();
+
+	cc = &caches[s->class];
+	b->next = cc->head;
+	cc->head = b;
+
+	if (++cc->count > POOL_CACHE_MAX)
+		flush(s->class, cc, POOL_CACHE_MAX / 2);
+}
+
+void pool_thread_flush(void)
+{
+	unsigned int c;
+
+	for (c = 0; c < NCLASSES; c++)
+		flush(c, &caches[c], 0);
+}
@@ -0,0 +1,911 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * An adaptive radix tree, after Leis et al., "The Adaptive Radix
+ * Tree: ARTful Indexing for Main-Memory Databases".
+ *
+ * Child pointers either point to an inner node or, with the low bit
+ * set, to a leaf, which holds a copy of the whole key.  A key that
+ * ends where an inner node branches, i.e., one that is a prefix of
+ * other keys, hangs off that node's end pointer rather than a child.
+ *
+ * Each inner node stores the length of its compressed path but only
+ * the first MAX_PREFIX bytes of it.  Lookups skip any bytes beyond
+ * those (optimistic search) since the final comparison against the
+ * leaf catches a mismatch; inserts and prefix scans, which need the
+ * bytes themselves, read them from any leaf below the node.
+ */
+
+#include <stddef.h>		/* size_t, NULL */
+#include <stdlib.h>		/* malloc, free */
+#include <string.h>		/* memcmp, memcpy, memmove, memset */
+#include <stdint.h>		/* uint8_t, uintptr_t */
+#include <c-hacks/art.h>
+
+#ifndef ART_MAX_PREFIX
+#define ART_MAX_PREFIX 10
+#endif
+
+#define MAX_PREFIX ART_MAX_PREFIX
+
+#if defined(__SSE2__) && !defined(ART_NO_SIMD)
+#include <emmintrin.h>
+#define ART_HAVE_SSE2 1
+#endif
+
+enum node_type { NODE4, NODE16, NODE48, NODE256 };
+
+struct art_leaf {
+	void *val;
+	size_t len;
+	unsigned char key[];
+};
+
+struct art_node {
+	uint8_t type;
+	uint16_t nchildren;
+	uint32_t prefix_len;	/* bytes of compressed path */
+	unsigned char prefix[MAX_PREFIX];
+	struct art_leaf *end;	/* key that ends at this node */
+};
+
+/* Keys are kept sorted so that the children are in key order. */
+
+struct node4 {
+	struct art_node n;
+	unsigned char keys[4];
+	struct art_node *children[4];
+};
+
+struct node16 {
+	struct art_node n;
+	unsigned char keys[16];
+	struct art_node *children[16];
+};
+
+/* index[c] is 1 + the slot of the child for byte c, or 0. */
+
+struct node48 {
+	struct art_node n;
+	unsigned char index[256];
+	struct art_node *children[48];
+};
+
+struct node256 {
+	struct art_node n;
+	struct art_node *children[256];
+};
+
+struct art {
+	struct art_node *root;
+	unsigned long nentries;
+	ART_VAL_FREE_FN val_free_fn;
+	ART_MALLOC_FN malloc_fn;
+	ART_FREE_FN free_fn;
+};
+
+#define IS_LEAF(N)	(((uintptr_t)(N) & 1) != 0)
+#define LEAF(N)		((struct art_leaf *)((uintptr_t)(N) & ~(uintptr_t)1))
+#define TAG(L)		((struct art_node *)((uintptr_t)(L) | 1))
+
+#define N4(N)		((struct node4 *)(N))
+#define N16(N)		((struct node16 *)(N))
+#define N48(N)		((struct node48 *)(N))
+#define N256(N)		((struct node256 *)(N))
+
+static const size_t node_sizes[] = {
+	sizeof(struct node4), sizeof(struct node16),
+	sizeof(struct node48), sizeof(struct node256),
+};
+
+/* Node sizes to shrink at, leaving room to avoid thrashing. */
+
+static const int shrink_at[] = { 0, 3, 12, 37 };
+static const int capacity[] = { 4, 16, 48, 256 };
+
+static INLINE size_t min_size(size_t a, size_t b)
+{
+	return (a < b) ? a : b;
+}
+
+static struct art_node *node_new(struct art *t, enum node_type type)
+{
+	struct art_node *n = t->malloc_fn(node_sizes[type]);
+
+	if (n != NULL) {
+		memset(n, 0, node_sizes[type]);
+		n->type = (uint8_t)type;
+	}
+
+	return n;
+}
+
+static struct art_leaf *leaf_new(struct art *t, const unsigned char *key,
+				 size_t len, void *val)
+{
+	struct art_leaf *l = t->malloc_fn(sizeof(*l) + len);
+
+	if (l != NULL) {
+		l->val = val;
+		l->len = len;
+		memcpy(l->key, key, len);
+	}
+
+	return l;
+}
+
+static INLINE int leaf_matches(const struct art_leaf *l,
+			       const unsigned char *key, size_t len)
+{
+	return l->len == len && memcmp(l->key, key, len) == 0;
+}
+
+/* Returns the index of c among the keys of a Node16, or -1. */
+
+static INLINE int node16_find(const struct node16 *n, unsigned char c)
+{
+#if defined(ART_HAVE_SSE2)
+	__m128i keys = _mm_loadu_si128((const __m128i *)n->keys);
+	int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(keys,
+						    _mm_set1_epi8((char)c)));
+
+	mask &= (1 << n->n.nchildren) - 1;
+
+	return mask ? __builtin_ctz(mask) : -1;
+#else
+	int i;
+
+	for (i = 0; i < n->n.nchildren; i++) {
+		if (n->keys[i] == c)
+			return i;
+	}
+
+	return -1;
+#endif
+}
+
+/* Returns the number of keys of a Node16 that are less than c. */
+
+static INLINE int node16_rank(const struct node16 *n, unsigned char c)
+{
+#if defined(ART_HAVE_SSE2)
+	/* SSE2 only compares signed bytes, so flip the top bits. */
+	const __m128i bias = _mm_set1_epi8((char)0x80);
+	__m128i keys = _mm_xor_si128(_mm_loadu_si128((const __m128i *)
+						     n->keys), bias);
+	__m128i kc = _mm_xor_si128(_mm_set1_epi8((char)c), bias);
+	int mask = _mm_movemask_epi8(_mm_cmplt_epi8(keys, kc));
+
+	return __builtin_popcount(mask & ((1 << n->n.nchildren) - 1));
+#else
+	int i;
+
+	for (i = 0; i < n->n.nchildren && n->keys[i] < c; i++) ;
+
+	return i;
+#endif
+}
+
+/* Returns the slot holding the child for byte c, or NULL. */
+
+static struct art_node **find_child(struct art_node *n, unsigned char c)
+{
+	int i;
+
+	switch (n->type) {
+	case NODE4:
+		for (i = 0; i < n->nchildren; i++) {
+			if (N4(n)->keys[i] == c)
+				return &N4(n)->children[i];
+		}
+		break;
+	case NODE16:
+		if ((i = node16_find(N16(n), c)) >= 0)
+			return &N16(n)->children[i];
+		break;
+	case NODE48:
+		if ((i = N48(n)->index[c]) != 0)
+			return &N48(n)->children[i - 1];
+		break;
+	default:
+		if (N256(n)->children[c] != NULL)
+			return &N256(n)->children[c];
+		break;
+	}
+
+	return NULL;
+}
+
+/* Adds a child for byte c to n, which must have room for it. */
+
+static void add_child(struct art_node *n, unsigned char c,
+		      struct art_node *child)
+{
+	unsigned char *keys;
+	struct art_node **children;
+	int i, pos;
+
+	switch (n->type) {
+	case NODE4:
+	case NODE16:
+		if (n->type == NODE4) {
+			keys = N4(n)->keys;
+			children = N4(n)->children;
+			for (pos = 0; pos < n->nchildren && keys[pos] < c; pos++) ;
+		} else {
+			keys = N16(n)->keys;
+			children = N16(n)->children;
+			pos = node16_rank(N16(n), c);
+		}
+		memmove(&keys[pos + 1], &keys[pos], n->nchildren - pos);
+		memmove(&children[pos + 1], &children[pos],
+			(n->nchildren - pos) * sizeof(*children));
+		keys[pos] = c;
+		children[pos] = child;
+		break;
+	case NODE48:
+		for (i = 0; N48(n)->children[i] != NULL; i++) ;
+		N48(n)->children[i] = child;
+		N48(n)->index[c] = (unsigned char)(i + 1);
+		break;
+	default:
+		N256(n)->children[c] = child;
+		break;
+	}
+
+	n->nchildren++;
+}
+
+static void remove_child(struct art_node *n, unsigned char c)
+{
+	unsigned char *keys;
+	struct art_node **children;
+	int pos;
+
+	switch (n->type) {
+	case NODE4:
+	case NODE16:
+		if (n->type == NODE4) {
+			keys = N4(n)->keys;
+			children = N4(n)->children;
+			for (pos = 0; keys[pos] != c; pos++) ;
+		} else {
+			keys = N16(n)->keys;
+			children = N16(n)->children;
+			pos = node16_find(N16(n), c);
+		}
+		memmove(&keys[pos], &keys[pos + 1], n->nchildren - pos - 1);
+		memmove(&children[pos], &children[pos + 1],
+			(n->nchildren - pos - 1) * sizeof(*children));
+		break;
+	case NODE48:
+		N48(n)->children[N48(n)->index[c] - 1] = NULL;
+		N48(n)->index[c] = 0;
+		break;
+	default:
+		N256(n)->children[c] = NULL;
+		break;
+	}
+
+	n->nchildren--;
+}
+
+/*
+ * Moves the children of n into to, a node of the next size up or
+ * down, which takes over n's place in the tree.
+ */
+static void move_children(struct art_node *n, struct art_node *to)
+{
+	int i, c, pos = 0;
+
+	to->nchildren = n->nchildren;
+	to->prefix_len = n->prefix_len;
+	memcpy(to->prefix, n->prefix, MAX_PREFIX);
+	to->end = n->end;
+
+	if (n->type == NODE4 || n->type == NODE16) {
+		unsigned char *keys = (n->type == NODE4) ? N4(n)->keys
+		    : N16(n)->keys;
+		struct art_node **children = (n->type == NODE4)
+		    ? N4(n)->children : N16(n)->children;
+
+		if (to->type == NODE48) {
+			for (i = 0; i < n->nchildren; i++) {
+				N48(to)->index[keys[i]] = (unsigned char)(i + 1);
+				N48(to)->children[i] = children[i];
+			}
+		} else if (to->type == NODE16) {
+			memcpy(N16(to)->keys, keys, n->nchildren);
+			memcpy(N16(to)->children, children,
+			       n->nchildren * sizeof(*children));
+		} else {
+			memcpy(N4(to)->keys, keys, n->nchildren);
+			memcpy(N4(to)->children, children,
+			       n->nchildren * sizeof(*children));
+		}
+	} else if (n->type == NODE48) {
+		for (c = 0; c < 256; c++) {
+			if ((i = N48(n)->index[c]) == 0)
+				continue;
+			if (to->type == NODE256) {
+				N256(to)->children[c] = N48(n)->children[i - 1];
+			} else {
+				N16(to)->keys[pos] = (unsigned char)c;
+				N16(to)->children[pos++] = N48(n)->children[i - 1];
+			}
+		}
+	} else {
+		for (c = 0; c < 256; c++) {
+			if (N256(n)->children[c] == NULL)
+				continue;
+			N48(to)->index[c] = (unsigned char)(pos + 1);
+			N48(to)->children[pos++] = N256(n)->children[c];
+		}
+	}
+}
+
+/* Returns the smallest leaf below n. */
+
+static struct art_leaf *minimum(const struct art_node *n)
+{
+	int c;
+
+	while (!IS_LEAF(n)) {
+		if (n->end != NULL)
+			return n->end;
+
+		switch (n->type) {
+		case NODE4:
+			n = N4(n)->children[0];
+			break;
+		case NODE16:
+			n = N16(n)->children[0];
+			break;
+		case NODE48:
+			for (c = 0; N48(n)->index[c] == 0; c++) ;
+			n = N48(n)->children[N48(n)->index[c] - 1];
+			break;
+		default:
+			for (c = 0; N256(n)->children[c] == NULL; c++) ;
+			n = N256(n)->children[c];
+			break;
+		}
+	}
+
+	return LEAF(n);
+}
+
+/*
+ * Returns how many of the stored prefix bytes of n match key from
+ * depth on.  Bytes of a longer prefix are not checked.
+ */
+static INLINE size_t check_prefix(const struct art_node *n,
+				  const unsigned char *key, size_t len,
+				  size_t depth)
+{
+	size_t i, max = min_size(min_size(n->prefix_len, MAX_PREFIX),
+				 len - depth);
+
+	for (i = 0; i < max && n->prefix[i] == key[depth + i]; i++) ;
+
+	return i;
+}
+
+/*
+ * Returns how many bytes of the whole prefix of n match key from depth
+ * on, reading the bytes past those stored from a leaf below n.
+ */
+static size_t prefix_mismatch(const struct art_node *n,
+			      const unsigned char *key, size_t len,
+			      size_t depth)
+{
+	const struct art_leaf *l;
+	size_t i = check_prefix(n, key, len, depth), max;
+
+	if (i < MAX_PREFIX || n->prefix_len <= MAX_PREFIX)
+		return i;
+
+	l = minimum(n);
+	max = min_size(n->prefix_len, min_size(l->len, len) - depth);
+
+	while (i < max && l->key[depth + i] == key[depth + i])
+		i++;
+
+	return i;
+}
+
+/* Hangs leaf l off n, which branches at byte depth. */
+
+static void place_leaf(struct art_node *n, struct art_leaf *l, size_t depth)
+{
+	if (l->len == depth)
+		n->end = l;
+	else
+		add_child(n, l->key[depth], TAG(l));
+}
+
+int art_insert(struct art *t, const void *key, size_t len, void *v)
+{
+	const unsigned char *k = key;
+	struct art_node **ref = &t->root, **child, *n, *nn;
+	struct art_leaf *l, *leaf;
+	size_t depth = 0, i, max;
+
+	/* Allocate everything up front so a failure changes nothing. */
+
+	for (;;) {
+		n = *ref;
+
+		if (n == NULL) {
+			if ((leaf = leaf_new(t, k, len, v)) == NULL)
+				return 1;
+			*ref = TAG(leaf);
+			break;
+		}
+
+		if (IS_LEAF(n)) {
+			l = LEAF(n);
+
+			if (leaf_matches(l, k, len)) {
+				if (t->val_free_fn != NULL)
+					t->val_free_fn(l->val);
+				l->val = v;
+				return 0;
+			}
+
+			/* Lazy expansion: split the leaf where they differ. */
+
+			if ((leaf = leaf_new(t, k, len, v)) == NULL)
+				return 1;
+			if ((nn = node_new(t, NODE4)) == NULL) {
+				t->free_fn(leaf);
+				return 1;
+			}
+
+			max = min_size(l->len, len) - depth;
+			for (i = 0; i < max && l->key[depth + i] == k[depth + i];
+			     i++) ;
+
+			nn->prefix_len = (uint32_t)i;
+			memcpy(nn->prefix, &k[depth], min_size(i, MAX_PREFIX));
+			place_leaf(nn, l, depth + i);
+			place_leaf(nn, leaf, depth + i);
+			*ref = nn;
+			break;
+		}
+
+		if (n->prefix_len != 0) {
+			i = prefix_mismatch(n, k, len, depth);
+
+			if (i < n->prefix_len) {
+				unsigned char c;
+
+				/* Split the compressed path at the mismatch. */
+
+				if ((leaf = leaf_new(t, k, len, v)) == NULL)
+					return 1;
+				if ((nn = node_new(t, NODE4)) == NULL) {
+					t->free_fn(leaf);
+					return 1;
+				}
+
+				nn->prefix_len = (uint32_t)i;
+				memcpy(nn->prefix, n->prefix,
+				       min_size(i, MAX_PREFIX));
+
+				if (n->prefix_len <= MAX_PREFIX) {
+					c = n->prefix[i];
+					n->prefix_len -= (uint32_t)(i + 1);
+					memmove(n->prefix, &n->prefix[i + 1],
+						n->prefix_len);
+				} else {
+					l = minimum(n);
+					c = l->key[depth + i];
+					n->prefix_len -= (uint32_t)(i + 1);
+					memcpy(n->prefix, &l->key[depth + i + 1],
+					       min_size(n->prefix_len,
+							MAX_PREFIX));
+				}
+
+				add_child(nn, c, n);
+				place_leaf(nn, leaf, depth + i);
+				*ref = nn;
+				break;
+			}
+
+			depth += n->prefix_len;
+		}
+
+		if (depth == len) {
+			if (n->end != NULL) {
+				if (t->val_free_fn != NULL)
+					t->val_free_fn(n->end->val);
+				n->end->val = v;
+				return 0;
+			}
+			if ((n->end = leaf_new(t, k, len, v)) == NULL)
+				return 1;
+			break;
+		}
+
+		if ((child = find_child(n, k[depth])) != NULL) {
+			ref = child;
+			depth++;
+			continue;
+		}
+
+		if ((leaf = leaf_new(t, k, len, v)) == NULL)
+			return 1;
+
+		if (n->nchildren == capacity[n->type]) {
+			if ((nn = node_new(t, n->type + 1)) == NULL) {
+				t->free_fn(leaf);
+				return 1;
+			}
+			move_children(n, nn);
+			t->free_fn(n);
+			*ref = n = nn;
+		}
+
+		add_child(n, k[depth], TAG(leaf));
+		break;
+	}
+
+	t->nentries++;
+
+	return 0;
+}
+
+void *art_lookup(const struct art *t, const void *key, size_t len)
+{
+	const unsigned char *k = key;
+	struct art_node *n = t->root, **child;
+	size_t depth = 0;
+
+	while (n != NULL) {
+		if (IS_LEAF(n)) {
+			const struct art_leaf *l = LEAF(n);
+			return leaf_matches(l, k, len) ? l->val : NULL;
+		}
+
+		if (n->prefix_len != 0) {
+			if (check_prefix(n, k, len, depth) !=
+			    min_size(n->prefix_len, MAX_PREFIX))
+				return NULL;
+			depth += n->prefix_len;
+		}
+
+		if (depth >= len) {
+			if (depth == len && n->end != NULL &&
+			    leaf_matches(n->end, k, len))
+				return n->end->val;
+			return NULL;
+		}
+
+		child = find_child(n, k[depth++]);
+		n = (child != NULL) ? *child : NULL;
+	}
+
+	return NULL;
+}
+
+/*
+ * Restores the shape rules after n, at *ref, lost a child or its end
+ * leaf: a Node4 left with one child and no end leaf is merged into
+ * that child, and larger nodes move down a size once they are sparse
+ * enough.  A failure to allocate the smaller node just leaves the
+ * larger one in place.
+ */
+static void compact(struct art *t, struct art_node **ref)
+{
+	struct art_node *n = *ref, *child, *nn;
+
+	if (n->type != NODE4) {
+		if (n->nchildren > shrink_at[n->type] ||
+		    (nn = node_new(t, n->type - 1)) == NULL)
+			return;
+		move_children(n, nn);
+		t->free_fn(n);
+		*ref = nn;
+		return;
+	}
+
+	if (n->nchildren == 0) {
+		*ref = (n->end != NULL) ? TAG(n->end) : NULL;
+		t->free_fn(n);
+		return;
+	}
+
+	if (n->nchildren > 1 || n->end != NULL)
+		return;
+
+	/* The child's path becomes n's path, its byte and its own. */
+
+	child = N4(n)->children[0];
+
+	if (!IS_LEAF(child)) {
+		size_t plen = n->prefix_len;
+
+		if (plen < MAX_PREFIX)
+			n->prefix[plen++] = N4(n)->keys[0];
+		if (plen < MAX_PREFIX) {
+			size_t sub = min_size(child->prefix_len,
+					      MAX_PREFIX - plen);
+			memcpy(&n->prefix[plen], child->prefix, sub);
+			plen += sub;
+		}
+
+		memcpy(child->prefix, n->prefix, min_size(plen, MAX_PREFIX));
+		child->prefix_len += n->prefix_len + 1;
+	}
+
+	*ref = child;
+	t->free_fn(n);
+}
+
+int art_remove(struct art *t, const void *key, size_t len)
+{
+	const unsigned char *k = key;
+	struct art_node **ref = &t->root, **child, *n;
+	struct art_leaf *l;
+	size_t depth = 0;
+
+	if ((n = t->root) == NULL)
+		return 1;
+
+	if (IS_LEAF(n)) {
+		l = LEAF(n);
+		if (!leaf_matches(l, k, len))
+			return 1;
+		t->root = NULL;
+		goto found;
+	}
+
+	for (;;) {
+		if (n->prefix_len != 0) {
+			if (check_prefix(n, k, len, depth) !=
+			    min_size(n->prefix_len, MAX_PREFIX))
+				return 1;
+			depth += n->prefix_len;
+		}
+
+		if (depth > len)
+			return 1;
+
+		if (depth == len) {
+			if ((l = n->end) == NULL || !leaf_matches(l, k, len))
+				return 1;
+			n->end = NULL;
+			compact(t, ref);
+			goto found;
+		}
+
+		if ((child = find_child(n, k[depth])) == NULL)
+			return 1;
+
+		if (IS_LEAF(*child)) {
+			l = LEAF(*child);
+			if (!leaf_matches(l, k, len))
+				return 1;
+			remove_child(n, k[depth]);
+			compact(t, ref);
+			goto found;
+		}
+
+		ref = child;
+		n = *ref;
+		depth++;
+	}
+
+ found:
+	if (t->val_free_fn != NULL)
+		t->val_free_fn(l->val);
+	t->free_fn(l);
+	t->nentries--;
+
+	return 0;
+}
+
+/* Applies fn to the subtree at n in order; returns 0 if fn stopped. */
+
+static int walk(const struct art_node *n, ART_APPLY_FN fn, void *client_data,
+		unsigned long *count)
+{
+	const struct art_leaf *l;
+	int i, c;
+
+	if (IS_LEAF(n)) {
+		l = LEAF(n);
+		(*count)++;
+		return fn(l->key, l->len, l->val, client_data);
+	}
+
+	if (n->end != NULL) {
+		(*count)++;
+		if (!fn(n->end->key, n->end->len, n->end->val, client_data))
+			return 0;
+	}
+
+	switch (n->type) {
+	case NODE4:
+		for (i = 0; i < n->nchildren; i++) {
+			if (!walk(N4(n)->children[i], fn, client_data, count))
+				return 0;
+		}
+		break;
+	case NODE16:
+		for (i = 0; i < n->nchildren; i++) {
+			if (!walk(N16(n)->children[i], fn, client_data, count))
+				return 0;
+		}
+		break;
+	case NODE48:
+		for (c = 0; c < 256; c++) {
+			if ((i = N48(n)->index[c]) != 0 &&
+			    !walk(N48(n)->children[i - 1], fn, client_data,
+				  count))
+				return 0;
+		}
+		break;
+	default:
+		for (c = 0; c < 256; c++) {
+			if (N256(n)->children[c] != NULL &&
+			    !walk(N256(n)->children[c], fn, client_data, count))
+				return 0;
+		}
+		break;
+	}
+
+	return 1;
+}
+
+unsigned long art_apply(const struct art *t, ART_APPLY_FN fn,
+			void *client_data)
+{
+	unsigned long count = 0;
+
+	if (t->root != NULL)
+		walk(t->root, fn, client_data, &count);
+
+	return count;
+}
+
+unsigned long art_prefix_scan(const struct art *t, const void *prefix,
+			      size_t len, ART_APPLY_FN fn, void *client_data)
+{
+	const unsigned char *p = prefix;
+	struct art_node *n = t->root, **child;
+	unsigned long count = 0;
+	size_t depth = 0;
+
+	while (n != NULL) {
+		if (IS_LEAF(n)) {
+			const struct art_leaf *l = LEAF(n);
+			if (l->len >= len && memcmp(l->key, p, len) == 0)
+				walk(n, fn, client_data, &count);
+			break;
+		}
+
+		/* Every byte of the path has to match, not just those stored. */
+
+		if (n->prefix_len != 0 && depth < len) {
+			const struct art_leaf *l = minimum(n);
+			size_t max = min_size(n->prefix_len, len - depth);
+
+			if (memcmp(&l->key[depth], &p[depth], max) != 0)
+				break;
+		}
+
+		depth += n->prefix_len;
+
+		if (depth >= len) {
+			walk(n, fn, client_data, &count);
+			break;
+		}
+
+		child = find_child(n, p[depth++]);
+		n = (child != NULL) ? *child : NULL;
+	}
+
+	return count;
+}
+
+static void free_subtree(struct art *t, struct art_node *n)
+{
+	struct art_leaf *l;
+	int i, c;
+
+	if (IS_LEAF(n)) {
+		l = LEAF(n);
+		if (t->val_free_fn != NULL)
+			t->val_free_fn(l->val);
+		t->free_fn(l);
+		return;
+	}
+
+	if (n->end != NULL)
+		free_subtree(t, TAG(n->end));
+
+	switch (n->type) {
+	case NODE4:
+		for (i = 0; i < n->nchildren; i++)
+			free_subtree(t, N4(n)->children[i]);
+		break;
+	case NODE16:
+		for (i = 0; i < n->nchildren; i++)
+			free_subtree(t, N16(n)->children[i]);
+		break;
+	case NODE48:
+		for (c = 0; c < 256; c++) {
+			if ((i = N48(n)->index[c]) != 0)
+				free_subtree(t, N48(n)->children[i - 1]);
+		}
+		break;
+	default:
+		for (c = 0; c < 256; c++) {
+			if (N256(n)->children[c] != NULL)
+				free_subtree(t, N256(n)->children[c]);
+		}
+		break;
+	}
+
+	t->free_fn(n);
+}
+
+void art_delete(struct art *t)
+{
+	if (t->root != NULL)
+		free_subtree(t, t->root);
+
+	t->free_fn(t);
+}
+
+unsigned long art_count(const struct art *t)
+{
+	return t->nentries;
+}
+
+struct art *art_create(ART_VAL_FREE_FN val_free_fn,
+		       ART_MALLOC_FN malloc_fn, ART_FREE_FN free_fn)
+{
+	struct art *t;
+
+	malloc_fn = (malloc_fn != NULL) ? malloc_fn : malloc;
+	free_fn = (free_fn != NULL) ? free_fn : free;
+
+	if ((t = malloc_fn(sizeof(*t))) == NULL)
+		return NULL;
+
+	t->root = NULL;
+	t->nentries = 0;
+	t->val_free_fn = val_free_fn;
+	t->malloc_fn = malloc_fn;
+	t->free_fn = free_fn;
+
+	return t;
+}
@@ -0,0 +1,961 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * A B+tree in a memory-mapped file, updated by shadow paging.
+ *
+ * Every page written by the batch being built is stamped with the
+ * batch's transaction id, which is one more than that of the last
+ * commit.  A page with an older stamp belongs to the committed tree,
+ * so it is copied before it is changed, as is the path down to it.
+ * The pages a batch copies are queued and only become free once the
+ * batch is committed.
+ *
+ * The file is only remapped when it grows, which would invalidate
+ * every page pointer held, so each operation first reserves all the
+ * pages it could possibly need.  As with btree.c, that means a failed
+ * allocation never leaves an operation half done.
+ */
+
+#define _GNU_SOURCE
+
+#include <stddef.h>		/* size_t, NULL, offsetof */
+#include <stdlib.h>		/* malloc, free */
+#include <string.h>		/* memcpy, memmove */
+#include <stdint.h>		/* int64_t, uint64_t */
+#include <errno.h>
+#include <fcntl.h>		/* open */
+#include <unistd.h>		/* pread, pwrite, ftruncate, close */
+#include <sys/mman.h>		/* mmap, msync */
+#include <sys/stat.h>		/* fstat */
+#include <c-hacks/btree-file.h>
+
+#define META_MAGIC		0x3145455254424843ULL	/* "CHBTREE1" */
+#define META_VERSION		1
+#define META_SLOT_SIZE		512
+#define MIN_PAGE_SIZE		1024
+#define MAX_PAGE_SIZE		65536
+#define DEFAULT_PAGE_SIZE	4096
+#define INITIAL_PAGES		16
+
+#if defined(_MSC_VER)
+#define INLINE __inline
+#else
+#define INLINE inline
+#endif
+
+struct meta {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t page_size;
+	uint64_t txid;
+	uint64_t root;
+	uint64_t height;
+	uint64_t nentries;
+	uint64_t npages;	/* pages in use, from 0 */
+	uint64_t free_first;	/* first page of the free list, or 0 */
+	uint64_t free_npages;	/* pages holding the free list */
+	uint64_t nfree;		/* page numbers in the free list */
+	uint64_t checksum;
+};
+
+/*
+ * Node page header.  A leaf is followed by leaf_cap keys and as many
+ * values; an inner node by inner_cap keys and inner_cap + 1 child
+ * page numbers.
+ */
+struct page {
+	uint64_t txid;		/* batch that wrote the page */
+	uint16_t leaf;
+	uint16_t nkeys;
+	uint32_t unused;
+};
+
+struct btree_file {
+	int fd;
+	int flags;
+	unsigned char *map;
+	uint64_t map_pages;
+	size_t page_size;
+	int leaf_cap;
+	int inner_cap;
+	struct meta meta;	/* last commit */
+	uint64_t txid;		/* batch being built */
+	uint64_t root;
+	int height;
+	unsigned long nentries;
+	uint64_t npages;
+	uint64_t *avail;	/* pages free as of the last commit */
+	size_t navail;
+	size_t ncommitted;	/* navail at the last commit */
+	uint64_t *pending;	/* pages freed by this batch */
+	size_t npending;
+	size_t pending_size;
+	int dirty;
+	BTREE_FILE_MALLOC_FN malloc_fn;
+	BTREE_FILE_FREE_FN free_fn;
+};
+
+/* Result of splitting a node: the separator and the new right page. */
+
+struct split {
+	int64_t key;
+	uint64_t right;		/* 0, which is never a node, if no split */
+};
+
+static INLINE struct page *page_at(const struct btree_file *f, uint64_t pgno)
+{
+	return (struct page *)(f->map + pgno * f->page_size);
+}
+
+static INLINE int64_t *keys_of(const struct page *p)
+{
+	return (int64_t *)(p + 1);
+}
+
+static INLINE uint64_t *vals_of(const struct btree_file *f,
+				const struct page *p)
+{
+	return (uint64_t *)(keys_of(p) + f->leaf_cap);
+}
+
+static INLINE uint64_t *children_of(const struct btree_file *f,
+				    const struct page *p)
+{
+	return (uint64_t *)(keys_of(p) + f->inner_cap);
+}
+
+/*
+ * Returns the index of the first of the n keys that is not less than
+ * k, or greater than k if or_equal is set.  The loop has no data
+ * dependent branches, which matters for the large nodes of a file.
+ */
+static INLINE int search(const int64_t *keys, int n, int64_t k,
+			 int or_equal)
+{
+	const int64_t *base = keys;
+
+	if (n == 0)
+		return 0;
+
+	if (or_equal) {
+		while (n > 1) {
+			int half = n / 2;
+			base = (base[half] <= k) ? base + half : base;
+			n -= half;
+		}
+		return (int)(base - keys) + (*base <= k);
+	}
+
+	while (n > 1) {
+		int half = n / 2;
+		base = (base[half] < k) ? base + half : base;
+		n -= half;
+	}
+
+	return (int)(base - keys) + (*base < k);
+}
+
+static uint64_t meta_checksum(const struct meta *m)
+{
+	const unsigned char *p = (const unsigned char *)m;
+	uint64_t h = 0xcbf29ce484222325ULL;	/* FNV-1a */
+	size_t i;
+
+	for (i = 0; i < offsetof(struct meta, checksum); i++)
+		h = (h ^ p[i]) * 0x100000001b3ULL;
+
+	return h;
+}
+
+static int meta_valid(const struct meta *m)
+{
+	return m->magic == META_MAGIC && m->version == META_VERSION &&
+	    m->checksum == meta_checksum(m) &&
+	    m->page_size >= MIN_PAGE_SIZE && m->page_size <= MAX_PAGE_SIZE &&
+	    (m->page_size & (m->page_size - 1)) == 0 &&
+	    m->root > 0 && m->root < m->npages;
+}
+
+/*
+ * Extends the file and its mapping to at least npages.  Returns 0 on
+ * success or 1 with errno set.
+ */
+static int grow_map(struct btree_file *f, uint64_t npages)
+{
+	uint64_t n = f->map_pages;
+	void *map;
+
+	if (npages <= n)
+		return 0;
+
+	while (n < npages)
+		n *= 2;
+
+	if (ftruncate(f->fd, (off_t)(n * f->page_size)) != 0)
+		return 1;
+
+	map = mmap(NULL, n * f->page_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED, f->fd, 0);
+	if (map == MAP_FAILED)
+		return 1;
+
+	munmap(f->map, f->map_pages * f->page_size);
+	f->map = map;
+	f->map_pages = n;
+
+	return 0;
+}
+
+static int reserve_pending(struct btree_file *f, size_t n)
+{
+	uint64_t *pending;
+	size_t size = f->pending_size ? f->pending_size : 64;
+
+	if (f->npending + n <= f->pending_size)
+		return 0;
+
+	while (size < f->npending + n)
+		size *= 2;
+
+	if ((pending = f->malloc_fn(size * sizeof(*pending))) == NULL) {
+		errno = ENOMEM;
+		return 1;
+	}
+
+	if (f->pending != NULL) {
+		memcpy(pending, f->pending, f->npending * sizeof(*pending));
+		f->free_fn(f->pending);
+	}
+
+	f->pending = pending;
+	f->pending_size = size;
+
+	return 0;
+}
+
+/*
+ * Makes sure that n pages can be allocated, and as many freed, without
+ * growing the file or any array.  Returns 0 on success or 1 with errno
+ * set.
+ */
+static int reserve(struct btree_file *f, size_t n)
+{
+	size_t from_end = (f->navail < n) ? n - f->navail : 0;
+
+	if (grow_map(f, f->npages + from_end) != 0)
+		return 1;
+
+	return reserve_pending(f, n);
+}
+
+/* Pages an insert or remove may need: copies, splits or frees. */
+
+static INLINE size_t op_pages(const struct btree_file *f)
+{
+	return 3 * (size_t)f->height + 2;
+}
+
+static uint64_t alloc_page(struct btree_file *f, int leaf)
+{
+	uint64_t pgno = (f->navail > 0) ? f->avail[--f->navail] : f->npages++;
+	struct page *p = page_at(f, pgno);
+
+	p->txid = f->txid;
+	p->leaf = (uint16_t)leaf;
+	p->nkeys = 0;
+	p->unused = 0;
+	f->dirty = 1;
+
+	return pgno;
+}
+
+static INLINE void free_page(struct btree_file *f, uint64_t pgno)
+{
+	f->pending[f->npending++] = pgno;
+}
+
+/*
+ * Returns the page numbered *slot, which the caller is about to
+ * modify, having first copied it if it belongs to the last commit.
+ */
+static struct page *own(struct btree_file *f, uint64_t *slot)
+{
+	struct page *p = page_at(f, *slot), *copy;
+	uint64_t pgno;
+
+	if (p->txid == f->txid)
+		return p;
+
+	pgno = alloc_page(f, p->leaf);
+	copy = page_at(f, pgno);
+	memcpy(copy, p, f->page_size);
+	copy->txid = f->txid;
+
+	free_page(f, *slot);
+	*slot = pgno;
+
+	return copy;
+}
+
+static void leaf_insert_at(struct btree_file *f, struct page *n, int pos,
+			   int64_t k, uint64_t v)
+{
+	int64_t *keys = keys_of(n);
+	uint64_t *vals = vals_of(f, n);
+	int nmove = n->nkeys - pos;
+
+	memmove(&keys[pos + 1], &keys[pos], nmove * sizeof(*keys));
+	memmove(&vals[pos + 1], &vals[pos], nmove * sizeof(*vals));
+	keys[pos] = k;
+	vals[pos] = v;
+	n->nkeys++;
+}
+
+static void leaf_insert(struct btree_file *f, struct page *n, int64_t k,
+			uint64_t v, struct split *s)
+{
+	int pos = search(keys_of(n), n->nkeys, k, 0);
+	struct page *r;
+	uint64_t rp;
+	int mid;
+
+	if (pos < n->nkeys && keys_of(n)[pos] == k) {
+		vals_of(f, n)[pos] = v;
+		return;
+	}
+
+	f->nentries++;
+
+	if (n->nkeys < f->leaf_cap) {
+		leaf_insert_at(f, n, pos, k, v);
+		return;
+	}
+
+	/*
+	 * Split in half, unless the key goes at the very end: ascending
+	 * inserts then leave full pages behind them.
+	 */
+	rp = alloc_page(f, 1);
+	r = page_at(f, rp);
+	mid = (pos == n->nkeys) ? n->nkeys : n->nkeys / 2;
+
+	r->nkeys = n->nkeys - mid;
+	memcpy(keys_of(r), &keys_of(n)[mid], r->nkeys * sizeof(int64_t));
+	memcpy(vals_of(f, r), &vals_of(f, n)[mid], r->nkeys * sizeof(uint64_t));
+	n->nkeys = mid;
+
+	if (pos <= mid && mid != f->leaf_cap)
+		leaf_insert_at(f, n, pos, k, v);
+	else
+		leaf_insert_at(f, r, pos - mid, k, v);
+
+	s->key = keys_of(r)[0];
+	s->right = rp;
+}
+
+static void inner_insert_at(struct btree_file *f, struct page *n, int ci,
+			    const struct split *cs)
+{
+	int64_t *keys = keys_of(n);
+	uint64_t *children = children_of(f, n);
+	int nmove = n->nkeys - ci;
+
+	memmove(&keys[ci + 1], &keys[ci], nmove * sizeof(*keys));
+	memmove(&children[ci + 2], &children[ci + 1],
+		nmove * sizeof(*children));
+	keys[ci] = cs->key;
+	children[ci + 1] = cs->right;
+	n->nkeys++;
+}
+
+/*
+ * Adds the separator and right page of a split child at index ci,
+ * splitting n in turn if it is full.
+ */
+static void inner_insert(struct btree_file *f, struct page *n, int ci,
+			 const struct split *cs, struct split *s)
+{
+	struct page *r;
+	uint64_t rp;
+	int mid;
+
+	if (n->nkeys < f->inner_cap) {
+		inner_insert_at(f, n, ci, cs);
+		return;
+	}
+
+	/* keys[mid] moves up; children 0 to mid stay on the left. */
+
+	rp = alloc_page(f, 0);
+	r = page_at(f, rp);
+	mid = n->nkeys / 2;
+
+	r->nkeys = n->nkeys - mid - 1;
+	memcpy(keys_of(r), &keys_of(n)[mid + 1], r->nkeys * sizeof(int64_t));
+	memcpy(children_of(f, r), &children_of(f, n)[mid + 1],
+	       (r->nkeys + 1) * sizeof(uint64_t));
+	n->nkeys = mid;
+
+	s->key = keys_of(n)[mid];
+	s->right = rp;
+
+	if (ci <= mid)
+		inner_insert_at(f, n, ci, cs);
+	else
+		inner_insert_at(f, r, ci - mid - 1, cs);
+}
+
+static void node_insert(struct btree_file *f, struct page *n, int64_t k,
+			uint64_t v, struct split *s)
+{
+	struct split cs;
+	int ci;
+
+	if (n->leaf) {
+		leaf_insert(f, n, k, v, s);
+		return;
+	}
+
+	ci = search(keys_of(n), n->nkeys, k, 1);
+	cs.right = 0;
+	node_insert(f, own(f, &children_of(f, n)[ci]), k, v, &cs);
+
+	if (cs.right != 0)
+		inner_insert(f, n, ci, &cs, s);
+}
+
+int btree_file_insert(struct btree_file *f, int64_t k, uint64_t v)
+{
+	struct split s;
+
+	if (reserve(f, op_pages(f)) != 0)
+		return 1;
+
+	s.right = 0;
+	node_insert(f, own(f, &f->root), k, v, &s);
+	f->dirty = 1;
+
+	if (s.right != 0) {
+		uint64_t rootp = alloc_page(f, 0);
+		struct page *root = page_at(f, rootp);
+
+		root->nkeys = 1;
+		keys_of(root)[0] = s.key;
+		children_of(f, root)[0] = f->root;
+		children_of(f, root)[1] = s.right;
+		f->root = rootp;
+		f->height++;
+	}
+
+	return 0;
+}
+
+static const struct page *find_leaf(const struct btree_file *f, int64_t k)
+{
+	const struct page *n = page_at(f, f->root);
+
+	while (!n->leaf)
+		n = page_at(f, children_of(f, n)[search(keys_of(n), n->nkeys,
+							  k, 1)]);
+
+	return n;
+}
+
+int btree_file_lookup(const struct btree_file *f, int64_t k, uint64_t *v)
+{
+	const struct page *n = find_leaf(f, k);
+	int pos = search(keys_of(n), n->nkeys, k, 0);
+
+	if (pos < n->nkeys && keys_of(n)[pos] == k) {
+		*v = vals_of(f, n)[pos];
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Returns 1 if n is an empty leaf or leads only to one. */
+
+static int subtree_empty(const struct btree_file *f, const struct page *n)
+{
+	while (!n->leaf) {
+		if (n->nkeys != 0)
+			return 0;
+		n = page_at(f, children_of(f, n)[0]);
+	}
+
+	return n->nkeys == 0;
+}
+
+/* Frees the pages of an empty subtree. */
+
+static void free_empty(struct btree_file *f, uint64_t pgno)
+{
+	for (;;) {
+		const struct page *n = page_at(f, pgno);
+		free_page(f, pgno);
+		if (n->leaf)
+			break;
+		pgno = children_of(f, n)[0];
+	}
+}
+
+/* Returns 1 if k was found and removed from the subtree at n. */
+
+static int node_remove(struct btree_file *f, struct page *n, int64_t k)
+{
+	int64_t *keys = keys_of(n);
+	struct page *c;
+	int ci, ki, pos;
+
+	if (n->leaf) {
+		uint64_t *vals = vals_of(f, n);
+
+		pos = search(keys, n->nkeys, k, 0);
+		if (pos >= n->nkeys || keys[pos] != k)
+			return 0;
+
+		memmove(&keys[pos], &keys[pos + 1],
+			(n->nkeys - pos - 1) * sizeof(*keys));
+		memmove(&vals[pos], &vals[pos + 1],
+			(n->nkeys - pos - 1) * sizeof(*vals));
+		n->nkeys--;
+		f->nentries--;
+
+		return 1;
+	}
+
+	ci = search(keys, n->nkeys, k, 1);
+	c = own(f, &children_of(f, n)[ci]);
+
+	if (!node_remove(f, c, k))
+		return 0;
+
+	/* Unlink an emptied child along with the separator that bounds it. */
+
+	if (n->nkeys > 0 && subtree_empty(f, c)) {
+		uint64_t *children = children_of(f, n);
+
+		free_empty(f, children[ci]);
+		ki = (ci > 0) ? ci - 1 : 0;
+		memmove(&keys[ki], &keys[ki + 1],
+			(n->nkeys - ki - 1) * sizeof(*keys));
+		memmove(&children[ci], &children[ci + 1],
+			(n->nkeys - ci) * sizeof(*children));
+		n->nkeys--;
+	}
+
+	return 1;
+}
+
+int btree_file_remove(struct btree_file *f, int64_t k)
+{
+	struct page *root;
+	uint64_t v;
+
+	/* Don't copy the path to a key that isn't there. */
+
+	if (btree_file_lookup(f, k, &v) != 0 || reserve(f, op_pages(f)) != 0)
+		return 1;
+
+	node_remove(f, own(f, &f->root), k);
+	f->dirty = 1;
+
+	while (!(root = page_at(f, f->root))->leaf && root->nkeys == 0) {
+		free_page(f, f->root);
+		f->root = children_of(f, root)[0];
+		f->height--;
+	}
+
+	return 0;
+}
+
+unsigned long btree_file_count(const struct btree_file *f)
+{
+	return f->nentries;
+}
+
+void btree_file_rollback(struct btree_file *f)
+{
+	f->root = f->meta.root;
+	f->height = (int)f->meta.height;
+	f->nentries = (unsigned long)f->meta.nentries;
+	f->npages = f->meta.npages;
+	f->navail = f->ncommitted;
+	f->npending = 0;
+	f->dirty = 0;
+}
+
+int btree_file_commit(struct btree_file *f)
+{
+	size_t per_page = f->page_size / sizeof(uint64_t);
+	uint64_t i, nlist, total, *avail;
+	struct meta m;
+	int error = 0;
+
+	if (!f->dirty)
+		return 0;
+
+	/* This commit writes a new free list so the old one goes too. */
+
+	if (reserve_pending(f, f->meta.free_npages) != 0)
+		return -1;
+
+	for (i = 0; i < f->meta.free_npages; i++)
+		f->pending[f->npending++] = f->meta.free_first + i;
+
+	total = f->navail + f->npending;
+	nlist = (total + per_page - 1) / per_page;
+
+	if ((avail = f->malloc_fn((total + 1) * sizeof(*avail))) == NULL) {
+		errno = ENOMEM;
+		goto fail;
+	}
+
+	memcpy(avail, f->avail, f->navail * sizeof(*avail));
+	memcpy(&avail[f->navail], f->pending, f->npending * sizeof(*avail));
+
+	/* The free list goes at the end, clear of any free page. */
+
+	if (grow_map(f, f->npages + nlist) != 0) {
+		f->free_fn(avail);
+		goto fail;
+	}
+
+	if (nlist > 0)
+		memcpy(page_at(f, f->npages), avail, total * sizeof(*avail));
+
+	if (!(f->flags & BTREE_FILE_NOSYNC) &&
+	    msync(f->map, (f->npages + nlist) * f->page_size, MS_SYNC) != 0) {
+		f->free_fn(avail);
+		goto fail;
+	}
+
+	memset(&m, 0, sizeof(m));
+	m.magic = META_MAGIC;
+	m.version = META_VERSION;
+	m.page_size = (uint32_t)f->page_size;
+	m.txid = f->txid;
+	m.root = f->root;
+	m.height = (uint64_t)f->height;
+	m.nentries = f->nentries;
+	m.npages = f->npages + nlist;
+	m.free_first = (nlist > 0) ? f->npages : 0;
+	m.free_npages = nlist;
+	m.nfree = total;
+	m.checksum = meta_checksum(&m);
+
+	/* Overwrite the older meta record: this is the commit point. */
+
+	memcpy(f->map + (f->txid % 2) * META_SLOT_SIZE, &m, sizeof(m));
+
+	if (!(f->flags & BTREE_FILE_NOSYNC) &&
+	    msync(f->map, f->page_size, MS_SYNC) != 0)
+		error = -1;
+
+	f->free_fn(f->avail);
+	f->avail = avail;
+	f->navail = f->ncommitted = total;
+	f->npending = 0;
+	f->npages = m.npages;
+	f->meta = m;
+	f->txid++;
+	f->dirty = 0;
+
+	return error;
+
+ fail:
+	f->npending -= f->meta.free_npages;
+	return -1;
+}
+
+/* Writes an empty tree, committed as transaction 1, to a new file. */
+
+static int init_file(struct btree_file *f)
+{
+	unsigned char *buf;
+	struct page *root;
+	struct meta m;
+	int error = 0;
+
+	if ((buf = f->malloc_fn(f->page_size)) == NULL) {
+		errno = ENOMEM;
+		return 1;
+	}
+
+	memset(buf, 0, f->page_size);
+	root = (struct page *)buf;
+	root->txid = 1;
+	root->leaf = 1;
+
+	memset(&m, 0, sizeof(m));
+	m.magic = META_MAGIC;
+	m.version = META_VERSION;
+	m.page_size = (uint32_t)f->page_size;
+	m.txid = 1;
+	m.root = 1;
+	m.height = 1;
+	m.npages = 2;
+	m.checksum = meta_checksum(&m);
+
+	if (ftruncate(f->fd, (off_t)(INITIAL_PAGES * f->page_size)) != 0 ||
+	    pwrite(f->fd, buf, f->page_size, (off_t)f->page_size) !=
+	    (ssize_t) f->page_size ||
+	    pwrite(f->fd, &m, sizeof(m), META_SLOT_SIZE) != sizeof(m) ||
+	    (!(f->flags & BTREE_FILE_NOSYNC) && fsync(f->fd) != 0))
+		error = 1;
+
+	f->free_fn(buf);
+
+	return error;
+}
+
+/* Reads the newest valid meta record into f->meta. */
+
+static int read_meta(struct btree_file *f)
+{
+	struct meta m[2];
+	int i, best = -1;
+
+	memset(m, 0, sizeof(m));
+
+	for (i = 0; i < 2; i++) {
+		if (pread(f->fd, &m[i], sizeof(m[i]), i * META_SLOT_SIZE) !=
+		    sizeof(m[i]))
+			continue;
+		if (meta_valid(&m[i]) && (best < 0 || m[i].txid > m[best].txid))
+			best = i;
+	}
+
+	if (best < 0) {
+		errno = EILSEQ;
+		return 1;
+	}
+
+	f->meta = m[best];
+
+	return 0;
+}
+
+struct btree_file *btree_file_open(const char *path, size_t page_size,
+				   int flags,
+				   BTREE_FILE_MALLOC_FN malloc_fn,
+				   BTREE_FILE_FREE_FN free_fn)
+{
+	struct btree_file *f;
+	struct stat st;
+	int saved_errno;
+
+	malloc_fn = (malloc_fn != NULL) ? malloc_fn : malloc;
+	free_fn = (free_fn != NULL) ? free_fn : free;
+	page_size = (page_size != 0) ? page_size : DEFAULT_PAGE_SIZE;
+
+	if (page_size < MIN_PAGE_SIZE || page_size > MAX_PAGE_SIZE ||
+	    (page_size & (page_size - 1)) != 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if ((f = malloc_fn(sizeof(*f))) == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	memset(f, 0, sizeof(*f));
+	f->flags = flags;
+	f->malloc_fn = malloc_fn;
+	f->free_fn = free_fn;
+	f->page_size = page_size;
+	f->map = MAP_FAILED;
+
+	if ((f->fd = open(path, O_RDWR | O_CREAT, 0644)) < 0)
+		goto fail;
+
+	if (fstat(f->fd, &st) != 0)
+		goto fail;
+
+	if (st.st_size == 0) {
+		if (init_file(f) != 0 || fstat(f->fd, &st) != 0)
+			goto fail;
+	}
+
+	if (read_meta(f) != 0)
+		goto fail;
+
+	f->page_size = f->meta.page_size;
+	f->leaf_cap = (int)((f->page_size - sizeof(struct page)) / 16);
+	f->inner_cap = (int)((f->page_size - sizeof(struct page) - 8) / 16);
+	f->map_pages = (uint64_t)st.st_size / f->page_size;
+
+	if (f->map_pages < f->meta.npages ||
+	    f->meta.free_first + f->meta.free_npages > f->meta.npages ||
+	    f->meta.nfree > f->meta.free_npages * (f->page_size / 8)) {
+		errno = EILSEQ;
+		goto fail;
+	}
+
+	f->map = mmap(NULL, f->map_pages * f->page_size,
+		      PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, 0);
+	if (f->map == MAP_FAILED)
+		goto fail;
+
+	if ((f->avail = malloc_fn((f->meta.nfree + 1) *
+				  sizeof(*f->avail))) == NULL) {
+		errno = ENOMEM;
+		goto fail;
+	}
+
+	if (f->meta.nfree > 0)
+		memcpy(f->avail, page_at(f, f->meta.free_first),
+		       f->meta.nfree * sizeof(*f->avail));
+
+	f->ncommitted = f->meta.nfree;
+	f->txid = f->meta.txid + 1;
+	btree_file_rollback(f);
+
+	return f;
+
+ fail:
+	saved_errno = errno;
+	if (f->map != MAP_FAILED)
+		munmap(f->map, f->map_pages * f->page_size);
+	if (f->fd >= 0)
+		close(f->fd);
+	free_fn(f);
+	errno = saved_errno;
+
+	return NULL;
+}
+
+int btree_file_close(struct btree_file *f)
+{
+	int error = 0;
+
+	munmap(f->map, f->map_pages * f->page_size);
+
+	if (close(f->fd) != 0)
+		error = -1;
+
+	f->free_fn(f->avail);
+	if (f->pending != NULL)
+		f->free_fn(f->pending);
+	f->free_fn(f);
+
+	return error;
+}
+
+static void iter_set(struct btree_file_iter *iter,
+		     const struct btree_file *f, uint64_t page, int pos)
+{
+	/* We have to do some funky casting in order to initialize the
+	 * private fields as they are declared const -- we don't want
+	 * clients changing them but we need to. */
+
+	*(const struct btree_file **)&iter->file = f;
+	*(uint64_t *)&iter->page = page;
+	*(int *)&iter->pos = pos;
+}
+
+void btree_file_iter_init(const struct btree_file *f,
+			  struct btree_file_iter *iter)
+{
+	uint64_t pgno = f->root;
+
+	while (!page_at(f, pgno)->leaf)
+		pgno = children_of(f, page_at(f, pgno))[0];
+
+	iter->key = 0;
+	iter->val = 0;
+	iter_set(iter, f, pgno, 0);
+}
+
+void btree_file_lower_bound(const struct btree_file *f, int64_t k,
+			    struct btree_file_iter *iter)
+{
+	uint64_t pgno = f->root;
+	const struct page *n;
+
+	while (!(n = page_at(f, pgno))->leaf)
+		pgno = children_of(f, n)[search(keys_of(n), n->nkeys, k, 1)];
+
+	iter->key = 0;
+	iter->val = 0;
+	iter_set(iter, f, pgno, search(keys_of(n), n->nkeys, k, 0));
+}
+
+/*
+ * Returns the leaf after the one holding k, the last key of its leaf,
+ * or 0.  That is the leftmost leaf under the nearest ancestor with a
+ * child to the right; pages have no sibling links since a copied page
+ * would leave its neighbours pointing at the committed version.
+ */
+static uint64_t next_leaf(const struct btree_file *f, int64_t k)
+{
+	const struct page *n = page_at(f, f->root);
+	uint64_t next = 0;
+
+	while (!n->leaf) {
+		int ci = search(keys_of(n), n->nkeys, k, 1);
+		if (ci < n->nkeys)
+			next = children_of(f, n)[ci + 1];
+		n = page_at(f, children_of(f, n)[ci]);
+	}
+
+	if (next != 0) {
+		while (!page_at(f, next)->leaf)
+			next = children_of(f, page_at(f, next))[0];
+	}
+
+	return next;
+}
+
+int btree_file_iter_next(struct btree_file_iter *iter)
+{
+	const struct btree_file *f = iter->file;
+	uint64_t pgno = iter->page;
+	int pos = iter->pos;
+	const struct page *n;
+
+	while (pgno != 0 && pos >= (n = page_at(f, pgno))->nkeys) {
+		pgno = (n->nkeys > 0) ? next_leaf(f, keys_of(n)[n->nkeys - 1])
+		    : 0;
+		pos = 0;
+	}
+
+	if (pgno == 0) {
+		iter_set(iter, f, 0, 0);
+		return 0;
+	}
+
+	n = page_at(f, pgno);
+	iter->key = keys_of(n)[pos];
+	iter->val = vals_of(f, n)[pos];
+	iter_set(iter, f, pgno, pos + 1);
+
+	return 1;
+}
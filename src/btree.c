@@ -1 +1,1741 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * A B+tree implementation.
+ *
+ * Every node holds up to BTREE_NODE_KEYS keys in a contiguous array
+ * so that a search within a node touches a couple of cache lines
+ * rather than one cache line per key.  Values live only in the leaves,
+ * which are linked left to right for in-order iteration.  An inner
+ * node with n keys has n + 1 children; child i holds the keys that
+ * are >= keys[i - 1] and < keys[i].  Each separator is the smallest
+ * key of the subtree to its right, which means every separator is
+ * also a live key in some leaf.  Removal relies on this to replace a
+ * separator that refers to a key that is about to be freed.
+ *
+ * All nodes other than the root hold at least BTREE_NODE_KEYS / 2
+ * keys.  Insertion splits full nodes on the way back up; removal
+ * borrows from, or merges with, a sibling on the way back up.
+ *
+ * Inner nodes also count the entries under each child, which makes
+ * rank and select queries O(log n): an update adjusts one count at
+ * each level on its way back up, or recounts the nodes a split or
+ * rebalance touched.
+ *
+ * Trees created without a comparator hold integer keys in the key
+ * pointers themselves.  A search within such a node doesn't call a
+ * comparator or branch on each key: it counts the keys that are less
+ * than the search key, which for a sorted array is the insertion
+ * index.  On x86-64 CPUs with AVX2 the count is four 64-bit compares
+ * per instruction plus a popcount; elsewhere it is a branch-free loop.
+ *
+ * A persistent tree shares nodes with its snapshots.  Each node counts
+ * the parents (or tree roots) that refer to it and a writer copies any
+ * node that is shared before changing it, along with the path down to
+ * it, so a snapshot is just another reference to the root.  Shared
+ * leaves can't be linked, so a persistent tree finds the next leaf by
+ * descending from the root again.
+ *
+ * A tree of string keys keeps, for each node, the length of a prefix
+ * that all its keys share and a head for each key: the next 8 bytes
+ * after that prefix as a big-endian integer, which orders just like
+ * the bytes do.  A search compares the prefix once, against the first
+ * key, and then compares heads; only keys whose heads are equal to
+ * the search key's, and that run on for 8 bytes or more, have to be
+ * dereferenced.  The prefix may be shorter than the longest one the
+ * keys share, since removing keys never lengthens it, but never longer.
+ */
+
+#include <stddef.h>		/* size_t, NULL */
+#include <stdlib.h>		/* malloc, free */
+#include <string.h>		/* memmove, memcpy */
+#include <stdint.h>		/* intptr_t */
+#include <stdatomic.h>
 #include <c-hacks/btree.h>
+#include <c-hacks/btree-funcs.h>
+
+#ifndef BTREE_NODE_KEYS
+#define BTREE_NODE_KEYS 16
+#endif
+
+#if BTREE_NODE_KEYS < 4
+#error "BTREE_NODE_KEYS must be at least 4"
+#endif
+
+#define MIN_KEYS (BTREE_NODE_KEYS / 2)
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) && \
+    BTREE_NODE_KEYS <= 64 && !defined(BTREE_NO_SIMD)
+#include <immintrin.h>
+#define BTREE_HAVE_AVX2 1
+#endif
+
+#if defined(_MSC_VER)
+#define INLINE __inline
+#else
+#define INLINE inline
+#endif
+
+struct btree_node {
+	void *keys[BTREE_NODE_KEYS];	/* searched with unaligned AVX2 loads */
+	int nkeys;
+	int leaf;
+	atomic_int refs;	/* parents and roots sharing this node */
+	int prefix;		/* bytes every string key starts with */
+	union {
+		struct {
+			struct btree_node *children[BTREE_NODE_KEYS + 1];
+			unsigned long counts[BTREE_NODE_KEYS + 1];
+		};
+		struct {
+			void *vals[BTREE_NODE_KEYS];
+			struct btree_node *next;	/* leaf to the right */
+		} leaf;
+	} u;
+	uint64_t heads[];	/* string keys only: see key_head() */
+};
+
+struct btree {
+	BTREE_COMPARE_FN compare_fn;
+	int direct;		/* intptr_t keys, no comparator */
+	int avx2;		/* use AVX2 for direct keys */
+	int persistent;		/* nodes may be shared with snapshots */
+	int strings;		/* string keys, with prefixes and heads */
+	size_t node_size;
+	unsigned long nentries;
+	int height;		/* levels, including the leaves */
+	BTREE_KEY_FREE_FN key_free_fn;
+	BTREE_VAL_FREE_FN val_free_fn;
+	BTREE_MALLOC_FN malloc_fn;
+	BTREE_FREE_FN free_fn;
+	struct btree_node *root;
+	struct btree_node *spare;	/* nodes reserved for splits */
+	int nspare;
+};
+
+/* Result of splitting a node: the separator and the new right node. */
+
+struct split {
+	void *key;
+	struct btree_node *right;
+};
+
+/* Returns the number of entries under n. */
+
+static unsigned long node_total(const struct btree_node *n)
+{
+	unsigned long total = 0;
+	int i;
+
+	if (n->leaf)
+		return n->nkeys;
+
+	for (i = 0; i <= n->nkeys; i++)
+		total += n->u.counts[i];
+
+	return total;
+}
+
+/*
+ * Ensures that an insert can split every node on its path without
+ * allocating, so that a failed allocation can never leave the tree
+ * half split.  A persistent tree may also have to copy every node on
+ * the path (or, for a remove, a sibling at each level) and keeps one
+ * more for btree_clear() to replace a shared root with.  Returns 0 on
+ * success or 1 if no memory is available.
+ */
+static INLINE int spares_needed(const struct btree *t)
+{
+	return t->persistent ? 2 * t->height + 2 : t->height + 1;
+}
+
+static int reserve_nodes(struct btree *t)
+{
+	while (t->nspare < spares_needed(t)) {
+		struct btree_node *n;
+
+		if ((n = t->malloc_fn(t->node_size)) == NULL)
+			return 1;
+
+		n->u.children[0] = t->spare;
+		t->spare = n;
+		t->nspare++;
+	}
+
+	return 0;
+}
+
+static struct btree_node *node_new(struct btree *t, int leaf)
+{
+	struct btree_node *n = t->spare;
+
+	t->spare = n->u.children[0];
+	t->nspare--;
+
+	n->nkeys = 0;
+	n->leaf = leaf;
+	n->prefix = 0;
+	atomic_init(&n->refs, 1);
+
+	if (leaf)
+		n->u.leaf.next = NULL;
+
+	return n;
+}
+
+/*
+ * Drops a reference to n, freeing it and releasing its children if it
+ * was the last.  Keys and values are not freed: a persistent tree
+ * doesn't own them.
+ */
+static void node_release(struct btree *t, struct btree_node *n)
+{
+	int i;
+
+	if (atomic_fetch_sub_explicit(&n->refs, 1, memory_order_acq_rel) != 1)
+		return;
+
+	if (!n->leaf) {
+		for (i = 0; i <= n->nkeys; i++)
+			node_release(t, n->u.children[i]);
+	}
+
+	t->free_fn(n);
+}
+
+/*
+ * Returns the node at *slot, which the caller is about to modify,
+ * having first replaced it with a private copy if it is shared.  The
+ * node holding slot must already be private.
+ */
+static struct btree_node *own(struct btree *t, struct btree_node **slot)
+{
+	struct btree_node *n = *slot, *copy;
+	int i;
+
+	if (!t->persistent ||
+	    atomic_load_explicit(&n->refs, memory_order_acquire) == 1)
+		return n;
+
+	copy = node_new(t, n->leaf);
+	copy->nkeys = n->nkeys;
+	copy->prefix = n->prefix;
+	memcpy(copy->keys, n->keys, n->nkeys * sizeof(void *));
+	if (t->strings)
+		memcpy(copy->heads, n->heads, n->nkeys * sizeof(uint64_t));
+
+	if (n->leaf) {
+		memcpy(copy->u.leaf.vals, n->u.leaf.vals,
+		       n->nkeys * sizeof(void *));
+	} else {
+		memcpy(copy->u.children, n->u.children,
+		       (n->nkeys + 1) * sizeof(void *));
+		memcpy(copy->u.counts, n->u.counts,
+		       (n->nkeys + 1) * sizeof(unsigned long));
+		for (i = 0; i <= n->nkeys; i++)
+			atomic_fetch_add_explicit(&n->u.children[i]->refs, 1,
+						  memory_order_relaxed);
+	}
+
+	*slot = copy;
+	node_release(t, n);
+
+	return copy;
+}
+
+#if defined(BTREE_HAVE_AVX2)
+
+/*
+ * Returns the number of keys in n that are less than k, or less than
+ * or equal to k if or_equal is set.
+ */
+__attribute__ ((target("avx2,popcnt")))
+static int avx2_rank(const struct btree_node *n, intptr_t k, int or_equal)
+{
+	const __m256i kv = _mm256_set1_epi64x(k);
+	const long long *keys = (const long long *)n->keys;
+	unsigned long long gt = 0;	/* bit i set if keys[i] > k */
+	unsigned long long lt = 0;	/* bit i set if keys[i] < k */
+	unsigned long long valid;
+	int i;
+
+	for (i = 0; i + 4 <= BTREE_NODE_KEYS && i < n->nkeys; i += 4) {
+		__m256i kn = _mm256_loadu_si256((const __m256i *)&keys[i]);
+		if (or_equal)
+			gt |= (unsigned long long)
+			    _mm256_movemask_pd(_mm256_castsi256_pd
+					       (_mm256_cmpgt_epi64(kn, kv))) << i;
+		else
+			lt |= (unsigned long long)
+			    _mm256_movemask_pd(_mm256_castsi256_pd
+					       (_mm256_cmpgt_epi64(kv, kn))) << i;
+	}
+
+	/* Node sizes that aren't a multiple of four leave a tail. */
+	for (; i < n->nkeys; i++) {
+		gt |= (unsigned long long)((intptr_t) n->keys[i] > k) << i;
+		lt |= (unsigned long long)((intptr_t) n->keys[i] < k) << i;
+	}
+
+	valid = (n->nkeys < 64) ? (1ULL << n->nkeys) - 1 : ~0ULL;
+
+	if (or_equal)
+		return n->nkeys - __builtin_popcountll(gt & valid);
+
+	return __builtin_popcountll(lt & valid);
+}
+
+#endif
+
+static INLINE int direct_rank(const struct btree *t,
+			      const struct btree_node *n, intptr_t k,
+			      int or_equal)
+{
+	int i, rank = 0;
+
+#if defined(BTREE_HAVE_AVX2)
+	if (t->avx2)
+		return avx2_rank(n, k, or_equal);
+#else
+	(void)t;
+#endif
+
+	if (or_equal) {
+		for (i = 0; i < n->nkeys; i++)
+			rank += ((intptr_t) n->keys[i] <= k);
+	} else {
+		for (i = 0; i < n->nkeys; i++)
+			rank += ((intptr_t) n->keys[i] < k);
+	}
+
+	return rank;
+}
+
+static int string_compare(const void *a, const void *b)
+{
+	return strcmp((const char *)a, (const char *)b);
+}
+
+/*
+ * Returns up to the first 8 bytes of s packed big-endian, so that
+ * heads compare like strcmp() on those bytes.  The low byte is zero if
+ * s ends within them.
+ */
+static INLINE uint64_t key_head(const char *s)
+{
+	uint64_t h = 0;
+	int i;
+
+	for (i = 0; i < 8 && s[i] != '\0'; i++)
+		h |= (uint64_t)(unsigned char)s[i] << (56 - 8 * i);
+
+	return h;
+}
+
+static INLINE int common_prefix(const char *a, const char *b)
+{
+	int i = 0;
+
+	while (a[i] != '\0' && a[i] == b[i])
+		i++;
+
+	return i;
+}
+
+/* Recomputes the prefix and every head of n. */
+
+static void prefix_refresh(const struct btree *t, struct btree_node *n)
+{
+	int i;
+
+	if (!t->strings || n->nkeys == 0)
+		return;
+
+	n->prefix = common_prefix(n->keys[0], n->keys[n->nkeys - 1]);
+	for (i = 0; i < n->nkeys; i++)
+		n->heads[i] = key_head((const char *)n->keys[i] + n->prefix);
+}
+
+/*
+ * Updates n after keys[pos] has been stored, with the heads of any
+ * keys that moved already moved along with them.  The new key can
+ * only shorten the prefix if it is the first or last key.
+ */
+static void prefix_set(const struct btree *t, struct btree_node *n, int pos)
+{
+	const char *k = n->keys[pos];
+	int p = n->prefix;
+
+	if (!t->strings)
+		return;
+
+	if (n->nkeys == 1)
+		p = common_prefix(k, k);
+	else if (pos == 0)
+		p = common_prefix(k, n->keys[n->nkeys - 1]);
+	else if (pos == n->nkeys - 1)
+		p = common_prefix(n->keys[0], k);
+
+	if (p < n->prefix || n->nkeys == 1) {
+		n->prefix = p;
+		prefix_refresh(t, n);
+	} else {
+		n->heads[pos] = key_head(k + n->prefix);
+	}
+}
+
+/* Moves count heads of n from index from to index to, like memmove(). */
+
+static INLINE void heads_move(const struct btree *t, struct btree_node *n,
+			      int to, int from, int count)
+{
+	if (t->strings)
+		memmove(&n->heads[to], &n->heads[from],
+			count * sizeof(uint64_t));
+}
+
+/*
+ * Returns the number of keys in n that are less than k, or less than
+ * or equal to k if or_equal is set, and sets *found if k is present.
+ */
+static int string_rank(const struct btree_node *n, const char *k,
+		       int or_equal, int *found)
+{
+	int c, lo = 0, hi = n->nkeys;
+	uint64_t hk;
+
+	*found = 0;
+
+	if (n->nkeys == 0)
+		return 0;
+
+	if ((c = strncmp(k, n->keys[0], n->prefix)) != 0)
+		return (c < 0) ? 0 : n->nkeys;
+
+	k += n->prefix;
+	hk = key_head(k);
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (n->heads[mid] != hk)
+			c = (n->heads[mid] < hk) ? -1 : 1;
+		else if ((hk & 0xff) == 0)
+			c = 0;	/* both end within the head */
+		else
+			c = strcmp((const char *)n->keys[mid] + n->prefix + 8,
+				   k + 8);
+
+		if (c == 0)
+			*found = 1;
+
+		if (c < 0 || (c == 0 && or_equal))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* Returns the index of the first key in n that is greater than k. */
+
+static INLINE int upper_bound(const struct btree *t,
+			      const struct btree_node *n, const void *k)
+{
+	int lo = 0, hi = n->nkeys;
+
+	if (t->direct)
+		return direct_rank(t, n, (intptr_t) k, 1);
+
+	if (t->strings)
+		return string_rank(n, k, 1, &lo);
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (t->compare_fn(n->keys[mid], k) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+ * Returns the index of the first key in n that is not less than k and
+ * sets *found if that key is equal to k.
+ */
+static INLINE int lower_bound(const struct btree *t,
+			      const struct btree_node *n, const void *k,
+			      int *found)
+{
+	int lo = 0, hi = n->nkeys;
+
+	if (t->direct) {
+		lo = direct_rank(t, n, (intptr_t) k, 0);
+		*found = (lo < n->nkeys && n->keys[lo] == k);
+		return lo;
+	}
+
+	if (t->strings)
+		return string_rank(n, k, 0, found);
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (t->compare_fn(n->keys[mid], k) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*found = (lo < n->nkeys && t->compare_fn(n->keys[lo], k) == 0);
+
+	return lo;
+}
+
+static INLINE struct btree_node *find_leaf(const struct btree *t,
+					   const void *k)
+{
+	struct btree_node *n = t->root;
+
+	while (!n->leaf)
+		n = n->u.children[upper_bound(t, n, k)];
+
+	return n;
+}
+
+static INLINE struct btree_node *leftmost_leaf(const struct btree *t)
+{
+	struct btree_node *n = t->root;
+
+	while (!n->leaf)
+		n = n->u.children[0];
+
+	return n;
+}
+
+static INLINE void *subtree_min(const struct btree_node *n)
+{
+	while (!n->leaf)
+		n = n->u.children[0];
+
+	return n->keys[0];
+}
+
+static INLINE struct btree_node *rightmost_leaf(struct btree_node *n)
+{
+	while (!n->leaf)
+		n = n->u.children[n->nkeys];
+
+	return n;
+}
+
+static INLINE void leaf_insert_at(const struct btree *t,
+				  struct btree_node *n, int pos, void *k,
+				  void *v)
+{
+	int nmove = n->nkeys - pos;
+
+	memmove(&n->keys[pos + 1], &n->keys[pos], nmove * sizeof(void *));
+	memmove(&n->u.leaf.vals[pos + 1], &n->u.leaf.vals[pos],
+		nmove * sizeof(void *));
+	heads_move(t, n, pos + 1, pos, nmove);
+	n->keys[pos] = k;
+	n->u.leaf.vals[pos] = v;
+	n->nkeys++;
+	prefix_set(t, n, pos);
+}
+
+static void leaf_insert(struct btree *t, struct btree_node *n, void *k,
+			void *v, struct split *s)
+{
+	struct btree_node *right;
+	int found, mid, split_at, pos = lower_bound(t, n, k, &found);
+
+	if (found) {
+		if (t->val_free_fn != NULL)
+			t->val_free_fn(n->u.leaf.vals[pos]);
+		n->u.leaf.vals[pos] = v;
+		return;
+	}
+
+	t->nentries++;
+
+	if (n->nkeys < BTREE_NODE_KEYS) {
+		leaf_insert_at(t, n, pos, k, v);
+		return;
+	}
+
+	/* Split so that the left node ends up with mid keys. */
+
+	right = node_new(t, 1);
+	mid = (BTREE_NODE_KEYS + 1) / 2;
+	split_at = (pos < mid) ? mid - 1 : mid;
+
+	right->nkeys = n->nkeys - split_at;
+	memcpy(right->keys, &n->keys[split_at], right->nkeys * sizeof(void *));
+	memcpy(right->u.leaf.vals, &n->u.leaf.vals[split_at],
+	       right->nkeys * sizeof(void *));
+	n->nkeys = split_at;
+
+	if (pos < mid)
+		leaf_insert_at(t, n, pos, k, v);
+	else
+		leaf_insert_at(t, right, pos - mid, k, v);
+
+	/* Each half may share a longer prefix than the whole did. */
+	prefix_refresh(t, n);
+	prefix_refresh(t, right);
+
+	right->u.leaf.next = n->u.leaf.next;
+	n->u.leaf.next = right;
+
+	s->key = right->keys[0];
+	s->right = right;
+}
+
+/*
+ * Adds the separator and right node of a split child at index ci,
+ * splitting n in turn if it is full.
+ */
+static void inner_insert(struct btree *t, struct btree_node *n, int ci,
+			 const struct split *cs, struct split *s)
+{
+	void *keys[BTREE_NODE_KEYS + 1];
+	struct btree_node *children[BTREE_NODE_KEYS + 2];
+	unsigned long counts[BTREE_NODE_KEYS + 2];
+	struct btree_node *right;
+	int nmove = n->nkeys - ci, mid;
+
+	if (n->nkeys < BTREE_NODE_KEYS) {
+		memmove(&n->keys[ci + 1], &n->keys[ci], nmove * sizeof(void *));
+		memmove(&n->u.children[ci + 2], &n->u.children[ci + 1],
+			nmove * sizeof(void *));
+		memmove(&n->u.counts[ci + 2], &n->u.counts[ci + 1],
+			nmove * sizeof(unsigned long));
+		heads_move(t, n, ci + 1, ci, nmove);
+		n->keys[ci] = cs->key;
+		n->u.children[ci + 1] = cs->right;
+		n->u.counts[ci + 1] = node_total(cs->right);
+		n->nkeys++;
+		prefix_set(t, n, ci);
+		return;
+	}
+
+	memcpy(keys, n->keys, ci * sizeof(void *));
+	keys[ci] = cs->key;
+	memcpy(&keys[ci + 1], &n->keys[ci], nmove * sizeof(void *));
+
+	memcpy(children, n->u.children, (ci + 1) * sizeof(void *));
+	children[ci + 1] = cs->right;
+	memcpy(&children[ci + 2], &n->u.children[ci + 1],
+	       nmove * sizeof(void *));
+
+	memcpy(counts, n->u.counts, (ci + 1) * sizeof(unsigned long));
+	counts[ci + 1] = node_total(cs->right);
+	memcpy(&counts[ci + 2], &n->u.counts[ci + 1],
+	       nmove * sizeof(unsigned long));
+
+	/* Keep mid keys on the left and promote the next one. */
+
+	right = node_new(t, 0);
+	mid = (BTREE_NODE_KEYS + 1) / 2;
+
+	n->nkeys = mid;
+	memcpy(n->keys, keys, mid * sizeof(void *));
+	memcpy(n->u.children, children, (mid + 1) * sizeof(void *));
+	memcpy(n->u.counts, counts, (mid + 1) * sizeof(unsigned long));
+
+	right->nkeys = BTREE_NODE_KEYS - mid;
+	memcpy(right->keys, &keys[mid + 1], right->nkeys * sizeof(void *));
+	memcpy(right->u.children, &children[mid + 1],
+	       (right->nkeys + 1) * sizeof(void *));
+	memcpy(right->u.counts, &counts[mid + 1],
+	       (right->nkeys + 1) * sizeof(unsigned long));
+
+	prefix_refresh(t, n);
+	prefix_refresh(t, right);
+
+	s->key = keys[mid];
+	s->right = right;
+}
+
+static void node_insert(struct btree *t, struct btree_node *n, void *k,
+			void *v, struct split *s)
+{
+	struct btree_node *c;
+	struct split cs;
+	unsigned long before = t->nentries;
+	int ci;
+
+	if (n->leaf) {
+		leaf_insert(t, n, k, v, s);
+		return;
+	}
+
+	ci = upper_bound(t, n, k);
+	cs.right = NULL;
+	c = own(t, &n->u.children[ci]);
+	node_insert(t, c, k, v, &cs);
+
+	if (cs.right == NULL) {
+		n->u.counts[ci] += t->nentries - before;
+		return;
+	}
+
+	n->u.counts[ci] = node_total(c);
+	inner_insert(t, n, ci, &cs, s);
+}
+
+int btree_insert(struct btree *t, void *k, void *v)
+{
+	struct split s;
+
+	if (reserve_nodes(t) != 0)
+		return 1;
+
+	s.right = NULL;
+	node_insert(t, own(t, &t->root), k, v, &s);
+
+	if (s.right != NULL) {
+		struct btree_node *root = node_new(t, 0);
+		root->nkeys = 1;
+		root->keys[0] = s.key;
+		root->u.children[0] = t->root;
+		root->u.children[1] = s.right;
+		root->u.counts[0] = node_total(t->root);
+		root->u.counts[1] = node_total(s.right);
+		prefix_refresh(t, root);
+		t->root = root;
+		t->height++;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns how many nodes a level of m items (keys for leaves,
+ * children for inner nodes) is packed into, given the target number
+ * of items per node.  Spreading the items evenly over that many nodes
+ * must not leave any node with fewer than min items unless it is the
+ * only node, i.e., the root.
+ */
+static size_t level_nodes(size_t m, int per_node, int min)
+{
+	size_t nn = (m + per_node - 1) / per_node;
+
+	if (nn > 1 && m / nn < (size_t)min)
+		nn = m / min;
+
+	return nn;
+}
+
+/* Frees spare nodes beyond what reserve_nodes() would keep. */
+
+static void release_nodes(struct btree *t)
+{
+	while (t->nspare > spares_needed(t)) {
+		struct btree_node *n = t->spare;
+		t->spare = n->u.children[0];
+		t->nspare--;
+		t->free_fn(n);
+	}
+}
+
+int btree_bulk_load(struct btree *t, void **keys, void **vals, size_t n,
+		    double fill_factor)
+{
+	struct btree_node **nodes;
+	void **mins;		/* smallest key below each of nodes[] */
+	size_t i, m, nn, pos, nleaves, total;
+	int leaf_fill, inner_fill, height;
+
+	if (t->nentries != 0)
+		return 1;
+
+	for (i = 1; i < n; i++) {
+		if (t->compare_fn(keys[i - 1], keys[i]) >= 0)
+			return 1;
+	}
+
+	if (n == 0)
+		return 0;
+
+	if (!(fill_factor >= 0.5))
+		fill_factor = 0.5;
+	if (fill_factor > 1.0)
+		fill_factor = 1.0;
+
+	leaf_fill = (int)(BTREE_NODE_KEYS * fill_factor + 0.5);
+	if (leaf_fill < MIN_KEYS)
+		leaf_fill = MIN_KEYS;
+	inner_fill = (int)((BTREE_NODE_KEYS + 1) * fill_factor + 0.5);
+	if (inner_fill < MIN_KEYS + 1)
+		inner_fill = MIN_KEYS + 1;
+
+	/* Allocate every node up front so the build itself can't fail. */
+
+	nleaves = level_nodes(n, leaf_fill, MIN_KEYS);
+	total = nleaves;
+	for (m = nleaves; m > 1; m = nn) {
+		nn = level_nodes(m, inner_fill, MIN_KEYS + 1);
+		total += nn;
+	}
+
+	nodes = t->malloc_fn(nleaves * sizeof(*nodes));
+	mins = t->malloc_fn(nleaves * sizeof(*mins));
+
+	if (nodes == NULL || mins == NULL)
+		goto fail;
+
+	for (i = 0; i < total; i++) {
+		struct btree_node *node;
+
+		if ((node = t->malloc_fn(t->node_size)) == NULL)
+			goto fail;
+
+		node->u.children[0] = t->spare;
+		t->spare = node;
+		t->nspare++;
+	}
+
+	/* Fill the leaves left to right... */
+
+	for (i = 0, pos = 0; i < nleaves; i++) {
+		struct btree_node *leaf = node_new(t, 1);
+
+		leaf->nkeys = n / nleaves + (i < n % nleaves);
+		memcpy(leaf->keys, &keys[pos], leaf->nkeys * sizeof(void *));
+		if (vals != NULL)
+			memcpy(leaf->u.leaf.vals, &vals[pos],
+			       leaf->nkeys * sizeof(void *));
+		else
+			memset(leaf->u.leaf.vals, 0,
+			       leaf->nkeys * sizeof(void *));
+
+		if (i > 0)
+			nodes[i - 1]->u.leaf.next = leaf;
+
+		prefix_refresh(t, leaf);
+
+		nodes[i] = leaf;
+		mins[i] = leaf->keys[0];
+		pos += leaf->nkeys;
+	}
+
+	/*
+	 * ...then build each level above from the one below.  A level
+	 * has at most half as many nodes as the one below it, so it can
+	 * be written over the same arrays.
+	 */
+	for (height = 1, m = nleaves; m > 1; m = nn, height++) {
+		nn = level_nodes(m, inner_fill, MIN_KEYS + 1);
+
+		for (i = 0, pos = 0; i < nn; i++) {
+			struct btree_node *inner = node_new(t, 0);
+			int j, nchildren = m / nn + (i < m % nn);
+
+			inner->nkeys = nchildren - 1;
+			inner->u.children[0] = nodes[pos];
+			inner->u.counts[0] = node_total(nodes[pos]);
+			for (j = 1; j < nchildren; j++) {
+				inner->keys[j - 1] = mins[pos + j];
+				inner->u.children[j] = nodes[pos + j];
+				inner->u.counts[j] = node_total(nodes[pos + j]);
+			}
+			prefix_refresh(t, inner);
+
+			nodes[i] = inner;
+			mins[i] = mins[pos];
+			pos += nchildren;
+		}
+	}
+
+	/* An empty tree always has a leaf for its root. */
+
+	node_release(t, t->root);
+	t->root = nodes[0];
+	t->height = height;
+	t->nentries = n;
+
+	t->free_fn(nodes);
+	t->free_fn(mins);
+
+	return 0;
+
+ fail:
+	release_nodes(t);
+	if (nodes != NULL)
+		t->free_fn(nodes);
+	if (mins != NULL)
+		t->free_fn(mins);
+
+	return 1;
+}
+
+/*
+ * Merges the longest run at the start of keys that fits in the leaf
+ * that keys[0] belongs in.  bound points at the smallest separator to
+ * the right of the path taken so far, or is NULL at the right edge of
+ * the tree; keys not less than it belong in a later leaf.  Returns the
+ * number of keys consumed, which is 0 only if the leaf is full and
+ * doesn't already hold keys[0].
+ */
+static size_t node_merge(struct btree *t, struct btree_node *n, void **keys,
+			 void **vals, size_t nkeys, void *const *bound)
+{
+	void *mkeys[BTREE_NODE_KEYS], *mvals[BTREE_NODE_KEYS];
+	unsigned long before = t->nentries;
+	int c = 1, i = 0, out = 0;
+	size_t j;
+
+	if (!n->leaf) {
+		struct btree_node *child;
+		int ci = upper_bound(t, n, keys[0]);
+
+		if (ci < n->nkeys)
+			bound = &n->keys[ci];
+
+		child = own(t, &n->u.children[ci]);
+		j = node_merge(t, child, keys, vals, nkeys, bound);
+		n->u.counts[ci] += t->nentries - before;
+
+		return j;
+	}
+
+	for (j = 0; j < nkeys; j++) {
+		void *v = (vals != NULL) ? vals[j] : NULL;
+
+		if (bound != NULL && t->compare_fn(keys[j], *bound) >= 0)
+			break;
+
+		while (i < n->nkeys &&
+		       (c = t->compare_fn(n->keys[i], keys[j])) < 0) {
+			mkeys[out] = n->keys[i];
+			mvals[out++] = n->u.leaf.vals[i++];
+		}
+
+		if (i < n->nkeys && c == 0) {
+			if (t->val_free_fn != NULL)
+				t->val_free_fn(n->u.leaf.vals[i]);
+			mkeys[out] = n->keys[i++];
+			mvals[out++] = v;
+			continue;
+		}
+
+		if (out + n->nkeys - i == BTREE_NODE_KEYS)
+			break;
+
+		mkeys[out] = keys[j];
+		mvals[out++] = v;
+		t->nentries++;
+	}
+
+	if (j == 0)
+		return 0;
+
+	memcpy(&mkeys[out], &n->keys[i], (n->nkeys - i) * sizeof(void *));
+	memcpy(&mvals[out], &n->u.leaf.vals[i], (n->nkeys - i) * sizeof(void *));
+	n->nkeys = out + n->nkeys - i;
+	memcpy(n->keys, mkeys, n->nkeys * sizeof(void *));
+	memcpy(n->u.leaf.vals, mvals, n->nkeys * sizeof(void *));
+	prefix_refresh(t, n);
+
+	return j;
+}
+
+int btree_merge_sorted(struct btree *t, void **keys, void **vals, size_t n)
+{
+	size_t i, used;
+
+	for (i = 1; i < n; i++) {
+		if (t->compare_fn(keys[i - 1], keys[i]) >= 0)
+			return 1;
+	}
+
+	for (i = 0; i < n; i += used) {
+		if (reserve_nodes(t) != 0)
+			return 1;
+
+		used = node_merge(t, own(t, &t->root), &keys[i],
+				  (vals != NULL) ? &vals[i] : NULL, n - i, NULL);
+
+		/* A full leaf has to be split by a plain insert. */
+
+		if (used == 0) {
+			if (btree_insert(t, keys[i],
+					 (vals != NULL) ? vals[i] : NULL) != 0)
+				return 1;
+			used = 1;
+		}
+	}
+
+	return 0;
+}
+
+void *btree_lookup(const struct btree *t, const void *k)
+{
+	const struct btree_node *n = find_leaf(t, k);
+	int found, pos = lower_bound(t, n, k, &found);
+
+	return found ? n->u.leaf.vals[pos] : NULL;
+}
+
+static void borrow_from_left(const struct btree *t, struct btree_node *p,
+			     int ci)
+{
+	struct btree_node *c = p->u.children[ci];
+	struct btree_node *l = p->u.children[ci - 1];
+	unsigned long moved;	/* entries that change subtree */
+
+	memmove(&c->keys[1], &c->keys[0], c->nkeys * sizeof(void *));
+	heads_move(t, c, 1, 0, c->nkeys);
+
+	if (c->leaf) {
+		memmove(&c->u.leaf.vals[1], &c->u.leaf.vals[0],
+			c->nkeys * sizeof(void *));
+		c->keys[0] = l->keys[l->nkeys - 1];
+		c->u.leaf.vals[0] = l->u.leaf.vals[l->nkeys - 1];
+		p->keys[ci - 1] = c->keys[0];
+		moved = 1;
+	} else {
+		memmove(&c->u.children[1], &c->u.children[0],
+			(c->nkeys + 1) * sizeof(void *));
+		memmove(&c->u.counts[1], &c->u.counts[0],
+			(c->nkeys + 1) * sizeof(unsigned long));
+		c->keys[0] = p->keys[ci - 1];
+		c->u.children[0] = l->u.children[l->nkeys];
+		c->u.counts[0] = moved = l->u.counts[l->nkeys];
+		p->keys[ci - 1] = l->keys[l->nkeys - 1];
+	}
+
+	p->u.counts[ci - 1] -= moved;
+	p->u.counts[ci] += moved;
+
+	l->nkeys--;
+	c->nkeys++;
+	prefix_set(t, c, 0);
+	prefix_set(t, p, ci - 1);
+}
+
+static void borrow_from_right(const struct btree *t, struct btree_node *p,
+			      int ci)
+{
+	struct btree_node *c = p->u.children[ci];
+	struct btree_node *r = p->u.children[ci + 1];
+	unsigned long moved;	/* entries that change subtree */
+
+	if (c->leaf) {
+		c->keys[c->nkeys] = r->keys[0];
+		c->u.leaf.vals[c->nkeys] = r->u.leaf.vals[0];
+		memmove(&r->keys[0], &r->keys[1],
+			(r->nkeys - 1) * sizeof(void *));
+		memmove(&r->u.leaf.vals[0], &r->u.leaf.vals[1],
+			(r->nkeys - 1) * sizeof(void *));
+		p->keys[ci] = r->keys[0];
+		moved = 1;
+	} else {
+		c->keys[c->nkeys] = p->keys[ci];
+		c->u.children[c->nkeys + 1] = r->u.children[0];
+		c->u.counts[c->nkeys + 1] = moved = r->u.counts[0];
+		p->keys[ci] = r->keys[0];
+		memmove(&r->keys[0], &r->keys[1],
+			(r->nkeys - 1) * sizeof(void *));
+		memmove(&r->u.children[0], &r->u.children[1],
+			r->nkeys * sizeof(void *));
+		memmove(&r->u.counts[0], &r->u.counts[1],
+			r->nkeys * sizeof(unsigned long));
+	}
+
+	p->u.counts[ci] += moved;
+	p->u.counts[ci + 1] -= moved;
+
+	heads_move(t, r, 0, 1, r->nkeys - 1);
+	r->nkeys--;
+	c->nkeys++;
+	prefix_set(t, c, c->nkeys - 1);
+	prefix_set(t, p, ci);
+}
+
+/* Merges child i + 1 of p into child i. */
+
+static void merge_children(struct btree *t, struct btree_node *p, int i)
+{
+	struct btree_node *l = p->u.children[i];
+	struct btree_node *r = p->u.children[i + 1];
+
+	if (l->leaf) {
+		memcpy(&l->keys[l->nkeys], r->keys, r->nkeys * sizeof(void *));
+		memcpy(&l->u.leaf.vals[l->nkeys], r->u.leaf.vals,
+		       r->nkeys * sizeof(void *));
+		l->nkeys += r->nkeys;
+		l->u.leaf.next = r->u.leaf.next;
+	} else {
+		l->keys[l->nkeys] = p->keys[i];
+		memcpy(&l->keys[l->nkeys + 1], r->keys,
+		       r->nkeys * sizeof(void *));
+		memcpy(&l->u.children[l->nkeys + 1], r->u.children,
+		       (r->nkeys + 1) * sizeof(void *));
+		memcpy(&l->u.counts[l->nkeys + 1], r->u.counts,
+		       (r->nkeys + 1) * sizeof(unsigned long));
+		l->nkeys += r->nkeys + 1;
+	}
+
+	p->u.counts[i] += p->u.counts[i + 1];
+
+	prefix_refresh(t, l);
+
+	memmove(&p->keys[i], &p->keys[i + 1],
+		(p->nkeys - i - 1) * sizeof(void *));
+	memmove(&p->u.children[i + 1], &p->u.children[i + 2],
+		(p->nkeys - i - 1) * sizeof(void *));
+	memmove(&p->u.counts[i + 1], &p->u.counts[i + 2],
+		(p->nkeys - i - 1) * sizeof(unsigned long));
+	heads_move(t, p, i, i + 1, p->nkeys - i - 1);
+	p->nkeys--;
+
+	t->free_fn(r);
+}
+
+/*
+ * Restores the minimum occupancy of child ci of p.  Both p and the
+ * child are private; the sibling involved is made private first.
+ */
+static void rebalance(struct btree *t, struct btree_node *p, int ci)
+{
+	if (ci > 0 && p->u.children[ci - 1]->nkeys > MIN_KEYS) {
+		own(t, &p->u.children[ci - 1]);
+		borrow_from_left(t, p, ci);
+	} else if (ci < p->nkeys && p->u.children[ci + 1]->nkeys > MIN_KEYS) {
+		own(t, &p->u.children[ci + 1]);
+		borrow_from_right(t, p, ci);
+	} else if (ci > 0) {
+		own(t, &p->u.children[ci - 1]);
+		merge_children(t, p, ci - 1);
+	} else {
+		own(t, &p->u.children[ci + 1]);
+		merge_children(t, p, ci);
+	}
+}
+
+/* Returns 1 if k was found and removed from the subtree at n. */
+
+static int node_remove(struct btree *t, struct btree_node *n, const void *k)
+{
+	struct btree_node *c;
+	int ci, found, is_separator;
+
+	if (n->leaf) {
+		int pos = lower_bound(t, n, k, &found);
+		int nmove = n->nkeys - pos - 1;
+
+		if (!found)
+			return 0;
+
+		if (t->key_free_fn != NULL)
+			t->key_free_fn(n->keys[pos]);
+		if (t->val_free_fn != NULL && n->u.leaf.vals[pos] != NULL)
+			t->val_free_fn(n->u.leaf.vals[pos]);
+
+		memmove(&n->keys[pos], &n->keys[pos + 1],
+			nmove * sizeof(void *));
+		memmove(&n->u.leaf.vals[pos], &n->u.leaf.vals[pos + 1],
+			nmove * sizeof(void *));
+		heads_move(t, n, pos, pos + 1, nmove);
+		n->nkeys--;
+		t->nentries--;
+
+		return 1;
+	}
+
+	ci = upper_bound(t, n, k);
+	c = own(t, &n->u.children[ci]);
+
+	/* Decide now, as k may be freed by the time we come back up. */
+	is_separator = (ci > 0 && t->compare_fn(n->keys[ci - 1], k) == 0);
+
+	if (!node_remove(t, c, k))
+		return 0;
+
+	n->u.counts[ci]--;
+
+	if (is_separator) {
+		n->keys[ci - 1] = subtree_min(c);
+		prefix_set(t, n, ci - 1);
+	}
+
+	if (c->nkeys < MIN_KEYS)
+		rebalance(t, n, ci);
+
+	return 1;
+}
+
+int btree_remove(struct btree *t, const void *k)
+{
+	/* Don't copy the path to a key that isn't there. */
+
+	if (t->persistent) {
+		const struct btree_node *n = find_leaf(t, k);
+		int found;
+
+		lower_bound(t, n, k, &found);
+		if (!found || reserve_nodes(t) != 0)
+			return 1;
+	}
+
+	if (!node_remove(t, own(t, &t->root), k))
+		return 1;
+
+	if (!t->root->leaf && t->root->nkeys == 0) {
+		struct btree_node *root = t->root;
+		t->root = root->u.children[0];
+		t->height--;
+		t->free_fn(root);
+	}
+
+	return 0;
+}
+
+static void free_subtree(struct btree *t, struct btree_node *n)
+{
+	int i;
+
+	if (n->leaf) {
+		for (i = 0; i < n->nkeys; i++) {
+			if (t->key_free_fn != NULL)
+				t->key_free_fn(n->keys[i]);
+			if (t->val_free_fn != NULL)
+				t->val_free_fn(n->u.leaf.vals[i]);
+		}
+	} else {
+		for (i = 0; i <= n->nkeys; i++)
+			free_subtree(t, n->u.children[i]);
+	}
+
+	t->free_fn(n);
+}
+
+void btree_clear(struct btree *t)
+{
+	struct btree_node *root = t->root;
+	int i;
+
+	/*
+	 * A persistent tree takes a new root, or, if none can be
+	 * allocated, empties the old one provided no snapshot shares it.
+	 */
+
+	if (t->persistent) {
+		if (t->spare != NULL || reserve_nodes(t) == 0) {
+			node_release(t, root);
+			root = node_new(t, 1);
+		} else if (atomic_load_explicit(&root->refs,
+						memory_order_acquire) != 1) {
+			return;
+		} else {
+			if (!root->leaf) {
+				for (i = 0; i <= root->nkeys; i++)
+					node_release(t, root->u.children[i]);
+			}
+			root->nkeys = 0;
+			root->leaf = 1;
+			root->prefix = 0;
+			root->u.leaf.next = NULL;
+		}
+		t->root = root;
+		t->height = 1;
+		t->nentries = 0;
+		(void)reserve_nodes(t);
+		return;
+	}
+
+	/* Reuse the root as the new, empty, leaf. */
+
+	if (root->leaf) {
+		for (i = 0; i < root->nkeys; i++) {
+			if (t->key_free_fn != NULL)
+				t->key_free_fn(root->keys[i]);
+			if (t->val_free_fn != NULL)
+				t->val_free_fn(root->u.leaf.vals[i]);
+		}
+	} else {
+		for (i = 0; i <= root->nkeys; i++)
+			free_subtree(t, root->u.children[i]);
+	}
+
+	root->nkeys = 0;
+	root->leaf = 1;
+	root->u.leaf.next = NULL;
+	t->height = 1;
+	t->nentries = 0;
+}
+
+/*
+ * Removes the subtree of height lvl, where leaves have height 0, whose
+ * smallest key is k from the subtree at n, of height h.  Returns the
+ * number of entries removed.  Like node_remove(), each level fixes a
+ * separator that referred to k and rebalances on the way back up; the
+ * parent of the subtree loses a single child so a borrow or merge is
+ * enough to restore it.
+ */
+static unsigned long node_remove_subtree(struct btree *t,
+					 struct btree_node *n, int h,
+					 const void *k, int lvl)
+{
+	struct btree_node *c;
+	unsigned long removed;
+	int ci = upper_bound(t, n, k), is_separator, at;
+
+	if (h == lvl + 1) {
+		c = n->u.children[ci];
+		removed = n->u.counts[ci];
+
+		/* Drop the separator to the left of c, or right of child 0. */
+
+		at = (ci > 0) ? ci - 1 : 0;
+		memmove(&n->keys[at], &n->keys[at + 1],
+			(n->nkeys - at - 1) * sizeof(void *));
+		heads_move(t, n, at, at + 1, n->nkeys - at - 1);
+		memmove(&n->u.children[ci], &n->u.children[ci + 1],
+			(n->nkeys - ci) * sizeof(void *));
+		memmove(&n->u.counts[ci], &n->u.counts[ci + 1],
+			(n->nkeys - ci) * sizeof(unsigned long));
+		n->nkeys--;
+
+		if (t->persistent)
+			node_release(t, c);
+		else
+			free_subtree(t, c);
+
+		return removed;
+	}
+
+	c = own(t, &n->u.children[ci]);
+
+	/* Decide now, as k is freed along with the subtree. */
+	is_separator = (ci > 0 && t->compare_fn(n->keys[ci - 1], k) == 0);
+
+	removed = node_remove_subtree(t, c, h - 1, k, lvl);
+	n->u.counts[ci] -= removed;
+
+	if (is_separator) {
+		n->keys[ci - 1] = subtree_min(c);
+		prefix_set(t, n, ci - 1);
+	}
+
+	if (c->nkeys < MIN_KEYS)
+		rebalance(t, n, ci);
+
+	return removed;
+}
+
+/* Returns 1 if every key under n is less than b. */
+
+static INLINE int below(const struct btree *t, struct btree_node *n,
+			const void *b)
+{
+	n = rightmost_leaf(n);
+
+	return t->compare_fn(n->keys[n->nkeys - 1], b) < 0;
+}
+
+/*
+ * Each pass finds k, the first key in the range, and looks down its
+ * path for the highest subtree that starts at k and ends before b.
+ * That subtree is unlinked whole; if there is none, the leaf holding
+ * k also holds keys outside the range and k is removed on its own.
+ * Only the leaves at either end of the range are emptied key by key.
+ */
+unsigned long btree_delete_range(struct btree *t, const void *a,
+				 const void *b)
+{
+	unsigned long before = t->nentries;
+	struct btree_iter iter;
+
+	if (t->compare_fn(a, b) >= 0)
+		return 0;
+
+	for (;;) {
+		struct btree_node *n, *c = NULL, *left = NULL;
+		void *k;
+		int h;
+
+		btree_lower_bound(t, a, &iter);
+		if (!btree_iter_next(&iter) || t->compare_fn(iter.key, b) >= 0)
+			break;
+
+		k = iter.key;
+		n = t->root;
+
+		if (subtree_min(n) == k && below(t, n, b)) {
+			btree_clear(t);
+			break;
+		}
+
+		for (h = t->height - 1; h > 0; h--, n = c) {
+			int ci = upper_bound(t, n, k);
+
+			if (ci > 0)
+				left = n->u.children[ci - 1];
+			c = n->u.children[ci];
+
+			if (subtree_min(c) == k && below(t, c, b))
+				break;
+		}
+
+		if (h == 0) {
+			if (btree_remove(t, k) != 0)
+				break;
+			continue;
+		}
+
+		if (reserve_nodes(t) != 0)
+			break;
+
+		/* Stitch the leaf chain around the subtree. */
+
+		if (!t->persistent && left != NULL)
+			rightmost_leaf(left)->u.leaf.next =
+			    rightmost_leaf(c)->u.leaf.next;
+
+		t->nentries -= node_remove_subtree(t, own(t, &t->root),
+						   t->height - 1, k, h - 1);
+
+		if (!t->root->leaf && t->root->nkeys == 0) {
+			struct btree_node *root = t->root;
+			t->root = root->u.children[0];
+			t->height--;
+			t->free_fn(root);
+		}
+	}
+
+	return before - t->nentries;
+}
+
+void btree_delete(struct btree *t)
+{
+	struct btree_node *n;
+
+	if (t->persistent)
+		node_release(t, t->root);
+	else
+		free_subtree(t, t->root);
+
+	while ((n = t->spare) != NULL) {
+		t->spare = n->u.children[0];
+		t->free_fn(n);
+	}
+
+	t->free_fn(t);
+}
+
+unsigned long btree_count(const struct btree *t)
+{
+	return t->nentries;
+}
+
+unsigned long btree_rank(const struct btree *t, const void *k)
+{
+	const struct btree_node *n = t->root;
+	unsigned long rank = 0;
+	int i, ci, found;
+
+	while (!n->leaf) {
+		ci = upper_bound(t, n, k);
+		for (i = 0; i < ci; i++)
+			rank += n->u.counts[i];
+		n = n->u.children[ci];
+	}
+
+	return rank + lower_bound(t, n, k, &found);
+}
+
+unsigned long btree_count_range(const struct btree *t, const void *a,
+				const void *b)
+{
+	if (t->compare_fn(a, b) >= 0)
+		return 0;
+
+	return btree_rank(t, b) - btree_rank(t, a);
+}
+
+struct btree *btree_create(BTREE_COMPARE_FN compare_fn,
+			   BTREE_KEY_FREE_FN key_free_fn,
+			   BTREE_VAL_FREE_FN val_free_fn,
+			   BTREE_MALLOC_FN malloc_fn, BTREE_FREE_FN free_fn)
+{
+	struct btree *t;
+
+	malloc_fn = (malloc_fn != NULL) ? malloc_fn : malloc;
+	free_fn = (free_fn != NULL) ? free_fn : free;
+	if ((t = malloc_fn(sizeof(*t))) == NULL)
+		return NULL;
+
+	t->direct = (compare_fn == NULL);
+	t->compare_fn = t->direct ? btree_direct_compare : compare_fn;
+#if defined(BTREE_HAVE_AVX2)
+	t->avx2 = t->direct && __builtin_cpu_supports("avx2");
+#else
+	t->avx2 = 0;
+#endif
+	t->persistent = 0;
+	t->strings = 0;
+	t->node_size = sizeof(struct btree_node);
+	t->nentries = 0;
+	t->height = 1;
+	t->key_free_fn = key_free_fn;
+	t->val_free_fn = val_free_fn;
+	t->malloc_fn = malloc_fn;
+	t->free_fn = free_fn;
+	t->spare = NULL;
+	t->nspare = 0;
+
+	if (reserve_nodes(t) != 0) {
+		while (t->spare != NULL) {
+			struct btree_node *n = t->spare;
+			t->spare = n->u.children[0];
+			free_fn(n);
+		}
+		free_fn(t);
+		return NULL;
+	}
+
+	t->root = node_new(t, 1);
+
+	return t;
+}
+
+int btree_set_persistent(struct btree *t)
+{
+	if (t->nentries != 0 || t->key_free_fn != NULL ||
+	    t->val_free_fn != NULL)
+		return 1;
+
+	t->persistent = 1;
+
+	return 0;
+}
+
+int btree_set_string_keys(struct btree *t)
+{
+	struct btree_node *n, *spare = NULL;
+	size_t size = sizeof(*n) + BTREE_NODE_KEYS * sizeof(uint64_t);
+	int i, nspare = spares_needed(t) + 1;
+
+	if (t->nentries != 0)
+		return 1;
+
+	if (t->strings)
+		return 0;
+
+	/*
+	 * Nodes grow by the array of heads, so replace the empty root
+	 * and the spares.  The extra spare becomes the new root.
+	 */
+	for (i = 0; i < nspare; i++) {
+		if ((n = t->malloc_fn(size)) == NULL) {
+			while ((n = spare) != NULL) {
+				spare = n->u.children[0];
+				t->free_fn(n);
+			}
+			return 1;
+		}
+		n->u.children[0] = spare;
+		spare = n;
+	}
+
+	node_release(t, t->root);
+	while ((n = t->spare) != NULL) {
+		t->spare = n->u.children[0];
+		t->free_fn(n);
+	}
+
+	t->spare = spare;
+	t->nspare = nspare;
+	t->node_size = size;
+	t->strings = 1;
+	t->direct = 0;
+	t->avx2 = 0;
+	t->compare_fn = string_compare;
+	t->root = node_new(t, 1);
+
+	return 0;
+}
+
+struct btree *btree_snapshot(struct btree *t)
+{
+	struct btree *s;
+
+	if (!t->persistent || (s = t->malloc_fn(sizeof(*s))) == NULL)
+		return NULL;
+
+	*s = *t;
+	s->spare = NULL;
+	s->nspare = 0;
+
+	if (reserve_nodes(s) != 0) {
+		struct btree_node *n;
+		while ((n = s->spare) != NULL) {
+			s->spare = n->u.children[0];
+			s->free_fn(n);
+		}
+		s->free_fn(s);
+		return NULL;
+	}
+
+	atomic_fetch_add_explicit(&t->root->refs, 1, memory_order_relaxed);
+
+	return s;
+}
+
+/*
+ * Returns the leaf to the right of n.  A persistent tree looks for the
+ * leaf that holds the successor of the last key in n, which is the
+ * leftmost leaf under the nearest ancestor with a child to the right.
+ */
+static const struct btree_node *next_leaf(const struct btree *t,
+					  const struct btree_node *n)
+{
+	const struct btree_node *p, *next = NULL;
+	const void *k;
+
+	if (!t->persistent)
+		return n->u.leaf.next;
+
+	if (n->nkeys == 0)
+		return NULL;
+
+	k = n->keys[n->nkeys - 1];
+
+	for (p = t->root; !p->leaf;) {
+		int ci = upper_bound(t, p, k);
+		if (ci < p->nkeys)
+			next = p->u.children[ci + 1];
+		p = p->u.children[ci];
+	}
+
+	if (next != NULL) {
+		while (!next->leaf)
+			next = next->u.children[0];
+	}
+
+	return next;
+}
+
+unsigned long btree_apply(const struct btree *t, BTREE_APPLY_FN apply,
+			  void *client_data)
+{
+	unsigned long nentries = 0;
+	const struct btree_node *n;
+	int i;
+
+	for (n = leftmost_leaf(t); n != NULL; n = next_leaf(t, n)) {
+		for (i = 0; i < n->nkeys; i++) {
+			nentries++;
+			if (!apply(n->keys[i], n->u.leaf.vals[i], client_data))
+				return nentries;
+		}
+	}
+
+	return nentries;
+}
+
+static void iter_set(struct btree_iter *iter, const struct btree_node *n,
+		     int pos)
+{
+	/* We have to do some funky casting in order to initialize the
+	 * private fields as they are declared const -- we don't want
+	 * clients changing them but we need to. */
+
+	*(const struct btree_node **)&iter->node = n;
+	*(int *)&iter->pos = pos;
+}
+
+void btree_iter_init(const struct btree *t, struct btree_iter *iter)
+{
+	iter->key = iter->val = NULL;
+	*(const struct btree **)&iter->tree = t;
+	iter_set(iter, leftmost_leaf(t), 0);
+}
+
+void btree_select(const struct btree *t, unsigned long i,
+		  struct btree_iter *iter)
+{
+	const struct btree_node *n = t->root;
+	int ci;
+
+	iter->key = iter->val = NULL;
+	*(const struct btree **)&iter->tree = t;
+
+	if (i >= t->nentries) {
+		iter_set(iter, NULL, 0);
+		return;
+	}
+
+	while (!n->leaf) {
+		for (ci = 0; ci < n->nkeys && i >= n->u.counts[ci]; ci++)
+			i -= n->u.counts[ci];
+		n = n->u.children[ci];
+	}
+
+	iter_set(iter, n, (int)i);
+}
+
+void btree_lower_bound(const struct btree *t, const void *k,
+		       struct btree_iter *iter)
+{
+	const struct btree_node *n = find_leaf(t, k);
+	int found;
+
+	iter->key = iter->val = NULL;
+	*(const struct btree **)&iter->tree = t;
+	iter_set(iter, n, lower_bound(t, n, k, &found));
+}
+
+int btree_iter_next(struct btree_iter *iter)
+{
+	const struct btree_node *n = iter->node;
+	int pos = iter->pos;
+
+	while (n != NULL && pos >= n->nkeys) {
+		n = next_leaf(iter->tree, n);
+		pos = 0;
+	}
+
+	if (n == NULL) {
+		iter_set(iter, NULL, 0);
+		return 0;
+	}
+
+	iter->key = n->keys[pos];
+	iter->val = n->u.leaf.vals[pos];
+	iter_set(iter, n, pos + 1);
+
+	return 1;
+}
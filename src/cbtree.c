@@ -0,0 +1,633 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * A B+tree with optimistic lock coupling.
+ *
+ * The version word of a node counts modifications in its upper bits;
+ * bit 1 is set while a writer holds the node and bit 0 once it has
+ * been unlinked.  A reader loads the version, reads what it needs and
+ * then checks that the version is unchanged; every field that may be
+ * read while a writer is active is atomic, so such reads are merely
+ * stale and never undefined.  On the way down a reader validates each
+ * inner node after reading the child pointer, before touching the
+ * child, and again after noting the child's version, which catches a
+ * child that was split in between.
+ *
+ * Writers upgrade the version they read to a lock with a single
+ * compare-and-swap, which fails if anything changed since, so a writer
+ * never has to revalidate what it read before locking.  A full node is
+ * split while descending, with its parent locked, so the parent always
+ * has room for the new separator.
+ */
+
+#define _GNU_SOURCE
+
+#include <stddef.h>		/* size_t, NULL */
+#include <stdlib.h>		/* malloc, free */
+#include <stdint.h>		/* intptr_t, uint64_t */
+#include <stdatomic.h>
+#include <sched.h>		/* sched_yield */
+#include <c-hacks/cbtree.h>
+
+#ifndef CBTREE_NODE_KEYS
+#define CBTREE_NODE_KEYS 16
+#endif
+
+#if CBTREE_NODE_KEYS < 3
+#error "CBTREE_NODE_KEYS must be at least 3"
+#endif
+
+#define OBSOLETE	1
+#define LOCKED		2
+
+/* Restarts before a thread gives up its time slice to the writer. */
+#define SPIN_RESTARTS	16
+
+#if defined(_MSC_VER)
+#define INLINE __inline
+#else
+#define INLINE inline
+#endif
+
+#define LOAD(P)		atomic_load_explicit((P), memory_order_relaxed)
+#define STORE(P, V)	atomic_store_explicit((P), (V), memory_order_relaxed)
+
+struct cbtree_node {
+	_Atomic uint64_t version;
+	atomic_int nkeys;
+	int leaf;
+	_Atomic intptr_t keys[CBTREE_NODE_KEYS];
+	union {
+		_Atomic(struct cbtree_node *) children[CBTREE_NODE_KEYS + 1];
+		_Atomic(void *) vals[CBTREE_NODE_KEYS];
+	} u;
+};
+
+struct cbtree {
+	_Atomic(struct cbtree_node *) root;
+	atomic_ulong nentries;
+	struct epoch *epoch;
+	CBTREE_VAL_FREE_FN val_free_fn;
+	CBTREE_MALLOC_FN malloc_fn;
+	CBTREE_FREE_FN free_fn;
+};
+
+/* Notes the version of n.  Returns 1 if n is locked or obsolete. */
+
+static INLINE int read_lock(struct cbtree_node *n, uint64_t *version)
+{
+	*version = atomic_load_explicit(&n->version, memory_order_acquire);
+	return (*version & (LOCKED | OBSOLETE)) != 0;
+}
+
+/* Returns 1 if n has changed since version was noted. */
+
+static INLINE int validate(struct cbtree_node *n, uint64_t version)
+{
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(&n->version,
+				    memory_order_relaxed) != version;
+}
+
+/* Locks n if it is unchanged since version.  Returns 1 on failure. */
+
+static INLINE int upgrade(struct cbtree_node *n, uint64_t version)
+{
+	if (!atomic_compare_exchange_strong(&n->version, &version,
+					    version + LOCKED))
+		return 1;
+
+	/* Readers that see our stores must also see the lock. */
+	atomic_thread_fence(memory_order_release);
+	return 0;
+}
+
+static INLINE void write_unlock(struct cbtree_node *n)
+{
+	atomic_fetch_add_explicit(&n->version, LOCKED, memory_order_release);
+}
+
+static INLINE void write_unlock_obsolete(struct cbtree_node *n)
+{
+	atomic_fetch_add_explicit(&n->version, LOCKED + OBSOLETE,
+				  memory_order_release);
+}
+
+static INLINE void backoff(int *restarts)
+{
+	if (++*restarts % SPIN_RESTARTS == 0)
+		sched_yield();
+}
+
+/*
+ * Returns the number of keys in n that are less than k, or less than
+ * or equal to k if or_equal is set.  For an inner node with or_equal
+ * set that is the index of the child to descend into.
+ */
+static INLINE int rank(struct cbtree_node *n, intptr_t k, int or_equal)
+{
+	int i, r = 0, nkeys = LOAD(&n->nkeys);
+
+	if (or_equal) {
+		for (i = 0; i < nkeys; i++)
+			r += (LOAD(&n->keys[i]) <= k);
+	} else {
+		for (i = 0; i < nkeys; i++)
+			r += (LOAD(&n->keys[i]) < k);
+	}
+
+	return r;
+}
+
+static INLINE struct cbtree_node *load_child(struct cbtree_node *n, int i)
+{
+	return atomic_load_explicit(&n->u.children[i], memory_order_acquire);
+}
+
+static INLINE struct cbtree_node *load_root(struct cbtree *t)
+{
+	return atomic_load_explicit(&t->root, memory_order_acquire);
+}
+
+static struct cbtree_node *node_new(struct cbtree *t, int leaf)
+{
+	struct cbtree_node *n;
+
+	if ((n = t->malloc_fn(sizeof(*n))) == NULL)
+		return NULL;
+
+	atomic_init(&n->version, 0);
+	atomic_init(&n->nkeys, 0);
+	n->leaf = leaf;
+
+	return n;
+}
+
+/*
+ * Descends to the leaf for k.  On success the leaf, its version, its
+ * parent (NULL for a root leaf), the parent's version and the index of
+ * the leaf in its parent are returned.  If fence is not NULL it is set
+ * to the smallest separator above k on the path, which bounds the keys
+ * in the leaf; *has_fence is 0 for the rightmost leaf.  Returns 1 if
+ * the caller has to restart.
+ */
+static int find_leaf(struct cbtree *t, intptr_t k, struct cbtree_node **leaf,
+		     uint64_t *version, struct cbtree_node **parent,
+		     uint64_t *parent_version, int *ci, intptr_t *fence,
+		     int *has_fence)
+{
+	struct cbtree_node *n = load_root(t), *p = NULL, *c;
+	uint64_t v, pv = 0, cv;
+	int i = 0;
+
+	if (has_fence != NULL)
+		*has_fence = 0;
+
+	if (read_lock(n, &v) || n != load_root(t))
+		return 1;
+
+	while (!n->leaf) {
+		i = rank(n, k, 1);
+
+		if (fence != NULL && i < LOAD(&n->nkeys)) {
+			*fence = LOAD(&n->keys[i]);
+			*has_fence = 1;
+		}
+
+		c = load_child(n, i);
+
+		if (validate(n, v) || read_lock(c, &cv) || validate(n, v))
+			return 1;
+
+		p = n;
+		pv = v;
+		n = c;
+		v = cv;
+	}
+
+	*leaf = n;
+	*version = v;
+	*parent = p;
+	*parent_version = pv;
+	*ci = i;
+
+	return 0;
+}
+
+/*
+ * Splits the locked node n, whose parent p (NULL if n is the root) is
+ * also locked.  Returns 1 if no memory is available.
+ */
+static int split(struct cbtree *t, struct cbtree_node *n,
+		 struct cbtree_node *p)
+{
+	struct cbtree_node *r = node_new(t, n->leaf);
+	int i, ci, mid = CBTREE_NODE_KEYS / 2, nkeys = LOAD(&n->nkeys);
+	intptr_t sep;
+
+	if (r == NULL)
+		return 1;
+
+	if (n->leaf) {
+		for (i = mid; i < nkeys; i++) {
+			STORE(&r->keys[i - mid], LOAD(&n->keys[i]));
+			STORE(&r->u.vals[i - mid], LOAD(&n->u.vals[i]));
+		}
+		STORE(&r->nkeys, nkeys - mid);
+		sep = LOAD(&r->keys[0]);
+		STORE(&n->nkeys, mid);
+	} else {
+		/* keys[mid] moves up to the parent. */
+		sep = LOAD(&n->keys[mid]);
+		for (i = mid + 1; i < nkeys; i++)
+			STORE(&r->keys[i - mid - 1], LOAD(&n->keys[i]));
+		for (i = mid + 1; i <= nkeys; i++)
+			STORE(&r->u.children[i - mid - 1],
+			      LOAD(&n->u.children[i]));
+		STORE(&r->nkeys, nkeys - mid - 1);
+		STORE(&n->nkeys, mid);
+	}
+
+	if (p == NULL) {
+		struct cbtree_node *root = node_new(t, 0);
+
+		if (root == NULL) {
+			/* Nothing was published yet; undo the split. */
+			STORE(&n->nkeys, nkeys);
+			t->free_fn(r);
+			return 1;
+		}
+
+		STORE(&root->keys[0], sep);
+		STORE(&root->u.children[0], n);
+		STORE(&root->u.children[1], r);
+		STORE(&root->nkeys, 1);
+		atomic_store_explicit(&t->root, root, memory_order_release);
+		return 0;
+	}
+
+	nkeys = LOAD(&p->nkeys);
+
+	for (ci = 0; LOAD(&p->u.children[ci]) != n; ci++)
+		;
+
+	for (i = nkeys; i > ci; i--) {
+		STORE(&p->keys[i], LOAD(&p->keys[i - 1]));
+		STORE(&p->u.children[i + 1], LOAD(&p->u.children[i]));
+	}
+
+	STORE(&p->keys[ci], sep);
+	atomic_store_explicit(&p->u.children[ci + 1], r, memory_order_release);
+	STORE(&p->nkeys, nkeys + 1);
+
+	return 0;
+}
+
+static void retire_val(struct cbtree *t, struct epoch_thread *self, void *v)
+{
+	if (t->val_free_fn != NULL && v != NULL)
+		epoch_retire(self, v, t->val_free_fn);
+}
+
+int cbtree_insert(struct cbtree *t, struct epoch_thread *self, intptr_t k,
+		  void *v)
+{
+	struct cbtree_node *n, *p, *c;
+	uint64_t nv, pv, cv;
+	int i, pos, nkeys, restarts = 0;
+	void *old;
+
+	epoch_enter(self);
+
+	goto start;
+ restart:
+	backoff(&restarts);
+ start:
+	n = load_root(t);
+	p = NULL;
+	pv = 0;
+
+	if (read_lock(n, &nv) || n != load_root(t))
+		goto restart;
+
+	for (;;) {
+		if (LOAD(&n->nkeys) == CBTREE_NODE_KEYS) {
+			if (p != NULL && upgrade(p, pv))
+				goto restart;
+			if (upgrade(n, nv)) {
+				if (p != NULL)
+					write_unlock(p);
+				goto restart;
+			}
+			if (p == NULL && n != load_root(t)) {
+				write_unlock(n);
+				goto restart;
+			}
+
+			i = split(t, n, p);
+
+			write_unlock(n);
+			if (p != NULL)
+				write_unlock(p);
+
+			if (i != 0) {
+				epoch_leave(self);
+				return 1;
+			}
+
+			goto restart;
+		}
+
+		if (n->leaf)
+			break;
+
+		c = load_child(n, rank(n, k, 1));
+
+		if (validate(n, nv) || read_lock(c, &cv) || validate(n, nv))
+			goto restart;
+		if (p != NULL && validate(p, pv))
+			goto restart;
+
+		p = n;
+		pv = nv;
+		n = c;
+		nv = cv;
+	}
+
+	if (upgrade(n, nv))
+		goto restart;
+
+	nkeys = LOAD(&n->nkeys);
+	pos = rank(n, k, 0);
+
+	if (pos < nkeys && LOAD(&n->keys[pos]) == k) {
+		old = LOAD(&n->u.vals[pos]);
+		STORE(&n->u.vals[pos], v);
+		write_unlock(n);
+		retire_val(t, self, old);
+		epoch_leave(self);
+		return 0;
+	}
+
+	for (i = nkeys; i > pos; i--) {
+		STORE(&n->keys[i], LOAD(&n->keys[i - 1]));
+		STORE(&n->u.vals[i], LOAD(&n->u.vals[i - 1]));
+	}
+
+	STORE(&n->keys[pos], k);
+	STORE(&n->u.vals[pos], v);
+	STORE(&n->nkeys, nkeys + 1);
+	write_unlock(n);
+
+	atomic_fetch_add_explicit(&t->nentries, 1, memory_order_relaxed);
+	epoch_leave(self);
+
+	return 0;
+}
+
+void *cbtree_lookup(struct cbtree *t, struct epoch_thread *self, intptr_t k)
+{
+	struct cbtree_node *n, *p;
+	uint64_t v, pv;
+	int ci, pos, restarts = 0;
+	void *val;
+
+	epoch_enter(self);
+
+	goto start;
+ restart:
+	backoff(&restarts);
+ start:
+	if (find_leaf(t, k, &n, &v, &p, &pv, &ci, NULL, NULL))
+		goto restart;
+
+	pos = rank(n, k, 0);
+	val = (pos < LOAD(&n->nkeys) && LOAD(&n->keys[pos]) == k) ?
+	    LOAD(&n->u.vals[pos]) : NULL;
+
+	if (validate(n, v))
+		goto restart;
+
+	epoch_leave(self);
+
+	return val;
+}
+
+/* Removes child ci, and the separator that bounds it, from p. */
+
+static void unlink_child(struct cbtree_node *p, int ci)
+{
+	int i, nkeys = LOAD(&p->nkeys);
+	int ki = (ci > 0) ? ci - 1 : 0;
+
+	for (i = ki; i < nkeys - 1; i++)
+		STORE(&p->keys[i], LOAD(&p->keys[i + 1]));
+	for (i = ci; i < nkeys; i++)
+		STORE(&p->u.children[i], LOAD(&p->u.children[i + 1]));
+
+	STORE(&p->nkeys, nkeys - 1);
+}
+
+int cbtree_remove(struct cbtree *t, struct epoch_thread *self, intptr_t k)
+{
+	struct cbtree_node *n, *p;
+	uint64_t v, pv;
+	int i, ci, pos, nkeys, restarts = 0;
+	void *old;
+
+	epoch_enter(self);
+
+	goto start;
+ restart:
+	backoff(&restarts);
+ start:
+	if (find_leaf(t, k, &n, &v, &p, &pv, &ci, NULL, NULL))
+		goto restart;
+
+	nkeys = LOAD(&n->nkeys);
+	pos = rank(n, k, 0);
+
+	if (pos >= nkeys || LOAD(&n->keys[pos]) != k) {
+		if (validate(n, v))
+			goto restart;
+		epoch_leave(self);
+		return 1;
+	}
+
+	if (nkeys == 1 && p != NULL && LOAD(&p->nkeys) > 0) {
+		/* Removing the last key: unlink the leaf as well. */
+		if (upgrade(p, pv))
+			goto restart;
+		if (upgrade(n, v)) {
+			write_unlock(p);
+			goto restart;
+		}
+
+		old = LOAD(&n->u.vals[0]);
+		unlink_child(p, ci);
+		write_unlock_obsolete(n);
+		write_unlock(p);
+		epoch_retire(self, n, t->free_fn);
+	} else {
+		if (upgrade(n, v))
+			goto restart;
+
+		old = LOAD(&n->u.vals[pos]);
+		for (i = pos; i < nkeys - 1; i++) {
+			STORE(&n->keys[i], LOAD(&n->keys[i + 1]));
+			STORE(&n->u.vals[i], LOAD(&n->u.vals[i + 1]));
+		}
+		STORE(&n->nkeys, nkeys - 1);
+		write_unlock(n);
+	}
+
+	retire_val(t, self, old);
+	atomic_fetch_sub_explicit(&t->nentries, 1, memory_order_relaxed);
+	epoch_leave(self);
+
+	return 0;
+}
+
+unsigned long cbtree_range(struct cbtree *t, struct epoch_thread *self,
+			   intptr_t lo, intptr_t hi, CBTREE_APPLY_FN fn,
+			   void *client_data)
+{
+	intptr_t keys[CBTREE_NODE_KEYS];
+	void *vals[CBTREE_NODE_KEYS];
+	struct cbtree_node *n, *p;
+	unsigned long nvisited = 0;
+	uint64_t v, pv;
+	intptr_t fence = 0;
+	int i, ci, nkeys, ncopied, has_fence, restarts = 0;
+
+	epoch_enter(self);
+
+	while (lo < hi) {
+		if (find_leaf(t, lo, &n, &v, &p, &pv, &ci, &fence,
+			      &has_fence)) {
+			backoff(&restarts);
+			continue;
+		}
+
+		/*
+		 * Copy the leaf so that fn runs outside the optimistic
+		 * read.  A leaf that gained the range of an unlinked
+		 * sibling may hold keys at or above the fence; they are
+		 * picked up from the next leaf instead.
+		 */
+		nkeys = LOAD(&n->nkeys);
+		for (i = rank(n, lo, 0), ncopied = 0; i < nkeys; i++) {
+			intptr_t k = LOAD(&n->keys[i]);
+			if (k >= hi || (has_fence && k >= fence))
+				break;
+			keys[ncopied] = k;
+			vals[ncopied++] = LOAD(&n->u.vals[i]);
+		}
+
+		if (validate(n, v)) {
+			backoff(&restarts);
+			continue;
+		}
+
+		for (i = 0; i < ncopied; i++) {
+			nvisited++;
+			if (!fn(keys[i], vals[i], client_data)) {
+				epoch_leave(self);
+				return nvisited;
+			}
+		}
+
+		if (!has_fence)
+			break;
+
+		lo = fence;
+	}
+
+	epoch_leave(self);
+
+	return nvisited;
+}
+
+unsigned long cbtree_count(const struct cbtree *t)
+{
+	return atomic_load_explicit(&((struct cbtree *)t)->nentries,
+				    memory_order_relaxed);
+}
+
+struct cbtree *cbtree_create(struct epoch *e, CBTREE_VAL_FREE_FN val_free_fn,
+			     CBTREE_MALLOC_FN malloc_fn,
+			     CBTREE_FREE_FN free_fn)
+{
+	struct cbtree *t;
+	struct cbtree_node *root;
+
+	malloc_fn = (malloc_fn != NULL) ? malloc_fn : malloc;
+	free_fn = (free_fn != NULL) ? free_fn : free;
+
+	if ((t = malloc_fn(sizeof(*t))) == NULL)
+		return NULL;
+
+	t->epoch = e;
+	t->val_free_fn = val_free_fn;
+	t->malloc_fn = malloc_fn;
+	t->free_fn = free_fn;
+	atomic_init(&t->nentries, 0);
+
+	if ((root = node_new(t, 1)) == NULL) {
+		free_fn(t);
+		return NULL;
+	}
+
+	atomic_init(&t->root, root);
+
+	return t;
+}
+
+static void free_subtree(struct cbtree *t, struct cbtree_node *n)
+{
+	int i, nkeys = LOAD(&n->nkeys);
+
+	if (n->leaf) {
+		for (i = 0; i < nkeys && t->val_free_fn != NULL; i++) {
+			void *v = LOAD(&n->u.vals[i]);
+			if (v != NULL)
+				t->val_free_fn(v);
+		}
+	} else {
+		for (i = 0; i <= nkeys; i++)
+			free_subtree(t, LOAD(&n->u.children[i]));
+	}
+
+	t->free_fn(n);
+}
+
+void cbtree_delete(struct cbtree *t)
+{
+	free_subtree(t, LOAD(&t->root));
+	t->free_fn(t);
+}
@@ -0,0 +1,480 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Epoch-based reclamation.
+ *
+ * Each registered thread owns a record holding the epoch it announced
+ * on entry to its current critical section, or at its last quiescent
+ * state (shifted left by one, with bit 0 set while it is inside, or
+ * online), and a FIFO of bags of the pointers it has retired.  Records
+ * are never unlinked from the domain's list, only marked free for
+ * reuse, so walking the list needs no locking.
+ *
+ * A bag is stamped with the global epoch when it is sealed, which is
+ * no earlier than the retirement of anything in it, so one stamp, and
+ * one allocation, serves a whole batch.
+ *
+ * A thread going from outside to inside must make its announcement
+ * visible before it loads anything from a container.  Where Linux
+ * provides membarrier(), try_advance() forces a barrier on every
+ * running thread of the process before it believes an announcement,
+ * and readers get away with a compiler barrier; elsewhere each reader
+ * issues a full fence.
+ */
+
+#define _GNU_SOURCE
+
+#include <stddef.h>		/* size_t, NULL */
+#include <stdlib.h>		/* malloc, free */
+#include <stdatomic.h>
+#include <pthread.h>
+#include <c-hacks/epoch.h>
+
+#if defined(__linux__)
+#include <unistd.h>		/* syscall */
+#include <sys/syscall.h>	/* SYS_membarrier */
+#include <linux/membarrier.h>
+#endif
+
+/* Number of retired pointers in a bag. */
+#ifndef EPOCH_RETIRE_BATCH
+#define EPOCH_RETIRE_BATCH 64
+#endif
+
+#define ACTIVE 1UL
+
+struct retired {
+	void *ptr;
+	EPOCH_RETIRE_FN free_fn;
+};
+
+struct bag {
+	unsigned long epoch;	/* global epoch when sealed */
+	int n;
+	struct bag *next;
+	struct retired items[EPOCH_RETIRE_BATCH];
+};
+
+struct epoch_thread {
+	_Atomic unsigned long state;	/* epoch << 1 | ACTIVE */
+	atomic_int in_use;
+	int nesting;
+	struct bag *current;	/* being filled */
+	struct bag *head, *tail;	/* sealed, oldest first */
+	struct bag *spare;	/* emptied, for reuse */
+	struct epoch *e;
+	struct epoch_thread *next;
+};
+
+struct epoch {
+	_Atomic unsigned long global;
+	_Atomic(struct epoch_thread *) threads;
+	pthread_mutex_t lock;	/* protects orphans */
+	struct bag *orphans;
+	atomic_int has_orphans;
+	EPOCH_MALLOC_FN malloc_fn;
+	EPOCH_FREE_FN free_fn;
+};
+
+#if defined(__linux__) && defined(SYS_membarrier) && \
+    !defined(EPOCH_NO_MEMBARRIER)
+
+static pthread_once_t membarrier_once = PTHREAD_ONCE_INIT;
+static int have_membarrier;
+
+static void membarrier_init(void)
+{
+	long cmds = syscall(SYS_membarrier, MEMBARRIER_CMD_QUERY, 0, 0);
+
+	if (cmds < 0 || !(cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED))
+		return;
+
+	have_membarrier =
+	    syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED,
+		    0, 0) == 0;
+}
+
+/* Returns 0 if every running thread has executed a full barrier. */
+
+static int membarrier(void)
+{
+	return (int)syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED,
+			    0, 0);
+}
+
+#else
+
+static int have_membarrier;
+
+static int membarrier(void)
+{
+	return -1;
+}
+
+#endif
+
+struct epoch *epoch_create(EPOCH_MALLOC_FN malloc_fn, EPOCH_FREE_FN free_fn)
+{
+	struct epoch *e;
+
+	malloc_fn = (malloc_fn != NULL) ? malloc_fn : malloc;
+	free_fn = (free_fn != NULL) ? free_fn : free;
+
+#if defined(__linux__) && defined(SYS_membarrier) && \
+    !defined(EPOCH_NO_MEMBARRIER)
+	pthread_once(&membarrier_once, membarrier_init);
+#endif
+
+	if ((e = malloc_fn(sizeof(*e))) == NULL)
+		return NULL;
+
+	if (pthread_mutex_init(&e->lock, NULL) != 0) {
+		free_fn(e);
+		return NULL;
+	}
+
+	atomic_init(&e->global, 0);
+	atomic_init(&e->threads, NULL);
+	e->orphans = NULL;
+	atomic_init(&e->has_orphans, 0);
+	e->malloc_fn = malloc_fn;
+	e->free_fn = free_fn;
+
+	return e;
+}
+
+/* Frees what is in a bag, and returns how many pointers that was. */
+
+static unsigned long empty_bag(struct bag *b)
+{
+	unsigned long n = (unsigned long)b->n;
+	int i;
+
+	for (i = 0; i < b->n; i++)
+		b->items[i].free_fn(b->items[i].ptr);
+	b->n = 0;
+
+	return n;
+}
+
+static void free_bags(struct epoch *e, struct bag *b)
+{
+	while (b != NULL) {
+		struct bag *next = b->next;
+		empty_bag(b);
+		e->free_fn(b);
+		b = next;
+	}
+}
+
+void epoch_delete(struct epoch *e)
+{
+	struct epoch_thread *th = atomic_load(&e->threads);
+
+	while (th != NULL) {
+		struct epoch_thread *next = th->next;
+		free_bags(e, th->current);
+		free_bags(e, th->head);
+		free_bags(e, th->spare);
+		e->free_fn(th);
+		th = next;
+	}
+
+	free_bags(e, e->orphans);
+	pthread_mutex_destroy(&e->lock);
+	e->free_fn(e);
+}
+
+struct epoch_thread *epoch_register(struct epoch *e)
+{
+	struct epoch_thread *th;
+	int unused = 0;
+
+	/* Reuse the record of a thread that has unregistered. */
+
+	for (th = atomic_load(&e->threads); th != NULL; th = th->next) {
+		if (atomic_compare_exchange_strong(&th->in_use, &unused, 1))
+			return th;
+		unused = 0;
+	}
+
+	if ((th = e->malloc_fn(sizeof(*th))) == NULL)
+		return NULL;
+
+	atomic_init(&th->state, 0);
+	atomic_init(&th->in_use, 1);
+	th->nesting = 0;
+	th->current = NULL;
+	th->head = th->tail = NULL;
+	th->spare = NULL;
+	th->e = e;
+	th->next = atomic_load(&e->threads);
+
+	while (!atomic_compare_exchange_weak(&e->threads, &th->next, th))
+		;
+
+	return th;
+}
+
+/*
+ * Moves the bag being filled to the end of the FIFO, stamped with the
+ * current epoch.
+ */
+static void seal(struct epoch_thread *self)
+{
+	struct bag *b = self->current;
+
+	if (b == NULL || b->n == 0)
+		return;
+
+	/* The unlinks of everything in b precede the stamp. */
+	atomic_thread_fence(memory_order_seq_cst);
+	b->epoch = atomic_load(&self->e->global);
+	b->next = NULL;
+
+	if (self->tail != NULL)
+		self->tail->next = b;
+	else
+		self->head = b;
+	self->tail = b;
+	self->current = NULL;
+}
+
+void epoch_unregister(struct epoch_thread *self)
+{
+	struct epoch *e = self->e;
+
+	epoch_reclaim(self);
+
+	if (self->head != NULL) {
+		pthread_mutex_lock(&e->lock);
+		self->tail->next = e->orphans;
+		e->orphans = self->head;
+		atomic_store(&e->has_orphans, 1);
+		pthread_mutex_unlock(&e->lock);
+		self->head = self->tail = NULL;
+	}
+
+	if (self->spare != NULL) {
+		e->free_fn(self->spare);
+		self->spare = NULL;
+	}
+
+	self->nesting = 0;
+	atomic_store(&self->state, 0);
+	atomic_store(&self->in_use, 0);
+}
+
+/*
+ * Announces the global epoch, from outside any critical section.
+ * Loads from the container must not be ordered before this.
+ */
+static void announce(struct epoch_thread *self)
+{
+	unsigned long global = atomic_load_explicit(&self->e->global,
+						    memory_order_acquire);
+
+	atomic_store_explicit(&self->state, global << 1 | ACTIVE,
+			      memory_order_release);
+
+	if (have_membarrier)
+		atomic_signal_fence(memory_order_seq_cst);
+	else
+		atomic_thread_fence(memory_order_seq_cst);
+}
+
+void epoch_enter(struct epoch_thread *self)
+{
+	if (self->nesting++ > 0)
+		return;
+
+	announce(self);
+}
+
+void epoch_leave(struct epoch_thread *self)
+{
+	if (--self->nesting > 0)
+		return;
+
+	atomic_store_explicit(&self->state, 0, memory_order_release);
+}
+
+void epoch_quiescent(struct epoch_thread *self)
+{
+	unsigned long state = atomic_load_explicit(&self->state,
+						   memory_order_relaxed);
+	unsigned long global;
+
+	if (!(state & ACTIVE)) {
+		announce(self);
+		return;
+	}
+
+	/*
+	 * Already online: the announcement being replaced covers any
+	 * load that moves ahead of this one.
+	 */
+	global = atomic_load_explicit(&self->e->global, memory_order_acquire);
+	if ((state >> 1) != global)
+		atomic_store_explicit(&self->state, global << 1 | ACTIVE,
+				      memory_order_release);
+}
+
+void epoch_offline(struct epoch_thread *self)
+{
+	atomic_store_explicit(&self->state, 0, memory_order_release);
+}
+
+/* Returns 1 if no thread announces an epoch other than global. */
+
+static int all_seen(struct epoch *e, unsigned long global)
+{
+	struct epoch_thread *th;
+
+	for (th = atomic_load(&e->threads); th != NULL; th = th->next) {
+		unsigned long state = atomic_load(&th->state);
+		if ((state & ACTIVE) && (state >> 1) != global)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Advances the global epoch if every thread in a critical section has
+ * seen it.  Returns the global epoch.
+ */
+static unsigned long try_advance(struct epoch *e)
+{
+	unsigned long global = atomic_load(&e->global);
+
+	if (!all_seen(e, global))
+		return global;
+
+	/*
+	 * Readers only issued a compiler barrier: make them issue a real
+	 * one, so that an announcement still in a store buffer, which
+	 * the scan above may have missed, can be seen, and look again.
+	 * A laggard is never missed, so only a scan that found none
+	 * needs to be repeated.
+	 */
+	if (have_membarrier) {
+		if (membarrier() != 0 || !all_seen(e, global))
+			return global;
+	}
+
+	if (atomic_compare_exchange_strong(&e->global, &global, global + 1))
+		return global + 1;
+
+	return global;
+}
+
+/* Frees orphaned bags from epochs before safe. */
+
+static unsigned long reclaim_orphans(struct epoch *e, unsigned long safe)
+{
+	struct bag **bp, *b;
+	unsigned long nfreed = 0;
+
+	if (pthread_mutex_trylock(&e->lock) != 0)
+		return 0;
+
+	for (bp = &e->orphans; (b = *bp) != NULL;) {
+		if (b->epoch < safe) {
+			*bp = b->next;
+			nfreed += empty_bag(b);
+			e->free_fn(b);
+		} else {
+			bp = &b->next;
+		}
+	}
+
+	atomic_store(&e->has_orphans, e->orphans != NULL);
+	pthread_mutex_unlock(&e->lock);
+
+	return nfreed;
+}
+
+unsigned long epoch_reclaim(struct epoch_thread *self)
+{
+	struct epoch *e = self->e;
+	unsigned long nfreed = 0, global, safe;
+
+	seal(self);
+
+	global = try_advance(e);
+	safe = (global >= 1) ? global - 1 : 0;
+
+	/* Anything retired before epoch global - 1 is unreachable. */
+
+	while (self->head != NULL && self->head->epoch < safe) {
+		struct bag *b = self->head;
+		self->head = b->next;
+		nfreed += empty_bag(b);
+		if (self->spare == NULL) {
+			b->next = NULL;
+			self->spare = b;
+		} else {
+			e->free_fn(b);
+		}
+	}
+
+	if (self->head == NULL)
+		self->tail = NULL;
+
+	if (atomic_load_explicit(&e->has_orphans, memory_order_relaxed))
+		nfreed += reclaim_orphans(e, safe);
+
+	return nfreed;
+}
+
+int epoch_retire(struct epoch_thread *self, void *ptr,
+		 EPOCH_RETIRE_FN free_fn)
+{
+	struct bag *b = self->current;
+
+	if (b == NULL) {
+		if (self->spare != NULL) {
+			b = self->spare;
+			self->spare = NULL;
+		} else if ((b = self->e->malloc_fn(sizeof(*b))) == NULL) {
+			return 1;
+		}
+		b->n = 0;
+		b->next = NULL;
+		self->current = b;
+	}
+
+	b->items[b->n].ptr = ptr;
+	b->items[b->n].free_fn = free_fn;
+
+	if (++b->n == EPOCH_RETIRE_BATCH)
+		epoch_reclaim(self);
+
+	return 0;
+}
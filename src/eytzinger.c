@@ -0,0 +1,251 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Eytzinger layout search.
+ *
+ * A search starts at index 1 and moves to 2i or 2i + 1 until it falls
+ * off the bottom of the tree.  The path taken spells out the result:
+ * each right turn appends a 1 bit, so the last key that was not less
+ * than the search key is found by dropping the trailing 1 bits, and
+ * the 0 bit before them, from the final index.
+ */
+
+#include <stddef.h>		/* size_t, NULL */
+#include <stdlib.h>		/* malloc, free */
+#include <stdint.h>		/* intptr_t, uintptr_t */
+#include <c-hacks/eytzinger.h>
+
+#define CACHE_LINE 64
+
+#if defined(_MSC_VER)
+#define INLINE __inline
+#else
+#define INLINE inline
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define PREFETCH(P) __builtin_prefetch(P)
+#else
+#define PREFETCH(P) ((void)(P))
+#endif
+
+struct eytzinger {
+	EYTZINGER_COMPARE_FN compare_fn;	/* NULL for intptr_t keys */
+	size_t n;
+	void **keys;		/* keys[1..n], cache line aligned */
+	void **vals;		/* vals[1..n] */
+	void *mem;		/* allocation holding both */
+	EYTZINGER_FREE_FN free_fn;
+};
+
+/*
+ * Prefetches the 16 descendants of i four levels down, keys[16i] to
+ * keys[16i + 15], which fill two cache lines as keys is aligned.  The
+ * address is computed as an integer: near the bottom of the tree it
+ * lies beyond the array, which a prefetch tolerates.
+ */
+static INLINE void prefetch_descendants(void *const *keys, size_t i)
+{
+	uintptr_t p = (uintptr_t)keys + 16 * i * sizeof(void *);
+
+	PREFETCH((const void *)p);
+	PREFETCH((const void *)(p + CACHE_LINE));
+}
+
+/* Converts the index a search fell off the tree at to the result. */
+
+static INLINE size_t strip_right_turns(size_t i)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return i >> (__builtin_ctzl(~i) + 1);
+#else
+	while (i & 1)
+		i >>= 1;
+	return i >> 1;
+#endif
+}
+
+/*
+ * Returns the index of the smallest key not less than k, or 0 if
+ * there is none.
+ */
+static INLINE size_t search(const struct eytzinger *e, const void *k)
+{
+	void *const *keys = e->keys;
+	size_t i = 1;
+
+	if (e->compare_fn == NULL) {
+		const intptr_t *ikeys = (const intptr_t *)keys;
+		intptr_t ik = (intptr_t) k;
+
+		while (i <= e->n) {
+			prefetch_descendants(keys, i);
+			i = 2 * i + (ikeys[i] < ik);
+		}
+	} else {
+		while (i <= e->n) {
+			prefetch_descendants(keys, i);
+			i = 2 * i + (e->compare_fn(keys[i], k) < 0);
+		}
+	}
+
+	return strip_right_turns(i);
+}
+
+/*
+ * Fills the subtree rooted at index i, in order, from src starting at
+ * pos and returns the position after the last one used.
+ */
+static size_t fill(struct eytzinger *e, void *const *keys,
+		   void *const *vals, size_t i, size_t pos)
+{
+	if (i > e->n)
+		return pos;
+
+	pos = fill(e, keys, vals, 2 * i, pos);
+	e->keys[i] = keys[pos];
+	e->vals[i] = (vals != NULL) ? vals[pos] : NULL;
+
+	return fill(e, keys, vals, 2 * i + 1, pos + 1);
+}
+
+struct eytzinger *eytzinger_create(EYTZINGER_COMPARE_FN compare_fn,
+				   void *const *keys, void *const *vals,
+				   size_t n,
+				   EYTZINGER_MALLOC_FN malloc_fn,
+				   EYTZINGER_FREE_FN free_fn)
+{
+	struct eytzinger *e;
+	uintptr_t base;
+	size_t i;
+
+	malloc_fn = (malloc_fn != NULL) ? malloc_fn : malloc;
+	free_fn = (free_fn != NULL) ? free_fn : free;
+
+	for (i = 1; i < n; i++) {
+		if (compare_fn == NULL
+		    ? (intptr_t) keys[i - 1] >= (intptr_t) keys[i]
+		    : compare_fn(keys[i - 1], keys[i]) >= 0)
+			return NULL;
+	}
+
+	if ((e = malloc_fn(sizeof(*e))) == NULL)
+		return NULL;
+
+	/* Index 0 is unused; padding allows keys to be aligned. */
+
+	e->mem = malloc_fn(2 * (n + 1) * sizeof(void *) + CACHE_LINE);
+	if (e->mem == NULL) {
+		free_fn(e);
+		return NULL;
+	}
+
+	base = ((uintptr_t)e->mem + CACHE_LINE - 1) &
+	    ~(uintptr_t)(CACHE_LINE - 1);
+	e->keys = (void **)base;
+	e->vals = e->keys + n + 1;
+	e->keys[0] = e->vals[0] = NULL;
+	e->compare_fn = compare_fn;
+	e->n = n;
+	e->free_fn = free_fn;
+
+	fill(e, keys, vals, 1, 0);
+
+	return e;
+}
+
+struct eytzinger *eytzinger_create_from_btree(const struct btree *t,
+					      EYTZINGER_COMPARE_FN compare_fn,
+					      EYTZINGER_MALLOC_FN malloc_fn,
+					      EYTZINGER_FREE_FN free_fn)
+{
+	struct eytzinger *e;
+	struct btree_iter iter;
+	size_t i, n = btree_count(t);
+	void **keys, **vals;
+
+	malloc_fn = (malloc_fn != NULL) ? malloc_fn : malloc;
+	free_fn = (free_fn != NULL) ? free_fn : free;
+
+	if ((keys = malloc_fn((2 * n + 1) * sizeof(void *))) == NULL)
+		return NULL;
+
+	vals = keys + n;
+
+	btree_iter_init(t, &iter);
+	for (i = 0; btree_iter_next(&iter); i++) {
+		keys[i] = iter.key;
+		vals[i] = iter.val;
+	}
+
+	e = eytzinger_create(compare_fn, keys, vals, n, malloc_fn, free_fn);
+	free_fn(keys);
+
+	return e;
+}
+
+void eytzinger_delete(struct eytzinger *e)
+{
+	e->free_fn(e->mem);
+	e->free_fn(e);
+}
+
+void *eytzinger_lookup(const struct eytzinger *e, const void *k)
+{
+	size_t i = search(e, k);
+
+	if (i == 0)
+		return NULL;
+
+	if (e->compare_fn == NULL ? e->keys[i] != k
+	    : e->compare_fn(e->keys[i], k) != 0)
+		return NULL;
+
+	return e->vals[i];
+}
+
+int eytzinger_lower_bound(const struct eytzinger *e, const void *k,
+			  void **key, void **val)
+{
+	size_t i = search(e, k);
+
+	if (i == 0)
+		return 1;
+
+	if (key != NULL)
+		*key = e->keys[i];
+	if (val != NULL)
+		*val = e->vals[i];
+
+	return 0;
+}
+
+size_t eytzinger_count(const struct eytzinger *e)
+{
+	return e->n;
+}
@@ -0,0 +1,427 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * A sorted flat map.
+ *
+ * Keys and values live in parallel arrays, keys first so that a scan
+ * touches only keys, which grow by doubling and are allocated on the
+ * first insert.  Every search is a rank: the number of keys less than
+ * the search key, which is both where the key is if present and where
+ * it would be inserted.
+ */
+
+#include <stddef.h>		/* size_t, NULL */
+#include <stdlib.h>		/* malloc, free */
+#include <string.h>		/* memmove, memcpy */
+#include <stdint.h>		/* intptr_t */
+#include <c-hacks/flatmap.h>
+
+#define MIN_CAPACITY 4
+
+#if defined(_MSC_VER)
+#define INLINE __inline
+#else
+#define INLINE inline
+#endif
+
+struct flatmap {
+	FLATMAP_COMPARE_FN compare_fn;	/* NULL for intptr_t keys */
+	size_t nentries;
+	size_t capacity;
+	void **keys;
+	void **vals;
+	FLATMAP_KEY_FREE_FN key_free_fn;
+	FLATMAP_VAL_FREE_FN val_free_fn;
+	FLATMAP_MALLOC_FN malloc_fn;
+	FLATMAP_FREE_FN free_fn;
+};
+
+struct entry {
+	void *key;
+	void *val;
+};
+
+/*
+ * Returns the number of keys less than k.  The search narrows the
+ * range with a conditional move rather than a branch, which the CPU
+ * would mispredict half the time.  For integer keys this measured as
+ * fast as counting the keys with AVX2 compares even at 4 keys, and
+ * faster from 16 on, so there is no separate linear scan.
+ */
+static size_t rank(const struct flatmap *m, const void *k)
+{
+	void *const *keys = m->keys;
+	size_t base = 0, len = m->nentries, half;
+
+	if (len == 0)
+		return 0;
+
+	if (m->compare_fn != NULL) {
+		while (len > 1) {
+			half = len / 2;
+			base += (m->compare_fn(keys[base + half], k) < 0)
+			    ? half : 0;
+			len -= half;
+		}
+		return base + (m->compare_fn(keys[base], k) < 0);
+	}
+
+	while (len > 1) {
+		half = len / 2;
+		base += ((intptr_t) keys[base + half] < (intptr_t) k) ? half : 0;
+		len -= half;
+	}
+
+	return base + ((intptr_t) keys[base] < (intptr_t) k);
+}
+
+static INLINE int compare(const struct flatmap *m, const void *a,
+			  const void *b)
+{
+	if (m->compare_fn != NULL)
+		return m->compare_fn(a, b);
+
+	return ((intptr_t) a > (intptr_t) b) - ((intptr_t) a < (intptr_t) b);
+}
+
+static INLINE int key_at(const struct flatmap *m, size_t pos, const void *k)
+{
+	return pos < m->nentries && compare(m, m->keys[pos], k) == 0;
+}
+
+/* Replaces the arrays with ones of the given capacity. */
+
+static int resize(struct flatmap *m, size_t capacity)
+{
+	void **keys, **vals;
+
+	if ((keys = m->malloc_fn(capacity * sizeof(void *))) == NULL)
+		return 1;
+
+	if ((vals = m->malloc_fn(capacity * sizeof(void *))) == NULL) {
+		m->free_fn(keys);
+		return 1;
+	}
+
+	if (m->nentries != 0) {
+		memcpy(keys, m->keys, m->nentries * sizeof(void *));
+		memcpy(vals, m->vals, m->nentries * sizeof(void *));
+	}
+
+	if (m->keys != NULL) {
+		m->free_fn(m->keys);
+		m->free_fn(m->vals);
+	}
+
+	m->keys = keys;
+	m->vals = vals;
+	m->capacity = capacity;
+
+	return 0;
+}
+
+int flatmap_insert(struct flatmap *m, void *k, void *v)
+{
+	size_t pos = rank(m, k);
+
+	if (key_at(m, pos, k)) {
+		if (m->val_free_fn != NULL)
+			m->val_free_fn(m->vals[pos]);
+		m->vals[pos] = v;
+		return 0;
+	}
+
+	if (m->nentries == m->capacity &&
+	    resize(m, m->capacity ? 2 * m->capacity : MIN_CAPACITY) != 0)
+		return 1;
+
+	memmove(&m->keys[pos + 1], &m->keys[pos],
+		(m->nentries - pos) * sizeof(void *));
+	memmove(&m->vals[pos + 1], &m->vals[pos],
+		(m->nentries - pos) * sizeof(void *));
+	m->keys[pos] = k;
+	m->vals[pos] = v;
+	m->nentries++;
+
+	return 0;
+}
+
+/* Stable bottom-up merge sort of a into tmp and back, by key. */
+
+static struct entry *sort_entries(const struct flatmap *m, struct entry *a,
+				  struct entry *tmp, size_t n)
+{
+	size_t width, lo, i, j, k, mid, hi;
+	struct entry *swap;
+
+	for (width = 1; width < n; width *= 2) {
+		for (lo = 0; lo < n; lo += 2 * width) {
+			mid = (lo + width < n) ? lo + width : n;
+			hi = (lo + 2 * width < n) ? lo + 2 * width : n;
+
+			for (i = lo, j = mid, k = lo; k < hi; k++) {
+				if (i < mid && (j == hi ||
+						compare(m, a[i].key,
+							a[j].key) <= 0))
+					tmp[k] = a[i++];
+				else
+					tmp[k] = a[j++];
+			}
+		}
+
+		swap = a;
+		a = tmp;
+		tmp = swap;
+	}
+
+	return a;
+}
+
+int flatmap_insert_batch(struct flatmap *m, void **keys, void **vals,
+			 size_t n)
+{
+	struct entry *buf, *batch;
+	void **new_keys, **new_vals;
+	size_t i, j, k, nunique, capacity;
+	int cmp;
+
+	if (n == 0)
+		return 0;
+
+	if ((buf = m->malloc_fn(2 * n * sizeof(*buf))) == NULL)
+		return 1;
+
+	for (i = 0; i < n; i++) {
+		buf[i].key = keys[i];
+		buf[i].val = (vals != NULL) ? vals[i] : NULL;
+	}
+
+	batch = sort_entries(m, buf, buf + n, n);
+
+	for (nunique = 1, i = 1; i < n; i++)
+		nunique += compare(m, batch[i - 1].key, batch[i].key) != 0;
+
+	/* Merge into new arrays sized for the worst case. */
+
+	for (capacity = m->capacity ? m->capacity : MIN_CAPACITY;
+	     capacity < m->nentries + nunique; capacity *= 2) ;
+
+	new_keys = m->malloc_fn(capacity * sizeof(void *));
+	new_vals = m->malloc_fn(capacity * sizeof(void *));
+
+	if (new_keys == NULL || new_vals == NULL) {
+		if (new_keys != NULL)
+			m->free_fn(new_keys);
+		if (new_vals != NULL)
+			m->free_fn(new_vals);
+		m->free_fn(buf);
+		return 1;
+	}
+
+	/*
+	 * Nothing can fail from here.  Collapse each run of equal keys to
+	 * its first key and last value, freeing the values in between as
+	 * inserting them in turn would have.
+	 */
+	for (k = 0, i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && compare(m, batch[i].key,
+						 batch[j].key) == 0; j++) {
+			if (m->val_free_fn != NULL)
+				m->val_free_fn(batch[j - 1].val);
+		}
+		batch[k].key = batch[i].key;
+		batch[k++].val = batch[j - 1].val;
+	}
+
+	for (i = 0, j = 0, k = 0; i < m->nentries || j < nunique; k++) {
+		cmp = (i == m->nentries) ? 1 : (j == nunique) ? -1
+		    : compare(m, m->keys[i], batch[j].key);
+
+		if (cmp < 0) {
+			new_keys[k] = m->keys[i];
+			new_vals[k] = m->vals[i++];
+		} else if (cmp > 0) {
+			new_keys[k] = batch[j].key;
+			new_vals[k] = batch[j++].val;
+		} else {
+			if (m->val_free_fn != NULL)
+				m->val_free_fn(m->vals[i]);
+			new_keys[k] = m->keys[i++];
+			new_vals[k] = batch[j++].val;
+		}
+	}
+
+	if (m->keys != NULL) {
+		m->free_fn(m->keys);
+		m->free_fn(m->vals);
+	}
+
+	m->keys = new_keys;
+	m->vals = new_vals;
+	m->capacity = capacity;
+	m->nentries = k;
+	m->free_fn(buf);
+
+	return 0;
+}
+
+int flatmap_remove(struct flatmap *m, const void *k)
+{
+	size_t pos = rank(m, k);
+
+	if (!key_at(m, pos, k))
+		return 1;
+
+	if (m->key_free_fn != NULL)
+		m->key_free_fn(m->keys[pos]);
+	if (m->val_free_fn != NULL)
+		m->val_free_fn(m->vals[pos]);
+
+	m->nentries--;
+	memmove(&m->keys[pos], &m->keys[pos + 1],
+		(m->nentries - pos) * sizeof(void *));
+	memmove(&m->vals[pos], &m->vals[pos + 1],
+		(m->nentries - pos) * sizeof(void *));
+
+	return 0;
+}
+
+void *flatmap_lookup(const struct flatmap *m, const void *k)
+{
+	size_t pos = rank(m, k);
+
+	return key_at(m, pos, k) ? m->vals[pos] : NULL;
+}
+
+size_t flatmap_count(const struct flatmap *m)
+{
+	return m->nentries;
+}
+
+size_t flatmap_apply(const struct flatmap *m, FLATMAP_APPLY_FN fn,
+		     void *client_data)
+{
+	size_t i;
+
+	for (i = 0; i < m->nentries; i++) {
+		if (!fn(m->keys[i], m->vals[i], client_data))
+			return i + 1;
+	}
+
+	return i;
+}
+
+static void iter_set(struct flatmap_iter *iter, const struct flatmap *m,
+		     size_t pos)
+{
+	/* The private fields are const so that clients can't change
+	 * them; only we can, with a cast. */
+
+	iter->key = iter->val = NULL;
+	*(const struct flatmap **)&iter->map = m;
+	*(size_t *)&iter->pos = pos;
+}
+
+void flatmap_iter_init(const struct flatmap *m, struct flatmap_iter *iter)
+{
+	iter_set(iter, m, 0);
+}
+
+void flatmap_lower_bound(const struct flatmap *m, const void *k,
+			 struct flatmap_iter *iter)
+{
+	iter_set(iter, m, rank(m, k));
+}
+
+int flatmap_iter_next(struct flatmap_iter *iter)
+{
+	const struct flatmap *m = iter->map;
+	size_t pos = iter->pos;
+
+	if (pos >= m->nentries)
+		return 0;
+
+	iter->key = m->keys[pos];
+	iter->val = m->vals[pos];
+	*(size_t *)&iter->pos = pos + 1;
+
+	return 1;
+}
+
+void flatmap_clear(struct flatmap *m)
+{
+	size_t i;
+
+	for (i = 0; i < m->nentries; i++) {
+		if (m->key_free_fn != NULL)
+			m->key_free_fn(m->keys[i]);
+		if (m->val_free_fn != NULL)
+			m->val_free_fn(m->vals[i]);
+	}
+
+	if (m->keys != NULL) {
+		m->free_fn(m->keys);
+		m->free_fn(m->vals);
+	}
+
+	m->keys = m->vals = NULL;
+	m->nentries = m->capacity = 0;
+}
+
+void flatmap_delete(struct flatmap *m)
+{
+	flatmap_clear(m);
+	m->free_fn(m);
+}
+
+struct flatmap *flatmap_create(FLATMAP_COMPARE_FN compare_fn,
+			       FLATMAP_KEY_FREE_FN key_free_fn,
+			       FLATMAP_VAL_FREE_FN val_free_fn,
+			       FLATMAP_MALLOC_FN malloc_fn,
+			       FLATMAP_FREE_FN free_fn)
+{
+	struct flatmap *m;
+
+	malloc_fn = (malloc_fn != NULL) ? malloc_fn : malloc;
+	free_fn = (free_fn != NULL) ? free_fn : free;
+
+	if ((m = malloc_fn(sizeof(*m))) == NULL)
+		return NULL;
+
+	m->compare_fn = compare_fn;
+	m->nentries = 0;
+	m->capacity = 0;
+	m->keys = NULL;
+	m->vals = NULL;
+	m->key_free_fn = key_free_fn;
+	m->val_free_fn = val_free_fn;
+	m->malloc_fn = malloc_fn;
+	m->free_fn = free_fn;
+
+	return m;
+}
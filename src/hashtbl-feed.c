@@ -0,0 +1,671 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * A change feed for hash tables.
+ *
+ * The feed is a hashtbl observer that encodes every mutation into a
+ * byte ring buffer.  The ring is drained by the leader, typically into
+ * a pipe or a socket, and the applier on the follower side decodes the
+ * byte stream and replays it against a replica table.  The stream has
+ * no framing beyond the records themselves so a follower can consume
+ * it in arbitrarily sized chunks.
+ */
+
+#include <stddef.h>		/* size_t, NULL */
+#include <stdlib.h>		/* malloc, free */
+#include <string.h>		/* memcpy, memmove */
+#include <errno.h>
+#include <unistd.h>		/* read, write */
+#include <c-hacks/hashtbl.h>
+#include <c-hacks/hashtbl-feed.h>
+#include <c-hacks/leb128.h>
+
+#if defined(_MSC_VER)
+#define INLINE __inline
+#else
+#define INLINE inline
+#endif
+
+/* Largest LEB128 encoding of a 64-bit value. */
+#define LEB128_MAX_BYTES 10
+
+/* Fixed part of a record: op, seqno, keylen and vallen. */
+#define RECORD_HEADER_MAX (1 + 3 * LEB128_MAX_BYTES)
+
+#define SCRATCH_INITIAL_SIZE 256
+#define APPLIER_READ_SIZE 65536
+
+struct hashtbl_feed {
+	struct hashtbl *h;
+	unsigned char *ring;
+	size_t ring_size;	/* pow2 */
+	unsigned long long head;	/* next byte written */
+	unsigned long long tail;	/* next byte read */
+	unsigned long long seqno;	/* last record produced */
+	int overflowed;
+	HASHTBL_FEED_ENCODE_FN key_encode_fn;
+	HASHTBL_FEED_ENCODE_FN val_encode_fn;
+	HASHTBL_MALLOC_FN malloc_fn;
+	HASHTBL_FREE_FN free_fn;
+	unsigned char *scratch;	/* record being encoded */
+	size_t scratch_size;
+};
+
+struct hashtbl_feed_applier {
+	struct hashtbl *h;
+	unsigned long long next_seqno;
+	int failed;
+	HASHTBL_FEED_DECODE_FN key_decode_fn;
+	HASHTBL_FEED_DECODE_FN val_decode_fn;
+	HASHTBL_KEY_FREE_FN key_free_fn;
+	HASHTBL_VAL_FREE_FN val_free_fn;
+	HASHTBL_MALLOC_FN malloc_fn;
+	HASHTBL_FREE_FN free_fn;
+	unsigned char *buf;	/* unconsumed bytes */
+	size_t buf_len;
+	size_t buf_size;
+};
+
+static int is_power_of_2(size_t x)
+{
+	return ((x & (x - 1)) == 0);
+}
+
+static INLINE size_t ring_free(const struct hashtbl_feed *feed)
+{
+	return feed->ring_size - (size_t)(feed->head - feed->tail);
+}
+
+static void ring_put(struct hashtbl_feed *feed, const void *src, size_t n)
+{
+	size_t off = (size_t)feed->head & (feed->ring_size - 1);
+	size_t n1 = feed->ring_size - off;
+
+	if (n1 > n)
+		n1 = n;
+
+	memcpy(feed->ring + off, src, n1);
+	memcpy(feed->ring, (const unsigned char *)src + n1, n - n1);
+	feed->head += n;
+}
+
+/* Copies up to n bytes from the ring without consuming them. */
+
+static size_t ring_peek(const struct hashtbl_feed *feed, void *dst, size_t n)
+{
+	size_t pending = (size_t)(feed->head - feed->tail);
+	size_t off = (size_t)feed->tail & (feed->ring_size - 1);
+	size_t n1 = feed->ring_size - off;
+
+	if (n > pending)
+		n = pending;
+	if (n1 > n)
+		n1 = n;
+
+	memcpy(dst, feed->ring + off, n1);
+	memcpy((unsigned char *)dst + n1, feed->ring, n - n1);
+
+	return n;
+}
+
+static int scratch_reserve(struct hashtbl_feed *feed, size_t n)
+{
+	unsigned char *p;
+	size_t size = feed->scratch_size;
+
+	if (n <= size)
+		return 0;
+
+	while (size < n)
+		size *= 2;
+
+	if ((p = feed->malloc_fn(size)) == NULL)
+		return 1;
+
+	memcpy(p, feed->scratch, feed->scratch_size);
+	feed->free_fn(feed->scratch);
+	feed->scratch = p;
+	feed->scratch_size = size;
+
+	return 0;
+}
+
+/*
+ * Encodes a length-prefixed object at offset *pos of the scratch
+ * buffer.  Returns 0 on success or 1 if no memory could be allocated.
+ */
+static int encode_object(struct hashtbl_feed *feed, size_t *pos,
+			 HASHTBL_FEED_ENCODE_FN encode, const void *obj)
+{
+	unsigned char tmp[1];
+	size_t n;
+
+	/* Size the object first so the length prefix can go before it. */
+	n = encode(obj, tmp, 0);
+
+	if (scratch_reserve(feed, *pos + LEB128_MAX_BYTES + n) != 0)
+		return 1;
+
+	*pos += leb128_encode_ull(feed->scratch + *pos, n);
+	(void)encode(obj, feed->scratch + *pos, n);
+	*pos += n;
+
+	return 0;
+}
+
+static void feed_observer(const struct hashtbl *h, enum hashtbl_op op,
+			  const void *key, const void *val, void *client_data)
+{
+	struct hashtbl_feed *feed = client_data;
+	size_t pos = 0;
+
+	(void)h;
+
+	/* Dropped records still consume a sequence number so that a
+	 * follower can detect the gap. */
+	feed->seqno++;
+
+	if (feed->overflowed)
+		return;
+
+	feed->scratch[pos++] = (unsigned char)op;
+	pos += leb128_encode_ull(feed->scratch + pos, feed->seqno);
+
+	if (op == HASHTBL_OP_INSERT || op == HASHTBL_OP_REMOVE) {
+		if (encode_object(feed, &pos, feed->key_encode_fn, key) != 0)
+			goto overflow;
+	}
+
+	if (op == HASHTBL_OP_INSERT) {
+		if (encode_object(feed, &pos, feed->val_encode_fn, val) != 0)
+			goto overflow;
+	}
+
+	if (pos > ring_free(feed))
+		goto overflow;
+
+	ring_put(feed, feed->scratch, pos);
+	return;
+
+ overflow:
+	feed->overflowed = 1;
+}
+
+struct hashtbl_feed *hashtbl_feed_create(struct hashtbl *h, size_t ring_size,
+					 HASHTBL_FEED_ENCODE_FN key_encode_fn,
+					 HASHTBL_FEED_ENCODE_FN val_encode_fn,
+					 HASHTBL_MALLOC_FN malloc_fn,
+					 HASHTBL_FREE_FN free_fn)
+{
+	struct hashtbl_feed *feed;
+
+	malloc_fn = (malloc_fn != NULL) ? malloc_fn : malloc;
+	free_fn = (free_fn != NULL) ? free_fn : free;
+
+	if (ring_size < RECORD_HEADER_MAX || !is_power_of_2(ring_size))
+		return NULL;
+
+	if ((feed = malloc_fn(sizeof(*feed))) == NULL)
+		return NULL;
+
+	feed->h = h;
+	feed->ring_size = ring_size;
+	feed->head = 0;
+	feed->tail = 0;
+	feed->seqno = 0;
+	feed->overflowed = 0;
+	feed->key_encode_fn = key_encode_fn;
+	feed->val_encode_fn = val_encode_fn;
+	feed->malloc_fn = malloc_fn;
+	feed->free_fn = free_fn;
+	feed->scratch_size = SCRATCH_INITIAL_SIZE;
+
+	if ((feed->ring = malloc_fn(ring_size)) == NULL) {
+		free_fn(feed);
+		return NULL;
+	}
+
+	if ((feed->scratch = malloc_fn(feed->scratch_size)) == NULL) {
+		free_fn(feed->ring);
+		free_fn(feed);
+		return NULL;
+	}
+
+	hashtbl_set_observer(h, feed_observer, feed);
+
+	return feed;
+}
+
+void hashtbl_feed_delete(struct hashtbl_feed *feed)
+{
+	hashtbl_set_observer(feed->h, NULL, NULL);
+	feed->free_fn(feed->scratch);
+	feed->free_fn(feed->ring);
+	feed->free_fn(feed);
+}
+
+size_t hashtbl_feed_pending(const struct hashtbl_feed *feed)
+{
+	return (size_t)(feed->head - feed->tail);
+}
+
+unsigned long long hashtbl_feed_seqno(const struct hashtbl_feed *feed)
+{
+	return feed->seqno;
+}
+
+int hashtbl_feed_overflowed(const struct hashtbl_feed *feed)
+{
+	return feed->overflowed;
+}
+
+void hashtbl_feed_reset(struct hashtbl_feed *feed)
+{
+	feed->tail = feed->head;
+	feed->overflowed = 0;
+}
+
+size_t hashtbl_feed_read(struct hashtbl_feed *feed, void *buf, size_t len)
+{
+	size_t n = ring_peek(feed, buf, len);
+
+	feed->tail += n;
+	return n;
+}
+
+int hashtbl_feed_flush(struct hashtbl_feed *feed, int fd)
+{
+	while (feed->head != feed->tail) {
+		size_t off = (size_t)feed->tail & (feed->ring_size - 1);
+		size_t n = (size_t)(feed->head - feed->tail);
+		ssize_t nwritten;
+
+		/* Write up to the physical end of the ring. */
+		if (n > feed->ring_size - off)
+			n = feed->ring_size - off;
+
+		if ((nwritten = write(fd, feed->ring + off, n)) < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return -1;
+		}
+
+		feed->tail += (size_t)nwritten;
+	}
+
+	return 0;
+}
+
+struct hashtbl_feed_applier *hashtbl_feed_applier_create(struct hashtbl *h,
+							 unsigned long long
+							 next_seqno,
+							 HASHTBL_FEED_DECODE_FN
+							 key_decode_fn,
+							 HASHTBL_FEED_DECODE_FN
+							 val_decode_fn,
+							 HASHTBL_KEY_FREE_FN
+							 key_free_fn,
+							 HASHTBL_VAL_FREE_FN
+							 val_free_fn,
+							 HASHTBL_MALLOC_FN
+							 malloc_fn,
+							 HASHTBL_FREE_FN
+							 free_fn)
+{
+	struct hashtbl_feed_applier *a;
+
+	malloc_fn = (malloc_fn != NULL) ? malloc_fn : malloc;
+	free_fn = (free_fn != NULL) ? free_fn : free;
+
+	if ((a = malloc_fn(sizeof(*a))) == NULL)
+		return NULL;
+
+	a->h = h;
+	a->next_seqno = next_seqno;
+	a->failed = 0;
+	a->key_decode_fn = key_decode_fn;
+	a->val_decode_fn = val_decode_fn;
+	a->key_free_fn = key_free_fn;
+	a->val_free_fn = val_free_fn;
+	a->malloc_fn = malloc_fn;
+	a->free_fn = free_fn;
+	a->buf = NULL;
+	a->buf_len = 0;
+	a->buf_size = 0;
+
+	return a;
+}
+
+void hashtbl_feed_applier_delete(struct hashtbl_feed_applier *a)
+{
+	if (a->buf != NULL)
+		a->free_fn(a->buf);
+	a->free_fn(a);
+}
+
+unsigned long long hashtbl_feed_applier_seqno(const struct
+					      hashtbl_feed_applier *a)
+{
+	return a->next_seqno;
+}
+
+static int buf_reserve(struct hashtbl_feed_applier *a, size_t n)
+{
+	unsigned char *p;
+	size_t size = (a->buf_size != 0) ? a->buf_size : SCRATCH_INITIAL_SIZE;
+
+	if (n <= a->buf_size)
+		return 0;
+
+	while (size < n)
+		size *= 2;
+
+	if ((p = a->malloc_fn(size)) == NULL)
+		return 1;
+
+	if (a->buf != NULL) {
+		memcpy(p, a->buf, a->buf_len);
+		a->free_fn(a->buf);
+	}
+
+	a->buf = p;
+	a->buf_size = size;
+
+	return 0;
+}
+
+/*
+ * Decodes an unsigned LEB128 value from [*p, end).  Returns 1 if the
+ * encoding is incomplete, -1 if it is too long, otherwise 0 and *p
+ * is advanced past the value.
+ */
+static int decode_uleb(const unsigned char **p, const unsigned char *end,
+		       unsigned long long *value)
+{
+	const unsigned char *q;
+
+	for (q = *p; q < end && q - *p < LEB128_MAX_BYTES; q++) {
+		if ((*q & 0x80) == 0) {
+			*p = leb128_decode_ull(*p, value);
+			return 0;
+		}
+	}
+
+	return (q == end) ? 1 : -1;
+}
+
+/*
+ * Decodes a length-prefixed object from [*p, end).  Returns as per
+ * decode_uleb() and, on success, points *obj at the object's bytes.
+ */
+static int decode_object(const unsigned char **p, const unsigned char *end,
+			 const unsigned char **obj, size_t *len)
+{
+	unsigned long long n;
+	const unsigned char *q = *p;
+	int rc;
+
+	if ((rc = decode_uleb(&q, end, &n)) != 0)
+		return rc;
+
+	if (n > (unsigned long long)(end - q))
+		return 1;
+
+	*obj = q;
+	*len = (size_t)n;
+	*p = q + n;
+
+	return 0;
+}
+
+static int apply_insert(struct hashtbl_feed_applier *a,
+			const unsigned char *kp, size_t klen,
+			const unsigned char *vp, size_t vlen)
+{
+	unsigned long count = hashtbl_count(a->h);
+	void *k, *v;
+
+	if (a->key_decode_fn(kp, klen, &k) != 0)
+		return -1;
+
+	if (a->val_decode_fn(vp, vlen, &v) != 0) {
+		if (a->key_free_fn != NULL)
+			a->key_free_fn(k);
+		return -1;
+	}
+
+	/* Only a new key can fail, as replacing a value doesn't
+	 * allocate, so a failure leaves the table unchanged. */
+	if (hashtbl_insert(a->h, k, v) != 0) {
+		if (a->key_free_fn != NULL)
+			a->key_free_fn(k);
+		if (a->val_free_fn != NULL && v != NULL)
+			a->val_free_fn(v);
+		return -1;
+	}
+
+	/* A replaced value keeps the table's copy of the key. */
+	if (hashtbl_count(a->h) == count && a->key_free_fn != NULL)
+		a->key_free_fn(k);
+
+	return 0;
+}
+
+static int apply_remove(struct hashtbl_feed_applier *a,
+			const unsigned char *kp, size_t klen)
+{
+	void *k;
+
+	if (a->key_decode_fn(kp, klen, &k) != 0)
+		return -1;
+
+	(void)hashtbl_remove(a->h, k);
+
+	if (a->key_free_fn != NULL)
+		a->key_free_fn(k);
+
+	return 0;
+}
+
+/*
+ * Applies the record at *p.  Returns 1 if the record is incomplete,
+ * -1 on error, otherwise 0 and *p is advanced past the record.
+ */
+static int apply_record(struct hashtbl_feed_applier *a,
+			const unsigned char **p, const unsigned char *end)
+{
+	const unsigned char *q = *p, *kp = NULL, *vp = NULL;
+	size_t klen = 0, vlen = 0;
+	unsigned long long seqno;
+	int op, rc;
+
+	if (q == end)
+		return 1;
+
+	op = *q++;
+
+	if ((rc = decode_uleb(&q, end, &seqno)) != 0)
+		return rc;
+
+	switch (op) {
+	case HASHTBL_OP_INSERT:
+		if ((rc = decode_object(&q, end, &kp, &klen)) != 0)
+			return rc;
+		if ((rc = decode_object(&q, end, &vp, &vlen)) != 0)
+			return rc;
+		break;
+	case HASHTBL_OP_REMOVE:
+		if ((rc = decode_object(&q, end, &kp, &klen)) != 0)
+			return rc;
+		break;
+	case HASHTBL_OP_CLEAR:
+		break;
+	default:
+		return -1;
+	}
+
+	if (seqno != a->next_seqno)
+		return -1;
+
+	switch (op) {
+	case HASHTBL_OP_INSERT:
+		rc = apply_insert(a, kp, klen, vp, vlen);
+		break;
+	case HASHTBL_OP_REMOVE:
+		rc = apply_remove(a, kp, klen);
+		break;
+	default:
+		hashtbl_clear(a->h);
+		break;
+	}
+
+	if (rc != 0)
+		return -1;
+
+	a->next_seqno++;
+	*p = q;
+
+	return 0;
+}
+
+/*
+ * Applies all complete records in [buf, buf + len).  Returns the
+ * number of records applied, or -1 on error; *consumed is set to the
+ * number of bytes those records occupied.
+ */
+static long apply_records(struct hashtbl_feed_applier *a,
+			  const unsigned char *buf, size_t len,
+			  size_t *consumed)
+{
+	const unsigned char *p = buf, *end = buf + len;
+	long napplied = 0;
+	int rc;
+
+	while ((rc = apply_record(a, &p, end)) == 0)
+		napplied++;
+
+	*consumed = (size_t)(p - buf);
+
+	if (rc < 0) {
+		a->failed = 1;
+		return -1;
+	}
+
+	return napplied;
+}
+
+/* Applies the buffered bytes and keeps any trailing partial record. */
+
+static long apply_buffered(struct hashtbl_feed_applier *a)
+{
+	size_t consumed;
+	long napplied = apply_records(a, a->buf, a->buf_len, &consumed);
+
+	if (napplied >= 0) {
+		memmove(a->buf, a->buf + consumed, a->buf_len - consumed);
+		a->buf_len -= consumed;
+	}
+
+	return napplied;
+}
+
+long hashtbl_feed_apply(struct hashtbl_feed_applier *a, const void *buf,
+			size_t len)
+{
+	size_t consumed;
+	long napplied;
+
+	if (a->failed)
+		return -1;
+
+	if (a->buf_len != 0) {
+		if (buf_reserve(a, a->buf_len + len) != 0)
+			return -1;
+		memcpy(a->buf + a->buf_len, buf, len);
+		a->buf_len += len;
+		return apply_buffered(a);
+	}
+
+	/* Nothing is buffered: apply straight from the caller's bytes
+	 * and only copy a trailing partial record. */
+
+	if ((napplied = apply_records(a, buf, len, &consumed)) < 0)
+		return -1;
+
+	if (consumed < len) {
+		if (buf_reserve(a, len - consumed) != 0)
+			return -1;
+		memcpy(a->buf, (const unsigned char *)buf + consumed,
+		       len - consumed);
+		a->buf_len = len - consumed;
+	}
+
+	return napplied;
+}
+
+long hashtbl_feed_apply_fd(struct hashtbl_feed_applier *a, int fd,
+			   unsigned long *napplied)
+{
+	ssize_t nread;
+	long n;
+
+	if (napplied != NULL)
+		*napplied = 0;
+
+	if (a->failed) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	if (buf_reserve(a, a->buf_len + APPLIER_READ_SIZE) != 0) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	do {
+		nread = read(fd, a->buf + a->buf_len,
+			     a->buf_size - a->buf_len);
+	} while (nread < 0 && errno == EINTR);
+
+	if (nread <= 0)
+		return (long)nread;
+
+	a->buf_len += (size_t)nread;
+
+	if ((n = apply_buffered(a)) < 0) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	if (napplied != NULL)
+		*napplied = (unsigned long)n;
+
+	return (long)nread;
+}
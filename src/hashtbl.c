@@ -44,6 +44,8 @@
 #endif
 #include <c-hacks/hashtbl.h>
 #include <c-hacks/hashtbl-funcs.h>
+#include <c-hacks/histogram.h>
+#include <c-hacks/usdt.h>
 
 #define UNUSED_PARAMETER(X) (void)(X)
 
@@ -69,9 +71,28 @@ struct hashtbl {
 	HASHTBL_VAL_FREE_FN val_free_fn;
 	HASHTBL_MALLOC_FN malloc_fn;
 	HASHTBL_FREE_FN free_fn;
+	HASHTBL_OBSERVER_FN observer_fn;
+	void *observer_data;
+	struct latency *latency;
+	unsigned int select_nsamples;	/* 0 unless choosing hash_fn */
+	enum hashtbl_key_kind select_kind;
 	struct hashtbl_entry **table;
 };
 
+enum {
+	LATENCY_INSERT,
+	LATENCY_LOOKUP,
+	LATENCY_REMOVE,
+	LATENCY_NOPS
+};
+
+/* Latencies recorded after hashtbl_latency_enable(). */
+struct latency {
+	unsigned long long mask;	/* time when (nops & mask) == 0 */
+	unsigned long long nops;
+	struct histogram ops[LATENCY_NOPS];
+};
+
 struct hashtbl_entry {
 	struct hashtbl_entry *next;
 	void *key;
@@ -79,6 +100,18 @@ struct hashtbl_entry {
 	unsigned int hash;	/* hash of key */
 };
 
+#define SELECT_NCANDIDATES	2
+#define SELECT_ROUNDS		3
+
+/* The built-in hash functions hashtbl_select_hash() chooses from. */
+static const HASHTBL_HASH_FN select_candidates[][SELECT_NCANDIDATES] = {
+	[HASHTBL_KEY_STRING] = {hashtbl_string_hash,
+				hashtbl_string_fnv1a_hash},
+	[HASHTBL_KEY_INT] = {hashtbl_int_hash, hashtbl_int_mix_hash},
+	[HASHTBL_KEY_INT64] = {hashtbl_int64_hash, hashtbl_int64_mix_hash},
+	[HASHTBL_KEY_DIRECT] = {hashtbl_direct_hash, hashtbl_direct_mix_hash},
+};
+
 static int roundup_to_next_power_of_2(int x)
 {
 	int n = 1;
@@ -126,17 +159,35 @@ static INLINE void link_entry(struct hashtbl *h, struct hashtbl_entry *entry)
 	h->nentries++;
 }
 
+/* Returns non-zero if the current operation should be timed. */
+static INLINE int latency_sample(struct hashtbl *h)
+{
+	return h->latency != NULL &&
+	    (h->latency->nops++ & h->latency->mask) == 0;
+}
+
+static void latency_record(struct hashtbl *h, int op, uint64_t start)
+{
+	uint64_t ns = histogram_clock_ns(histogram_clock() - start);
+
+	histogram_record(&h->latency->ops[op], ns);
+}
+
 static INLINE struct hashtbl_entry *find_entry(struct hashtbl *h,
 					       unsigned int hv, const void *k)
 {
 	struct hashtbl_entry *entry = tbl_entry(h, hv);
+	unsigned long depth = 0;
 
 	while (entry != NULL) {
+		depth++;
 		if (entry->hash == hv && h->equals_fn(entry->key, k))
 			break;
 		entry = entry->next;
 	}
 
+	USDT_PROBE3(hashtbl, chain, h, hv, depth);
+
 	return entry;
 }
 
@@ -149,8 +200,10 @@ static struct hashtbl_entry *remove_key(struct hashtbl *h, const void *k)
 	unsigned int hv = h->hash_fn(k);
 	struct hashtbl_entry **head = tbl_entry_ref(h, hv);
 	struct hashtbl_entry *entry = *head;
+	unsigned long depth = 0;
 
 	while (entry != NULL) {
+		depth++;
 		if (entry->hash == hv && h->equals_fn(entry->key, k)) {
 			unlink_entry(h, head, entry);
 			break;
@@ -159,6 +212,8 @@ static struct hashtbl_entry *remove_key(struct hashtbl *h, const void *k)
 		entry = entry->next;
 	}
 
+	USDT_PROBE3(hashtbl, chain, h, hv, depth);
+
 	return entry;
 }
 
@@ -168,8 +223,10 @@ static struct hashtbl_entry *hashtbl_entry_new(struct hashtbl *h,
 {
 	struct hashtbl_entry *entry;
 
-	if ((entry = h->malloc_fn(sizeof(*entry))) == NULL)
+	if ((entry = h->malloc_fn(sizeof(*entry))) == NULL) {
+		USDT_PROBE2(hashtbl, alloc_fail, h, sizeof(*entry));
 		return NULL;
+	}
 
 	entry->key = k;
 	entry->val = v;
@@ -179,7 +236,7 @@ static struct hashtbl_entry *hashtbl_entry_new(struct hashtbl *h,
 	return entry;
 }
 
-int hashtbl_insert(struct hashtbl *h, void *k, void *v)
+static INLINE int insert(struct hashtbl *h, void *k, void *v)
 {
 	struct hashtbl_entry *entry;
 	unsigned int hv = h->hash_fn(k);
@@ -188,6 +245,9 @@ int hashtbl_insert(struct hashtbl *h, void *k, void *v)
 		if (h->val_free_fn != NULL)
 			h->val_free_fn(entry->val);
 		entry->val = v;
+		if (h->observer_fn != NULL)
+			h->observer_fn(h, HASHTBL_OP_INSERT, k, v,
+				       h->observer_data);
 		return 0;
 	}
 
@@ -195,6 +255,8 @@ int hashtbl_insert(struct hashtbl *h, void *k, void *v)
 		if (h->nentries >= (unsigned int)h->resize_threshold) {
 			/* auto resize failures are benign. */
 			(void)hashtbl_resize(h, 2 * h->table_size);
+			/* It may also have chosen a new hash_fn. */
+			hv = h->hash_fn(k);
 		}
 	}
 
@@ -203,21 +265,27 @@ int hashtbl_insert(struct hashtbl *h, void *k, void *v)
 
 	link_entry(h, entry);
 
+	if (h->observer_fn != NULL)
+		h->observer_fn(h, HASHTBL_OP_INSERT, k, v, h->observer_data);
+
 	return 0;
 }
 
-void *hashtbl_lookup(struct hashtbl *h, const void *k)
+static INLINE void *lookup(struct hashtbl *h, const void *k)
 {
 	struct hashtbl_entry *entry = find_entry(h, h->hash_fn(k), k);
 
 	return (entry != NULL) ? entry->val : NULL;
 }
 
-int hashtbl_remove(struct hashtbl *h, const void *k)
+static INLINE int remove_entry(struct hashtbl *h, const void *k)
 {
 	struct hashtbl_entry *entry = remove_key(h, k);
 
 	if (entry != NULL) {
+		if (h->observer_fn != NULL)
+			h->observer_fn(h, HASHTBL_OP_REMOVE, entry->key,
+				       entry->val, h->observer_data);
 		if (h->key_free_fn != NULL)
 			h->key_free_fn(entry->key);
 		if (h->val_free_fn != NULL && entry->val != NULL)
@@ -229,7 +297,52 @@ int hashtbl_remove(struct hashtbl *h, const void *k)
 	return 1;
 }
 
-void hashtbl_clear(struct hashtbl *h)
+int hashtbl_insert(struct hashtbl *h, void *k, void *v)
+{
+	uint64_t start;
+	int rc;
+
+	if (!latency_sample(h))
+		return insert(h, k, v);
+
+	start = histogram_clock();
+	rc = insert(h, k, v);
+	latency_record(h, LATENCY_INSERT, start);
+
+	return rc;
+}
+
+void *hashtbl_lookup(struct hashtbl *h, const void *k)
+{
+	uint64_t start;
+	void *v;
+
+	if (!latency_sample(h))
+		return lookup(h, k);
+
+	start = histogram_clock();
+	v = lookup(h, k);
+	latency_record(h, LATENCY_LOOKUP, start);
+
+	return v;
+}
+
+int hashtbl_remove(struct hashtbl *h, const void *k)
+{
+	uint64_t start;
+	int rc;
+
+	if (!latency_sample(h))
+		return remove_entry(h, k);
+
+	start = histogram_clock();
+	rc = remove_entry(h, k);
+	latency_record(h, LATENCY_REMOVE, start);
+
+	return rc;
+}
+
+static void clear_entries(struct hashtbl *h)
 {
 	int i;
 	struct hashtbl_entry *entry, *next;
@@ -250,9 +363,18 @@ void hashtbl_clear(struct hashtbl *h)
 	}
 }
 
+void hashtbl_clear(struct hashtbl *h)
+{
+	if (h->observer_fn != NULL)
+		h->observer_fn(h, HASHTBL_OP_CLEAR, NULL, NULL,
+			       h->observer_data);
+	clear_entries(h);
+}
+
 void hashtbl_delete(struct hashtbl *h)
 {
-	hashtbl_clear(h);
+	hashtbl_latency_disable(h);
+	clear_entries(h);
 	h->free_fn(h->table);
 	h->free_fn(h);
 }
@@ -282,8 +404,10 @@ struct hashtbl *hashtbl_create(int capacity, double max_load_factor,
 	hash_fn = (hash_fn != NULL) ? hash_fn : hashtbl_direct_hash;
 	equals_fn = (equals_fn != NULL) ? equals_fn : hashtbl_direct_equals;
 
-	if ((h = malloc_fn(sizeof(*h))) == NULL)
+	if ((h = malloc_fn(sizeof(*h))) == NULL) {
+		USDT_PROBE2(hashtbl, alloc_fail, NULL, sizeof(*h));
 		return NULL;
+	}
 
 	if (max_load_factor < 0.0) {
 		max_load_factor = 0.75f;
@@ -302,6 +426,11 @@ struct hashtbl *hashtbl_create(int capacity, double max_load_factor,
 	h->val_free_fn = val_free_fn;
 	h->malloc_fn = malloc_fn;
 	h->free_fn = free_fn;
+	h->observer_fn = NULL;
+	h->observer_data = NULL;
+	h->latency = NULL;
+	h->select_nsamples = 0;
+	h->select_kind = HASHTBL_KEY_DIRECT;
 	h->table = NULL;
 
 	if (hashtbl_resize(h, capacity) != 0) {
@@ -312,12 +441,132 @@ struct hashtbl *hashtbl_create(int capacity, double max_load_factor,
 	return h;
 }
 
+/* Keeps select_time() from being optimised away. */
+static volatile unsigned int select_sink;
+
+/* Nanoseconds fn takes to hash each of the n keys, the best of a few. */
+static double select_time(HASHTBL_HASH_FN fn, void **keys, unsigned int n)
+{
+	uint64_t start, t, best = UINT64_MAX;
+	unsigned int i, acc = 0;
+	int round;
+
+	for (round = 0; round < SELECT_ROUNDS; round++) {
+		start = histogram_clock();
+		for (i = 0; i < n; i++)
+			acc ^= fn(keys[i]);
+		t = histogram_clock() - start;
+		if (t < best)
+			best = t;
+	}
+
+	select_sink = acc;
+
+	return (double)histogram_clock_ns(best) / n;
+}
+
+/*
+ * Mean position of the n keys in their chains when hashed by fn into
+ * size slots; 1 if every key has a slot to itself.
+ */
+static double select_probes(HASHTBL_HASH_FN fn, void **keys, unsigned int n,
+			    unsigned int *slots, int size)
+{
+	unsigned long long sum = 0;
+	unsigned int i;
+
+	memset(slots, 0, (size_t) size * sizeof(*slots));
+
+	for (i = 0; i < n; i++)
+		sum += ++slots[fn(keys[i]) & (unsigned int)(size - 1)];
+
+	return (double)sum / n;
+}
+
+/*
+ * Choose the hash function for hashtbl_select_hash() from a sample of
+ * the table's keys.  Returns NULL if no memory could be allocated.
+ */
+static HASHTBL_HASH_FN select_hash(struct hashtbl *h, int capacity)
+{
+	HASHTBL_HASH_FN fns[1 + SELECT_NCANDIDATES];
+	double probes[1 + SELECT_NCANDIDATES], ns[1 + SELECT_NCANDIDATES];
+	double least;
+	unsigned long stride, pos = 0;
+	unsigned int n = 0, *slots;
+	void **keys;
+	int i, nfns = 0, best, size;
+	size_t nbytes;
+
+	size = roundup_to_next_power_of_2((int)h->select_nsamples);
+	if (size > capacity)
+		size = capacity;
+
+	nbytes = h->select_nsamples * sizeof(*keys) +
+	    (size_t) size * sizeof(*slots);
+
+	if ((keys = h->malloc_fn(nbytes)) == NULL) {
+		USDT_PROBE2(hashtbl, alloc_fail, h, nbytes);
+		return NULL;
+	}
+
+	slots = (unsigned int *)(keys + h->select_nsamples);
+
+	/* Every stride'th entry, so the sample spans the table. */
+	stride = h->nentries / h->select_nsamples;
+
+	for (i = 0; i < h->table_size && n < h->select_nsamples; i++) {
+		struct hashtbl_entry *entry;
+
+		for (entry = h->table[i]; entry != NULL; entry = entry->next) {
+			if (pos++ % stride == 0 && n < h->select_nsamples)
+				keys[n++] = entry->key;
+		}
+	}
+
+	/*
+	 * The current function may be one of the candidates, but the
+	 * built-ins are static inline, so a caller's copy has its own
+	 * address and can't be matched: it is simply measured twice.
+	 */
+	fns[nfns++] = h->hash_fn;
+	for (i = 0; i < SELECT_NCANDIDATES; i++)
+		fns[nfns++] = select_candidates[h->select_kind][i];
+
+	for (i = 0; i < nfns; i++) {
+		probes[i] = select_probes(fns[i], keys, n, slots, size);
+		ns[i] = select_time(fns[i], keys, n);
+	}
+
+	least = probes[0];
+	for (i = 1; i < nfns; i++) {
+		if (probes[i] < least)
+			least = probes[i];
+	}
+
+	/* Of those that spread the keys well enough, the fastest. */
+	best = -1;
+	for (i = 0; i < nfns; i++) {
+		if (probes[i] > least * 1.05)
+			continue;
+		if (best < 0 || ns[i] < ns[best] * 0.95)
+			best = i;
+	}
+
+	h->free_fn(keys);
+
+	USDT_PROBE4(hashtbl, select_hash, h, n, h->hash_fn, fns[best]);
+
+	return fns[best];
+}
+
 int hashtbl_resize(struct hashtbl *h, int capacity)
 {
-	int i;
+	int i, rehash = 0;
 	struct hashtbl_entry **new_table;
 	size_t nbytes;
 	struct hashtbl tmp_h;
+	HASHTBL_HASH_FN hash_fn;
 
 	if (capacity < 1) {
 		capacity = 1;
@@ -332,15 +581,26 @@ int hashtbl_resize(struct hashtbl *h, int capacity)
 	if (capacity < h->table_size || capacity == h->table_size)
 		return 0;
 
+	USDT_PROBE3(hashtbl, resize_start, h, h->table_size, capacity);
+
 	nbytes = (size_t) capacity *sizeof(*new_table);
 
-	if ((tmp_h.table = h->malloc_fn(nbytes)) == NULL)
+	if ((tmp_h.table = h->malloc_fn(nbytes)) == NULL) {
+		USDT_PROBE2(hashtbl, alloc_fail, h, nbytes);
 		return 1;
+	}
 
 	memset(tmp_h.table, 0, nbytes);
 	tmp_h.nentries = 0;
 	tmp_h.table_size = capacity;
 
+	if (h->select_nsamples != 0 && h->nentries >= h->select_nsamples &&
+	    (hash_fn = select_hash(h, capacity)) != NULL) {
+		rehash = hash_fn != h->hash_fn;
+		h->hash_fn = hash_fn;
+		h->select_nsamples = 0;
+	}
+
 	/* Transfer all entries from old table to new table. */
 
 	for (i = 0; i < h->table_size; i++) {
@@ -349,6 +609,8 @@ int hashtbl_resize(struct hashtbl *h, int capacity)
 
 		while ((entry = *head) != NULL) {
 			unlink_entry(h, head, entry);
+			if (rehash)
+				entry->hash = h->hash_fn(entry->key);
 			link_entry(&tmp_h, entry);
 			/* Look for other chained keys in this slot */
 			head = &h->table[i];
@@ -362,6 +624,8 @@ int hashtbl_resize(struct hashtbl *h, int capacity)
 	h->nentries = tmp_h.nentries;
 	h->resize_threshold = resize_threshold(capacity, h->max_load_factor);
 
+	USDT_PROBE3(hashtbl, resize_end, h, capacity, h->nentries);
+
 	return 0;
 }
 
@@ -434,3 +698,90 @@ double hashtbl_load_factor(const struct hashtbl *h)
 {
 	return (double)h->nentries / (double)h->table_size;
 }
+
+void hashtbl_set_observer(struct hashtbl *h, HASHTBL_OBSERVER_FN fn,
+			  void *client_data)
+{
+	h->observer_fn = fn;
+	h->observer_data = (fn != NULL) ? client_data : NULL;
+}
+
+int hashtbl_latency_enable(struct hashtbl *h, unsigned int sample_shift)
+{
+	int i;
+
+	if (h->latency == NULL) {
+		h->latency = h->malloc_fn(sizeof(*h->latency));
+		if (h->latency == NULL) {
+			USDT_PROBE2(hashtbl, alloc_fail, h,
+				    sizeof(*h->latency));
+			return 1;
+		}
+	}
+
+	if (sample_shift > 63)
+		sample_shift = 63;
+
+	h->latency->mask = (1ULL << sample_shift) - 1;
+	h->latency->nops = 0;
+	for (i = 0; i < LATENCY_NOPS; i++)
+		histogram_init(&h->latency->ops[i]);
+
+	/* Keep the calibration out of the first sample. */
+	histogram_clock_calibrate();
+
+	return 0;
+}
+
+void hashtbl_latency_disable(struct hashtbl *h)
+{
+	if (h->latency != NULL) {
+		h->free_fn(h->latency);
+		h->latency = NULL;
+	}
+}
+
+int hashtbl_latency(const struct hashtbl *h, enum hashtbl_latency_op op,
+		    struct histogram *hist)
+{
+	if (h->latency == NULL)
+		return 1;
+
+	switch (op) {
+	case HASHTBL_LATENCY_INSERT:
+		histogram_merge(hist, &h->latency->ops[LATENCY_INSERT]);
+		return 0;
+	case HASHTBL_LATENCY_LOOKUP:
+		histogram_merge(hist, &h->latency->ops[LATENCY_LOOKUP]);
+		return 0;
+	case HASHTBL_LATENCY_REMOVE:
+		histogram_merge(hist, &h->latency->ops[LATENCY_REMOVE]);
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+int hashtbl_select_hash(struct hashtbl *h, enum hashtbl_key_kind kind,
+			unsigned int nsamples)
+{
+	switch (kind) {
+	case HASHTBL_KEY_STRING:
+	case HASHTBL_KEY_INT:
+	case HASHTBL_KEY_INT64:
+	case HASHTBL_KEY_DIRECT:
+		break;
+	default:
+		return 1;
+	}
+
+	h->select_kind = kind;
+	h->select_nsamples = nsamples;
+
+	return 0;
+}
+
+HASHTBL_HASH_FN hashtbl_hash_fn(const struct hashtbl *h)
+{
+	return h->hash_fn;
+}
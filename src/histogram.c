@@ -0,0 +1,254 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Log-linear histogram.
+ *
+ * Bucket group 0 holds the values below HISTOGRAM_SUB_BUCKETS, one
+ * per bucket.  Group g > 0 holds the values whose top bit is bit
+ * g + SUB_BITS - 1, split on the SUB_BITS bits below the top bit; the
+ * bits below those are dropped.  So the index of a value is its group
+ * followed by those SUB_BITS bits.
+ */
+
+#define _GNU_SOURCE
+
+#include <stddef.h>		/* NULL */
+#include <string.h>		/* memset */
+#include <stdatomic.h>
+#include <time.h>		/* clock_gettime */
+#include <c-hacks/histogram.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <x86intrin.h>		/* __rdtsc */
+#define HAVE_RDTSC 1
+#endif
+
+#if defined(_MSC_VER)
+#define INLINE __inline
+#else
+#define INLINE inline
+#endif
+
+#define SUB_BITS	HISTOGRAM_SUB_BITS
+#define SUB_BUCKETS	HISTOGRAM_SUB_BUCKETS
+
+/* How long histogram_clock_calibrate() watches the clock for. */
+#define CALIBRATE_NS	1000000
+
+/* Nanoseconds per tick, in 16.16 fixed point; 0 until calibrated. */
+static atomic_ulong ns_per_tick;
+
+static INLINE int msb64(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return 63 - __builtin_clzll(x);
+#else
+	int n = 0;
+
+	while (x >>= 1)
+		n++;
+	return n;
+#endif
+}
+
+static INLINE int bucket_index(uint64_t value)
+{
+	int shift;
+
+	if (value < SUB_BUCKETS)
+		return (int)value;
+
+	shift = msb64(value) - SUB_BITS;
+
+	return ((shift + 1) << SUB_BITS) +
+	    (int)((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+/* Returns the highest value that lands in bucket i. */
+static uint64_t bucket_high(int i)
+{
+	int group = i >> SUB_BITS;
+	uint64_t sub = (uint64_t)(i & (SUB_BUCKETS - 1));
+	int shift;
+
+	if (group == 0)
+		return sub;
+
+	shift = group - 1;
+
+	return ((SUB_BUCKETS + sub) << shift) + ((1ULL << shift) - 1);
+}
+
+void histogram_init(struct histogram *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min = UINT64_MAX;
+}
+
+void histogram_record(struct histogram *h, uint64_t value)
+{
+	h->buckets[bucket_index(value)]++;
+	h->count++;
+	h->sum += value;
+	if (value < h->min)
+		h->min = value;
+	if (value > h->max)
+		h->max = value;
+}
+
+void histogram_merge(struct histogram *dst, const struct histogram *src)
+{
+	int i;
+
+	if (src->count == 0)
+		return;
+
+	for (i = 0; i < HISTOGRAM_NBUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+uint64_t histogram_count(const struct histogram *h)
+{
+	return h->count;
+}
+
+uint64_t histogram_percentile(const struct histogram *h, double pct)
+{
+	uint64_t rank, seen = 0;
+	double r;
+	int i;
+
+	if (h->count == 0)
+		return 0;
+
+	if (pct <= 0.0)
+		return h->min;
+
+	if (pct >= 100.0)
+		return h->max;
+
+	/* The rank'th smallest value, counting from 1, rounding up. */
+	r = pct / 100.0 * (double)h->count;
+	rank = (uint64_t)r;
+	if ((double)rank < r || rank == 0)
+		rank++;
+
+	for (i = 0; i < HISTOGRAM_NBUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank) {
+			uint64_t high = bucket_high(i);
+			return (high < h->max) ? high : h->max;
+		}
+	}
+
+	return h->max;
+}
+
+void histogram_summary(const struct histogram *h,
+		       struct histogram_summary *s)
+{
+	memset(s, 0, sizeof(*s));
+
+	if (h->count == 0)
+		return;
+
+	s->count = h->count;
+	s->min = h->min;
+	s->max = h->max;
+	s->mean = (double)h->sum / (double)h->count;
+	s->p50 = histogram_percentile(h, 50.0);
+	s->p99 = histogram_percentile(h, 99.0);
+	s->p999 = histogram_percentile(h, 99.9);
+}
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t histogram_clock(void)
+{
+#if defined(HAVE_RDTSC)
+	return __rdtsc();
+#else
+	return monotonic_ns();
+#endif
+}
+
+void histogram_clock_calibrate(void)
+{
+	uint64_t ns0, ns, ticks0, ticks;
+	unsigned long scale = 1UL << 16;
+
+	if (atomic_load_explicit(&ns_per_tick, memory_order_relaxed) != 0)
+		return;
+
+#if defined(HAVE_RDTSC)
+	ns0 = monotonic_ns();
+	ticks0 = histogram_clock();
+	do {
+		ns = monotonic_ns() - ns0;
+		ticks = histogram_clock() - ticks0;
+	} while (ns < CALIBRATE_NS);
+
+	if (ticks != 0)
+		scale = (unsigned long)((ns << 16) / ticks);
+	if (scale == 0)
+		scale = 1;
+#else
+	(void)ns0, (void)ns, (void)ticks0, (void)ticks;
+#endif
+
+	/* Racing callers store near enough the same value. */
+	atomic_store_explicit(&ns_per_tick, scale, memory_order_relaxed);
+}
+
+uint64_t histogram_clock_ns(uint64_t ticks)
+{
+	uint64_t scale = atomic_load_explicit(&ns_per_tick,
+					      memory_order_relaxed);
+
+	if (scale == 0) {
+		histogram_clock_calibrate();
+		scale = atomic_load_explicit(&ns_per_tick,
+					     memory_order_relaxed);
+	}
+
+	/* Split so that the product can't overflow for any sane delta. */
+	return (ticks >> 16) * scale + (((ticks & 0xffff) * scale) >> 16);
+}
@@ -0,0 +1,195 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * An interval tree on top of an augmented rbtree.
+ *
+ * Nodes are ordered by start, then last, and each caches max_last, the
+ * largest last in its subtree, which rbtree keeps up to date through
+ * the augment callback.  A search for [lo, hi] relies on two facts:
+ * nothing in a subtree whose max_last is below lo can overlap, and
+ * nothing after a node whose start is above hi can overlap either.
+ */
+
+#include <stddef.h>		/* size_t, NULL */
+#include <stdlib.h>		/* qsort */
+#include <stdint.h>		/* int64_t */
+#include <c-hacks/itree.h>
+
+#if defined(_MSC_VER)
+#define INLINE __inline
+#else
+#define INLINE inline
+#endif
+
+#define NODE(N)	RBTREE_ENTRY(N, struct itree_node, rb)
+
+static int node_compare(const struct rbtree_node *a,
+			const struct rbtree_node *b)
+{
+	const struct itree_node *x = NODE(a), *y = NODE(b);
+
+	if (x->start != y->start)
+		return (x->start > y->start) - (x->start < y->start);
+
+	return (x->last > y->last) - (x->last < y->last);
+}
+
+static void augment(struct rbtree_node *rb)
+{
+	struct itree_node *n = NODE(rb);
+	int64_t max = n->last;
+
+	if (rb->left != NULL && NODE(rb->left)->max_last > max)
+		max = NODE(rb->left)->max_last;
+	if (rb->right != NULL && NODE(rb->right)->max_last > max)
+		max = NODE(rb->right)->max_last;
+
+	n->max_last = max;
+}
+
+void itree_init(struct itree *t)
+{
+	rbtree_init_augmented(&t->rb, node_compare, augment);
+}
+
+void itree_insert(struct itree *t, struct itree_node *n)
+{
+	n->max_last = n->last;
+	rbtree_insert_multi(&t->rb, &n->rb);
+}
+
+void itree_remove(struct itree *t, struct itree_node *n)
+{
+	rbtree_remove(&t->rb, &n->rb);
+}
+
+static int ptr_compare(const void *a, const void *b)
+{
+	return node_compare(&(*(struct itree_node *const *)a)->rb,
+			    &(*(struct itree_node *const *)b)->rb);
+}
+
+static struct rbtree_node *next_node(void *client_data)
+{
+	struct itree_node ***pos = client_data;
+
+	return &(*(*pos)++)->rb;
+}
+
+void itree_build(struct itree *t, struct itree_node **nodes, size_t n)
+{
+	struct itree_node **pos = nodes;
+	size_t i;
+
+	for (i = 1; i < n; i++) {
+		if (node_compare(&nodes[i - 1]->rb, &nodes[i]->rb) > 0) {
+			qsort(nodes, n, sizeof(*nodes), ptr_compare);
+			break;
+		}
+	}
+
+	rbtree_build(&t->rb, next_node, &pos, n);
+}
+
+/*
+ * Returns the first interval under n, in start order, that overlaps
+ * [lo, hi].  If the left subtree has any interval ending at or after
+ * lo then the first such is the answer, provided it starts by hi, and
+ * otherwise nothing in the whole tree can be.
+ */
+static struct itree_node *subtree_search(struct itree_node *n, int64_t lo,
+					 int64_t hi)
+{
+	for (;;) {
+		struct rbtree_node *rb = &n->rb;
+
+		if (rb->left != NULL && NODE(rb->left)->max_last >= lo) {
+			n = NODE(rb->left);
+			continue;
+		}
+
+		if (n->start > hi)
+			return NULL;
+		if (n->last >= lo)
+			return n;
+
+		if (rb->right == NULL || NODE(rb->right)->max_last < lo)
+			return NULL;
+
+		n = NODE(rb->right);
+	}
+}
+
+struct itree_node *itree_first_overlap(const struct itree *t, int64_t lo,
+				       int64_t hi)
+{
+	struct itree_node *root;
+
+	if (t->rb.root == NULL)
+		return NULL;
+
+	root = NODE(t->rb.root);
+	if (root->max_last < lo || NODE(rbtree_first(&t->rb))->start > hi)
+		return NULL;
+
+	return subtree_search(root, lo, hi);
+}
+
+struct itree_node *itree_next_overlap(const struct itree_node *n,
+				      int64_t lo, int64_t hi)
+{
+	const struct rbtree_node *rb = &n->rb, *prev;
+	struct rbtree_node *right = rb->right;
+
+	for (;;) {
+		/* Everything before n has been seen: try n's right... */
+
+		if (right != NULL && NODE(right)->max_last >= lo)
+			return subtree_search(NODE(right), lo, hi);
+
+		/* ...then the first ancestor that n is to the left of. */
+
+		do {
+			prev = rb;
+			if ((rb = rbtree_parent(rb)) == NULL)
+				return NULL;
+			right = rb->right;
+		} while (right == prev);
+
+		n = NODE(rb);
+		if (n->start > hi)
+			return NULL;
+		if (n->last >= lo)
+			return (struct itree_node *)n;
+	}
+}
+
+unsigned long itree_count(const struct itree *t)
+{
+	return rbtree_count(&t->rb);
+}
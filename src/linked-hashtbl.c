@@ -49,6 +49,8 @@
 
 #include <c-hacks/linked-hashtbl.h>
 #include <c-hacks/hashtbl-funcs.h>
+#include <c-hacks/histogram.h>
+#include <c-hacks/usdt.h>
 
 #define UNUSED_PARAMETER(X) (void)(X)
 
@@ -84,9 +86,24 @@ struct l_hashtbl {
 	LINKED_HASHTBL_MALLOC_FN malloc_fn;
 	LINKED_HASHTBL_FREE_FN free_fn;
 	LINKED_HASHTBL_EVICTOR_FN evictor_fn;
+	struct latency *latency;
 	struct l_hashtbl_entry **table;
 };
 
+enum {
+	LATENCY_INSERT,
+	LATENCY_LOOKUP,
+	LATENCY_REMOVE,
+	LATENCY_NOPS
+};
+
+/* Latencies recorded after l_hashtbl_latency_enable(). */
+struct latency {
+	unsigned long long mask;	/* time when (nops & mask) == 0 */
+	unsigned long long nops;
+	struct histogram ops[LATENCY_NOPS];
+};
+
 struct l_hashtbl_entry {
 	struct l_hashtbl_list_head list;	/* all_entries list */
 	struct l_hashtbl_entry *next;	/* per slot list */
@@ -172,13 +189,17 @@ static INLINE struct l_hashtbl_entry *find_entry(struct l_hashtbl *h,
 						 unsigned int hv, const void *k)
 {
 	struct l_hashtbl_entry *entry = tbl_entry(h, hv);
+	unsigned long depth = 0;
 
 	while (entry != NULL) {
+		depth++;
 		if (entry->hash == hv && h->equals_fn(entry->key, k))
 			break;
 		entry = entry->next;
 	}
 
+	USDT_PROBE3(l_hashtbl, chain, h, hv, depth);
+
 	return entry;
 }
 
@@ -191,8 +212,10 @@ static struct l_hashtbl_entry *remove_key(struct l_hashtbl *h, const void *k)
 	unsigned int hv = h->hash_fn(k);
 	struct l_hashtbl_entry **slot_ref = tbl_entry_ref(h, hv);
 	struct l_hashtbl_entry *entry = *slot_ref;
+	unsigned long depth = 0;
 
 	while (entry != NULL) {
+		depth++;
 		if (entry->hash == hv && h->equals_fn(entry->key, k)) {
 			/* advance previous node to next entry. */
 			*slot_ref = entry->next;
@@ -204,10 +227,42 @@ static struct l_hashtbl_entry *remove_key(struct l_hashtbl *h, const void *k)
 		entry = entry->next;
 	}
 
+	USDT_PROBE3(l_hashtbl, chain, h, hv, depth);
+
 	return entry;
 }
 
-int l_hashtbl_insert(struct l_hashtbl *h, void *k, void *v)
+/* Returns non-zero if the current operation should be timed. */
+static INLINE int latency_sample(struct l_hashtbl *h)
+{
+	return h->latency != NULL &&
+	    (h->latency->nops++ & h->latency->mask) == 0;
+}
+
+static void latency_record(struct l_hashtbl *h, int op, uint64_t start)
+{
+	uint64_t ns = histogram_clock_ns(histogram_clock() - start);
+
+	histogram_record(&h->latency->ops[op], ns);
+}
+
+static INLINE int remove_entry(struct l_hashtbl *h, const void *k)
+{
+	struct l_hashtbl_entry *entry = remove_key(h, k);
+
+	if (entry != NULL) {
+		if (h->key_free_fn != NULL)
+			h->key_free_fn(entry->key);
+		if (h->val_free_fn != NULL && entry->val != NULL)
+			h->val_free_fn(entry->val);
+		h->free_fn(entry);
+		return 0;
+	}
+
+	return 1;
+}
+
+static INLINE int insert(struct l_hashtbl *h, void *k, void *v)
 {
 	struct l_hashtbl_entry *entry, **slot_ref;
 	unsigned int hv = h->hash_fn(k);
@@ -221,8 +276,10 @@ int l_hashtbl_insert(struct l_hashtbl *h, void *k, void *v)
 		return 0;
 	}
 
-	if ((entry = h->malloc_fn(sizeof(*entry))) == NULL)
+	if ((entry = h->malloc_fn(sizeof(*entry))) == NULL) {
+		USDT_PROBE2(l_hashtbl, alloc_fail, h, sizeof(*entry));
 		return 1;
+	}
 
 	entry->key = k;
 	entry->val = v;
@@ -242,7 +299,8 @@ int l_hashtbl_insert(struct l_hashtbl *h, void *k, void *v)
 		/* Evict oldest entry. */
 		struct l_hashtbl_list_head *node = h->all_entries.prev;
 		entry = LIST_ENTRY(node, struct l_hashtbl_entry, list);
-		l_hashtbl_remove(h, entry->key);
+		USDT_PROBE3(l_hashtbl, evict, h, entry->key, h->nentries);
+		remove_entry(h, entry->key);
 	}
 
 	if (h->auto_resize) {
@@ -255,7 +313,7 @@ int l_hashtbl_insert(struct l_hashtbl *h, void *k, void *v)
 	return 0;
 }
 
-void *l_hashtbl_lookup(struct l_hashtbl *h, const void *k)
+static INLINE void *lookup(struct l_hashtbl *h, const void *k)
 {
 	unsigned int hv = h->hash_fn(k);
 	struct l_hashtbl_entry *entry = find_entry(h, hv, k);
@@ -268,20 +326,49 @@ void *l_hashtbl_lookup(struct l_hashtbl *h, const void *k)
 	return NULL;
 }
 
+int l_hashtbl_insert(struct l_hashtbl *h, void *k, void *v)
+{
+	uint64_t start;
+	int rc;
+
+	if (!latency_sample(h))
+		return insert(h, k, v);
+
+	start = histogram_clock();
+	rc = insert(h, k, v);
+	latency_record(h, LATENCY_INSERT, start);
+
+	return rc;
+}
+
+void *l_hashtbl_lookup(struct l_hashtbl *h, const void *k)
+{
+	uint64_t start;
+	void *v;
+
+	if (!latency_sample(h))
+		return lookup(h, k);
+
+	start = histogram_clock();
+	v = lookup(h, k);
+	latency_record(h, LATENCY_LOOKUP, start);
+
+	return v;
+}
+
 int l_hashtbl_remove(struct l_hashtbl *h, const void *k)
 {
-	struct l_hashtbl_entry *entry = remove_key(h, k);
+	uint64_t start;
+	int rc;
 
-	if (entry != NULL) {
-		if (h->key_free_fn != NULL)
-			h->key_free_fn(entry->key);
-		if (h->val_free_fn != NULL && entry->val != NULL)
-			h->val_free_fn(entry->val);
-		h->free_fn(entry);
-		return 0;
-	}
+	if (!latency_sample(h))
+		return remove_entry(h, k);
 
-	return 1;
+	start = histogram_clock();
+	rc = remove_entry(h, k);
+	latency_record(h, LATENCY_REMOVE, start);
+
+	return rc;
 }
 
 void l_hashtbl_clear(struct l_hashtbl *h)
@@ -308,6 +395,7 @@ void l_hashtbl_clear(struct l_hashtbl *h)
 
 void l_hashtbl_delete(struct l_hashtbl *h)
 {
+	l_hashtbl_latency_disable(h);
 	l_hashtbl_clear(h);
 	h->free_fn(h->table);
 	h->free_fn(h);
@@ -341,8 +429,10 @@ struct l_hashtbl *l_hashtbl_create(int capacity, double max_load_factor,
 	equals_fn = (equals_fn != NULL) ? equals_fn : hashtbl_direct_equals;
 	evictor_fn = (evictor_fn != NULL) ? evictor_fn : remove_eldest;
 
-	if ((h = malloc_fn(sizeof(*h))) == NULL)
+	if ((h = malloc_fn(sizeof(*h))) == NULL) {
+		USDT_PROBE2(l_hashtbl, alloc_fail, NULL, sizeof(*h));
 		return NULL;
+	}
 
 	if (max_load_factor < 0.0) {
 		max_load_factor = 0.75f;
@@ -363,6 +453,7 @@ struct l_hashtbl *l_hashtbl_create(int capacity, double max_load_factor,
 	h->malloc_fn = malloc_fn;
 	h->free_fn = free_fn;
 	h->evictor_fn = evictor_fn;
+	h->latency = NULL;
 	h->table = NULL;
 	list_init(&h->all_entries);
 
@@ -394,10 +485,14 @@ int l_hashtbl_resize(struct l_hashtbl *h, int capacity)
 	if (capacity < h->table_size || capacity == h->table_size)
 		return 0;
 
+	USDT_PROBE3(l_hashtbl, resize_start, h, h->table_size, capacity);
+
 	nbytes = (size_t) capacity *sizeof(*new_table);
 
-	if ((tmp_h.table = h->malloc_fn(nbytes)) == NULL)
+	if ((tmp_h.table = h->malloc_fn(nbytes)) == NULL) {
+		USDT_PROBE2(l_hashtbl, alloc_fail, h, nbytes);
 		return 1;
+	}
 
 	memset(tmp_h.table, 0, nbytes);
 	tmp_h.table_size = capacity;
@@ -418,6 +513,8 @@ int l_hashtbl_resize(struct l_hashtbl *h, int capacity)
 	h->table_size = capacity;
 	h->resize_threshold = resize_threshold(capacity, h->max_load_factor);
 
+	USDT_PROBE3(l_hashtbl, resize_end, h, capacity, h->nentries);
+
 	return 0;
 }
 
@@ -485,3 +582,59 @@ double l_hashtbl_load_factor(const struct l_hashtbl *h)
 {
 	return (double)h->nentries / (double)h->table_size;
 }
+
+int l_hashtbl_latency_enable(struct l_hashtbl *h, unsigned int sample_shift)
+{
+	int i;
+
+	if (h->latency == NULL) {
+		h->latency = h->malloc_fn(sizeof(*h->latency));
+		if (h->latency == NULL) {
+			USDT_PROBE2(l_hashtbl, alloc_fail, h,
+				    sizeof(*h->latency));
+			return 1;
+		}
+	}
+
+	if (sample_shift > 63)
+		sample_shift = 63;
+
+	h->latency->mask = (1ULL << sample_shift) - 1;
+	h->latency->nops = 0;
+	for (i = 0; i < LATENCY_NOPS; i++)
+		histogram_init(&h->latency->ops[i]);
+
+	/* Keep the calibration out of the first sample. */
+	histogram_clock_calibrate();
+
+	return 0;
+}
+
+void l_hashtbl_latency_disable(struct l_hashtbl *h)
+{
+	if (h->latency != NULL) {
+		h->free_fn(h->latency);
+		h->latency = NULL;
+	}
+}
+
+int l_hashtbl_latency(const struct l_hashtbl *h,
+		      enum l_hashtbl_latency_op op, struct histogram *hist)
+{
+	if (h->latency == NULL)
+		return 1;
+
+	switch (op) {
+	case LINKED_HASHTBL_LATENCY_INSERT:
+		histogram_merge(hist, &h->latency->ops[LATENCY_INSERT]);
+		return 0;
+	case LINKED_HASHTBL_LATENCY_LOOKUP:
+		histogram_merge(hist, &h->latency->ops[LATENCY_LOOKUP]);
+		return 0;
+	case LINKED_HASHTBL_LATENCY_REMOVE:
+		histogram_merge(hist, &h->latency->ops[LATENCY_REMOVE]);
+		return 0;
+	default:
+		return 1;
+	}
+}
@@ -0,0 +1,517 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * A red-black tree with parent pointers, following the algorithms in
+ * Cormen et al., "Introduction to Algorithms", without the sentinel
+ * leaf since nodes belong to the caller.
+ *
+ * A node is red when bit 0 of parent_color is set; node addresses are
+ * at least pointer aligned so the bit is otherwise always clear.  The
+ * smallest and largest nodes are cached in the tree and updated as
+ * nodes come and go.
+ *
+ * An augmented tree caches a value per node that is computed from the
+ * node and its children, such as the largest endpoint of the intervals
+ * in its subtree.  A rotation changes the subtrees of just the two
+ * nodes involved so it recomputes those two, child first.  Linking or
+ * unlinking a node changes the subtree of every ancestor, so before
+ * rebalancing starts the values are recomputed from the point of the
+ * change up to the root.
+ */
+
+#include <stddef.h>		/* NULL */
+#include <stdint.h>		/* uintptr_t */
+#include <c-hacks/rbtree.h>
+
+#if defined(_MSC_VER)
+#define INLINE __inline
+#else
+#define INLINE inline
+#endif
+
+#define RED 1
+
+static INLINE struct rbtree_node *parent(const struct rbtree_node *n)
+{
+	return (struct rbtree_node *)(n->parent_color & ~(uintptr_t)RED);
+}
+
+static INLINE int is_red(const struct rbtree_node *n)
+{
+	return n != NULL && (n->parent_color & RED);
+}
+
+static INLINE void set_parent(struct rbtree_node *n, struct rbtree_node *p)
+{
+	n->parent_color = (uintptr_t)p | (n->parent_color & RED);
+}
+
+static INLINE void set_red(struct rbtree_node *n)
+{
+	n->parent_color |= RED;
+}
+
+static INLINE void set_black(struct rbtree_node *n)
+{
+	n->parent_color &= ~(uintptr_t)RED;
+}
+
+/* Points whatever referred to old, in p or the root, at new. */
+
+static INLINE void replace_child(struct rbtree *t, struct rbtree_node *p,
+				 struct rbtree_node *old,
+				 struct rbtree_node *new)
+{
+	if (p == NULL)
+		t->root = new;
+	else if (p->left == old)
+		p->left = new;
+	else
+		p->right = new;
+}
+
+/* Recomputes the augmented values of n and all its ancestors. */
+
+static INLINE void propagate(const struct rbtree *t, struct rbtree_node *n)
+{
+	if (t->augment_fn == NULL)
+		return;
+
+	for (; n != NULL; n = parent(n))
+		t->augment_fn(n);
+}
+
+static void rotate_left(struct rbtree *t, struct rbtree_node *x)
+{
+	struct rbtree_node *y = x->right;
+
+	if ((x->right = y->left) != NULL)
+		set_parent(y->left, x);
+	set_parent(y, parent(x));
+	replace_child(t, parent(x), x, y);
+	y->left = x;
+	set_parent(x, y);
+
+	if (t->augment_fn != NULL) {
+		t->augment_fn(x);
+		t->augment_fn(y);
+	}
+}
+
+static void rotate_right(struct rbtree *t, struct rbtree_node *x)
+{
+	struct rbtree_node *y = x->left;
+
+	if ((x->left = y->right) != NULL)
+		set_parent(y->right, x);
+	set_parent(y, parent(x));
+	replace_child(t, parent(x), x, y);
+	y->right = x;
+	set_parent(x, y);
+
+	if (t->augment_fn != NULL) {
+		t->augment_fn(x);
+		t->augment_fn(y);
+	}
+}
+
+/* Links red node n below p, or as the root, and rebalances. */
+
+static void link_node(struct rbtree *t, struct rbtree_node *p,
+		      struct rbtree_node **link_to, struct rbtree_node *n)
+{
+	struct rbtree_node *g, *u;
+
+	n->parent_color = (uintptr_t)p | RED;
+	n->left = n->right = NULL;
+	*link_to = n;
+
+	if (t->first == NULL || link_to == &t->first->left)
+		t->first = n;
+	if (t->last == NULL || link_to == &t->last->right)
+		t->last = n;
+	t->nentries++;
+	propagate(t, n);
+
+	while ((p = parent(n)) != NULL && is_red(p)) {
+		/* A red node is never the root, so g exists. */
+		g = parent(p);
+
+		if (p == g->left) {
+			if (is_red(u = g->right)) {
+				set_black(p);
+				set_black(u);
+				set_red(g);
+				n = g;
+				continue;
+			}
+			if (n == p->right) {
+				rotate_left(t, p);
+				n = p;
+				p = parent(n);
+			}
+			set_black(p);
+			set_red(g);
+			rotate_right(t, g);
+		} else {
+			if (is_red(u = g->left)) {
+				set_black(p);
+				set_black(u);
+				set_red(g);
+				n = g;
+				continue;
+			}
+			if (n == p->left) {
+				rotate_right(t, p);
+				n = p;
+				p = parent(n);
+			}
+			set_black(p);
+			set_red(g);
+			rotate_left(t, g);
+		}
+	}
+
+	set_black(t->root);
+}
+
+struct rbtree_node *rbtree_insert(struct rbtree *t, struct rbtree_node *n)
+{
+	struct rbtree_node **link_to = &t->root, *p = NULL;
+	int cmp;
+
+	while (*link_to != NULL) {
+		p = *link_to;
+		if ((cmp = t->compare_fn(n, p)) == 0)
+			return p;
+		link_to = (cmp < 0) ? &p->left : &p->right;
+	}
+
+	link_node(t, p, link_to, n);
+
+	return NULL;
+}
+
+void rbtree_insert_multi(struct rbtree *t, struct rbtree_node *n)
+{
+	struct rbtree_node **link_to = &t->root, *p = NULL;
+
+	while (*link_to != NULL) {
+		p = *link_to;
+		link_to = (t->compare_fn(n, p) < 0) ? &p->left : &p->right;
+	}
+
+	link_node(t, p, link_to, n);
+}
+
+/*
+ * Restores the black height after a black node was unlinked from p,
+ * leaving x, which may be NULL, one black short.
+ */
+static void remove_fixup(struct rbtree *t, struct rbtree_node *x,
+			 struct rbtree_node *p)
+{
+	struct rbtree_node *w;
+
+	while (x != t->root && !is_red(x)) {
+		/* x is short a black so its sibling w can't be NULL. */
+
+		if (x == p->left) {
+			w = p->right;
+			if (is_red(w)) {
+				set_black(w);
+				set_red(p);
+				rotate_left(t, p);
+				w = p->right;
+			}
+			if (!is_red(w->left) && !is_red(w->right)) {
+				set_red(w);
+				x = p;
+				p = parent(x);
+				continue;
+			}
+			if (!is_red(w->right)) {
+				set_black(w->left);
+				set_red(w);
+				rotate_right(t, w);
+				w = p->right;
+			}
+			w->parent_color = (w->parent_color & ~(uintptr_t)RED) |
+			    (p->parent_color & RED);
+			set_black(p);
+			set_black(w->right);
+			rotate_left(t, p);
+		} else {
+			w = p->left;
+			if (is_red(w)) {
+				set_black(w);
+				set_red(p);
+				rotate_right(t, p);
+				w = p->left;
+			}
+			if (!is_red(w->left) && !is_red(w->right)) {
+				set_red(w);
+				x = p;
+				p = parent(x);
+				continue;
+			}
+			if (!is_red(w->left)) {
+				set_black(w->right);
+				set_red(w);
+				rotate_left(t, w);
+				w = p->left;
+			}
+			w->parent_color = (w->parent_color & ~(uintptr_t)RED) |
+			    (p->parent_color & RED);
+			set_black(p);
+			set_black(w->left);
+			rotate_right(t, p);
+		}
+
+		x = t->root;
+	}
+
+	if (x != NULL)
+		set_black(x);
+}
+
+void rbtree_remove(struct rbtree *t, struct rbtree_node *n)
+{
+	struct rbtree_node *y, *x, *p;
+	int black;
+
+	if (n == t->first)
+		t->first = rbtree_next(n);
+	if (n == t->last)
+		t->last = rbtree_prev(n);
+	t->nentries--;
+
+	/* y is the node that actually leaves its place: n or its successor. */
+
+	if (n->left == NULL || n->right == NULL) {
+		y = n;
+	} else {
+		for (y = n->right; y->left != NULL; y = y->left) ;
+	}
+
+	x = (y->left != NULL) ? y->left : y->right;
+	p = parent(y);
+	black = !is_red(y);
+
+	if (x != NULL)
+		set_parent(x, p);
+	replace_child(t, p, y, x);
+
+	if (y != n) {
+		/* The successor takes n's place, and its colour. */
+
+		y->parent_color = n->parent_color;
+		y->left = n->left;
+		y->right = n->right;
+		set_parent(y->left, y);
+		if (y->right != NULL)
+			set_parent(y->right, y);
+		replace_child(t, parent(n), n, y);
+		if (p == n)
+			p = y;
+	}
+
+	/* y, if it moved, is now an ancestor of p. */
+	propagate(t, p);
+
+	if (black)
+		remove_fixup(t, x, p);
+}
+
+struct rbtree_node *rbtree_lookup(const struct rbtree *t,
+				  const struct rbtree_node *probe)
+{
+	struct rbtree_node *n = rbtree_lower_bound(t, probe);
+
+	return (n != NULL && t->compare_fn(probe, n) == 0) ? n : NULL;
+}
+
+struct rbtree_node *rbtree_lower_bound(const struct rbtree *t,
+				       const struct rbtree_node *probe)
+{
+	struct rbtree_node *n = t->root, *found = NULL;
+
+	while (n != NULL) {
+		if (t->compare_fn(n, probe) < 0) {
+			n = n->right;
+		} else {
+			found = n;
+			n = n->left;
+		}
+	}
+
+	return found;
+}
+
+struct rbtree_node *rbtree_upper_bound(const struct rbtree *t,
+				       const struct rbtree_node *probe)
+{
+	struct rbtree_node *n = t->root, *found = NULL;
+
+	while (n != NULL) {
+		if (t->compare_fn(n, probe) <= 0) {
+			n = n->right;
+		} else {
+			found = n;
+			n = n->left;
+		}
+	}
+
+	return found;
+}
+
+struct rbtree_node *rbtree_first(const struct rbtree *t)
+{
+	return t->first;
+}
+
+struct rbtree_node *rbtree_last(const struct rbtree *t)
+{
+	return t->last;
+}
+
+struct rbtree_node *rbtree_next(const struct rbtree_node *n)
+{
+	struct rbtree_node *p;
+
+	if (n->right != NULL) {
+		for (n = n->right; n->left != NULL; n = n->left) ;
+		return (struct rbtree_node *)n;
+	}
+
+	while ((p = parent(n)) != NULL && n == p->right)
+		n = p;
+
+	return p;
+}
+
+struct rbtree_node *rbtree_prev(const struct rbtree_node *n)
+{
+	struct rbtree_node *p;
+
+	if (n->left != NULL) {
+		for (n = n->left; n->right != NULL; n = n->right) ;
+		return (struct rbtree_node *)n;
+	}
+
+	while ((p = parent(n)) != NULL && n == p->left)
+		n = p;
+
+	return p;
+}
+
+struct rbtree_node *rbtree_parent(const struct rbtree_node *n)
+{
+	return parent(n);
+}
+
+unsigned long rbtree_count(const struct rbtree *t)
+{
+	return t->nentries;
+}
+
+/*
+ * Builds a subtree of n nodes, taken in order, whose left and right
+ * halves differ in size by at most one.  Every empty link is then at
+ * depth h or h + 1, where h = floor(log2(n)) for the whole tree, so
+ * colouring the nodes at depth h red, and all others black, gives
+ * every path the same number of black nodes.
+ */
+static struct rbtree_node *build(struct rbtree *t, unsigned long n,
+				 int depth, int red_depth,
+				 RBTREE_NEXT_FN next_fn, void *client_data)
+{
+	struct rbtree_node *left, *node, *right;
+
+	if (n == 0)
+		return NULL;
+
+	left = build(t, (n - 1) / 2, depth + 1, red_depth, next_fn,
+		     client_data);
+	node = next_fn(client_data);
+	right = build(t, n - 1 - (n - 1) / 2, depth + 1, red_depth, next_fn,
+		      client_data);
+
+	node->parent_color = (depth == red_depth) ? RED : 0;
+	if ((node->left = left) != NULL)
+		set_parent(left, node);
+	if ((node->right = right) != NULL)
+		set_parent(right, node);
+
+	if (t->augment_fn != NULL)
+		t->augment_fn(node);
+
+	return node;
+}
+
+void rbtree_build(struct rbtree *t, RBTREE_NEXT_FN next_fn,
+		  void *client_data, unsigned long n)
+{
+	struct rbtree_node *x;
+	int h = 0;
+
+	while ((n >> h) > 1)
+		h++;
+
+	t->root = build(t, n, 0, h, next_fn, client_data);
+	t->nentries = n;
+
+	if (t->root == NULL) {
+		t->first = t->last = NULL;
+		return;
+	}
+
+	set_parent(t->root, NULL);
+	set_black(t->root);
+
+	for (x = t->root; x->left != NULL; x = x->left) ;
+	t->first = x;
+	for (x = t->root; x->right != NULL; x = x->right) ;
+	t->last = x;
+}
+
+void rbtree_init(struct rbtree *t, RBTREE_COMPARE_FN compare_func)
+{
+	rbtree_init_augmented(t, compare_func, NULL);
+}
+
+void rbtree_init_augmented(struct rbtree *t, RBTREE_COMPARE_FN compare_func,
+			   RBTREE_AUGMENT_FN augment_func)
+{
+	t->root = NULL;
+	t->first = NULL;
+	t->last = NULL;
+	t->nentries = 0;
+	t->compare_fn = compare_func;
+	t->augment_fn = augment_func;
+}
@@ -0,0 +1,490 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * A lock-free skip list after Fraser, "Practical lock-freedom", and
+ * Herlihy and Shavit, "The Art of Multiprocessor Programming".
+ *
+ * Bit 0 of a link marks the node that holds it as deleted at that
+ * level; a marked link is never changed again, so a compare-and-swap
+ * that splices a node in after a marked one fails.  A remove first
+ * swaps the node's value for DELETED, which is the point at which the
+ * key leaves the map and settles races with other removes and with
+ * inserts replacing the value.  It then marks every level, top down,
+ * and find() unlinks marked nodes wherever it meets them.
+ *
+ * The upper levels of a new node are linked after it has appeared at
+ * level 0, so a remove can mark the node while the insert is still
+ * linking it, and the insert may then link a level the remove has
+ * already swept.  The node can only be retired once both are done:
+ * each sets its bit in the node's state, and whichever comes second
+ * makes a last pass with find() to unlink it and then retires it.
+ */
+
+#define _GNU_SOURCE
+
+#include <stddef.h>		/* size_t, NULL */
+#include <stdlib.h>		/* malloc, free */
+#include <stdint.h>		/* intptr_t, uintptr_t, uint64_t */
+#include <stdatomic.h>
+#include <c-hacks/skiplist.h>
+
+#ifndef SKIPLIST_MAX_LEVEL
+#define SKIPLIST_MAX_LEVEL 16
+#endif
+
+#define MAX_LEVEL	SKIPLIST_MAX_LEVEL
+#define MARK		((uintptr_t)1)
+
+/* Node states. */
+#define INSERTING	1
+#define REMOVED		2
+
+#if defined(_MSC_VER)
+#define INLINE __inline
+#else
+#define INLINE inline
+#endif
+
+#define LOAD(P)		atomic_load_explicit((P), memory_order_acquire)
+#define PTR(X)		((struct skiplist_node *)((X) & ~MARK))
+
+struct skiplist_node {
+	intptr_t key;
+	_Atomic(void *) val;
+	atomic_int state;
+	int height;
+	_Atomic uintptr_t next[];
+};
+
+struct skiplist {
+	struct skiplist_node *head;
+	atomic_int levels;	/* height of the tallest node */
+	atomic_ulong nentries;
+	struct epoch *epoch;
+	SKIPLIST_VAL_FREE_FN val_free_fn;
+	SKIPLIST_MALLOC_FN malloc_fn;
+	SKIPLIST_FREE_FN free_fn;
+};
+
+/* The value of an entry that has been removed. */
+static char deleted;
+#define DELETED ((void *)&deleted)
+
+static _Thread_local uint64_t height_seed;
+
+static INLINE uint64_t splitmix64(uint64_t x)
+{
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+/* Returns a height with P(h) = 3/4^h, from a per-thread generator. */
+
+static int random_height(void)
+{
+	uint64_t x;
+	int h = 1;
+
+	if (height_seed == 0)
+		height_seed = (uintptr_t)&height_seed;
+
+	x = splitmix64(height_seed += 0x9e3779b97f4a7c15ULL);
+
+	while (h < MAX_LEVEL && (x & 3) == 0) {
+		h++;
+		x >>= 2;
+	}
+
+	return h;
+}
+
+static struct skiplist_node *node_new(struct skiplist *sl, intptr_t k,
+				      void *v, int height)
+{
+	struct skiplist_node *n;
+	int i;
+
+	n = sl->malloc_fn(sizeof(*n) + height * sizeof(n->next[0]));
+	if (n == NULL)
+		return NULL;
+
+	n->key = k;
+	atomic_init(&n->val, v);
+	atomic_init(&n->state, 0);
+	n->height = height;
+	for (i = 0; i < height; i++)
+		atomic_init(&n->next[i], 0);
+
+	return n;
+}
+
+/* Marks every level of n, from the top down, as deleted. */
+
+static void mark_levels(struct skiplist_node *n)
+{
+	int l;
+
+	for (l = n->height - 1; l >= 0; l--)
+		atomic_fetch_or(&n->next[l], MARK);
+}
+
+/*
+ * Fills preds and succs, at every level up to the height of the list,
+ * with the last node whose key is less than k and the node after it,
+ * unlinking any marked nodes met along the way.
+ *
+ * Returns 1 if succs[0] holds k.
+ */
+static int find(struct skiplist *sl, intptr_t k,
+		struct skiplist_node **preds, struct skiplist_node **succs)
+{
+	struct skiplist_node *pred, *curr;
+	uintptr_t next, expect;
+	int l;
+
+ retry:
+	pred = sl->head;
+
+	for (l = atomic_load(&sl->levels) - 1; l >= 0; l--) {
+		curr = PTR(LOAD(&pred->next[l]));
+
+		while (curr != NULL) {
+			next = LOAD(&curr->next[l]);
+
+			if (next & MARK) {
+				expect = (uintptr_t)curr;
+				if (!atomic_compare_exchange_strong
+				    (&pred->next[l], &expect, next & ~MARK))
+					goto retry;
+				curr = PTR(next);
+				continue;
+			}
+
+			if (curr->key >= k)
+				break;
+
+			pred = curr;
+			curr = PTR(next);
+		}
+
+		preds[l] = pred;
+		succs[l] = curr;
+	}
+
+	return succs[0] != NULL && succs[0]->key == k;
+}
+
+/* Raises the height of the list to at least h. */
+
+static void raise_levels(struct skiplist *sl, int h)
+{
+	int levels = atomic_load(&sl->levels);
+
+	while (levels < h &&
+	       !atomic_compare_exchange_weak(&sl->levels, &levels, h)) ;
+}
+
+static void retire_val(struct skiplist *sl, struct epoch_thread *self,
+		       void *v)
+{
+	if (sl->val_free_fn != NULL && v != NULL)
+		epoch_retire(self, v, sl->val_free_fn);
+}
+
+/*
+ * Called by the insert and the remove of n once each is done with it:
+ * the second to arrive unlinks and retires n.
+ */
+static void release_node(struct skiplist *sl, struct epoch_thread *self,
+			 struct skiplist_node *n, int done)
+{
+	struct skiplist_node *preds[MAX_LEVEL], *succs[MAX_LEVEL];
+	int last;
+
+	if (done == INSERTING)
+		last = (atomic_fetch_and(&n->state, ~INSERTING) & REMOVED) != 0;
+	else
+		last = (atomic_fetch_or(&n->state, REMOVED) & INSERTING) == 0;
+
+	if (last) {
+		find(sl, n->key, preds, succs);
+		epoch_retire(self, n, sl->free_fn);
+	}
+}
+
+/* Links the upper levels of n, which is already in the list. */
+
+static void link_levels(struct skiplist *sl, struct skiplist_node *n,
+			struct skiplist_node **preds,
+			struct skiplist_node **succs)
+{
+	uintptr_t next, expect;
+	int l;
+
+	for (l = 1; l < n->height; l++) {
+		for (;;) {
+			/* Point n at its successor, unless n is being removed. */
+
+			next = LOAD(&n->next[l]);
+			if (next & MARK)
+				return;
+			if (PTR(next) != succs[l] &&
+			    !atomic_compare_exchange_strong(&n->next[l], &next,
+							    (uintptr_t)succs[l]))
+				return;
+
+			expect = (uintptr_t)succs[l];
+			if (atomic_compare_exchange_strong(&preds[l]->next[l],
+							   &expect,
+							   (uintptr_t)n))
+				break;
+
+			if (!find(sl, n->key, preds, succs) || succs[0] != n)
+				return;
+		}
+	}
+}
+
+int skiplist_insert(struct skiplist *sl, struct epoch_thread *self,
+		    intptr_t k, void *v)
+{
+	struct skiplist_node *preds[MAX_LEVEL], *succs[MAX_LEVEL], *n = NULL;
+	uintptr_t expect;
+	void *old;
+	int l, h = random_height();
+
+	raise_levels(sl, h);
+	epoch_enter(self);
+
+	for (;;) {
+		if (find(sl, k, preds, succs)) {
+			old = LOAD(&succs[0]->val);
+
+			if (old != DELETED &&
+			    atomic_compare_exchange_strong(&succs[0]->val, &old,
+							   v)) {
+				if (n != NULL)
+					sl->free_fn(n);
+				retire_val(sl, self, old);
+				epoch_leave(self);
+				return 0;
+			}
+
+			/* Help a remove along so that find() unlinks it. */
+
+			if (old == DELETED)
+				mark_levels(succs[0]);
+			continue;
+		}
+
+		if (n == NULL && (n = node_new(sl, k, v, h)) == NULL) {
+			epoch_leave(self);
+			return 1;
+		}
+
+		atomic_store_explicit(&n->state, (h > 1) ? INSERTING : 0,
+				      memory_order_relaxed);
+		for (l = 0; l < h; l++)
+			atomic_store_explicit(&n->next[l], (uintptr_t)succs[l],
+					      memory_order_relaxed);
+
+		expect = (uintptr_t)succs[0];
+		if (atomic_compare_exchange_strong(&preds[0]->next[0], &expect,
+						   (uintptr_t)n))
+			break;
+	}
+
+	atomic_fetch_add_explicit(&sl->nentries, 1, memory_order_relaxed);
+
+	if (h > 1) {
+		link_levels(sl, n, preds, succs);
+		release_node(sl, self, n, INSERTING);
+	}
+
+	epoch_leave(self);
+
+	return 0;
+}
+
+int skiplist_remove(struct skiplist *sl, struct epoch_thread *self,
+		    intptr_t k)
+{
+	struct skiplist_node *preds[MAX_LEVEL], *succs[MAX_LEVEL], *n;
+	void *old;
+
+	epoch_enter(self);
+
+	if (!find(sl, k, preds, succs)) {
+		epoch_leave(self);
+		return 1;
+	}
+
+	n = succs[0];
+	old = LOAD(&n->val);
+
+	do {
+		/* Someone else removed it first. */
+		if (old == DELETED) {
+			epoch_leave(self);
+			return 1;
+		}
+	} while (!atomic_compare_exchange_weak(&n->val, &old, DELETED));
+
+	mark_levels(n);
+	atomic_fetch_sub_explicit(&sl->nentries, 1, memory_order_relaxed);
+	release_node(sl, self, n, REMOVED);
+	retire_val(sl, self, old);
+	epoch_leave(self);
+
+	return 0;
+}
+
+/*
+ * Returns the first node at level 0 whose key is not less than k.
+ * Marked nodes are passed through rather than unlinked.
+ */
+static struct skiplist_node *lower_bound(struct skiplist *sl, intptr_t k)
+{
+	struct skiplist_node *pred = sl->head, *curr = NULL;
+	int l;
+
+	for (l = atomic_load(&sl->levels) - 1; l >= 0; l--) {
+		curr = PTR(LOAD(&pred->next[l]));
+		while (curr != NULL && curr->key < k) {
+			pred = curr;
+			curr = PTR(LOAD(&curr->next[l]));
+		}
+	}
+
+	return curr;
+}
+
+void *skiplist_lookup(struct skiplist *sl, struct epoch_thread *self,
+		      intptr_t k)
+{
+	struct skiplist_node *n;
+	void *v = NULL;
+
+	epoch_enter(self);
+
+	/* A removed node may still precede the live one for k. */
+
+	for (n = lower_bound(sl, k); n != NULL && n->key == k;
+	     n = PTR(LOAD(&n->next[0]))) {
+		if ((v = LOAD(&n->val)) != DELETED)
+			break;
+		v = NULL;
+	}
+
+	epoch_leave(self);
+
+	return v;
+}
+
+unsigned long skiplist_range(struct skiplist *sl, struct epoch_thread *self,
+			     intptr_t lo, intptr_t hi, SKIPLIST_APPLY_FN fn,
+			     void *client_data)
+{
+	struct skiplist_node *n;
+	unsigned long nvisited = 0;
+	intptr_t last = lo;
+	void *v;
+
+	epoch_enter(self);
+
+	for (n = lower_bound(sl, lo); n != NULL && n->key < hi;
+	     n = PTR(LOAD(&n->next[0]))) {
+		/* Skip removed entries and keys that were reinserted behind us. */
+
+		if ((v = LOAD(&n->val)) == DELETED ||
+		    (nvisited != 0 && n->key <= last))
+			continue;
+
+		last = n->key;
+		nvisited++;
+		if (!fn(n->key, v, client_data))
+			break;
+	}
+
+	epoch_leave(self);
+
+	return nvisited;
+}
+
+unsigned long skiplist_count(const struct skiplist *sl)
+{
+	return atomic_load_explicit(&((struct skiplist *)sl)->nentries,
+				    memory_order_relaxed);
+}
+
+struct skiplist *skiplist_create(struct epoch *e,
+				 SKIPLIST_VAL_FREE_FN val_free_fn,
+				 SKIPLIST_MALLOC_FN malloc_fn,
+				 SKIPLIST_FREE_FN free_fn)
+{
+	struct skiplist *sl;
+
+	malloc_fn = (malloc_fn != NULL) ? malloc_fn : malloc;
+	free_fn = (free_fn != NULL) ? free_fn : free;
+
+	if ((sl = malloc_fn(sizeof(*sl))) == NULL)
+		return NULL;
+
+	sl->epoch = e;
+	sl->val_free_fn = val_free_fn;
+	sl->malloc_fn = malloc_fn;
+	sl->free_fn = free_fn;
+	atomic_init(&sl->levels, 1);
+	atomic_init(&sl->nentries, 0);
+
+	if ((sl->head = node_new(sl, 0, NULL, MAX_LEVEL)) == NULL) {
+		free_fn(sl);
+		return NULL;
+	}
+
+	return sl;
+}
+
+void skiplist_delete(struct skiplist *sl)
+{
+	struct skiplist_node *n = sl->head, *next;
+	void *v;
+
+	while (n != NULL) {
+		next = PTR(LOAD(&n->next[0]));
+		v = LOAD(&n->val);
+		if (n != sl->head && v != DELETED && v != NULL &&
+		    sl->val_free_fn != NULL)
+			sl->val_free_fn(v);
+		sl->free_fn(n);
+		n = next;
+	}
+
+	sl->free_fn(sl);
+}
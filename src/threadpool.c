@@ -0,0 +1,613 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Work-stealing thread pool.
+ *
+ * The deques follow Lê, Pop, Cohen and Zappa Nardelli, "Correct and
+ * Efficient Work-Stealing for Weak Memory Models" (PPoPP 2013), with
+ * the release fence in push folded into a store-release of bottom.
+ * A deque that fills up is copied into one twice the size; a thief
+ * may still be reading the old array, so old arrays are only freed
+ * with the pool.
+ *
+ * Slot nworkers is the deque lent to a thread outside the pool by
+ * threadpool_run().  Tasks forked elsewhere outside the pool go on
+ * the injection list.
+ *
+ * Idle workers sleep on a condition variable.  A forking thread
+ * checks nsleepers after publishing its task and a worker checks for
+ * tasks after incrementing nsleepers, each behind a full fence, so at
+ * least one of them sees the other; gen, bumped under the lock, keeps
+ * a wakeup from being lost between a worker's check and its wait.
+ */
+
+#define _GNU_SOURCE
+
+#include <stddef.h>		/* size_t, NULL */
+#include <stdlib.h>		/* malloc, free */
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>		/* sched_yield */
+#include <unistd.h>		/* sysconf */
+#include <c-hacks/threadpool.h>
+
+/* Initial number of tasks a deque can hold. */
+#ifndef THREADPOOL_DEQUE_SIZE
+#define THREADPOOL_DEQUE_SIZE 64
+#endif
+
+struct array {
+	long size;		/* a power of 2 */
+	struct array *prev;	/* the array this one replaced */
+	_Atomic(struct threadpool_task *) buf[];
+};
+
+struct deque {
+	atomic_long top;
+	atomic_long bottom;
+	_Atomic(struct array *) array;
+};
+
+struct worker {
+	struct deque dq;
+	struct threadpool *p;
+	pthread_t thread;
+};
+
+struct threadpool {
+	int nworkers;
+	struct worker *workers;	/* nworkers + 1 slots */
+	pthread_mutex_t caller_lock;	/* held by owner of the last slot */
+	pthread_mutex_t lock;	/* protects injected and the sleep */
+	pthread_cond_t cond;
+	struct threadpool_task *injected;
+	atomic_int ninjected;
+	atomic_int nsleepers;
+	atomic_ulong gen;
+	atomic_int stop;
+	THREADPOOL_MALLOC_FN malloc_fn;
+	THREADPOOL_FREE_FN free_fn;
+};
+
+/* The deque slot of the calling thread, if it has one. */
+static _Thread_local struct worker *self;
+
+static _Thread_local unsigned int victim_seed;
+
+static pthread_once_t default_once = PTHREAD_ONCE_INIT;
+static struct threadpool *default_pool;
+
+static struct array *array_new(struct threadpool *p, long size)
+{
+	struct array *a;
+
+	a = p->malloc_fn(sizeof(*a) + (size_t)size * sizeof(a->buf[0]));
+	if (a == NULL)
+		return NULL;
+
+	a->size = size;
+	a->prev = NULL;
+
+	return a;
+}
+
+static int deque_init(struct threadpool *p, struct deque *d)
+{
+	struct array *a = array_new(p, THREADPOOL_DEQUE_SIZE);
+
+	if (a == NULL)
+		return 1;
+
+	atomic_init(&d->top, 0);
+	atomic_init(&d->bottom, 0);
+	atomic_init(&d->array, a);
+
+	return 0;
+}
+
+static void deque_destroy(struct threadpool *p, struct deque *d)
+{
+	struct array *a = atomic_load_explicit(&d->array, memory_order_relaxed);
+
+	while (a != NULL) {
+		struct array *prev = a->prev;
+		p->free_fn(a);
+		a = prev;
+	}
+}
+
+/*
+ * Pushes t at the bottom; only the owner may call this.  Returns 0 on
+ * success, or 1 if the deque is full and can't grow.
+ */
+static int deque_push(struct threadpool *p, struct deque *d,
+		      struct threadpool_task *t)
+{
+	long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+	long top = atomic_load_explicit(&d->top, memory_order_acquire);
+	struct array *a = atomic_load_explicit(&d->array,
+					       memory_order_relaxed);
+
+	if (b - top > a->size - 1) {
+		struct array *na = array_new(p, a->size * 2);
+		long i;
+
+		if (na == NULL)
+			return 1;
+
+		for (i = top; i < b; i++) {
+			struct threadpool_task *x;
+			x = atomic_load_explicit(&a->buf[i & (a->size - 1)],
+						 memory_order_relaxed);
+			atomic_store_explicit(&na->buf[i & (na->size - 1)], x,
+					      memory_order_relaxed);
+		}
+
+		na->prev = a;
+		atomic_store_explicit(&d->array, na, memory_order_release);
+		a = na;
+	}
+
+	atomic_store_explicit(&a->buf[b & (a->size - 1)], t,
+			      memory_order_relaxed);
+	atomic_store_explicit(&d->bottom, b + 1, memory_order_release);
+
+	return 0;
+}
+
+/* Pops the task at the bottom; only the owner may call this. */
+
+static struct threadpool_task *deque_take(struct deque *d)
+{
+	long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+	struct array *a = atomic_load_explicit(&d->array,
+					       memory_order_relaxed);
+	struct threadpool_task *x = NULL;
+	long t;
+
+	atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	t = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+	if (t <= b) {
+		x = atomic_load_explicit(&a->buf[b & (a->size - 1)],
+					 memory_order_relaxed);
+		if (t == b) {
+			/* The last task: race any thief for it. */
+			if (!atomic_compare_exchange_strong_explicit
+			    (&d->top, &t, t + 1, memory_order_seq_cst,
+			     memory_order_relaxed))
+				x = NULL;
+			atomic_store_explicit(&d->bottom, b + 1,
+					      memory_order_relaxed);
+		}
+	} else {
+		atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+	}
+
+	return x;
+}
+
+/*
+ * Steals the task at the top.  Returns NULL if the deque is empty or
+ * another thread took the task first.
+ */
+static struct threadpool_task *deque_steal(struct deque *d)
+{
+	long t = atomic_load_explicit(&d->top, memory_order_acquire);
+	long b;
+
+	atomic_thread_fence(memory_order_seq_cst);
+	b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+
+	if (t < b) {
+		struct array *a = atomic_load_explicit(&d->array,
+						       memory_order_acquire);
+		struct threadpool_task *x;
+
+		x = atomic_load_explicit(&a->buf[t & (a->size - 1)],
+					 memory_order_relaxed);
+		if (!atomic_compare_exchange_strong_explicit
+		    (&d->top, &t, t + 1, memory_order_seq_cst,
+		     memory_order_relaxed))
+			return NULL;
+		return x;
+	}
+
+	return NULL;
+}
+
+static int deque_empty(struct deque *d)
+{
+	long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+	long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+
+	return t >= b;
+}
+
+static void run_task(struct threadpool_task *t)
+{
+	t->fn(t->arg);
+	/* t may be gone as soon as done is set. */
+	atomic_store_explicit(&t->done, 1, memory_order_release);
+}
+
+static struct threadpool_task *take_injected(struct threadpool *p)
+{
+	struct threadpool_task *t;
+
+	if (atomic_load_explicit(&p->ninjected, memory_order_relaxed) == 0)
+		return NULL;
+
+	pthread_mutex_lock(&p->lock);
+	if ((t = p->injected) != NULL) {
+		p->injected = t->next;
+		atomic_fetch_sub_explicit(&p->ninjected, 1,
+					  memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	return t;
+}
+
+/*
+ * Returns a task for w to run: its own newest, else the oldest of a
+ * random victim's, else an injected one.  w is NULL for a thread
+ * outside the pool.
+ */
+static struct threadpool_task *find_task(struct threadpool *p,
+					 struct worker *w)
+{
+	int i, n = p->nworkers + 1;
+	unsigned int start;
+	struct threadpool_task *t;
+
+	if (w != NULL && (t = deque_take(&w->dq)) != NULL)
+		return t;
+
+	victim_seed = victim_seed * 1103515245 + 12345;
+	start = (victim_seed >> 16) % (unsigned int)n;
+
+	for (i = 0; i < n; i++) {
+		struct worker *v = &p->workers[(start + i) % n];
+
+		if (v != w && (t = deque_steal(&v->dq)) != NULL)
+			return t;
+	}
+
+	return take_injected(p);
+}
+
+static int has_work(struct threadpool *p)
+{
+	int i;
+
+	if (atomic_load_explicit(&p->ninjected, memory_order_relaxed) != 0)
+		return 1;
+
+	for (i = 0; i <= p->nworkers; i++) {
+		if (!deque_empty(&p->workers[i].dq))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Wakes a sleeping worker, if there is one, after publishing a task. */
+
+static void wake(struct threadpool *p)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (atomic_load_explicit(&p->nsleepers, memory_order_relaxed) == 0)
+		return;
+
+	pthread_mutex_lock(&p->lock);
+	atomic_fetch_add_explicit(&p->gen, 1, memory_order_relaxed);
+	pthread_cond_signal(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+}
+
+/* Sleeps until a task may have been published, or the pool stops. */
+
+static void sleep_idle(struct threadpool *p)
+{
+	unsigned long gen = atomic_load(&p->gen);
+
+	atomic_fetch_add(&p->nsleepers, 1);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (!has_work(p)) {
+		pthread_mutex_lock(&p->lock);
+		while (atomic_load(&p->gen) == gen && !atomic_load(&p->stop))
+			pthread_cond_wait(&p->cond, &p->lock);
+		pthread_mutex_unlock(&p->lock);
+	}
+
+	atomic_fetch_sub(&p->nsleepers, 1);
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	struct threadpool *p = w->p;
+
+	self = w;
+	victim_seed = (unsigned int)(w - p->workers) + 1;
+
+	while (!atomic_load_explicit(&p->stop, memory_order_acquire)) {
+		struct threadpool_task *t = find_task(p, w);
+
+		if (t != NULL)
+			run_task(t);
+		else
+			sleep_idle(p);
+	}
+
+	return NULL;
+}
+
+/* Returns the deque slot the calling thread owns in p, if any. */
+
+static struct worker *slot_of(struct threadpool *p)
+{
+	return (self != NULL && self->p == p) ? self : NULL;
+}
+
+static void stop_workers(struct threadpool *p, int nstarted)
+{
+	int i;
+
+	pthread_mutex_lock(&p->lock);
+	atomic_store_explicit(&p->stop, 1, memory_order_release);
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+
+	for (i = 0; i < nstarted; i++)
+		pthread_join(p->workers[i].thread, NULL);
+}
+
+static void free_pool(struct threadpool *p, int ndeques)
+{
+	int i;
+
+	for (i = 0; i < ndeques; i++)
+		deque_destroy(p, &p->workers[i].dq);
+
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->lock);
+	pthread_mutex_destroy(&p->caller_lock);
+	p->free_fn(p->workers);
+	p->free_fn(p);
+}
+
+struct threadpool *threadpool_create(int nthreads,
+				     THREADPOOL_MALLOC_FN malloc_fn,
+				     THREADPOOL_FREE_FN free_fn)
+{
+	struct threadpool *p;
+	int i;
+
+	malloc_fn = (malloc_fn != NULL) ? malloc_fn : malloc;
+	free_fn = (free_fn != NULL) ? free_fn : free;
+
+	if (nthreads < 0) {
+		long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = (ncpus > 1) ? (int)ncpus - 1 : 0;
+	}
+
+	if ((p = malloc_fn(sizeof(*p))) == NULL)
+		return NULL;
+
+	p->workers = malloc_fn((size_t)(nthreads + 1) * sizeof(*p->workers));
+	if (p->workers == NULL) {
+		free_fn(p);
+		return NULL;
+	}
+
+	p->nworkers = nthreads;
+	p->injected = NULL;
+	atomic_init(&p->ninjected, 0);
+	atomic_init(&p->nsleepers, 0);
+	atomic_init(&p->gen, 0);
+	atomic_init(&p->stop, 0);
+	p->malloc_fn = malloc_fn;
+	p->free_fn = free_fn;
+	pthread_mutex_init(&p->caller_lock, NULL);
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->cond, NULL);
+
+	for (i = 0; i <= nthreads; i++) {
+		p->workers[i].p = p;
+		if (deque_init(p, &p->workers[i].dq) != 0) {
+			free_pool(p, i);
+			return NULL;
+		}
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&p->workers[i].thread, NULL, worker_main,
+				   &p->workers[i]) != 0) {
+			stop_workers(p, i);
+			free_pool(p, nthreads + 1);
+			return NULL;
+		}
+	}
+
+	return p;
+}
+
+void threadpool_delete(struct threadpool *p)
+{
+	stop_workers(p, p->nworkers);
+	free_pool(p, p->nworkers + 1);
+}
+
+static void create_default(void)
+{
+	default_pool = threadpool_create(-1, NULL, NULL);
+}
+
+struct threadpool *threadpool_default(void)
+{
+	pthread_once(&default_once, create_default);
+	return default_pool;
+}
+
+int threadpool_nthreads(const struct threadpool *p)
+{
+	return p->nworkers;
+}
+
+void threadpool_fork(struct threadpool *p, struct threadpool_task *t,
+		     THREADPOOL_TASK_FN fn, void *arg)
+{
+	struct worker *w = slot_of(p);
+
+	t->fn = fn;
+	t->arg = arg;
+	atomic_store_explicit(&t->done, 0, memory_order_relaxed);
+
+	if (w != NULL) {
+		if (deque_push(p, &w->dq, t) != 0) {
+			/* No memory to grow the deque: run it now. */
+			run_task(t);
+			return;
+		}
+	} else {
+		pthread_mutex_lock(&p->lock);
+		t->next = p->injected;
+		p->injected = t;
+		atomic_fetch_add_explicit(&p->ninjected, 1,
+					  memory_order_relaxed);
+		pthread_mutex_unlock(&p->lock);
+	}
+
+	wake(p);
+}
+
+void threadpool_join(struct threadpool *p, struct threadpool_task *t)
+{
+	struct worker *w = slot_of(p);
+
+	while (!atomic_load_explicit(&t->done, memory_order_acquire)) {
+		struct threadpool_task *x = find_task(p, w);
+
+		if (x != NULL)
+			run_task(x);
+		else
+			sched_yield();
+	}
+}
+
+void threadpool_run(struct threadpool *p, THREADPOOL_TASK_FN fn, void *arg)
+{
+	struct threadpool_task t;
+	struct worker *prev;
+
+	if (p == NULL && (p = threadpool_default()) == NULL) {
+		fn(arg);
+		return;
+	}
+
+	if (slot_of(p) != NULL) {
+		fn(arg);
+		return;
+	}
+
+	if (pthread_mutex_trylock(&p->caller_lock) == 0) {
+		prev = self;
+		self = &p->workers[p->nworkers];
+		fn(arg);
+		self = prev;
+		pthread_mutex_unlock(&p->caller_lock);
+		return;
+	}
+
+	threadpool_fork(p, &t, fn, arg);
+	threadpool_join(p, &t);
+}
+
+struct range {
+	struct threadpool *p;
+	size_t begin, end, grain;
+	THREADPOOL_RANGE_FN fn;
+	void *arg;
+};
+
+/*
+ * Forks the upper half of the range until what is left fits in a
+ * grain, runs that, then joins the halves in the reverse order.
+ */
+static void range_run(void *arg)
+{
+	struct range *r = arg;
+	struct range halves[sizeof(size_t) * 8];
+	struct threadpool_task tasks[sizeof(size_t) * 8];
+	size_t begin = r->begin, end = r->end;
+	int n = 0;
+
+	while (end - begin > r->grain) {
+		size_t mid = begin + (end - begin) / 2;
+
+		halves[n] = *r;
+		halves[n].begin = mid;
+		halves[n].end = end;
+		threadpool_fork(r->p, &tasks[n], range_run, &halves[n]);
+		n++;
+		end = mid;
+	}
+
+	r->fn(begin, end, r->arg);
+
+	while (n-- > 0)
+		threadpool_join(r->p, &tasks[n]);
+}
+
+void threadpool_parallel_for(struct threadpool *p, size_t begin, size_t end,
+			     size_t grain, THREADPOOL_RANGE_FN fn, void *arg)
+{
+	struct range r;
+
+	if (begin >= end)
+		return;
+
+	if (p == NULL && (p = threadpool_default()) == NULL) {
+		fn(begin, end, arg);
+		return;
+	}
+
+	r.p = p;
+	r.begin = begin;
+	r.end = end;
+	r.grain = (grain != 0) ? grain : 1;
+	r.fn = fn;
+	r.arg = arg;
+
+	threadpool_run(p, range_run, &r);
+}
@@ -0,0 +1,383 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* test-arena.c - unit tests for arena and pool */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "CUnitTest.h"
+
+#include <c-hacks/arena.h>
+#include <c-hacks/hashtbl.h>
+#include <c-hacks/hashtbl-funcs.h>
+#include <c-hacks/linked-hashtbl.h>
+
+#define ALIGN	_Alignof(max_align_t)
+#define ALIGNED(P)	(((uintptr_t)(P) % ALIGN) == 0)
+
+static int nmallocs, nfrees;
+
+static void *count_malloc(size_t n)
+{
+	nmallocs++;
+	return malloc(n);
+}
+
+static void count_free(void *p)
+{
+	nfrees++;
+	free(p);
+}
+
+static unsigned long rand_state = 1;
+
+static unsigned long next_rand(void)
+{
+	rand_state = rand_state * 6364136223846793005UL + 1442695040888963407UL;
+	return rand_state >> 33;
+}
+
+/* Test that allocations are aligned, distinct and keep their contents. */
+
+static int test1(void)
+{
+	enum { N = 2000 };
+	static unsigned char *ptrs[N];
+	static size_t sizes[N];
+	struct arena *a = arena_create(256, count_malloc, count_free);
+	size_t i, j, used = 0;
+
+	CUT_ASSERT_NOT_NULL(a);
+	CUT_ASSERT_EQUAL(0, arena_used(a));
+
+	for (i = 0; i < N; i++) {
+		/* Every hundredth is bigger than any chunk so far. */
+		sizes[i] = (i % 100 == 99) ? 100000 : next_rand() % 300;
+		ptrs[i] = arena_alloc(a, sizes[i]);
+		CUT_ASSERT_NOT_NULL(ptrs[i]);
+		CUT_ASSERT_TRUE(ALIGNED(ptrs[i]));
+		memset(ptrs[i], (int)(i & 0xff), sizes[i]);
+		CUT_ASSERT_TRUE(arena_used(a) >= used + sizes[i]);
+		used = arena_used(a);
+	}
+
+	for (i = 0; i < N; i++) {
+		for (j = 0; j < sizes[i]; j++)
+			CUT_ASSERT_EQUAL((i & 0xff), ptrs[i][j]);
+	}
+
+	/* Chunks double, so there are far fewer chunks than allocations. */
+
+	CUT_ASSERT_TRUE(nmallocs < 64);
+
+	arena_delete(a);
+	CUT_ASSERT_EQUAL(nmallocs, nfrees);
+
+	return 0;
+}
+
+/* Test mark, rewind and reset. */
+
+static int test2(void)
+{
+	struct arena *a = arena_create(0, count_malloc, count_free);
+	struct arena_mark m;
+	size_t used;
+	char *p, *q;
+	int i, n;
+
+	CUT_ASSERT_NOT_NULL(a);
+
+	/* Marking an empty arena and rewinding to it empties it. */
+
+	m = arena_mark(a);
+	for (i = 0; i < 1000; i++)
+		CUT_ASSERT_NOT_NULL(arena_alloc(a, 100));
+	arena_rewind(a, m);
+	CUT_ASSERT_EQUAL(0, arena_used(a));
+
+	p = arena_alloc(a, 10);
+	used = arena_used(a);
+	m = arena_mark(a);
+	q = arena_alloc(a, 10);
+	CUT_ASSERT_TRUE(q > p);
+	arena_rewind(a, m);
+	CUT_ASSERT_EQUAL(used, arena_used(a));
+	CUT_ASSERT_TRUE(q == arena_alloc(a, 10));
+
+	/* Rewinding across chunks frees the newer ones. */
+
+	m = arena_mark(a);
+	for (i = 0; i < 1000; i++)
+		CUT_ASSERT_NOT_NULL(arena_alloc(a, 100));
+	arena_rewind(a, m);
+	CUT_ASSERT_EQUAL(used + 16, arena_used(a));
+	CUT_ASSERT_TRUE(q + 16 == arena_alloc(a, 1));
+
+	/*
+	 * After a reset the arena runs on the chunk it kept until it
+	 * needs more.
+	 */
+	arena_reset(a);
+	CUT_ASSERT_EQUAL(0, arena_used(a));
+	n = nmallocs;
+	for (i = 0; i < 1000; i++)
+		CUT_ASSERT_NOT_NULL(arena_alloc(a, 16));
+	CUT_ASSERT_EQUAL(n, nmallocs);
+
+	arena_delete(a);
+	CUT_ASSERT_EQUAL(nmallocs, nfrees);
+
+	return 0;
+}
+
+/* Test the arena as the allocator of both kinds of hash table. */
+
+static int test3(void)
+{
+	enum { N = 10000 };
+	struct arena *a = arena_create(0, NULL, NULL);
+	struct hashtbl *h;
+	struct l_hashtbl *lh;
+	intptr_t i;
+
+	CUT_ASSERT_NOT_NULL(a);
+
+	/* With no arena selected nothing can be allocated. */
+
+	CUT_ASSERT_NULL(arena_select(a));
+	CUT_ASSERT_TRUE(arena_select(NULL) == a);
+	CUT_ASSERT_NULL(arena_malloc(16));
+	arena_select(a);
+
+	h = hashtbl_create(16, 0.75, 1, hashtbl_direct_hash,
+			   hashtbl_direct_equals, NULL, NULL,
+			   arena_malloc, arena_free);
+	CUT_ASSERT_NOT_NULL(h);
+
+	lh = l_hashtbl_create(16, 0.75, 1, 0, hashtbl_direct_hash,
+			      hashtbl_direct_equals, NULL, NULL,
+			      arena_malloc, arena_free, NULL);
+	CUT_ASSERT_NOT_NULL(lh);
+
+	for (i = 1; i <= N; i++) {
+		CUT_ASSERT_EQUAL(0, hashtbl_insert(h, (void *)i,
+						   (void *)(i * 2)));
+		CUT_ASSERT_EQUAL(0, l_hashtbl_insert(lh, (void *)i,
+						     (void *)(i * 3)));
+	}
+
+	for (i = 1; i <= N; i += 2) {
+		CUT_ASSERT_EQUAL(0, hashtbl_remove(h, (void *)i));
+		CUT_ASSERT_EQUAL(0, l_hashtbl_remove(lh, (void *)i));
+	}
+
+	CUT_ASSERT_EQUAL(N / 2, hashtbl_count(h));
+	CUT_ASSERT_EQUAL(N / 2, l_hashtbl_count(lh));
+
+	for (i = 1; i <= N; i++) {
+		void *want2 = (i % 2) ? NULL : (void *)(i * 2);
+		void *want3 = (i % 2) ? NULL : (void *)(i * 3);
+
+		CUT_ASSERT_TRUE(hashtbl_lookup(h, (void *)i) == want2);
+		CUT_ASSERT_TRUE(l_hashtbl_lookup(lh, (void *)i) == want3);
+	}
+
+	CUT_ASSERT_TRUE(arena_used(a) > N * 2 * sizeof(void *));
+
+	/* Deleting the tables is optional: the reset frees them. */
+
+	hashtbl_delete(h);
+	arena_reset(a);
+	CUT_ASSERT_EQUAL(0, arena_used(a));
+
+	arena_select(NULL);
+	arena_delete(a);
+
+	return 0;
+}
+
+/* Test pool allocations of every size class, and larger. */
+
+static int test4(void)
+{
+	enum { N = 5000 };
+	static unsigned char *ptrs[N];
+	static size_t sizes[N];
+	struct hashtbl *h;
+	size_t i, j;
+	intptr_t k;
+
+	CUT_ASSERT_NOT_NULL(pool_malloc(0));
+	pool_free(NULL);
+
+	for (i = 0; i < N; i++) {
+		if (i % 500 == 0)
+			sizes[i] = 2049 + next_rand() % 200000;
+		else
+			sizes[i] = i % 2050;
+		ptrs[i] = pool_malloc(sizes[i]);
+		CUT_ASSERT_NOT_NULL(ptrs[i]);
+		CUT_ASSERT_TRUE(ALIGNED(ptrs[i]));
+		memset(ptrs[i], (int)(i & 0xff), sizes[i]);
+	}
+
+	/* Free every other block and reallocate into the holes. */
+
+	for (i = 0; i < N; i += 2)
+		pool_free(ptrs[i]);
+
+	for (i = 0; i < N; i += 2) {
+		ptrs[i] = pool_malloc(sizes[i]);
+		CUT_ASSERT_NOT_NULL(ptrs[i]);
+		memset(ptrs[i], (int)(i & 0xff), sizes[i]);
+	}
+
+	for (i = 0; i < N; i++) {
+		for (j = 0; j < sizes[i]; j++)
+			CUT_ASSERT_EQUAL((i & 0xff), ptrs[i][j]);
+		pool_free(ptrs[i]);
+	}
+
+	/* A block that was just freed is the next one handed out. */
+
+	ptrs[0] = pool_malloc(100);
+	pool_free(ptrs[0]);
+	CUT_ASSERT_TRUE(pool_malloc(112) == ptrs[0]);
+	pool_free(ptrs[0]);
+
+	h = hashtbl_create(16, 0.75, 1, hashtbl_direct_hash,
+			   hashtbl_direct_equals, NULL, NULL,
+			   pool_malloc, pool_free);
+	CUT_ASSERT_NOT_NULL(h);
+
+	for (k = 1; k <= 20000; k++)
+		CUT_ASSERT_EQUAL(0, hashtbl_insert(h, (void *)k, (void *)k));
+	for (k = 1; k <= 20000; k += 3)
+		CUT_ASSERT_EQUAL(0, hashtbl_remove(h, (void *)k));
+	for (k = 1; k <= 20000; k++) {
+		void *want = (k % 3 == 1) ? NULL : (void *)k;
+		CUT_ASSERT_TRUE(hashtbl_lookup(h, (void *)k) == want);
+	}
+
+	hashtbl_delete(h);
+	pool_thread_flush();
+
+	return 0;
+}
+
+#define NTHREADS	4
+#define NBLOCKS		20000
+
+struct worker {
+	pthread_t thread;
+	int id;
+	unsigned char **blocks;
+	int ok;
+};
+
+/*
+ * Allocates blocks, tagged with the worker's id, and frees half of
+ * the blocks allocated by the previous worker.
+ */
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long seed = (unsigned long)w->id + 1;
+	int i;
+
+	w->ok = 1;
+
+	for (i = 0; i < NBLOCKS; i++) {
+		size_t n;
+
+		seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+		n = 1 + (seed >> 33) % 600;
+		w->blocks[i] = pool_malloc(n);
+		if (w->blocks[i] == NULL) {
+			w->ok = 0;
+			return NULL;
+		}
+		memset(w->blocks[i], w->id, n);
+
+		if (i % 4 == 3) {
+			pool_free(w->blocks[i - 1]);
+			w->blocks[i - 1] = NULL;
+		}
+	}
+
+	for (i = 0; i < NBLOCKS; i++) {
+		if (w->blocks[i] != NULL && w->blocks[i][0] != w->id)
+			w->ok = 0;
+	}
+
+	return NULL;
+}
+
+/* Test the pool with threads that free each other's blocks. */
+
+static int test5(void)
+{
+	static unsigned char *blocks[NTHREADS][NBLOCKS];
+	struct worker workers[NTHREADS];
+	int i, j, round;
+
+	for (round = 0; round < 3; round++) {
+		for (i = 0; i < NTHREADS; i++) {
+			workers[i].id = i + 1;
+			workers[i].blocks = blocks[i];
+			CUT_ASSERT_EQUAL(0, pthread_create(&workers[i].thread,
+							   NULL, worker_main,
+							   &workers[i]));
+		}
+
+		for (i = 0; i < NTHREADS; i++) {
+			pthread_join(workers[i].thread, NULL);
+			CUT_ASSERT_TRUE(workers[i].ok);
+		}
+
+		/* The threads have exited; free what they left behind. */
+
+		for (i = 0; i < NTHREADS; i++) {
+			for (j = 0; j < NBLOCKS; j++)
+				pool_free(blocks[i][j]);
+		}
+		pool_thread_flush();
+	}
+
+	return 0;
+}
+
+CUT_BEGIN_TEST_HARNESS CUT_RUN_TEST(test1);
+CUT_RUN_TEST(test2);
+CUT_RUN_TEST(test3);
+CUT_RUN_TEST(test4);
+CUT_RUN_TEST(test5);
+CUT_END_TEST_HARNESS
@@ -0,0 +1,322 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* test-art.c - unit tests for art */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "CUnitTest.h"
+
+#include <c-hacks/art.h>
+
+#define KEY(X)			((void *)(intptr_t)(X))
+#define INT(X)			((int)(intptr_t)(X))
+
+struct key {
+	unsigned char bytes[32];
+	size_t len;
+};
+
+struct walk {
+	const struct key *expect;
+	int n;
+	int failed;
+};
+
+static unsigned long rand_state = 1;
+
+static unsigned long next_rand(void)
+{
+	rand_state = rand_state * 6364136223846793005UL + 1442695040888963407UL;
+	return rand_state >> 33;
+}
+
+static int key_compare(const void *a, const void *b)
+{
+	const struct key *x = a, *y = b;
+	size_t n = (x->len < y->len) ? x->len : y->len;
+	int r = memcmp(x->bytes, y->bytes, n);
+
+	if (r != 0)
+		return r;
+
+	return (x->len > y->len) - (x->len < y->len);
+}
+
+/* Checks each entry against the next expected key. */
+
+static int walk_check(const unsigned char *key, size_t len, void *val,
+		      void *client_data)
+{
+	struct walk *w = client_data;
+	const struct key *k = &w->expect[w->n++];
+
+	if (k->len != len || memcmp(k->bytes, key, len) != 0)
+		w->failed = 1;
+
+	return 1;
+}
+
+static int walk_stop(const unsigned char *key, size_t len, void *val,
+		     void *client_data)
+{
+	return --*(int *)client_data > 0;
+}
+
+static int nfreed;
+
+static void val_free(void *v)
+{
+	nfreed++;
+}
+
+/*
+ * Returns keys made of bytes that stress the node searches (0x00,
+ * 0x7f, 0x80, 0xff), many of which are prefixes of others, and some
+ * sharing a prefix longer than the part stored in a node.  The keys
+ * are sorted and unique.
+ */
+static size_t make_keys(struct key *keys, size_t n)
+{
+	static const unsigned char bytes[] = { 0x00, 0x01, 0x7f, 0x80, 0xfe,
+		0xff };
+	static const char common[] = "a-long-common-prefix/";
+	size_t i, j, m;
+
+	for (i = 0; i < n; i++) {
+		struct key *k = &keys[i];
+		size_t len = next_rand() % 8, start = 0;
+
+		if (i % 2 == 0) {
+			start = sizeof(common) - 1;
+			memcpy(k->bytes, common, start);
+			k->bytes[start++] = (unsigned char)next_rand();
+		}
+
+		for (j = 0; j < len; j++)
+			k->bytes[start + j] = bytes[next_rand() % sizeof(bytes)];
+
+		k->len = start + len;
+	}
+
+	qsort(keys, n, sizeof(*keys), key_compare);
+
+	for (i = m = 1; i < n; i++) {
+		if (key_compare(&keys[i], &keys[m - 1]) != 0)
+			keys[m++] = keys[i];
+	}
+
+	return m;
+}
+
+/* Test random inserts and removes against a model. */
+
+static int test1(void)
+{
+	enum { N = 4000, ROUNDS = 8 };
+	struct key *keys = malloc(N * sizeof(*keys));
+	struct key *expect = malloc(N * sizeof(*keys));
+	char *present = calloc(N, 1);
+	struct art *t = art_create(NULL, NULL, NULL);
+	struct walk w;
+	size_t i, n, nexpect, count = 0;
+	int round;
+
+	CUT_ASSERT_NOT_NULL(keys);
+	CUT_ASSERT_NOT_NULL(t);
+	n = make_keys(keys, N);
+
+	for (round = 0; round < ROUNDS; round++) {
+		/* Fill up on even rounds and drain on odd ones. */
+
+		for (i = 0; i < n; i++) {
+			size_t j = next_rand() % n;
+			int insert = (round % 2 == 0) ? (next_rand() % 4 != 0)
+			    : (next_rand() % 4 == 0);
+
+			if (insert) {
+				CUT_ASSERT_EQUAL(0, art_insert(t, keys[j].bytes,
+							       keys[j].len,
+							       KEY(j + 1)));
+				count += !present[j];
+				present[j] = 1;
+			} else {
+				CUT_ASSERT_EQUAL((present[j] ? 0 : 1),
+						 art_remove(t, keys[j].bytes,
+							    keys[j].len));
+				count -= present[j];
+				present[j] = 0;
+			}
+		}
+
+		CUT_ASSERT_EQUAL(count, art_count(t));
+
+		for (i = nexpect = 0; i < n; i++) {
+			void *val = art_lookup(t, keys[i].bytes, keys[i].len);
+			CUT_ASSERT_TRUE(val == (present[i] ? KEY(i + 1) : NULL));
+			if (present[i])
+				expect[nexpect++] = keys[i];
+		}
+
+		w.expect = expect;
+		w.n = w.failed = 0;
+		CUT_ASSERT_EQUAL(nexpect, art_apply(t, walk_check, &w));
+		CUT_ASSERT_EQUAL(0, w.failed);
+	}
+
+	/* Remove whatever is left; the tree ends up empty. */
+
+	for (i = 0; i < n; i++) {
+		CUT_ASSERT_EQUAL((present[i] ? 0 : 1),
+				 art_remove(t, keys[i].bytes, keys[i].len));
+	}
+
+	CUT_ASSERT_EQUAL(0, art_count(t));
+	CUT_ASSERT_EQUAL(0, art_apply(t, walk_check, &w));
+
+	art_delete(t);
+	free(keys);
+	free(expect);
+	free(present);
+
+	return 0;
+}
+
+/* Test prefix scans, early termination and integer keys. */
+
+static int test2(void)
+{
+	static const char *const words[] = {
+		"", "r", "ra", "ram", "ramp", "rampart", "ran", "rank",
+		"romane", "romanus", "romulus", "rubens", "ruber", "rubicon",
+		"rubicundus", "s",
+	};
+	enum { NWORDS = sizeof(words) / sizeof(words[0]), N = 1000 };
+	struct key expect[NWORDS];
+	struct art *t = art_create(val_free, NULL, NULL);
+	struct walk w;
+	unsigned char key[8];
+	int i, n, stop;
+
+	CUT_ASSERT_NOT_NULL(t);
+
+	for (i = NWORDS - 1; i >= 0; i--) {
+		CUT_ASSERT_EQUAL(0, art_insert(t, words[i], strlen(words[i]),
+					       KEY(i + 1)));
+	}
+
+	for (i = 0; i < NWORDS; i++) {
+		CUT_ASSERT_EQUAL(i + 1,
+				 INT(art_lookup(t, words[i], strlen(words[i]))));
+	}
+
+	/* Keys that match only part of a compressed path are absent. */
+
+	CUT_ASSERT_NULL(art_lookup(t, "rom", 3));
+	CUT_ASSERT_NULL(art_lookup(t, "rubi", 4));
+	CUT_ASSERT_NULL(art_lookup(t, "rampa", 5));
+
+	/* Replacing a value frees the old one. */
+
+	nfreed = 0;
+	CUT_ASSERT_EQUAL(0, art_insert(t, "ran", 3, KEY(7)));
+	CUT_ASSERT_EQUAL(1, nfreed);
+	CUT_ASSERT_EQUAL(NWORDS, art_count(t));
+
+	/* Scan for each word as a prefix, and for partial paths. */
+
+	for (i = 0; i < NWORDS + 3; i++) {
+		const char *p = (i < NWORDS) ? words[i]
+		    : (i == NWORDS) ? "rom" : (i == NWORDS + 1) ? "rubi" : "x";
+		int j;
+
+		for (j = n = 0; j < NWORDS; j++) {
+			if (strncmp(words[j], p, strlen(p)) == 0) {
+				expect[n].len = strlen(words[j]);
+				memcpy(expect[n].bytes, words[j], expect[n].len);
+				n++;
+			}
+		}
+
+		w.expect = expect;
+		w.n = w.failed = 0;
+		CUT_ASSERT_EQUAL(n, art_prefix_scan(t, p, strlen(p),
+						    walk_check, &w));
+		CUT_ASSERT_EQUAL(0, w.failed);
+	}
+
+	stop = 3;
+	CUT_ASSERT_EQUAL(3, art_apply(t, walk_stop, &stop));
+	stop = 2;
+	CUT_ASSERT_EQUAL(2, art_prefix_scan(t, "ro", 2, walk_stop, &stop));
+
+	nfreed = 0;
+	CUT_ASSERT_EQUAL(0, art_remove(t, "", 0));
+	CUT_ASSERT_EQUAL(1, art_remove(t, "", 0));
+	CUT_ASSERT_EQUAL(1, art_remove(t, "ramparts", 8));
+	CUT_ASSERT_EQUAL(1, nfreed);
+	art_delete(t);
+	CUT_ASSERT_EQUAL(NWORDS, nfreed);
+
+	/* Integer keys come back in numeric order. */
+
+	t = art_create(NULL, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(t);
+
+	for (i = 0; i < N; i++) {
+		art_key_int64((int64_t)((i * 7919) % N - N / 2) * 1000003, key);
+		CUT_ASSERT_EQUAL(0, art_insert(t, key, sizeof(key), KEY(i)));
+	}
+
+	{
+		struct key *sorted = malloc(N * sizeof(*sorted));
+
+		CUT_ASSERT_NOT_NULL(sorted);
+
+		for (i = 0; i < N; i++) {
+			art_key_int64((int64_t)(i - N / 2) * 1000003,
+				      sorted[i].bytes);
+			sorted[i].len = 8;
+		}
+
+		w.expect = sorted;
+		w.n = w.failed = 0;
+		CUT_ASSERT_EQUAL(N, art_apply(t, walk_check, &w));
+		CUT_ASSERT_EQUAL(0, w.failed);
+		free(sorted);
+	}
+
+	art_delete(t);
+
+	return 0;
+}
+
+CUT_BEGIN_TEST_HARNESS CUT_RUN_TEST(test1);
+CUT_RUN_TEST(test2);
+CUT_END_TEST_HARNESS
@@ -0,0 +1,346 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* test-btree-file.c - unit tests for btree-file */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "CUnitTest.h"
+
+#include <c-hacks/btree-file.h>
+
+#define NKEYS		4000
+#define SMALL_PAGE	1024	/* 63 keys per leaf, so trees get deep */
+
+/* Tiny PRNG so that runs are reproducible across libcs. */
+
+static unsigned int next_rand(unsigned int *state)
+{
+	*state = *state * 1103515245 + 12345;
+	return (*state >> 16) & 0x7fff;
+}
+
+static void temp_name(char *path)
+{
+	int fd;
+
+	strcpy(path, "/tmp/test-btree-file-XXXXXX");
+	fd = mkstemp(path);
+	close(fd);
+}
+
+static off_t file_size(const char *path)
+{
+	struct stat st;
+
+	return (stat(path, &st) == 0) ? st.st_size : -1;
+}
+
+/*
+ * Returns the number of mismatches between f and the model, where
+ * present[k] says whether k is in the tree with the value vals[k].
+ */
+static int check_contents(const struct btree_file *f, const char *present,
+			  const uint64_t *vals, int n)
+{
+	struct btree_file_iter iter;
+	int k, nbad = 0, count = 0;
+	int64_t prev = -1;
+	uint64_t v;
+
+	for (k = 0; k < n; k++) {
+		if (present[k]) {
+			count++;
+			if (btree_file_lookup(f, k, &v) != 0 || v != vals[k])
+				nbad++;
+		} else if (btree_file_lookup(f, k, &v) == 0) {
+			nbad++;
+		}
+	}
+
+	btree_file_iter_init(f, &iter);
+	while (btree_file_iter_next(&iter)) {
+		if (iter.key <= prev || iter.key >= n ||
+		    !present[iter.key] || iter.val != vals[iter.key])
+			nbad++;
+		prev = iter.key;
+		count--;
+	}
+
+	return nbad + (count != 0);
+}
+
+static unsigned long model_count(const char *present, int n)
+{
+	unsigned long count = 0;
+	int k;
+
+	for (k = 0; k < n; k++)
+		count += present[k];
+
+	return count;
+}
+
+/* Random inserts and removes, committed, rolled back and reopened. */
+
+static int test1(void)
+{
+	char path[64];
+	static char present[NKEYS], committed[NKEYS];
+	static uint64_t vals[NKEYS], committed_vals[NKEYS];
+	unsigned int seed = 42;
+	struct btree_file *f;
+	int i, k;
+
+	temp_name(path);
+	f = btree_file_open(path, SMALL_PAGE, BTREE_FILE_NOSYNC, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(f);
+	CUT_ASSERT_EQUAL(0, btree_file_count(f));
+
+	for (i = 1; i <= 40000; i++) {
+		k = (next_rand(&seed) << 15 | next_rand(&seed)) % NKEYS;
+
+		if (next_rand(&seed) % 3 != 0) {
+			vals[k] = (uint64_t)i << 32 | (uint64_t)k;
+			CUT_ASSERT_EQUAL(0, btree_file_insert(f, k, vals[k]));
+			present[k] = 1;
+		} else {
+			CUT_ASSERT_EQUAL((present[k] ? 0 : 1),
+					 btree_file_remove(f, k));
+			present[k] = 0;
+		}
+
+		if (i % 1000 == 0) {
+			CUT_ASSERT_EQUAL(model_count(present, NKEYS),
+					 btree_file_count(f));
+			CUT_ASSERT_EQUAL(0, check_contents(f, present, vals,
+							   NKEYS));
+		}
+
+		/* Every fifth batch is thrown away. */
+
+		if (i % 1500 == 0) {
+			if (i % 7500 == 0) {
+				btree_file_rollback(f);
+				memcpy(present, committed, sizeof(present));
+				memcpy(vals, committed_vals, sizeof(vals));
+			} else {
+				CUT_ASSERT_EQUAL(0, btree_file_commit(f));
+				memcpy(committed, present, sizeof(present));
+				memcpy(committed_vals, vals, sizeof(vals));
+			}
+			CUT_ASSERT_EQUAL(0, check_contents(f, present, vals,
+							   NKEYS));
+		}
+	}
+
+	/* Closing drops whatever wasn't committed. */
+
+	CUT_ASSERT_EQUAL(0, btree_file_close(f));
+	f = btree_file_open(path, 0, 0, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(f);
+	CUT_ASSERT_EQUAL(model_count(committed, NKEYS), btree_file_count(f));
+	CUT_ASSERT_EQUAL(0, check_contents(f, committed, committed_vals,
+					   NKEYS));
+
+	/* Remove everything: the tree shrinks back to an empty leaf. */
+
+	for (k = 0; k < NKEYS; k++) {
+		if (committed[k])
+			CUT_ASSERT_EQUAL(0, btree_file_remove(f, k));
+	}
+
+	memset(present, 0, sizeof(present));
+	CUT_ASSERT_EQUAL(0, btree_file_count(f));
+	CUT_ASSERT_EQUAL(0, check_contents(f, present, vals, NKEYS));
+	CUT_ASSERT_EQUAL(0, btree_file_commit(f));
+	CUT_ASSERT_EQUAL(0, btree_file_close(f));
+
+	f = btree_file_open(path, 0, 0, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(f);
+	CUT_ASSERT_EQUAL(0, btree_file_count(f));
+	CUT_ASSERT_EQUAL(0, btree_file_close(f));
+	unlink(path);
+
+	return 0;
+}
+
+/* Pages replaced by a commit are reused, so churn doesn't grow the file. */
+
+static int test2(void)
+{
+	char path[64];
+	struct btree_file *f;
+	off_t size;
+	int round, k;
+
+	temp_name(path);
+	f = btree_file_open(path, SMALL_PAGE, BTREE_FILE_NOSYNC, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(f);
+
+	for (k = 0; k < NKEYS; k++)
+		CUT_ASSERT_EQUAL(0, btree_file_insert(f, k, k));
+	CUT_ASSERT_EQUAL(0, btree_file_commit(f));
+	size = file_size(path);
+
+	for (round = 0; round < 20; round++) {
+		for (k = round % 2; k < NKEYS; k += 2)
+			CUT_ASSERT_EQUAL(0, btree_file_remove(f, k));
+		CUT_ASSERT_EQUAL(0, btree_file_commit(f));
+		for (k = round % 2; k < NKEYS; k += 2)
+			CUT_ASSERT_EQUAL(0, btree_file_insert(f, k, k + round));
+		CUT_ASSERT_EQUAL(0, btree_file_commit(f));
+	}
+
+	CUT_ASSERT_EQUAL(NKEYS, btree_file_count(f));
+	CUT_ASSERT_TRUE(file_size(path) <= 4 * size);
+	CUT_ASSERT_EQUAL(0, btree_file_close(f));
+	unlink(path);
+
+	return 0;
+}
+
+/* A torn or corrupt meta record falls back to the previous commit. */
+
+static int test3(void)
+{
+	char path[64];
+	struct btree_file *f;
+	uint64_t txid[2], v;
+	unsigned char byte;
+	int fd, k, newest;
+
+	temp_name(path);
+	f = btree_file_open(path, 0, 0, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(f);
+
+	for (k = 0; k < 100; k++)
+		CUT_ASSERT_EQUAL(0, btree_file_insert(f, k, k));
+	CUT_ASSERT_EQUAL(0, btree_file_commit(f));
+	for (k = 100; k < 200; k++)
+		CUT_ASSERT_EQUAL(0, btree_file_insert(f, k, k));
+	CUT_ASSERT_EQUAL(0, btree_file_commit(f));
+	CUT_ASSERT_EQUAL(0, btree_file_close(f));
+
+	/* The transaction id follows the magic, version and page size. */
+
+	fd = open(path, O_RDWR);
+	CUT_ASSERT_TRUE(fd >= 0);
+	CUT_ASSERT_EQUAL(8, pread(fd, &txid[0], 8, 16));
+	CUT_ASSERT_EQUAL(8, pread(fd, &txid[1], 8, 512 + 16));
+	newest = (txid[1] > txid[0]) ? 1 : 0;
+	CUT_ASSERT_EQUAL(1, pread(fd, &byte, 1, newest * 512 + 40));
+	byte ^= 0x01;
+	CUT_ASSERT_EQUAL(1, pwrite(fd, &byte, 1, newest * 512 + 40));
+	close(fd);
+
+	f = btree_file_open(path, 0, 0, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(f);
+	CUT_ASSERT_EQUAL(100, btree_file_count(f));
+	CUT_ASSERT_EQUAL(0, btree_file_lookup(f, 99, &v));
+	CUT_ASSERT_EQUAL(1, btree_file_lookup(f, 100, &v));
+	CUT_ASSERT_EQUAL(0, btree_file_close(f));
+
+	/* With both records gone the file is rejected. */
+
+	fd = open(path, O_RDWR);
+	CUT_ASSERT_EQUAL(1, pwrite(fd, &byte, 1, (1 - newest) * 512 + 40));
+	close(fd);
+
+	errno = 0;
+	CUT_ASSERT_NULL(btree_file_open(path, 0, 0, NULL, NULL));
+	CUT_ASSERT_EQUAL(EILSEQ, errno);
+	unlink(path);
+
+	return 0;
+}
+
+/* 16 KB pages, lower bound and page size validation. */
+
+static int test4(void)
+{
+	char path[64];
+	struct btree_file *f;
+	struct btree_file_iter iter;
+	int64_t k;
+
+	errno = 0;
+	CUT_ASSERT_NULL(btree_file_open("/tmp/unused", 3000, 0, NULL, NULL));
+	CUT_ASSERT_EQUAL(EINVAL, errno);
+	CUT_ASSERT_NULL(btree_file_open("/tmp/unused", 512, 0, NULL, NULL));
+	CUT_ASSERT_NULL(btree_file_open("/tmp/unused", 1 << 17, 0, NULL,
+					NULL));
+
+	temp_name(path);
+	f = btree_file_open(path, 16384, 0, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(f);
+
+	for (k = -20000; k < 20000; k += 2)
+		CUT_ASSERT_EQUAL(0, btree_file_insert(f, k, (uint64_t)k * 3));
+	CUT_ASSERT_EQUAL(0, btree_file_commit(f));
+	CUT_ASSERT_EQUAL(0, btree_file_close(f));
+
+	/* An existing file keeps its page size whatever is asked for. */
+
+	f = btree_file_open(path, 4096, 0, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(f);
+	CUT_ASSERT_EQUAL(20000, btree_file_count(f));
+	CUT_ASSERT_EQUAL(0, file_size(path) % 16384);
+
+	btree_file_lower_bound(f, 101, &iter);
+	for (k = 102; btree_file_iter_next(&iter); k += 2) {
+		CUT_ASSERT_EQUAL(k, iter.key);
+		CUT_ASSERT_EQUAL((uint64_t)k * 3, iter.val);
+	}
+	CUT_ASSERT_EQUAL(20000, k);
+
+	btree_file_lower_bound(f, 20000, &iter);
+	CUT_ASSERT_EQUAL(0, btree_file_iter_next(&iter));
+
+	btree_file_lower_bound(f, -30000, &iter);
+	CUT_ASSERT_EQUAL(1, btree_file_iter_next(&iter));
+	CUT_ASSERT_EQUAL(-20000, iter.key);
+
+	CUT_ASSERT_EQUAL(0, btree_file_close(f));
+	unlink(path);
+
+	return 0;
+}
+
+CUT_BEGIN_TEST_HARNESS CUT_RUN_TEST(test1);
+CUT_RUN_TEST(test2);
+CUT_RUN_TEST(test3);
+CUT_RUN_TEST(test4);
+CUT_END_TEST_HARNESS
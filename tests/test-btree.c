@@ -1,42 +1,1116 @@
-#include "cutest.h"
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
 
-void test_tutorial(void)
+/* test-btree.c - unit tests for btree */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "CUnitTest.h"
+
+#include <c-hacks/btree.h>
+#include <c-hacks/btree-funcs.h>
+
+#define UNUSED_PARAMETER(X)	(void)(X)
+#define STREQ(A,B)		strcmp((A), (B)) == 0
+#define KEY(X)			((void *)(intptr_t)(X))
+#define INT(X)			((int)(intptr_t)(X))
+#define NELEMENTS(X)		(sizeof((X)) / sizeof((X)[0]))
+
+/* Tiny PRNG so that runs are reproducible across libcs. */
+
+static unsigned int rand_state = 1;
+
+static unsigned int next_rand(void)
+{
+	rand_state = rand_state * 1103515245 + 12345;
+	return (rand_state >> 16) & 0x7fff;
+}
+
+static int *new_int(int x)
+{
+	int *p = malloc(sizeof(int));
+	*p = x;
+	return p;
+}
+
+/* Returns 1 if an in-order walk yields exactly the keys in present[]. */
+
+static int check_contents(struct btree *t, const char *present, int n)
+{
+	struct btree_iter iter;
+	int i = 0;
+	unsigned long count = 0;
+
+	btree_iter_init(t, &iter);
+
+	while (btree_iter_next(&iter)) {
+		int k = *(int *)iter.key;
+		while (i < n && !present[i])
+			i++;
+		if (i != k || *(int *)iter.val != k * 10)
+			return 0;
+		i++;
+		count++;
+	}
+
+	while (i < n && !present[i])
+		i++;
+
+	return i == n && count == btree_count(t);
+}
+
+static int apply_sum(const void *k, const void *v, const void *u)
+{
+	UNUSED_PARAMETER(v);
+	*(long *)u += INT(k);
+	return 1;
+}
+
+static int apply_stop(const void *k, const void *v, const void *u)
+{
+	UNUSED_PARAMETER(v);
+	*(long *)u = INT(k);
+	return INT(k) < 9;
+}
+
+/* Test basic tree creation/clear/size. */
+
+static int test1(void)
+{
+	struct btree_iter iter;
+	struct btree *t = btree_create(NULL, NULL, NULL, NULL, NULL);
+
+	CUT_ASSERT_NOT_NULL(t);
+	CUT_ASSERT_EQUAL(0, btree_count(t));
+	CUT_ASSERT_NULL(btree_lookup(t, KEY(1)));
+	CUT_ASSERT_EQUAL(1, btree_remove(t, KEY(1)));
+	btree_clear(t);
+	CUT_ASSERT_EQUAL(0, btree_count(t));
+	btree_iter_init(t, &iter);
+	CUT_ASSERT_FALSE(btree_iter_next(&iter));
+	btree_lower_bound(t, KEY(1), &iter);
+	CUT_ASSERT_FALSE(btree_iter_next(&iter));
+	btree_delete(t);
+	return 0;
+}
+
+/* Test direct keys: insert, replace, lookup, ordered iteration. */
+
+static int test2(void)
+{
+	int i;
+	long sum = 0;
+	struct btree_iter iter;
+	struct btree *t = btree_create(NULL, NULL, NULL, NULL, NULL);
+
+	CUT_ASSERT_NOT_NULL(t);
+
+	/* Insert in a scrambled order. */
+	for (i = 0; i < 1000; i++)
+		CUT_ASSERT_EQUAL(0, btree_insert(t, KEY((i * 7) % 1000),
+						 KEY(i)));
+	CUT_ASSERT_EQUAL(1000, btree_count(t));
+
+	for (i = 0; i < 1000; i++)
+		CUT_ASSERT_EQUAL(0, btree_insert(t, KEY(i), KEY(i + 1)));
+	CUT_ASSERT_EQUAL(1000, btree_count(t));
+
+	for (i = 0; i < 1000; i++)
+		CUT_ASSERT_EQUAL(i + 1, INT(btree_lookup(t, KEY(i))));
+	CUT_ASSERT_NULL(btree_lookup(t, KEY(-1)));
+	CUT_ASSERT_NULL(btree_lookup(t, KEY(1000)));
+
+	btree_iter_init(t, &iter);
+	for (i = 0; btree_iter_next(&iter); i++) {
+		CUT_ASSERT_EQUAL(i, INT(iter.key));
+		CUT_ASSERT_EQUAL(i + 1, INT(iter.val));
+	}
+	CUT_ASSERT_EQUAL(1000, i);
+
+	CUT_ASSERT_EQUAL(1000, btree_apply(t, apply_sum, &sum));
+	CUT_ASSERT_EQUAL(999 * 1000 / 2, sum);
+	CUT_ASSERT_EQUAL(10, btree_apply(t, apply_stop, &sum));
+	CUT_ASSERT_EQUAL(9, sum);
+
+	btree_clear(t);
+	CUT_ASSERT_EQUAL(0, btree_count(t));
+	CUT_ASSERT_NULL(btree_lookup(t, KEY(1)));
+	CUT_ASSERT_EQUAL(0, btree_insert(t, KEY(1), KEY(2)));
+	CUT_ASSERT_EQUAL(2, INT(btree_lookup(t, KEY(1))));
+	btree_delete(t);
+	return 0;
+}
+
+/* Test lower bound and range iteration. */
+
+static int test3(void)
+{
+	int i;
+	struct btree_iter iter;
+	struct btree *t = btree_create(NULL, NULL, NULL, NULL, NULL);
+
+	CUT_ASSERT_NOT_NULL(t);
+
+	/* Even keys only. */
+	for (i = 0; i < 500; i++)
+		CUT_ASSERT_EQUAL(0, btree_insert(t, KEY(i * 2), KEY(i)));
+
+	btree_lower_bound(t, KEY(-5), &iter);
+	CUT_ASSERT_TRUE(btree_iter_next(&iter));
+	CUT_ASSERT_EQUAL(0, INT(iter.key));
+
+	btree_lower_bound(t, KEY(101), &iter);
+	CUT_ASSERT_TRUE(btree_iter_next(&iter));
+	CUT_ASSERT_EQUAL(102, INT(iter.key));
+
+	btree_lower_bound(t, KEY(102), &iter);
+	CUT_ASSERT_TRUE(btree_iter_next(&iter));
+	CUT_ASSERT_EQUAL(102, INT(iter.key));
+
+	/* Walk [200, 300). */
+	btree_lower_bound(t, KEY(200), &iter);
+	for (i = 200; btree_iter_next(&iter) && INT(iter.key) < 300; i += 2)
+		CUT_ASSERT_EQUAL(i, INT(iter.key));
+	CUT_ASSERT_EQUAL(300, i);
+
+	btree_lower_bound(t, KEY(998), &iter);
+	CUT_ASSERT_TRUE(btree_iter_next(&iter));
+	CUT_ASSERT_EQUAL(998, INT(iter.key));
+	CUT_ASSERT_FALSE(btree_iter_next(&iter));
+
+	btree_lower_bound(t, KEY(999), &iter);
+	CUT_ASSERT_FALSE(btree_iter_next(&iter));
+
+	btree_delete(t);
+	return 0;
+}
+
+/* Test removal in ascending, descending and interleaved order. */
+
+static int test4(void)
+{
+	int i, pass;
+	struct btree *t = btree_create(NULL, NULL, NULL, NULL, NULL);
+
+	CUT_ASSERT_NOT_NULL(t);
+
+	for (pass = 0; pass < 3; pass++) {
+		for (i = 0; i < 1000; i++)
+			CUT_ASSERT_EQUAL(0, btree_insert(t, KEY(i), KEY(i)));
+		for (i = 0; i < 1000; i++) {
+			int k = (pass == 0) ? i :
+			    (pass == 1) ? 999 - i : (i * 37) % 1000;
+			CUT_ASSERT_EQUAL(0, btree_remove(t, KEY(k)));
+			CUT_ASSERT_EQUAL(1, btree_remove(t, KEY(k)));
+			CUT_ASSERT_NULL(btree_lookup(t, KEY(k)));
+			CUT_ASSERT_EQUAL(999 - i, btree_count(t));
+		}
+	}
+
+	btree_delete(t);
+	return 0;
+}
+
+/* Test random inserts and removes of malloc'ed keys and values. */
+
+static int test5(void)
+{
+	enum { N = 2000, OPS = 20000 };
+	static char present[N];
+	int i;
+	struct btree *t = btree_create(btree_int_compare, free, free, malloc,
+				       free);
+
+	CUT_ASSERT_NOT_NULL(t);
+	memset(present, 0, sizeof(present));
+
+	for (i = 0; i < OPS; i++) {
+		int k = (int)(next_rand() % N);
+
+		if (next_rand() % 3 != 0) {
+			if (!present[k]) {
+				CUT_ASSERT_EQUAL(0, btree_insert(t, new_int(k),
+								 new_int(k *
+									 10)));
+				present[k] = 1;
+			}
+		} else {
+			CUT_ASSERT_EQUAL((present[k] ? 0 : 1),
+					 btree_remove(t, &k));
+			present[k] = 0;
+		}
+
+		if (i % 1000 == 0)
+			CUT_ASSERT_TRUE(check_contents(t, present, N));
+	}
+
+	CUT_ASSERT_TRUE(check_contents(t, present, N));
+
+	for (i = 0; i < N; i++) {
+		int *v = btree_lookup(t, &i);
+		if (present[i]) {
+			CUT_ASSERT_NOT_NULL(v);
+			CUT_ASSERT_EQUAL(i * 10, *v);
+		} else {
+			CUT_ASSERT_NULL(v);
+		}
+	}
+
+	btree_delete(t);
+	return 0;
+}
+
+/* Test string keys. */
+
+static int test6(void)
+{
+	int i;
+	char buf[64], prev[64];
+	struct btree_iter iter;
+	struct btree *t = btree_create(btree_string_compare, free, free,
+				       NULL, NULL);
+
+	CUT_ASSERT_NOT_NULL(t);
+
+	for (i = 0; i < 500; i++) {
+		sprintf(buf, "%d", i);
+		CUT_ASSERT_EQUAL(0, btree_insert(t, strdup(buf), strdup(buf)));
+	}
+
+	CUT_ASSERT_EQUAL(500, btree_count(t));
+
+	for (i = 0; i < 500; i++) {
+		sprintf(buf, "%d", i);
+		CUT_ASSERT_TRUE(STREQ(buf, (char *)btree_lookup(t, buf)));
+	}
+
+	prev[0] = '\0';
+	btree_iter_init(t, &iter);
+	for (i = 0; btree_iter_next(&iter); i++) {
+		CUT_ASSERT_TRUE(strcmp(prev, iter.key) < 0);
+		strcpy(prev, iter.key);
+	}
+	CUT_ASSERT_EQUAL(500, i);
+
+	for (i = 0; i < 500; i += 2) {
+		sprintf(buf, "%d", i);
+		CUT_ASSERT_EQUAL(0, btree_remove(t, buf));
+	}
+
+	CUT_ASSERT_EQUAL(250, btree_count(t));
+	btree_lower_bound(t, "2", &iter);
+	CUT_ASSERT_TRUE(btree_iter_next(&iter));
+	CUT_ASSERT_TRUE(STREQ("201", (char *)iter.key));
+
+	btree_delete(t);
+	return 0;
+}
+
+/* Test direct keys across the whole signed range. */
+
+static int test7(void)
+{
+	int i;
+	intptr_t prev;
+	struct btree_iter iter;
+	struct btree *t = btree_create(NULL, NULL, NULL, NULL, NULL);
+	intptr_t keys[] = {
+		INTPTR_MIN, INTPTR_MIN + 1, -1000000, -2, -1, 0, 1, 2,
+		1000000, INTPTR_MAX - 1, INTPTR_MAX
+	};
+
+	CUT_ASSERT_NOT_NULL(t);
+
+	for (i = NELEMENTS(keys) - 1; i >= 0; i--)
+		CUT_ASSERT_EQUAL(0, btree_insert(t, KEY(keys[i]), KEY(i)));
+
+	for (i = 0; i < (int)NELEMENTS(keys); i++)
+		CUT_ASSERT_EQUAL(i, INT(btree_lookup(t, KEY(keys[i]))));
+
+	CUT_ASSERT_NULL(btree_lookup(t, KEY(-3)));
+	CUT_ASSERT_NULL(btree_lookup(t, KEY(INTPTR_MAX - 2)));
+
+	btree_lower_bound(t, KEY(-3), &iter);
+	CUT_ASSERT_TRUE(btree_iter_next(&iter));
+	CUT_ASSERT_TRUE((intptr_t) iter.key == -2);
+
+	btree_lower_bound(t, KEY(INTPTR_MIN), &iter);
+	prev = INTPTR_MIN;
+	for (i = 0; btree_iter_next(&iter); i++) {
+		CUT_ASSERT_TRUE((intptr_t) iter.key >= prev);
+		CUT_ASSERT_TRUE((intptr_t) iter.key == keys[i]);
+		prev = (intptr_t) iter.key;
+	}
+	CUT_ASSERT_EQUAL((int)NELEMENTS(keys), i);
+
+	for (i = 0; i < (int)NELEMENTS(keys); i += 2)
+		CUT_ASSERT_EQUAL(0, btree_remove(t, KEY(keys[i])));
+	for (i = 0; i < (int)NELEMENTS(keys); i++)
+		CUT_ASSERT_EQUAL((i % 2 ? i : 0),
+				 INT(btree_lookup(t, KEY(keys[i]))));
+
+	btree_delete(t);
+	return 0;
+}
+
+/* Test bulk loading, and that the loaded tree can still be modified. */
+
+static int test8(void)
+{
+	enum { N = 1500 };
+	static char present[N];
+	static void *keys[N], *vals[N];
+	static const int sizes[] = { 0, 1, 2, 7, 16, 17, 100, 333, N };
+	static const double fills[] = { 0.0, 0.5, 0.7, 1.0, 2.0 };
+	unsigned int s, f;
+	int i;
+
+	for (s = 0; s < NELEMENTS(sizes); s++) {
+		for (f = 0; f < NELEMENTS(fills); f++) {
+			int n = sizes[s];
+			struct btree *t = btree_create(btree_int_compare, free,
+						       free, NULL, NULL);
+
+			CUT_ASSERT_NOT_NULL(t);
+			memset(present, 0, sizeof(present));
+
+			for (i = 0; i < n; i++) {
+				keys[i] = new_int(i);
+				vals[i] = new_int(i * 10);
+				present[i] = 1;
+			}
+
+			CUT_ASSERT_EQUAL(0, btree_bulk_load(t, keys, vals, n,
+							    fills[f]));
+			CUT_ASSERT_EQUAL(n, btree_count(t));
+			CUT_ASSERT_TRUE(check_contents(t, present, N));
+
+			/* Splits and merges must cope with packed nodes. */
+
+			for (i = 0; i < 4 * N; i++) {
+				int k = (int)(next_rand() % N);
+
+				if (next_rand() % 2 == 0) {
+					if (!present[k]) {
+						CUT_ASSERT_EQUAL(0, btree_insert
+								 (t, new_int(k),
+								  new_int(k *
+									  10)));
+						present[k] = 1;
+					}
+				} else {
+					CUT_ASSERT_EQUAL((present[k] ? 0 : 1),
+							 btree_remove(t, &k));
+					present[k] = 0;
+				}
+			}
+
+			CUT_ASSERT_TRUE(check_contents(t, present, N));
+			btree_delete(t);
+		}
+	}
+
+	return 0;
+}
+
+/* Test that bulk loading rejects bad input and leaves the tree alone. */
+
+static int test9(void)
+{
+	static void *keys[] = { KEY(1), KEY(2), KEY(3), KEY(3), KEY(5) };
+	struct btree_iter iter;
+	struct btree *t = btree_create(NULL, NULL, NULL, NULL, NULL);
+	int i;
+
+	CUT_ASSERT_NOT_NULL(t);
+
+	/* Duplicates. */
+	CUT_ASSERT_EQUAL(1, btree_bulk_load(t, keys, NULL, 5, 1.0));
+	CUT_ASSERT_EQUAL(0, btree_count(t));
+
+	/* Out of order. */
+	keys[3] = KEY(0);
+	CUT_ASSERT_EQUAL(1, btree_bulk_load(t, keys, NULL, 5, 1.0));
+	CUT_ASSERT_EQUAL(0, btree_count(t));
+
+	keys[3] = KEY(4);
+	CUT_ASSERT_EQUAL(0, btree_bulk_load(t, keys, NULL, 5, 1.0));
+	CUT_ASSERT_EQUAL(5, btree_count(t));
+
+	/* Not empty. */
+	CUT_ASSERT_EQUAL(1, btree_bulk_load(t, keys, NULL, 5, 1.0));
+	CUT_ASSERT_EQUAL(5, btree_count(t));
+
+	btree_iter_init(t, &iter);
+	for (i = 1; btree_iter_next(&iter); i++) {
+		CUT_ASSERT_EQUAL(i, INT(iter.key));
+		CUT_ASSERT_NULL(iter.val);
+	}
+	CUT_ASSERT_EQUAL(6, i);
+
+	btree_clear(t);
+	CUT_ASSERT_EQUAL(0, btree_bulk_load(t, keys, NULL, 5, 1.0));
+	CUT_ASSERT_EQUAL(5, btree_count(t));
+
+	btree_delete(t);
+	return 0;
+}
+
+/* Returns 1 if the direct keys in t are exactly those in present[]. */
+
+static int check_direct(const struct btree *t, const char *present, int n)
+{
+	struct btree_iter iter;
+	unsigned long count = 0;
+	long sum = 0, expected = 0;
+	int i, prev = -1;
+
+	btree_iter_init(t, &iter);
+
+	while (btree_iter_next(&iter)) {
+		int k = INT(iter.key);
+		if (k <= prev || k >= n || !present[k] || INT(iter.val) != -k - 1)
+			return 0;
+		prev = k;
+		count++;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (present[i])
+			expected += i;
+		if ((btree_lookup(t, KEY(i)) != NULL) != present[i])
+			return 0;
+	}
+
+	btree_apply(t, apply_sum, &sum);
+
+	return count == btree_count(t) && sum == expected;
+}
+
+/* Test persistent trees: snapshots keep their contents while both
+ * the tree and the snapshots are modified. */
+
+static int test10(void)
+{
+	enum { N = 700, NSNAPS = 8, OPS = 400 };
+	static char present[NSNAPS + 1][N];
+	struct btree *snaps[NSNAPS];
+	struct btree *t = btree_create(NULL, NULL, NULL, NULL, NULL);
+	struct btree *u = btree_create(btree_int_compare, free, NULL, NULL,
+				       NULL);
+	int i, j;
+
+	CUT_ASSERT_NOT_NULL(t);
+	CUT_ASSERT_NULL(btree_snapshot(t));
+	CUT_ASSERT_EQUAL(0, btree_insert(t, KEY(1), KEY(-1)));
+	CUT_ASSERT_EQUAL(1, btree_set_persistent(t));	/* not empty */
+	CUT_ASSERT_EQUAL(1, btree_set_persistent(u));	/* owns keys */
+	btree_delete(u);
+	btree_clear(t);
+	CUT_ASSERT_EQUAL(0, btree_set_persistent(t));
+
+	memset(present, 0, sizeof(present));
+
+	for (i = 0; i < NSNAPS; i++) {
+		for (j = 0; j < OPS; j++) {
+			int k = (int)(next_rand() % N);
+			if (next_rand() % 3 != 0) {
+				CUT_ASSERT_EQUAL(0, btree_insert(t, KEY(k),
+								 KEY(-k - 1)));
+				present[NSNAPS][k] = 1;
+			} else {
+				CUT_ASSERT_EQUAL((present[NSNAPS][k] ? 0 : 1),
+						 btree_remove(t, KEY(k)));
+				present[NSNAPS][k] = 0;
+			}
+		}
+
+		snaps[i] = btree_snapshot(t);
+		CUT_ASSERT_NOT_NULL(snaps[i]);
+		memcpy(present[i], present[NSNAPS], N);
+	}
+
+	/* Writes to the tree after the last snapshot. */
+
+	for (i = 0; i < N; i++) {
+		if (i % 2) {
+			btree_remove(t, KEY(i));
+			present[NSNAPS][i] = 0;
+		} else {
+			btree_insert(t, KEY(i), KEY(-i - 1));
+			present[NSNAPS][i] = 1;
+		}
+	}
+
+	/* Writes to a snapshot, which forks it from the tree. */
+
+	for (i = 0; i < N / 2; i++) {
+		btree_remove(snaps[3], KEY(i));
+		present[3][i] = 0;
+	}
+
+	CUT_ASSERT_TRUE(check_direct(t, present[NSNAPS], N));
+	for (i = 0; i < NSNAPS; i++)
+		CUT_ASSERT_TRUE(check_direct(snaps[i], present[i], N));
+
+	/* Dropping versions in any order frees exactly what's unshared. */
+
+	btree_delete(snaps[5]);
+	btree_clear(snaps[0]);
+	CUT_ASSERT_EQUAL(0, btree_count(snaps[0]));
+	btree_clear(t);
+	memset(present[0], 0, N);
+	memset(present[NSNAPS], 0, N);
+	CUT_ASSERT_TRUE(check_direct(snaps[0], present[0], N));
+	CUT_ASSERT_TRUE(check_direct(t, present[NSNAPS], N));
+
+	for (i = 0; i < NSNAPS; i++) {
+		if (i != 5)
+			CUT_ASSERT_TRUE(check_direct(snaps[i], present[i], N));
+	}
+
+	btree_delete(t);
+	for (i = NSNAPS - 1; i >= 0; i--) {
+		if (i != 5)
+			btree_delete(snaps[i]);
+	}
+
+	return 0;
+}
+
+static int strcmp_ptrs(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * Returns 1 if an in-order walk, and a lookup of every key, agree with
+ * present[], where keys[] is sorted and each value is its index + 1.
+ */
+static int check_strings(const struct btree *t, char **keys,
+			 const char *present, int n)
+{
+	struct btree_iter iter;
+	int i = 0, count = 0;
+
+	btree_iter_init(t, &iter);
+
+	while (btree_iter_next(&iter)) {
+		while (i < n && !present[i])
+			i++;
+		if (i == n || iter.key != keys[i] || INT(iter.val) != i + 1)
+			return 0;
+		i++;
+		count++;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (btree_lookup(t, keys[i]) != (present[i] ? KEY(i + 1) : NULL))
+			return 0;
+	}
+
+	return count == (int)btree_count(t);
+}
+
+/* Test prefix-compressed string keys. */
+
+static int test11(void)
+{
+	enum { N = 1200 };
+	static char *keys[N];
+	static char present[N];
+	static const char *fixed[] = {
+		"", "h", "https://", "https://example.com",
+		"https://example.com/", "https://example.com/a",
+		"https://example.com/a/0000",	/* a prefix of the next */
+		"https://example.com/a/00001234567",
+		"https://example.com/a/0000123456",
+		"https://example.com/\x7f", "https://example.com/\xff",
+		"https://example.com/\xff\xff\xff\xff\xff\xff\xff\xff\xff",
+	};
+	struct btree *t = btree_create(btree_string_compare, NULL, NULL, NULL,
+				       NULL);
+	struct btree *snap;
+	struct btree_iter iter;
+	char buf[64];
+	int i, j, nfixed = (int)NELEMENTS(fixed);
+
+	CUT_ASSERT_NOT_NULL(t);
+	CUT_ASSERT_EQUAL(0, btree_insert(t, "x", KEY(1)));
+	CUT_ASSERT_EQUAL(1, btree_set_string_keys(t));	/* not empty */
+	btree_clear(t);
+	CUT_ASSERT_EQUAL(0, btree_set_string_keys(t));
+	CUT_ASSERT_EQUAL(0, btree_set_string_keys(t));
+
+	/* Keys sharing prefixes of many lengths, 7 to 9 bytes past them. */
+
+	for (i = 0; i < nfixed; i++)
+		keys[i] = strdup(fixed[i]);
+	for (; i < N; i++) {
+		j = i;		/* >= nfixed, so no clash with fixed[] */
+		switch (j % 4) {
+		case 0:
+			sprintf(buf, "https://example.com/a/%04d", j);
+			break;
+		case 1:
+			sprintf(buf, "https://example.com/a/%04d/%d", j - 1,
+				j % 1000);
+			break;
+		case 2:
+			sprintf(buf, "https://example.com/b/%d", j * 7919);
+			break;
+		default:
+			sprintf(buf, "/usr/lib/%c%d", 'a' + j % 26, j);
+			break;
+		}
+		keys[i] = strdup(buf);
+	}
+
+	qsort(keys, N, sizeof(keys[0]), strcmp_ptrs);
+
+	for (i = 0; i < 6000; i++) {
+		int k = (int)((next_rand() << 15 | next_rand()) % N);
+		if (next_rand() % 3 != 0) {
+			CUT_ASSERT_EQUAL(0, btree_insert(t, keys[k], KEY(k + 1)));
+			present[k] = 1;
+		} else {
+			CUT_ASSERT_EQUAL((present[k] ? 0 : 1),
+					 btree_remove(t, keys[k]));
+			present[k] = 0;
+		}
+		if (i % 500 == 0)
+			CUT_ASSERT_TRUE(check_strings(t, keys, present, N));
+	}
+
+	CUT_ASSERT_TRUE(check_strings(t, keys, present, N));
+
+	/* Lookups of keys that were never inserted, copied so no pointer
+	 * comparison can stand in for a string comparison. */
+
+	for (i = 0; i < N; i++) {
+		char copy[64];
+		strcpy(copy, keys[i]);
+		CUT_ASSERT_EQUAL(btree_lookup(t, keys[i]), btree_lookup(t, copy));
+		strcat(copy, "~");
+		CUT_ASSERT_NULL(btree_lookup(t, copy));
+	}
+
+	btree_lower_bound(t, "https://example.com/a/0000!", &iter);
+	for (i = 0; i < N && strcmp(keys[i], "https://example.com/a/0000!") < 0;
+	     i++) ;
+	while (i < N && !present[i])
+		i++;
+	CUT_ASSERT_TRUE(btree_iter_next(&iter));
+	CUT_ASSERT_TRUE(iter.key == keys[i]);
+
+	/* Bulk load and persistence keep prefixes and heads too. */
+
+	btree_delete(t);
+	t = btree_create(NULL, NULL, NULL, NULL, NULL);
+	CUT_ASSERT_EQUAL(0, btree_set_string_keys(t));
+	CUT_ASSERT_EQUAL(0, btree_set_persistent(t));
+	CUT_ASSERT_EQUAL(0, btree_bulk_load(t, (void **)keys, NULL, N, 1.0));
+	for (i = 0; i < N; i++)
+		CUT_ASSERT_EQUAL(0, btree_insert(t, keys[i], KEY(i + 1)));
+	memset(present, 1, sizeof(present));
+
+	snap = btree_snapshot(t);
+	CUT_ASSERT_NOT_NULL(snap);
+	for (i = 0; i < N; i += 2) {
+		CUT_ASSERT_EQUAL(0, btree_remove(t, keys[i]));
+		present[i] = 0;
+	}
+
+	CUT_ASSERT_TRUE(check_strings(t, keys, present, N));
+	memset(present, 1, sizeof(present));
+	CUT_ASSERT_TRUE(check_strings(snap, keys, present, N));
+
+	btree_delete(snap);
+	btree_delete(t);
+	for (i = 0; i < N; i++)
+		free(keys[i]);
+
+	return 0;
+}
+
+/* Test rank, select and range counts against a model. */
+
+static int test12(void)
 {
-	void *mem;
+	enum { N = 900 };
+	static char present[N];
+	static unsigned long below[N + 1];	/* present keys < index */
+	struct btree *t = btree_create(NULL, NULL, NULL, NULL, NULL);
+	struct btree *snap = NULL;
+	struct btree_iter iter;
+	void *keys[N];
+	unsigned long r;
+	int i, k, round;
+
+	CUT_ASSERT_NOT_NULL(t);
+	CUT_ASSERT_EQUAL(0, btree_rank(t, KEY(5)));
+	btree_select(t, 0, &iter);
+	CUT_ASSERT_FALSE(btree_iter_next(&iter));
+
+	for (round = 0; round < 12; round++) {
+		/* Rounds 4 and 8 switch to a bulk loaded, persistent tree. */
+
+		if (round == 4 || round == 8) {
+			int nkeys = 0;
+
+			btree_delete(t);
+			t = btree_create(NULL, NULL, NULL, NULL, NULL);
+			if (round == 8)
+				btree_set_persistent(t);
+			for (k = 0; k < N; k++) {
+				if (present[k])
+					keys[nkeys++] = KEY(k);
+			}
+			CUT_ASSERT_EQUAL(0, btree_bulk_load(t, keys, keys, nkeys,
+							    0.7));
+		}
+
+		for (i = 0; i < 600; i++) {
+			k = (int)(next_rand() % N);
+			if (next_rand() % 2) {
+				btree_insert(t, KEY(k), KEY(k));
+				present[k] = 1;
+			} else {
+				btree_remove(t, KEY(k));
+				present[k] = 0;
+			}
+			if (round >= 8 && i % 100 == 0) {
+				if (snap != NULL)
+					btree_delete(snap);
+				snap = btree_snapshot(t);
+			}
+		}
+
+		for (k = 0; k < N; k++)
+			below[k + 1] = below[k] + present[k];
+
+		CUT_ASSERT_EQUAL(below[N], btree_count(t));
+
+		for (k = 0; k < N; k++)
+			CUT_ASSERT_EQUAL(below[k], btree_rank(t, KEY(k)));
+		CUT_ASSERT_EQUAL(below[N], btree_rank(t, KEY(N + 10)));
+
+		for (k = 0; k < N; k++) {
+			if (!present[k])
+				continue;
+			btree_select(t, below[k], &iter);
+			CUT_ASSERT_TRUE(btree_iter_next(&iter));
+			CUT_ASSERT_EQUAL(k, INT(iter.key));
+		}
+
+		btree_select(t, below[N], &iter);
+		CUT_ASSERT_FALSE(btree_iter_next(&iter));
+
+		for (i = 0; i < 200; i++) {
+			int a = (int)(next_rand() % N), b = (int)(next_rand() % N);
+			r = (a < b) ? below[b] - below[a] : 0;
+			CUT_ASSERT_EQUAL(r, btree_count_range(t, KEY(a), KEY(b)));
+		}
+	}
+
+	/* Selecting the median and walking on from it. */
+
+	btree_select(t, below[N] / 2, &iter);
+	for (r = below[N] / 2; btree_iter_next(&iter); r++)
+		CUT_ASSERT_EQUAL(r, below[INT(iter.key)]);
+	CUT_ASSERT_EQUAL(below[N], r);
+
+	if (snap != NULL)
+		btree_delete(snap);
+	btree_delete(t);
+
+	return 0;
+}
+
+/*
+ * Test btree_merge_sorted() and btree_delete_range() against a model,
+ * on a plain tree and on a persistent one whose snapshots must not
+ * see the changes.
+ */
+static int test13(void)
+{
+	enum { N = 3000, ROUNDS = 60 };
+	static char present[N], saved[N];
+	void *keys[N];
+	int mode;
+
+	for (mode = 0; mode < 2; mode++) {
+		struct btree *t = btree_create(NULL, NULL, NULL, NULL, NULL);
+		struct btree *snap = NULL;
+		int round, i, k;
+
+		CUT_ASSERT_NOT_NULL(t);
+		if (mode == 1)
+			CUT_ASSERT_EQUAL(0, btree_set_persistent(t));
+
+		memset(present, 0, sizeof(present));
+		CUT_ASSERT_EQUAL(0, btree_delete_range(t, KEY(0), KEY(N)));
+		CUT_ASSERT_EQUAL(0, btree_merge_sorted(t, keys, NULL, 0));
+
+		for (round = 0; round < ROUNDS; round++) {
+			int a = (int)(next_rand() % N), b = (int)(next_rand() % N);
+			int step = 1 + (int)(next_rand() % 8), nkeys = 0;
+			unsigned long expected = 0;
+
+			/* A batch of every step'th key from a to b. */
 
-	mem = malloc(10);
-	TEST_CHECK(mem != NULL);
+			for (k = (a < b) ? a : b; k < ((a < b) ? b : a); k += step)
+				keys[nkeys++] = KEY(k);
+			CUT_ASSERT_EQUAL(0, btree_merge_sorted(t, keys, keys,
+							       nkeys));
+			for (i = 0; i < nkeys; i++)
+				present[INT(keys[i])] = 1;
 
-	mem = realloc(mem, 20);
-	TEST_CHECK(mem != NULL);
+			if (nkeys > 1) {
+				keys[0] = keys[1];
+				CUT_ASSERT_EQUAL(1, btree_merge_sorted(t, keys, keys,
+								       nkeys));
+			}
 
-	free(mem);
+			for (k = 0; k < N; k++) {
+				if (present[k])
+					btree_insert(t, KEY(k), KEY(-k - 1));
+			}
+
+			if (mode == 1 && round % 10 == 0) {
+				if (snap != NULL) {
+					CUT_ASSERT_TRUE(check_direct(snap, saved, N));
+					btree_delete(snap);
+				}
+				snap = btree_snapshot(t);
+				memcpy(saved, present, N);
+			}
+
+			/* Remove a range, mostly a narrow one. */
+
+			a = (int)(next_rand() % N);
+			b = a + (int)(next_rand() % ((round % 3) ? 200 : N));
+			for (k = a; k < b && k < N; k++) {
+				expected += present[k];
+				present[k] = 0;
+			}
+			CUT_ASSERT_EQUAL(expected, btree_delete_range(t, KEY(a),
+								      KEY(b)));
+			CUT_ASSERT_EQUAL(0, btree_delete_range(t, KEY(b), KEY(a)));
+			CUT_ASSERT_TRUE(check_direct(t, present, N));
+
+			for (expected = 0, k = 0; k < N; k += 97) {
+				CUT_ASSERT_EQUAL(expected, btree_rank(t, KEY(k)));
+				for (i = k; i < k + 97 && i < N; i++)
+					expected += present[i];
+			}
+		}
+
+		CUT_ASSERT_EQUAL(btree_count(t),
+				 btree_delete_range(t, KEY(-1), KEY(N)));
+		CUT_ASSERT_EQUAL(0, btree_count(t));
+
+		if (snap != NULL) {
+			CUT_ASSERT_TRUE(check_direct(snap, saved, N));
+			btree_delete(snap);
+		}
+		btree_delete(t);
+	}
+
+	return 0;
 }
 
-void test_fail(void)
+/* Test merges and range deletes of string keys that the tree frees. */
+
+static int test14(void)
 {
-	int a, b;
+	enum { N = 2000 };
+	static char present[N];
+	char *names[N], *batch[N], buf[32];
+	void *vals[N];
+	int mode, i, k;
+
+	for (i = 0; i < N; i++) {
+		sprintf(buf, "item/%05d", i);
+		names[i] = strdup(buf);
+	}
+
+	for (mode = 0; mode < 2; mode++) {
+		struct btree *t = btree_create(btree_string_compare, free, free,
+					       NULL, NULL);
+		struct btree_iter iter;
+		int round;
+
+		CUT_ASSERT_NOT_NULL(t);
+		if (mode == 1)
+			CUT_ASSERT_EQUAL(0, btree_set_string_keys(t));
+
+		memset(present, 0, sizeof(present));
+
+		for (round = 0; round < 30; round++) {
+			int a = (int)(next_rand() % N);
+			int b = a + (int)(next_rand() % 400);
+			int step = 1 + (int)(next_rand() % 4), nkeys = 0;
+			unsigned long expected = 0;
+
+			/* A key already in the tree is kept, so free ours. */
+
+			for (k = a; k < b && k < N; k += step) {
+				batch[nkeys] = strdup(names[k]);
+				vals[nkeys++] = new_int(k * 10);
+			}
+			CUT_ASSERT_EQUAL(0, btree_merge_sorted(t, (void **)batch,
+							       vals, nkeys));
+			for (i = 0; i < nkeys; i++) {
+				k = atoi(batch[i] + 5);
+				if (present[k])
+					free(batch[i]);
+				present[k] = 1;
+			}
 
-	/* This condition is designed to fail so you can see its output. */
-	a = 1;
-	b = 2;
-	TEST_CHECK(a + b == 5);
+			a = (int)(next_rand() % N);
+			b = a + (int)(next_rand() % 300);
+			for (k = a; k < b && k < N; k++) {
+				expected += present[k];
+				present[k] = 0;
+			}
+			CUT_ASSERT_EQUAL(expected,
+					 btree_delete_range(t, names[a],
+							    (b < N) ? names[b] :
+							    "item/~"));
 
-	/* Also show TEST_CHECK_ in action */
-	TEST_CHECK_(a + b == 5, "%d + %d == 5", a, b);
+			btree_iter_init(t, &iter);
+			for (k = 0; btree_iter_next(&iter); k++) {
+				while (k < N && !present[k])
+					k++;
+				CUT_ASSERT_TRUE(k < N);
+				CUT_ASSERT_TRUE(STREQ(names[k], iter.key));
+				CUT_ASSERT_EQUAL(k * 10, *(int *)iter.val);
+			}
+			while (k < N && !present[k])
+				k++;
+			CUT_ASSERT_EQUAL(N, k);
+		}
+
+		btree_delete(t);
+	}
+
+	for (i = 0; i < N; i++)
+		free(names[i]);
+
+	return 0;
+}
+
+static int malloc_fails;
+
+static void *failing_malloc(size_t n)
+{
+	return malloc_fails ? NULL : malloc(n);
 }
 
-void test_crash(void)
+/*
+ * Test clearing a persistent tree repeatedly, with and without a
+ * snapshot sharing its root, including when no new root can be had.
+ */
+
+static int test15(void)
 {
-	int *invalid = ((int *)NULL) + 0xdeadbeef;
+	struct btree *t = btree_create(NULL, NULL, NULL, failing_malloc,
+				       NULL);
+	struct btree *s;
+	int i;
+
+	CUT_ASSERT_NOT_NULL(t);
+	CUT_ASSERT_EQUAL(0, btree_set_persistent(t));
+	btree_clear(t);
+	btree_clear(t);
+	CUT_ASSERT_EQUAL(0, btree_count(t));
+
+	for (i = 0; i < 1000; i++)
+		CUT_ASSERT_EQUAL(0, btree_insert(t, KEY(i), KEY(i + 1)));
+	s = btree_snapshot(t);
+	CUT_ASSERT_NOT_NULL(s);
+	btree_clear(t);
+	btree_clear(t);
+	CUT_ASSERT_EQUAL(0, btree_count(t));
+	CUT_ASSERT_EQUAL(1000, btree_count(s));
+	CUT_ASSERT_EQUAL(KEY(501), btree_lookup(s, KEY(500)));
+	CUT_ASSERT_EQUAL(0, btree_insert(t, KEY(7), KEY(8)));
+	CUT_ASSERT_EQUAL(KEY(8), btree_lookup(t, KEY(7)));
+
+	/* Out of memory: an unshared root is emptied in place... */
+
+	for (i = 0; i < 1000; i++)
+		CUT_ASSERT_EQUAL(0, btree_insert(s, KEY(i), KEY(i + 2)));
+	malloc_fails = 1;
+	btree_clear(s);
+	btree_clear(s);
+	malloc_fails = 0;
+	CUT_ASSERT_EQUAL(0, btree_count(s));
+	CUT_ASSERT_EQUAL(0, btree_insert(s, KEY(3), KEY(4)));
+	CUT_ASSERT_EQUAL(KEY(4), btree_lookup(s, KEY(3)));
+	btree_delete(s);
+
+	/* ...but a shared one is left alone. */
+
+	s = btree_snapshot(t);
+	CUT_ASSERT_NOT_NULL(s);
+	malloc_fails = 1;
+	for (i = 0; i < 8; i++)
+		btree_clear(t);
+	malloc_fails = 0;
+	CUT_ASSERT_EQUAL(KEY(8), btree_lookup(s, KEY(7)));
+	CUT_ASSERT_EQUAL(1, btree_count(s));
+	btree_clear(t);
+	CUT_ASSERT_EQUAL(0, btree_count(t));
+	CUT_ASSERT_EQUAL(KEY(8), btree_lookup(s, KEY(7)));
 
-	*invalid = 42;
-	TEST_CHECK_(1 == 1,
-		    "We likely never get here, due to the crash above.");
+	btree_delete(s);
+	btree_delete(t);
+	return 0;
 }
 
-TEST_LIST = { {
-"tutorial", test_tutorial}, {
-"fail", test_fail}, {
-"crash", test_crash}, {
-0, 0}};
+CUT_BEGIN_TEST_HARNESS CUT_RUN_TEST(test1);
+CUT_RUN_TEST(test2);
+CUT_RUN_TEST(test3);
+CUT_RUN_TEST(test4);
+CUT_RUN_TEST(test5);
+CUT_RUN_TEST(test6);
+CUT_RUN_TEST(test7);
+CUT_RUN_TEST(test8);
+CUT_RUN_TEST(test9);
+CUT_RUN_TEST(test10);
+CUT_RUN_TEST(test11);
+CUT_RUN_TEST(test12);
+CUT_RUN_TEST(test13);
+CUT_RUN_TEST(test14);
+CUT_RUN_TEST(test15);
+CUT_END_TEST_HARNESS
@@ -0,0 +1,352 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* test-cbtree.c - unit tests for cbtree */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "CUnitTest.h"
+
+#include <c-hacks/cbtree.h>
+#include <c-hacks/epoch.h>
+
+#define UNUSED_PARAMETER(X)	(void)(X)
+#define KEY(X)			((void *)(intptr_t)(X))
+
+/* Tiny PRNG so that runs are reproducible across libcs. */
+
+static unsigned int next_rand(unsigned int *state)
+{
+	*state = *state * 1103515245 + 12345;
+	return (*state >> 16) & 0x7fff;
+}
+
+static intptr_t *new_val(intptr_t k)
+{
+	intptr_t *p = malloc(sizeof(*p));
+	*p = k * 10;
+	return p;
+}
+
+struct scan {
+	intptr_t prev;
+	unsigned long n;
+	unsigned long nbad;
+};
+
+/* Checks that keys arrive in order with the value that belongs to them. */
+
+static int scan_check(intptr_t k, void *v, void *client_data)
+{
+	struct scan *s = client_data;
+
+	if (k <= s->prev || *(intptr_t *)v != k * 10)
+		s->nbad++;
+	s->prev = k;
+	s->n++;
+
+	return 1;
+}
+
+static int scan_last(intptr_t k, void *v, void *client_data)
+{
+	UNUSED_PARAMETER(v);
+	((struct scan *)client_data)->prev = k;
+	return 1;
+}
+
+static int scan_stop(intptr_t k, void *v, void *client_data)
+{
+	UNUSED_PARAMETER(v);
+	*(intptr_t *)client_data = k;
+	return k < 100;
+}
+
+/* Test basic operations on one thread. */
+
+static int test1(void)
+{
+	struct epoch *e = epoch_create(NULL, NULL);
+	struct epoch_thread *self = epoch_register(e);
+	struct cbtree *t = cbtree_create(e, NULL, NULL, NULL);
+	intptr_t i, last = 0;
+	struct scan s;
+
+	CUT_ASSERT_NOT_NULL(t);
+	CUT_ASSERT_EQUAL(0, cbtree_count(t));
+	CUT_ASSERT_NULL(cbtree_lookup(t, self, 1));
+	CUT_ASSERT_EQUAL(1, cbtree_remove(t, self, 1));
+
+	for (i = 0; i < 1000; i++)
+		CUT_ASSERT_EQUAL(0, cbtree_insert(t, self, (i * 7) % 1000,
+						  KEY(i)));
+	CUT_ASSERT_EQUAL(1000, cbtree_count(t));
+
+	for (i = 0; i < 1000; i++)
+		CUT_ASSERT_TRUE(cbtree_lookup(t, self, (i * 7) % 1000) ==
+				KEY(i));
+
+	/* Replace. */
+	CUT_ASSERT_EQUAL(0, cbtree_insert(t, self, 5, KEY(-5)));
+	CUT_ASSERT_TRUE(cbtree_lookup(t, self, 5) == KEY(-5));
+	CUT_ASSERT_EQUAL(1000, cbtree_count(t));
+
+	memset(&s, 0, sizeof(s));
+	s.prev = 989;
+	CUT_ASSERT_EQUAL(10, cbtree_range(t, self, 990, 2000, scan_last, &s));
+	CUT_ASSERT_EQUAL(999, s.prev);
+	CUT_ASSERT_EQUAL(101, cbtree_range(t, self, -10, 2000, scan_stop,
+					   &last));
+	CUT_ASSERT_EQUAL(100, last);
+	CUT_ASSERT_EQUAL(0, cbtree_range(t, self, 500, 500, scan_stop, &last));
+
+	/* Empty every leaf. */
+	for (i = 0; i < 1000; i++)
+		CUT_ASSERT_EQUAL(0, cbtree_remove(t, self, i));
+	CUT_ASSERT_EQUAL(0, cbtree_count(t));
+	CUT_ASSERT_EQUAL(1, cbtree_remove(t, self, 1));
+
+	memset(&s, 0, sizeof(s));
+	s.prev = -1;
+	CUT_ASSERT_EQUAL(0, cbtree_range(t, self, -10, 2000, scan_check, &s));
+
+	for (i = 0; i < 100; i++)
+		CUT_ASSERT_EQUAL(0, cbtree_insert(t, self, i, KEY(i + 1)));
+	for (i = 0; i < 100; i++)
+		CUT_ASSERT_TRUE(cbtree_lookup(t, self, i) == KEY(i + 1));
+
+	cbtree_delete(t);
+	epoch_unregister(self);
+	epoch_delete(e);
+
+	return 0;
+}
+
+/* Test random operations against a model, with values to free. */
+
+static int test2(void)
+{
+	enum { N = 3000, OPS = 30000 };
+	static char present[N];
+	struct epoch *e = epoch_create(NULL, NULL);
+	struct epoch_thread *self = epoch_register(e);
+	struct cbtree *t = cbtree_create(e, free, NULL, NULL);
+	unsigned int seed = 1;
+	unsigned long npresent = 0;
+	struct scan s;
+	int i;
+
+	CUT_ASSERT_NOT_NULL(t);
+	memset(present, 0, sizeof(present));
+
+	for (i = 0; i < OPS; i++) {
+		int k = (int)(next_rand(&seed) % N);
+
+		if (next_rand(&seed) % 3 != 0) {
+			CUT_ASSERT_EQUAL(0, cbtree_insert(t, self, k,
+							  new_val(k)));
+			npresent += !present[k];
+			present[k] = 1;
+		} else {
+			CUT_ASSERT_EQUAL((present[k] ? 0 : 1),
+					 cbtree_remove(t, self, k));
+			npresent -= present[k];
+			present[k] = 0;
+		}
+	}
+
+	CUT_ASSERT_EQUAL(npresent, cbtree_count(t));
+
+	for (i = 0; i < N; i++) {
+		intptr_t *v = cbtree_lookup(t, self, i);
+		if (present[i]) {
+			CUT_ASSERT_NOT_NULL(v);
+			CUT_ASSERT_EQUAL(i * 10, *v);
+		} else {
+			CUT_ASSERT_NULL(v);
+		}
+	}
+
+	memset(&s, 0, sizeof(s));
+	s.prev = -1;
+	CUT_ASSERT_EQUAL(npresent, cbtree_range(t, self, 0, N, scan_check,
+						&s));
+	CUT_ASSERT_EQUAL(0, s.nbad);
+
+	cbtree_delete(t);
+	epoch_unregister(self);
+	epoch_delete(e);
+
+	return 0;
+}
+
+#define NWRITERS	3
+#define NREADERS	2
+#define NKEYS		2000
+#define NOPS		20000
+
+struct worker {
+	pthread_t thread;
+	struct cbtree *t;
+	struct epoch *e;
+	int id;
+	char present[NKEYS];
+	unsigned long nbad;
+};
+
+static int writers_done;
+
+/* Writer i owns the keys that are i modulo NWRITERS. */
+
+static void *writer(void *arg)
+{
+	struct worker *w = arg;
+	struct epoch_thread *self = epoch_register(w->e);
+	unsigned int seed = w->id + 1;
+	int i;
+
+	for (i = 0; i < NOPS; i++) {
+		int k = (int)(next_rand(&seed) % (NKEYS / NWRITERS)) *
+		    NWRITERS + w->id;
+
+		if (next_rand(&seed) % 2 == 0) {
+			if (cbtree_insert(w->t, self, k, new_val(k)) != 0)
+				w->nbad++;
+			w->present[k] = 1;
+		} else {
+			if (cbtree_remove(w->t, self, k) != !w->present[k])
+				w->nbad++;
+			w->present[k] = 0;
+		}
+	}
+
+	epoch_unregister(self);
+	return NULL;
+}
+
+static void *reader(void *arg)
+{
+	struct worker *w = arg;
+	struct epoch_thread *self = epoch_register(w->e);
+	unsigned int seed = w->id + 1;
+	struct scan s;
+
+	while (!__atomic_load_n(&writers_done, __ATOMIC_ACQUIRE)) {
+		intptr_t lo = next_rand(&seed) % NKEYS;
+		intptr_t *v;
+
+		memset(&s, 0, sizeof(s));
+		s.prev = lo - 1;
+		cbtree_range(w->t, self, lo, lo + 100, scan_check, &s);
+		w->nbad += s.nbad;
+
+		epoch_enter(self);
+		if ((v = cbtree_lookup(w->t, self, lo)) != NULL && *v != lo * 10)
+			w->nbad++;
+		epoch_leave(self);
+	}
+
+	epoch_unregister(self);
+	return NULL;
+}
+
+/* Test concurrent writers on disjoint keys with readers scanning. */
+
+static int test3(void)
+{
+	static struct worker writers[NWRITERS], readers[NREADERS];
+	struct epoch *e = epoch_create(NULL, NULL);
+	struct epoch_thread *self = epoch_register(e);
+	struct cbtree *t = cbtree_create(e, free, NULL, NULL);
+	unsigned long npresent = 0;
+	struct scan s;
+	int i, k;
+
+	CUT_ASSERT_NOT_NULL(t);
+	writers_done = 0;
+
+	for (i = 0; i < NREADERS; i++) {
+		memset(&readers[i], 0, sizeof(readers[i]));
+		readers[i].t = t;
+		readers[i].e = e;
+		readers[i].id = i;
+		CUT_ASSERT_EQUAL(0, pthread_create(&readers[i].thread, NULL,
+						   reader, &readers[i]));
+	}
+
+	for (i = 0; i < NWRITERS; i++) {
+		memset(&writers[i], 0, sizeof(writers[i]));
+		writers[i].t = t;
+		writers[i].e = e;
+		writers[i].id = i;
+		CUT_ASSERT_EQUAL(0, pthread_create(&writers[i].thread, NULL,
+						   writer, &writers[i]));
+	}
+
+	for (i = 0; i < NWRITERS; i++)
+		pthread_join(writers[i].thread, NULL);
+
+	__atomic_store_n(&writers_done, 1, __ATOMIC_RELEASE);
+
+	for (i = 0; i < NREADERS; i++) {
+		pthread_join(readers[i].thread, NULL);
+		CUT_ASSERT_EQUAL(0, readers[i].nbad);
+	}
+
+	for (i = 0; i < NWRITERS; i++) {
+		CUT_ASSERT_EQUAL(0, writers[i].nbad);
+		for (k = i; k < NKEYS; k += NWRITERS) {
+			npresent += writers[i].present[k];
+			CUT_ASSERT_EQUAL(writers[i].present[k],
+					 (cbtree_lookup(t, self, k) != NULL));
+		}
+	}
+
+	CUT_ASSERT_EQUAL(npresent, cbtree_count(t));
+
+	memset(&s, 0, sizeof(s));
+	s.prev = -1;
+	CUT_ASSERT_EQUAL(npresent, cbtree_range(t, self, 0, NKEYS, scan_check,
+						&s));
+	CUT_ASSERT_EQUAL(0, s.nbad);
+
+	cbtree_delete(t);
+	epoch_unregister(self);
+	epoch_delete(e);
+
+	return 0;
+}
+
+CUT_BEGIN_TEST_HARNESS CUT_RUN_TEST(test1);
+CUT_RUN_TEST(test2);
+CUT_RUN_TEST(test3);
+CUT_END_TEST_HARNESS
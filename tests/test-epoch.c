@@ -0,0 +1,386 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* test-epoch.c - unit tests for epoch */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include "CUnitTest.h"
+
+#include <c-hacks/epoch.h>
+
+static int nfreed;
+
+static void count_free(void *p)
+{
+	nfreed++;
+	free(p);
+}
+
+/* Reclaims until nothing more can be freed. */
+
+static void drain(struct epoch_thread *th)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		epoch_reclaim(th);
+}
+
+/* Test that retired pointers are freed once nobody can see them. */
+
+static int test1(void)
+{
+	struct epoch *e = epoch_create(NULL, NULL);
+	struct epoch_thread *a, *b;
+	int i;
+
+	CUT_ASSERT_NOT_NULL(e);
+	a = epoch_register(e);
+	CUT_ASSERT_NOT_NULL(a);
+	b = epoch_register(e);
+	CUT_ASSERT_NOT_NULL(b);
+	CUT_ASSERT_TRUE(a != b);
+
+	nfreed = 0;
+
+	epoch_enter(b);
+	epoch_enter(b);		/* nested */
+	epoch_leave(b);
+
+	/* b is still inside: at most one epoch can pass. */
+
+	for (i = 0; i < 10; i++)
+		CUT_ASSERT_EQUAL(0, epoch_retire(a, malloc(16), count_free));
+	drain(a);
+	CUT_ASSERT_EQUAL(0, nfreed);
+
+	epoch_leave(b);
+	drain(a);
+	CUT_ASSERT_EQUAL(10, nfreed);
+
+	/* Batches reclaim without an explicit call. */
+
+	for (i = 0; i < 1000; i++)
+		CUT_ASSERT_EQUAL(0, epoch_retire(a, malloc(16), count_free));
+	CUT_ASSERT_TRUE(nfreed > 10);
+
+	epoch_unregister(a);
+	epoch_unregister(b);
+	epoch_delete(e);
+	CUT_ASSERT_EQUAL(1010, nfreed);
+
+	return 0;
+}
+
+/* Test that pointers left behind by a thread are not lost. */
+
+static int test2(void)
+{
+	struct epoch *e = epoch_create(malloc, free);
+	struct epoch_thread *a, *b, *c;
+
+	CUT_ASSERT_NOT_NULL(e);
+	a = epoch_register(e);
+	CUT_ASSERT_NOT_NULL(a);
+	b = epoch_register(e);
+	CUT_ASSERT_NOT_NULL(b);
+
+	nfreed = 0;
+
+	epoch_enter(b);
+	CUT_ASSERT_EQUAL(0, epoch_retire(a, malloc(16), count_free));
+	epoch_unregister(a);
+	CUT_ASSERT_EQUAL(0, nfreed);
+
+	/* The record is reused. */
+	c = epoch_register(e);
+	CUT_ASSERT_TRUE(c == a);
+
+	epoch_leave(b);
+	drain(b);
+	CUT_ASSERT_EQUAL(1, nfreed);
+
+	CUT_ASSERT_EQUAL(0, epoch_retire(c, malloc(16), count_free));
+	epoch_delete(e);
+	CUT_ASSERT_EQUAL(2, nfreed);
+
+	return 0;
+}
+
+/* Test reclamation with a thread in the quiescent-state style. */
+
+static int test3(void)
+{
+	struct epoch *e = epoch_create(NULL, NULL);
+	struct epoch_thread *a, *b;
+	int i;
+
+	CUT_ASSERT_NOT_NULL(e);
+	a = epoch_register(e);
+	CUT_ASSERT_NOT_NULL(a);
+	b = epoch_register(e);
+	CUT_ASSERT_NOT_NULL(b);
+
+	nfreed = 0;
+
+	/* b is online and never passes through another quiescent state. */
+
+	epoch_quiescent(b);
+	for (i = 0; i < 10; i++)
+		CUT_ASSERT_EQUAL(0, epoch_retire(a, malloc(16), count_free));
+	drain(a);
+	CUT_ASSERT_EQUAL(0, nfreed);
+
+	/* Each quiescent state lets the epoch move on by one. */
+
+	for (i = 0; i < 4; i++) {
+		epoch_quiescent(b);
+		epoch_reclaim(a);
+	}
+	CUT_ASSERT_EQUAL(10, nfreed);
+
+	/* An offline thread holds nothing up. */
+
+	for (i = 0; i < 10; i++)
+		CUT_ASSERT_EQUAL(0, epoch_retire(a, malloc(16), count_free));
+	epoch_offline(b);
+	drain(a);
+	CUT_ASSERT_EQUAL(20, nfreed);
+
+	/* Nor does a thread that has left a critical section. */
+
+	epoch_quiescent(b);
+	epoch_enter(b);
+	epoch_leave(b);
+	for (i = 0; i < 10; i++)
+		CUT_ASSERT_EQUAL(0, epoch_retire(a, malloc(16), count_free));
+	drain(a);
+	CUT_ASSERT_EQUAL(30, nfreed);
+
+	epoch_unregister(a);
+	epoch_unregister(b);
+	epoch_delete(e);
+
+	return 0;
+}
+
+#define NSLOTS		16
+#define NREADERS	4
+#define NWRITERS	2
+#define NREADS		100000
+#define NWRITES		20000
+#define MAGIC		0x5eed
+
+struct node {
+	int magic;
+	int value;
+};
+
+static _Atomic(struct node *) slots[NSLOTS];
+static atomic_long nnodes_freed;
+static atomic_int nwriters_done;
+
+/*
+ * Scribbles on the node before freeing it: a reader still looking at
+ * it sees the wrong magic, and ThreadSanitizer sees a race.
+ */
+static void node_free(void *p)
+{
+	struct node *n = p;
+
+	n->magic = 0;
+	free(n);
+	atomic_fetch_add(&nnodes_freed, 1);
+}
+
+static struct node *node_new(int slot, int gen)
+{
+	struct node *n = malloc(sizeof(*n));
+
+	if (n != NULL) {
+		n->magic = MAGIC;
+		n->value = gen * NSLOTS + slot;
+	}
+
+	return n;
+}
+
+struct stress {
+	pthread_t thread;
+	struct epoch *e;
+	int id;
+	int qsbr;
+	int ok;
+};
+
+static int check_slot(unsigned int s)
+{
+	struct node *n = atomic_load_explicit(&slots[s],
+					      memory_order_acquire);
+
+	return n->magic == MAGIC && (unsigned int)n->value % NSLOTS == s;
+}
+
+static void *reader_main(void *arg)
+{
+	struct stress *st = arg;
+	struct epoch_thread *self = epoch_register(st->e);
+	unsigned int seed = (unsigned int)st->id;
+	int i;
+
+	st->ok = (self != NULL);
+	if (self == NULL)
+		return NULL;
+
+	/* Keep reading until the writers are done. */
+
+	for (i = 0; i < NREADS || atomic_load(&nwriters_done) < NWRITERS;
+	     i++) {
+		seed = seed * 1103515245 + 12345;
+
+		if (st->qsbr) {
+			if (!check_slot((seed >> 16) % NSLOTS))
+				st->ok = 0;
+			epoch_quiescent(self);
+			if (i % 1000 == 999)
+				epoch_offline(self);
+		} else {
+			epoch_enter(self);
+			if (!check_slot((seed >> 16) % NSLOTS))
+				st->ok = 0;
+			epoch_leave(self);
+		}
+
+		/* Interleave with the writers even on one CPU. */
+		if (i % 64 == 0)
+			sched_yield();
+	}
+
+	epoch_unregister(self);
+
+	return NULL;
+}
+
+static void *writer_main(void *arg)
+{
+	struct stress *st = arg;
+	struct epoch_thread *self = epoch_register(st->e);
+	int i;
+
+	st->ok = (self != NULL);
+	if (self == NULL)
+		return NULL;
+
+	for (i = 0; i < NWRITES; i++) {
+		int s = (i * NWRITERS + st->id) % NSLOTS;
+		struct node *n = node_new(s, i + 1);
+
+		if (n == NULL) {
+			st->ok = 0;
+			break;
+		}
+
+		n = atomic_exchange_explicit(&slots[s], n,
+					     memory_order_acq_rel);
+		if (epoch_retire(self, n, node_free) != 0)
+			node_free(n);
+
+		if (i % 16 == 0)
+			sched_yield();
+	}
+
+	epoch_unregister(self);
+	atomic_fetch_add(&nwriters_done, 1);
+
+	return NULL;
+}
+
+/*
+ * Stress test: readers in both styles check nodes while writers
+ * replace and retire them.  Meant to be run under ThreadSanitizer
+ * too (cmake -DBUILD_TSAN=ON).
+ */
+static int test4(void)
+{
+	struct stress readers[NREADERS], writers[NWRITERS];
+	struct epoch *e = epoch_create(NULL, NULL);
+	int i;
+
+	CUT_ASSERT_NOT_NULL(e);
+	atomic_store(&nnodes_freed, 0);
+	atomic_store(&nwriters_done, 0);
+
+	for (i = 0; i < NSLOTS; i++)
+		atomic_store(&slots[i], node_new(i, 0));
+
+	for (i = 0; i < NREADERS; i++) {
+		readers[i].e = e;
+		readers[i].id = i + 1;
+		readers[i].qsbr = i % 2;
+		CUT_ASSERT_EQUAL(0, pthread_create(&readers[i].thread, NULL,
+						   reader_main, &readers[i]));
+	}
+
+	for (i = 0; i < NWRITERS; i++) {
+		writers[i].e = e;
+		writers[i].id = i;
+		CUT_ASSERT_EQUAL(0, pthread_create(&writers[i].thread, NULL,
+						   writer_main, &writers[i]));
+	}
+
+	for (i = 0; i < NREADERS; i++) {
+		pthread_join(readers[i].thread, NULL);
+		CUT_ASSERT_TRUE(readers[i].ok);
+	}
+
+	for (i = 0; i < NWRITERS; i++) {
+		pthread_join(writers[i].thread, NULL);
+		CUT_ASSERT_TRUE(writers[i].ok);
+	}
+
+	for (i = 0; i < NSLOTS; i++)
+		node_free(atomic_load(&slots[i]));
+
+	epoch_delete(e);
+	CUT_ASSERT_EQUAL(NSLOTS + NWRITERS * NWRITES,
+			 atomic_load(&nnodes_freed));
+
+	return 0;
+}
+
+CUT_BEGIN_TEST_HARNESS CUT_RUN_TEST(test1);
+CUT_RUN_TEST(test2);
+CUT_RUN_TEST(test3);
+CUT_RUN_TEST(test4);
+CUT_END_TEST_HARNESS
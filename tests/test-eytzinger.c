@@ -0,0 +1,148 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* test-eytzinger.c - unit tests for eytzinger */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "CUnitTest.h"
+
+#include <c-hacks/btree.h>
+#include <c-hacks/btree-funcs.h>
+#include <c-hacks/eytzinger.h>
+
+#define KEY(X)			((void *)(intptr_t)(X))
+#define INT(X)			((int)(intptr_t)(X))
+
+/* Test every size up to N, so that every shape of last level is seen. */
+
+static int test1(void)
+{
+	enum { N = 300 };
+	void *keys[N], *vals[N], *key, *val;
+	struct eytzinger *e;
+	int n, i;
+
+	for (i = 0; i < N; i++) {
+		keys[i] = KEY(2 * i - 100);	/* odd keys are absent */
+		vals[i] = KEY(i + 1);
+	}
+
+	for (n = 0; n <= N; n++) {
+		e = eytzinger_create(NULL, keys, vals, n, NULL, NULL);
+		CUT_ASSERT_NOT_NULL(e);
+		CUT_ASSERT_EQUAL(n, eytzinger_count(e));
+
+		for (i = -1; i <= 2 * n; i++) {
+			int k = i - 100;
+			void *expect = (k % 2 == 0 && i >= 0 && i < 2 * n)
+			    ? KEY(i / 2 + 1) : NULL;
+			CUT_ASSERT_TRUE(eytzinger_lookup(e, KEY(k)) == expect);
+
+			/* The lower bound of k is the next even key. */
+
+			if (i + (i & 1) >= 2 * n) {
+				CUT_ASSERT_EQUAL(1, eytzinger_lower_bound(e, KEY(k),
+									  &key,
+									  &val));
+			} else {
+				CUT_ASSERT_EQUAL(0, eytzinger_lower_bound(e, KEY(k),
+									  &key,
+									  &val));
+				CUT_ASSERT_EQUAL(k + (i & 1), INT(key));
+				CUT_ASSERT_EQUAL((i + 1) / 2 + 1, INT(val));
+			}
+		}
+
+		eytzinger_delete(e);
+	}
+
+	/* Keys out of order, or repeated, are rejected. */
+
+	keys[5] = keys[4];
+	CUT_ASSERT_NULL(eytzinger_create(NULL, keys, vals, N, NULL, NULL));
+	keys[5] = KEY(-1000);
+	CUT_ASSERT_NULL(eytzinger_create(NULL, keys, vals, N, NULL, NULL));
+
+	return 0;
+}
+
+/* Test string keys built from a btree. */
+
+static int test2(void)
+{
+	enum { N = 1000 };
+	struct btree *t = btree_create(btree_string_compare, free, NULL, NULL,
+				       NULL);
+	struct eytzinger *e;
+	char buf[32], *key;
+	int i;
+
+	CUT_ASSERT_NOT_NULL(t);
+
+	/* "k0000", "k0002", ... in a scrambled order. */
+
+	for (i = 0; i < N; i++) {
+		sprintf(buf, "k%04d", ((i * 7919) % N) * 2);
+		CUT_ASSERT_EQUAL(0, btree_insert(t, strdup(buf), KEY(i + 1)));
+	}
+
+	e = eytzinger_create_from_btree(t, btree_string_compare, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(e);
+	CUT_ASSERT_EQUAL(N, eytzinger_count(e));
+
+	for (i = 0; i < 2 * N; i++) {
+		sprintf(buf, "k%04d", i);
+		if (i % 2 == 0) {
+			CUT_ASSERT_TRUE(eytzinger_lookup(e, buf) ==
+					btree_lookup(t, buf));
+			CUT_ASSERT_NOT_NULL(eytzinger_lookup(e, buf));
+		} else {
+			CUT_ASSERT_NULL(eytzinger_lookup(e, buf));
+		}
+	}
+
+	CUT_ASSERT_EQUAL(0, eytzinger_lower_bound(e, "k0001", (void **)&key,
+						  NULL));
+	CUT_ASSERT_TRUE(strcmp(key, "k0002") == 0);
+	CUT_ASSERT_EQUAL(0, eytzinger_lower_bound(e, "", (void **)&key, NULL));
+	CUT_ASSERT_TRUE(strcmp(key, "k0000") == 0);
+	CUT_ASSERT_EQUAL(1, eytzinger_lower_bound(e, "k1999", NULL, NULL));
+
+	eytzinger_delete(e);
+	btree_delete(t);
+
+	return 0;
+}
+
+CUT_BEGIN_TEST_HARNESS CUT_RUN_TEST(test1);
+CUT_RUN_TEST(test2);
+CUT_END_TEST_HARNESS
@@ -0,0 +1,224 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* test-flatmap.c - unit tests for flatmap */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "CUnitTest.h"
+
+#include <c-hacks/btree-funcs.h>
+#include <c-hacks/flatmap.h>
+
+#define KEY(X)			((void *)(intptr_t)(X))
+#define INT(X)			((int)(intptr_t)(X))
+
+static unsigned int next_rand(unsigned int *state)
+{
+	*state = *state * 1103515245 + 12345;
+	return (*state >> 16) & 0x7fff;
+}
+
+static int nvals, nfreed;
+
+static void val_free(void *v)
+{
+	nfreed++;
+	free(v);
+}
+
+/*
+ * Test integer keys against a model while the map grows from empty to
+ * several hundred entries and shrinks again.
+ */
+static int test1(void)
+{
+	enum { N = 300, OPS = 20000 };
+	static int model[N];	/* value + 1, or 0 if absent */
+	struct flatmap *m = flatmap_create(NULL, NULL, NULL, NULL, NULL);
+	struct flatmap_iter iter;
+	unsigned int seed = 1;
+	size_t count = 0;
+	int i, k;
+
+	CUT_ASSERT_NOT_NULL(m);
+	CUT_ASSERT_NULL(flatmap_lookup(m, KEY(0)));
+	CUT_ASSERT_EQUAL(1, flatmap_remove(m, KEY(0)));
+
+	for (i = 0; i < OPS; i++) {
+		/* Negative keys too: they compare as signed. */
+		k = (int)(next_rand(&seed) % N);
+
+		if (next_rand(&seed) % 2 == (unsigned)(i / 5000) % 2) {
+			CUT_ASSERT_EQUAL(0, flatmap_insert(m, KEY(k - N / 2),
+							   KEY(i + 1)));
+			count += (model[k] == 0);
+			model[k] = i + 1;
+		} else {
+			CUT_ASSERT_EQUAL((model[k] ? 0 : 1),
+					 flatmap_remove(m, KEY(k - N / 2)));
+			count -= (model[k] != 0);
+			model[k] = 0;
+		}
+
+		if (i % 97 != 0)
+			continue;
+
+		CUT_ASSERT_EQUAL(count, flatmap_count(m));
+
+		for (k = 0; k < N; k++) {
+			CUT_ASSERT_EQUAL(model[k],
+					 INT(flatmap_lookup(m, KEY(k - N / 2))));
+		}
+
+		flatmap_iter_init(m, &iter);
+		for (k = 0; k < N; k++) {
+			if (model[k] == 0)
+				continue;
+			CUT_ASSERT_EQUAL(1, flatmap_iter_next(&iter));
+			CUT_ASSERT_EQUAL(k - N / 2, INT(iter.key));
+		}
+		CUT_ASSERT_EQUAL(0, flatmap_iter_next(&iter));
+	}
+
+	/* Lower bounds, including past either end. */
+
+	for (k = -1; k <= N; k++) {
+		int expect;
+
+		for (expect = (k < 0) ? 0 : k; expect < N && !model[expect];
+		     expect++) ;
+
+		flatmap_lower_bound(m, KEY(k - N / 2), &iter);
+		if (expect == N) {
+			CUT_ASSERT_EQUAL(0, flatmap_iter_next(&iter));
+		} else {
+			CUT_ASSERT_EQUAL(1, flatmap_iter_next(&iter));
+			CUT_ASSERT_EQUAL(expect - N / 2, INT(iter.key));
+		}
+	}
+
+	flatmap_clear(m);
+	CUT_ASSERT_EQUAL(0, flatmap_count(m));
+	CUT_ASSERT_EQUAL(0, flatmap_insert(m, KEY(1), KEY(2)));
+	CUT_ASSERT_EQUAL(2, INT(flatmap_lookup(m, KEY(1))));
+	flatmap_delete(m);
+
+	return 0;
+}
+
+static int *new_val(int x)
+{
+	int *p = malloc(sizeof(*p));
+	*p = x;
+	nvals++;
+	return p;
+}
+
+/* Test batch inserts of string keys, with values to free. */
+
+static int test2(void)
+{
+	enum { N = 500, NBATCH = 4 };
+	struct flatmap *m = flatmap_create(btree_string_compare, free,
+					   val_free, NULL, NULL);
+	struct flatmap *model = flatmap_create(btree_string_compare, free,
+					       val_free, NULL, NULL);
+	static void *keys[N], *vals[N];
+	struct flatmap_iter iter, miter;
+	unsigned int seed = 1;
+	char buf[32];
+	int i, b, *v;
+
+	CUT_ASSERT_NOT_NULL(m);
+	CUT_ASSERT_NOT_NULL(model);
+	CUT_ASSERT_EQUAL(0, flatmap_insert_batch(m, keys, vals, 0));
+
+	/*
+	 * Each batch repeats keys, within itself and from earlier
+	 * batches.  The model takes the same keys one at a time.
+	 */
+	for (b = 0; b < NBATCH; b++) {
+		for (i = 0; i < N; i++) {
+			sprintf(buf, "k%05u", next_rand(&seed) % (2 * N));
+			keys[i] = strdup(buf);
+			vals[i] = new_val(b * N + i);
+			if (flatmap_lookup(model, buf) != NULL)
+				flatmap_insert(model, keys[i], new_val(b * N + i));
+			else
+				flatmap_insert(model, strdup(buf),
+					       new_val(b * N + i));
+		}
+
+		CUT_ASSERT_EQUAL(0, flatmap_insert_batch(m, keys, vals, N));
+
+		/* Keys the map didn't keep are the caller's to free. */
+
+		for (i = 0; i < N; i++) {
+			void *key;
+
+			flatmap_lower_bound(m, keys[i], &iter);
+			flatmap_iter_next(&iter);
+			key = iter.key;
+			if (key != keys[i])
+				free(keys[i]);
+		}
+
+		CUT_ASSERT_EQUAL(flatmap_count(model), flatmap_count(m));
+
+		flatmap_iter_init(m, &iter);
+		flatmap_iter_init(model, &miter);
+		while (flatmap_iter_next(&miter)) {
+			CUT_ASSERT_EQUAL(1, flatmap_iter_next(&iter));
+			CUT_ASSERT_TRUE(strcmp(iter.key, miter.key) == 0);
+			CUT_ASSERT_EQUAL(*(int *)miter.val, *(int *)iter.val);
+		}
+		CUT_ASSERT_EQUAL(0, flatmap_iter_next(&iter));
+	}
+
+	/* Every value was freed once, whether overwritten or not. */
+
+	for (i = 0; i < 2 * N; i += 2) {
+		sprintf(buf, "k%05d", i);
+		v = flatmap_lookup(model, buf);
+		CUT_ASSERT_EQUAL((v != NULL ? 0 : 1), flatmap_remove(m, buf));
+	}
+
+	flatmap_delete(model);
+	flatmap_delete(m);
+	CUT_ASSERT_EQUAL(nvals, nfreed);
+
+	return 0;
+}
+
+CUT_BEGIN_TEST_HARNESS CUT_RUN_TEST(test1);
+CUT_RUN_TEST(test2);
+CUT_END_TEST_HARNESS
@@ -0,0 +1,449 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* test-hashtbl-feed.c - unit tests for hashtbl_feed */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "CUnitTest.h"
+
+#include <c-hacks/hashtbl.h>
+#include <c-hacks/hashtbl-funcs.h>
+#include <c-hacks/hashtbl-feed.h>
+
+#define STREQ(A,B)		strcmp((A), (B)) == 0
+
+#define HASHTBL_STRING(name)						\
+	struct hashtbl *name = hashtbl_create(64, 0.75f, 1,		\
+					      hashtbl_string_hash,	\
+					      hashtbl_string_equals,	\
+					      free, free,		\
+					      malloc, free)
+
+static size_t string_encode(const void *obj, void *buf, size_t len)
+{
+	size_t n = strlen(obj);
+
+	if (n <= len)
+		memcpy(buf, obj, n);
+	return n;
+}
+
+static int string_decode(const void *buf, size_t len, void **obj)
+{
+	char *s = malloc(len + 1);
+
+	if (s == NULL)
+		return 1;
+	memcpy(s, buf, len);
+	s[len] = '\0';
+	*obj = s;
+	return 0;
+}
+
+static struct hashtbl_feed_applier *string_applier(struct hashtbl *h)
+{
+	return hashtbl_feed_applier_create(h, 1, string_decode, string_decode,
+					   free, free, NULL, NULL);
+}
+
+static int insert_int_string(struct hashtbl *h, int k, int v)
+{
+	char buf[64];
+	char *ks, *vs;
+
+	sprintf(buf, "%d", k);
+	ks = strdup(buf);
+	sprintf(buf, "%d", v);
+	vs = strdup(buf);
+	return hashtbl_insert(h, ks, vs);
+}
+
+static int remove_int_string(struct hashtbl *h, int k)
+{
+	char buf[64];
+
+	sprintf(buf, "%d", k);
+	return hashtbl_remove(h, buf);
+}
+
+/* Returns 1 if both tables hold identical string keys and values. */
+
+static int tables_equal(struct hashtbl *a, struct hashtbl *b)
+{
+	struct hashtbl_iter iter;
+
+	if (hashtbl_count(a) != hashtbl_count(b))
+		return 0;
+
+	hashtbl_iter_init(a, &iter);
+
+	while (hashtbl_iter_next(a, &iter)) {
+		char *v = hashtbl_lookup(b, iter.key);
+		if (v == NULL || !STREQ(v, (char *)iter.val))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Test observer notifications. */
+
+static int observer_counts[4];
+
+static void count_observer(const struct hashtbl *h, enum hashtbl_op op,
+			   const void *key, const void *val, void *client_data)
+{
+	(void)h;
+	(void)key;
+	(void)val;
+	if (client_data == observer_counts)
+		observer_counts[op]++;
+}
+
+static int test1(void)
+{
+	HASHTBL_STRING(h);
+	CUT_ASSERT_NOT_NULL(h);
+	memset(observer_counts, 0, sizeof(observer_counts));
+	hashtbl_set_observer(h, count_observer, observer_counts);
+	CUT_ASSERT_EQUAL(0, insert_int_string(h, 1, 1));
+	CUT_ASSERT_EQUAL(0, insert_int_string(h, 2, 2));
+	CUT_ASSERT_EQUAL(0, remove_int_string(h, 1));
+	CUT_ASSERT_EQUAL(1, remove_int_string(h, 1));
+	hashtbl_clear(h);
+	CUT_ASSERT_EQUAL(2, observer_counts[HASHTBL_OP_INSERT]);
+	CUT_ASSERT_EQUAL(1, observer_counts[HASHTBL_OP_REMOVE]);
+	CUT_ASSERT_EQUAL(1, observer_counts[HASHTBL_OP_CLEAR]);
+	hashtbl_set_observer(h, NULL, NULL);
+	CUT_ASSERT_EQUAL(0, insert_int_string(h, 3, 3));
+	CUT_ASSERT_EQUAL(2, observer_counts[HASHTBL_OP_INSERT]);
+	hashtbl_delete(h);
+	return 0;
+}
+
+/* Test replication through an in-memory buffer, a byte at a time. */
+
+static int test2(void)
+{
+	int i;
+	unsigned char buf[1];
+	long n, total = 0;
+	HASHTBL_STRING(leader);
+	HASHTBL_STRING(follower);
+	struct hashtbl_feed *feed;
+	struct hashtbl_feed_applier *applier;
+
+	feed = hashtbl_feed_create(leader, 1 << 16, string_encode,
+				   string_encode, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(feed);
+	applier = string_applier(follower);
+	CUT_ASSERT_NOT_NULL(applier);
+
+	for (i = 0; i < 100; i++)
+		CUT_ASSERT_EQUAL(0, insert_int_string(leader, i, i));
+	for (i = 0; i < 100; i += 3)
+		CUT_ASSERT_EQUAL(0, remove_int_string(leader, i));
+	for (i = 0; i < 100; i += 5) {
+		(void)remove_int_string(leader, i);
+		CUT_ASSERT_EQUAL(0, insert_int_string(leader, i, i * 2));
+	}
+
+	CUT_ASSERT_TRUE(hashtbl_feed_pending(feed) > 0);
+
+	while (hashtbl_feed_read(feed, buf, sizeof(buf)) == sizeof(buf)) {
+		n = hashtbl_feed_apply(applier, buf, sizeof(buf));
+		CUT_ASSERT_TRUE(n >= 0);
+		total += n;
+	}
+
+	CUT_ASSERT_EQUAL(0, hashtbl_feed_pending(feed));
+	CUT_ASSERT_EQUAL(hashtbl_feed_seqno(feed), total);
+	CUT_ASSERT_EQUAL(hashtbl_feed_seqno(feed) + 1,
+			 hashtbl_feed_applier_seqno(applier));
+	CUT_ASSERT_TRUE(tables_equal(leader, follower));
+	CUT_ASSERT_TRUE(tables_equal(follower, leader));
+
+	hashtbl_feed_applier_delete(applier);
+	hashtbl_feed_delete(feed);
+	hashtbl_delete(leader);
+	hashtbl_delete(follower);
+	return 0;
+}
+
+/* Test replication over a pipe, including clear. */
+
+static int test3(void)
+{
+	int i, fds[2];
+	unsigned long napplied, total = 0;
+	HASHTBL_STRING(leader);
+	HASHTBL_STRING(follower);
+	struct hashtbl_feed *feed;
+	struct hashtbl_feed_applier *applier;
+
+	CUT_ASSERT_EQUAL(0, pipe(fds));
+	feed = hashtbl_feed_create(leader, 1 << 12, string_encode,
+				   string_encode, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(feed);
+	applier = string_applier(follower);
+	CUT_ASSERT_NOT_NULL(applier);
+
+	for (i = 0; i < 50; i++)
+		CUT_ASSERT_EQUAL(0, insert_int_string(leader, i, i));
+	hashtbl_clear(leader);
+	for (i = 100; i < 150; i++)
+		CUT_ASSERT_EQUAL(0, insert_int_string(leader, i, i));
+
+	CUT_ASSERT_EQUAL(0, hashtbl_feed_flush(feed, fds[1]));
+	CUT_ASSERT_EQUAL(0, hashtbl_feed_pending(feed));
+	close(fds[1]);
+
+	while (hashtbl_feed_apply_fd(applier, fds[0], &napplied) > 0)
+		total += napplied;
+
+	close(fds[0]);
+	CUT_ASSERT_EQUAL(101, total);
+	CUT_ASSERT_EQUAL(50, hashtbl_count(follower));
+	CUT_ASSERT_TRUE(tables_equal(leader, follower));
+
+	hashtbl_feed_applier_delete(applier);
+	hashtbl_feed_delete(feed);
+	hashtbl_delete(leader);
+	hashtbl_delete(follower);
+	return 0;
+}
+
+/* Test ring overflow and resync after reset. */
+
+static int test4(void)
+{
+	int i;
+	unsigned char buf[256];
+	size_t n;
+	HASHTBL_STRING(leader);
+	HASHTBL_STRING(follower);
+	struct hashtbl_feed *feed;
+	struct hashtbl_feed_applier *applier;
+
+	feed = hashtbl_feed_create(leader, 64, string_encode, string_encode,
+				   NULL, NULL);
+	CUT_ASSERT_NOT_NULL(feed);
+	CUT_ASSERT_NULL(hashtbl_feed_create(leader, 100, string_encode,
+					    string_encode, NULL, NULL));
+
+	for (i = 0; i < 100; i++)
+		CUT_ASSERT_EQUAL(0, insert_int_string(leader, i, i));
+
+	CUT_ASSERT_TRUE(hashtbl_feed_overflowed(feed));
+	CUT_ASSERT_EQUAL(100, hashtbl_feed_seqno(feed));
+
+	/* The stream has a gap so the applier must reject it. */
+	applier = string_applier(follower);
+	n = hashtbl_feed_read(feed, buf, sizeof(buf));
+	CUT_ASSERT_TRUE(n > 0);
+	(void)hashtbl_feed_apply(applier, buf, n);
+	hashtbl_feed_reset(feed);
+	CUT_ASSERT_FALSE(hashtbl_feed_overflowed(feed));
+	CUT_ASSERT_EQUAL(0, hashtbl_feed_pending(feed));
+	CUT_ASSERT_EQUAL(0, insert_int_string(leader, 1000, 1000));
+	n = hashtbl_feed_read(feed, buf, sizeof(buf));
+	CUT_ASSERT_EQUAL(-1, hashtbl_feed_apply(applier, buf, n));
+	hashtbl_feed_applier_delete(applier);
+
+	/* Reseed the follower and continue from the current seqno. */
+	hashtbl_clear(follower);
+	hashtbl_feed_reset(feed);
+	for (i = 0; i < 100; i++)
+		CUT_ASSERT_EQUAL(0, insert_int_string(follower, i, i));
+	CUT_ASSERT_EQUAL(0, insert_int_string(follower, 1000, 1000));
+	applier = hashtbl_feed_applier_create(follower,
+					      hashtbl_feed_seqno(feed) + 1,
+					      string_decode, string_decode,
+					      free, free, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(applier);
+	CUT_ASSERT_EQUAL(0, remove_int_string(leader, 7));
+	n = hashtbl_feed_read(feed, buf, sizeof(buf));
+	CUT_ASSERT_EQUAL(1, hashtbl_feed_apply(applier, buf, n));
+	CUT_ASSERT_TRUE(tables_equal(leader, follower));
+
+	hashtbl_feed_applier_delete(applier);
+	hashtbl_feed_delete(feed);
+	hashtbl_delete(leader);
+	hashtbl_delete(follower);
+	return 0;
+}
+
+/* Test rejection of a corrupt stream. */
+
+static int test5(void)
+{
+	unsigned char bad[] = { 0x7f, 0x01 };
+	HASHTBL_STRING(follower);
+	struct hashtbl_feed_applier *applier = string_applier(follower);
+
+	CUT_ASSERT_NOT_NULL(applier);
+	CUT_ASSERT_EQUAL(-1, hashtbl_feed_apply(applier, bad, sizeof(bad)));
+	CUT_ASSERT_EQUAL(-1, hashtbl_feed_apply(applier, bad, 0));
+	hashtbl_feed_applier_delete(applier);
+	hashtbl_delete(follower);
+	return 0;
+}
+
+static int malloc_fails;
+
+static void *failing_malloc(size_t n)
+{
+	return malloc_fails ? NULL : malloc(n);
+}
+
+/*
+ * Test that a record failing for want of memory leaves the replica as
+ * it was and frees what it decoded.
+ */
+
+static int test6(void)
+{
+	unsigned char buf[256];
+	size_t n;
+	HASHTBL_STRING(leader);
+	struct hashtbl *follower = hashtbl_create(64, 0.75f, 1,
+						  hashtbl_string_hash,
+						  hashtbl_string_equals,
+						  free, free,
+						  failing_malloc, free);
+	struct hashtbl_feed *feed;
+	struct hashtbl_feed_applier *applier;
+	char *one = strdup("1");
+
+	CUT_ASSERT_NOT_NULL(follower);
+	feed = hashtbl_feed_create(leader, 1 << 12, string_encode,
+				   string_encode, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(feed);
+	applier = string_applier(follower);
+	CUT_ASSERT_NOT_NULL(applier);
+
+	CUT_ASSERT_EQUAL(0, hashtbl_insert(leader, one, strdup("1")));
+	n = hashtbl_feed_read(feed, buf, sizeof(buf));
+	CUT_ASSERT_EQUAL(1, hashtbl_feed_apply(applier, buf, n));
+
+	/* Replacing a value needs no memory; a new key does. */
+
+	CUT_ASSERT_EQUAL(0, hashtbl_insert(leader, one, strdup("2")));
+	CUT_ASSERT_EQUAL(0, insert_int_string(leader, 2, 2));
+	n = hashtbl_feed_read(feed, buf, sizeof(buf));
+	malloc_fails = 1;
+	CUT_ASSERT_EQUAL(-1, hashtbl_feed_apply(applier, buf, n));
+	malloc_fails = 0;
+	CUT_ASSERT_EQUAL(1, hashtbl_count(follower));
+	CUT_ASSERT_TRUE(STREQ("2", (char *)hashtbl_lookup(follower, "1")));
+	CUT_ASSERT_NULL(hashtbl_lookup(follower, "2"));
+
+	hashtbl_feed_applier_delete(applier);
+	hashtbl_feed_delete(feed);
+	hashtbl_delete(leader);
+	hashtbl_delete(follower);
+	return 0;
+}
+
+/* Encodes a NULL value as "-". */
+
+static size_t nullable_encode(const void *obj, void *buf, size_t len)
+{
+	return string_encode((obj != NULL) ? obj : "-", buf, len);
+}
+
+/* Decodes "-" as NULL and refuses "bad". */
+
+static int nullable_decode(const void *buf, size_t len, void **obj)
+{
+	if (len == 1 && memcmp(buf, "-", 1) == 0) {
+		*obj = NULL;
+		return 0;
+	}
+	if (len == 3 && memcmp(buf, "bad", 3) == 0)
+		return 1;
+	return string_decode(buf, len, obj);
+}
+
+/*
+ * Test that a NULL decoded value is applied like any other, and that
+ * a value that fails to decode fails its record.
+ */
+
+static int test7(void)
+{
+	unsigned char buf[256];
+	size_t n;
+	HASHTBL_STRING(leader);
+	HASHTBL_STRING(follower);
+	struct hashtbl_feed *feed;
+	struct hashtbl_feed_applier *applier;
+
+	feed = hashtbl_feed_create(leader, 1 << 12, string_encode,
+				   nullable_encode, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(feed);
+	applier = hashtbl_feed_applier_create(follower, 1, string_decode,
+					      nullable_decode, free, free,
+					      NULL, NULL);
+	CUT_ASSERT_NOT_NULL(applier);
+
+	CUT_ASSERT_EQUAL(0, hashtbl_insert(leader, strdup("a"), NULL));
+	CUT_ASSERT_EQUAL(0, hashtbl_insert(leader, strdup("b"), strdup("x")));
+	n = hashtbl_feed_read(feed, buf, sizeof(buf));
+	CUT_ASSERT_EQUAL(2, hashtbl_feed_apply(applier, buf, n));
+	CUT_ASSERT_EQUAL(2, hashtbl_count(follower));
+	CUT_ASSERT_NULL(hashtbl_lookup(follower, "a"));
+	CUT_ASSERT_TRUE(STREQ("x", (char *)hashtbl_lookup(follower, "b")));
+
+	CUT_ASSERT_EQUAL(0, hashtbl_insert(leader, strdup("c"),
+					   strdup("bad")));
+	n = hashtbl_feed_read(feed, buf, sizeof(buf));
+	CUT_ASSERT_EQUAL(-1, hashtbl_feed_apply(applier, buf, n));
+	CUT_ASSERT_EQUAL(2, hashtbl_count(follower));
+	CUT_ASSERT_NULL(hashtbl_lookup(follower, "c"));
+
+	hashtbl_feed_applier_delete(applier);
+	hashtbl_feed_delete(feed);
+	hashtbl_delete(leader);
+	hashtbl_delete(follower);
+	return 0;
+}
+
+CUT_BEGIN_TEST_HARNESS CUT_RUN_TEST(test1);
+CUT_RUN_TEST(test2);
+CUT_RUN_TEST(test3);
+CUT_RUN_TEST(test4);
+CUT_RUN_TEST(test5);
+CUT_RUN_TEST(test6);
+CUT_RUN_TEST(test7);
+CUT_END_TEST_HARNESS
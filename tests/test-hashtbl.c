@@ -37,6 +37,7 @@
 
 #include <c-hacks/hashtbl.h>
 #include <c-hacks/hashtbl-funcs.h>
+#include <c-hacks/histogram.h>
 
 #ifndef HASHTBL_MAX_LOAD_FACTOR
 #define HASHTBL_MAX_LOAD_FACTOR	0.75f
@@ -951,6 +952,151 @@ static int test24(void)
 	return 0;
 }
 
+/* Test latency recording. */
+
+static int test25(void)
+{
+	struct hashtbl *h;
+	struct histogram hist;
+	intptr_t i;
+
+	h = hashtbl_create(16, 0.75f, 1, NULL, NULL, NULL, NULL, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(h);
+
+	histogram_init(&hist);
+	CUT_ASSERT_EQUAL(1, hashtbl_latency(h, HASHTBL_LATENCY_INSERT, &hist));
+
+	CUT_ASSERT_EQUAL(0, hashtbl_latency_enable(h, 0));
+	for (i = 1; i <= 200; i++)
+		CUT_ASSERT_EQUAL(0, hashtbl_insert(h, (void *)i, (void *)i));
+	for (i = 1; i <= 200; i++)
+		CUT_ASSERT_EQUAL(i, (intptr_t) hashtbl_lookup(h, (void *)i));
+	for (i = 1; i <= 50; i++)
+		CUT_ASSERT_EQUAL(0, hashtbl_remove(h, (void *)i));
+
+	CUT_ASSERT_EQUAL(0, hashtbl_latency(h, HASHTBL_LATENCY_INSERT, &hist));
+	CUT_ASSERT_EQUAL(200, histogram_count(&hist));
+	CUT_ASSERT_EQUAL(0, hashtbl_latency(h, HASHTBL_LATENCY_LOOKUP, &hist));
+	CUT_ASSERT_EQUAL(400, histogram_count(&hist));
+	histogram_init(&hist);
+	CUT_ASSERT_EQUAL(0, hashtbl_latency(h, HASHTBL_LATENCY_REMOVE, &hist));
+	CUT_ASSERT_EQUAL(50, histogram_count(&hist));
+	CUT_ASSERT_EQUAL(1, hashtbl_latency(h, (enum hashtbl_latency_op)3,
+					    &hist));
+
+	/* Re-enabling empties; one in eight is sampled. */
+	CUT_ASSERT_EQUAL(0, hashtbl_latency_enable(h, 3));
+	for (i = 1; i <= 800; i++)
+		(void)hashtbl_lookup(h, (void *)i);
+	histogram_init(&hist);
+	CUT_ASSERT_EQUAL(0, hashtbl_latency(h, HASHTBL_LATENCY_LOOKUP, &hist));
+	CUT_ASSERT_EQUAL(100, histogram_count(&hist));
+	histogram_init(&hist);
+	CUT_ASSERT_EQUAL(0, hashtbl_latency(h, HASHTBL_LATENCY_INSERT, &hist));
+	CUT_ASSERT_EQUAL(0, histogram_count(&hist));
+
+	hashtbl_latency_disable(h);
+	CUT_ASSERT_EQUAL(1, hashtbl_latency(h, HASHTBL_LATENCY_LOOKUP, &hist));
+	CUT_ASSERT_EQUAL(150, hashtbl_count(h));
+
+	/* Deleting frees the histograms (for the leak checkers). */
+	CUT_ASSERT_EQUAL(0, hashtbl_latency_enable(h, 0));
+	hashtbl_delete(h);
+	return 0;
+}
+
+static unsigned int constant_hash(const void *k)
+{
+	(void)k;
+	return 42;
+}
+
+/* Longest chain the table's hash function gives the n keys. */
+static int max_chain(struct hashtbl *h, unsigned int *keys, int n)
+{
+	HASHTBL_HASH_FN fn = hashtbl_hash_fn(h);
+	int size = hashtbl_capacity(h);
+	int *slots = calloc((size_t) size, sizeof(*slots));
+	int i, max = 0;
+
+	for (i = 0; i < n; i++) {
+		int *c = &slots[fn(&keys[i]) & (unsigned int)(size - 1)];
+		if (++*c > max)
+			max = *c;
+	}
+	free(slots);
+	return max;
+}
+
+/* Test choosing the hash function from sampled keys. */
+
+static int test26(void)
+{
+	struct hashtbl *h;
+	unsigned int keys[1000];
+	int i;
+
+	for (i = 0; i < 1000; i++)
+		keys[i] = (unsigned int)i * 1024;
+
+	/* Identity hashing puts multiples of 1024 in one slot. */
+	h = hashtbl_create(16, 0.75f, 1, hashtbl_int_hash,
+			   hashtbl_int_equals, NULL, NULL, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(h);
+	CUT_ASSERT_EQUAL(0, hashtbl_select_hash(h, HASHTBL_KEY_INT, 64));
+	for (i = 0; i < 1000; i++)
+		CUT_ASSERT_EQUAL(0, hashtbl_insert(h, &keys[i], &keys[i]));
+	CUT_ASSERT_TRUE((hashtbl_hash_fn(h) != hashtbl_int_hash));
+	CUT_ASSERT_TRUE((max_chain(h, keys, 1000) < 32));
+	for (i = 0; i < 1000; i++)
+		CUT_ASSERT_EQUAL(&keys[i], hashtbl_lookup(h, &keys[i]));
+	for (i = 0; i < 1000; i += 2)
+		CUT_ASSERT_EQUAL(0, hashtbl_remove(h, &keys[i]));
+	CUT_ASSERT_EQUAL(500, hashtbl_count(h));
+	hashtbl_delete(h);
+
+	/* Anything beats a constant; resizing by hand chooses too. */
+	h = hashtbl_create(16, 0.75f, 0, constant_hash,
+			   hashtbl_int_equals, NULL, NULL, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(h);
+	CUT_ASSERT_EQUAL(0, hashtbl_select_hash(h, HASHTBL_KEY_INT, 64));
+	for (i = 0; i < 100; i++)
+		CUT_ASSERT_EQUAL(0, hashtbl_insert(h, &keys[i], &keys[i]));
+	CUT_ASSERT_TRUE((hashtbl_hash_fn(h) == constant_hash));
+	CUT_ASSERT_EQUAL(0, hashtbl_resize(h, 256));
+	CUT_ASSERT_TRUE((hashtbl_hash_fn(h) != constant_hash));
+	for (i = 0; i < 100; i++)
+		CUT_ASSERT_EQUAL(&keys[i], hashtbl_lookup(h, &keys[i]));
+	hashtbl_delete(h);
+
+	/* Too few keys at the resize, or cancelled: no change. */
+	h = hashtbl_create(16, 0.75f, 1, constant_hash,
+			   hashtbl_int_equals, NULL, NULL, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(h);
+	CUT_ASSERT_EQUAL(0, hashtbl_select_hash(h, HASHTBL_KEY_INT, 1000));
+	for (i = 0; i < 200; i++)
+		CUT_ASSERT_EQUAL(0, hashtbl_insert(h, &keys[i], &keys[i]));
+	CUT_ASSERT_EQUAL(256, hashtbl_capacity(h));
+	CUT_ASSERT_TRUE((hashtbl_hash_fn(h) == constant_hash));
+	hashtbl_delete(h);
+
+	h = hashtbl_create(16, 0.75f, 1, constant_hash,
+			   hashtbl_int_equals, NULL, NULL, NULL, NULL);
+	CUT_ASSERT_NOT_NULL(h);
+	CUT_ASSERT_EQUAL(0, hashtbl_select_hash(h, HASHTBL_KEY_INT, 8));
+	CUT_ASSERT_EQUAL(1, hashtbl_select_hash(h, (enum hashtbl_key_kind)4,
+						8));
+	CUT_ASSERT_EQUAL(0, hashtbl_select_hash(h, HASHTBL_KEY_INT, 0));
+	for (i = 0; i < 200; i++)
+		CUT_ASSERT_EQUAL(0, hashtbl_insert(h, &keys[i], &keys[i]));
+	CUT_ASSERT_EQUAL(256, hashtbl_capacity(h));
+	CUT_ASSERT_TRUE((hashtbl_hash_fn(h) == constant_hash));
+	for (i = 0; i < 200; i++)
+		CUT_ASSERT_EQUAL(&keys[i], hashtbl_lookup(h, &keys[i]));
+	hashtbl_delete(h);
+	return 0;
+}
+
 CUT_BEGIN_TEST_HARNESS CUT_RUN_TEST(test1);
 CUT_RUN_TEST(test2);
 CUT_RUN_TEST(test3);
@@ -975,4 +1121,6 @@ CUT_RUN_TEST(test21);
 CUT_RUN_TEST(test22);
 CUT_RUN_TEST(test23);
 CUT_RUN_TEST(test24);
+CUT_RUN_TEST(test25);
+CUT_RUN_TEST(test26);
 CUT_END_TEST_HARNESS
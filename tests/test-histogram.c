@@ -0,0 +1,190 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* test-histogram.c - unit tests for histogram */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "CUnitTest.h"
+
+#include <c-hacks/histogram.h>
+
+/* True if got is value, or at most one sub-bucket above it. */
+static int within_bucket(uint64_t value, uint64_t got)
+{
+	return got >= value && got - value <= value / HISTOGRAM_SUB_BUCKETS;
+}
+
+/* Test an empty histogram. */
+
+static int test1(void)
+{
+	struct histogram h;
+	struct histogram_summary s;
+
+	histogram_init(&h);
+	CUT_ASSERT_EQUAL(0, histogram_count(&h));
+	CUT_ASSERT_EQUAL(0, histogram_percentile(&h, 50.0));
+	CUT_ASSERT_EQUAL(0, histogram_percentile(&h, 100.0));
+	histogram_summary(&h, &s);
+	CUT_ASSERT_EQUAL(0, s.count);
+	CUT_ASSERT_EQUAL(0, s.min);
+	CUT_ASSERT_EQUAL(0, s.max);
+	CUT_ASSERT_EQUAL(0, s.p999);
+	return 0;
+}
+
+/* Test that small values are exact and percentiles are by rank. */
+
+static int test2(void)
+{
+	struct histogram h;
+	struct histogram_summary s;
+	uint64_t i;
+
+	histogram_init(&h);
+	for (i = 1; i <= 10; i++)
+		histogram_record(&h, i);
+
+	CUT_ASSERT_EQUAL(10, histogram_count(&h));
+	CUT_ASSERT_EQUAL(5, histogram_percentile(&h, 50.0));
+	CUT_ASSERT_EQUAL(6, histogram_percentile(&h, 50.1));
+	CUT_ASSERT_EQUAL(10, histogram_percentile(&h, 99.0));
+	CUT_ASSERT_EQUAL(1, histogram_percentile(&h, 0.0));
+	CUT_ASSERT_EQUAL(1, histogram_percentile(&h, 1.0));
+
+	histogram_summary(&h, &s);
+	CUT_ASSERT_EQUAL(10, s.count);
+	CUT_ASSERT_EQUAL(1, s.min);
+	CUT_ASSERT_EQUAL(10, s.max);
+	CUT_ASSERT_TRUE(s.mean > 5.49 && s.mean < 5.51);
+	CUT_ASSERT_EQUAL(5, s.p50);
+	CUT_ASSERT_EQUAL(10, s.p99);
+	return 0;
+}
+
+/* Test the relative error bound across the whole range. */
+
+static int test3(void)
+{
+	struct histogram h;
+	uint64_t v, got;
+	int shift;
+
+	for (shift = 0; shift < 64; shift++) {
+		uint64_t base = 1ULL << shift;
+		uint64_t probes[3];
+		int i;
+
+		probes[0] = base;
+		probes[1] = base + (base >> 1) + 1;
+		probes[2] = base + (base - 1);
+
+		for (i = 0; i < 3; i++) {
+			v = probes[i];
+			histogram_init(&h);
+			histogram_record(&h, v);
+			histogram_record(&h, UINT64_MAX);
+			got = histogram_percentile(&h, 50.0);
+			CUT_ASSERT_TRUE(within_bucket(v, got));
+			CUT_ASSERT_EQUAL(UINT64_MAX,
+					 histogram_percentile(&h, 100.0));
+		}
+	}
+
+	/* A percentile never exceeds the largest value recorded. */
+	histogram_init(&h);
+	histogram_record(&h, 1000001);
+	CUT_ASSERT_EQUAL(1000001, histogram_percentile(&h, 50.0));
+	return 0;
+}
+
+/* Test that merging equals recording everything in one. */
+
+static int test4(void)
+{
+	struct histogram a, b, all, merged;
+	double pcts[] = { 1.0, 25.0, 50.0, 90.0, 99.0, 99.9, 100.0 };
+	unsigned int i;
+
+	histogram_init(&a);
+	histogram_init(&b);
+	histogram_init(&all);
+	histogram_init(&merged);
+
+	srand(42);
+	for (i = 0; i < 100000; i++) {
+		uint64_t v = (uint64_t)rand() * (uint64_t)(rand() % 1000);
+
+		histogram_record((i & 1) ? &a : &b, v);
+		histogram_record(&all, v);
+	}
+
+	histogram_merge(&merged, &a);
+	histogram_merge(&merged, &b);
+
+	CUT_ASSERT_EQUAL(histogram_count(&all), histogram_count(&merged));
+	for (i = 0; i < sizeof(pcts) / sizeof(pcts[0]); i++) {
+		CUT_ASSERT_EQUAL(histogram_percentile(&all, pcts[i]),
+				 histogram_percentile(&merged, pcts[i]));
+	}
+
+	/* Merging an empty histogram changes nothing. */
+	histogram_init(&a);
+	histogram_merge(&merged, &a);
+	CUT_ASSERT_EQUAL(histogram_count(&all), histogram_count(&merged));
+	CUT_ASSERT_EQUAL(histogram_percentile(&all, 0.0),
+			 histogram_percentile(&merged, 0.0));
+	return 0;
+}
+
+/* Test that the clock measures a sleep about right. */
+
+static int test5(void)
+{
+	struct timespec ts = { 0, 2000000 };
+	uint64_t t0, ns;
+
+	histogram_clock_calibrate();
+	t0 = histogram_clock();
+	nanosleep(&ts, NULL);
+	ns = histogram_clock_ns(histogram_clock() - t0);
+
+	CUT_ASSERT_TRUE(ns >= 1500000);
+	CUT_ASSERT_TRUE(ns < 1000000000);
+	return 0;
+}
+
+CUT_BEGIN_TEST_HARNESS CUT_RUN_TEST(test1);
+CUT_RUN_TEST(test2);
+CUT_RUN_TEST(test3);
+CUT_RUN_TEST(test4);
+CUT_RUN_TEST(test5);
+CUT_END_TEST_HARNESS
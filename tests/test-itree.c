@@ -0,0 +1,237 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* test-itree.c - unit tests for itree */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "CUnitTest.h"
+
+#include <c-hacks/itree.h>
+
+struct range {
+	int id;
+	int in_tree;
+	struct itree_node node;
+};
+
+#define RANGE(N)	ITREE_ENTRY(N, struct range, node)
+
+static unsigned long rand_state = 1;
+
+static unsigned long next_rand(void)
+{
+	rand_state = rand_state * 6364136223846793005UL + 1442695040888963407UL;
+	return rand_state >> 33;
+}
+
+/* Returns 1 if max_last is right throughout the subtree at n. */
+
+static int check_max(const struct rbtree_node *n)
+{
+	const struct itree_node *x;
+	int64_t max;
+
+	if (n == NULL)
+		return 1;
+
+	x = ITREE_ENTRY(n, struct itree_node, rb);
+	max = x->last;
+	if (n->left != NULL &&
+	    ITREE_ENTRY(n->left, struct itree_node, rb)->max_last > max)
+		max = ITREE_ENTRY(n->left, struct itree_node, rb)->max_last;
+	if (n->right != NULL &&
+	    ITREE_ENTRY(n->right, struct itree_node, rb)->max_last > max)
+		max = ITREE_ENTRY(n->right, struct itree_node, rb)->max_last;
+
+	return x->max_last == max && check_max(n->left) &&
+	    check_max(n->right);
+}
+
+/*
+ * Returns 1 if an overlap query for [lo, hi] yields exactly the ranges
+ * a scan finds, in order of their start.
+ */
+static int check_query(const struct itree *t, const struct range *ranges,
+		       int n, int64_t lo, int64_t hi)
+{
+	struct itree_node *x;
+	int i, expected = 0, found = 0;
+	int64_t prev = INT64_MIN;
+
+	for (i = 0; i < n; i++) {
+		const struct itree_node *r = &ranges[i].node;
+		if (ranges[i].in_tree && r->start <= hi && r->last >= lo)
+			expected++;
+	}
+
+	for (x = itree_first_overlap(t, lo, hi); x != NULL;
+	     x = itree_next_overlap(x, lo, hi)) {
+		if (!RANGE(x)->in_tree || x->start > hi || x->last < lo ||
+		    x->start < prev)
+			return 0;
+		prev = x->start;
+		found++;
+	}
+
+	return found == expected;
+}
+
+/* Test stabbing and overlap queries against a scan. */
+
+static int test1(void)
+{
+	enum { N = 2000, SPAN = 10000 };
+	struct range *ranges = calloc(N, sizeof(*ranges));
+	struct itree t;
+	int i, round;
+
+	CUT_ASSERT_NOT_NULL(ranges);
+	itree_init(&t);
+	CUT_ASSERT_NULL(itree_first_overlap(&t, 0, SPAN));
+	CUT_ASSERT_EQUAL(0, itree_count(&t));
+
+	/* Mostly short ranges, some long ones and some points. */
+
+	for (i = 0; i < N; i++) {
+		int64_t start = (int64_t)(next_rand() % SPAN) - SPAN / 2;
+		int64_t len = (i % 10 == 0) ? (int64_t)(next_rand() % SPAN) :
+		    (i % 10 == 1) ? 0 : (int64_t)(next_rand() % 50);
+
+		ranges[i].id = i;
+		ranges[i].node.start = start;
+		ranges[i].node.last = start + len;
+	}
+
+	for (round = 0; round < 6; round++) {
+		for (i = 0; i < N; i++) {
+			if (next_rand() % 3 == 0) {
+				if (ranges[i].in_tree)
+					itree_remove(&t, &ranges[i].node);
+				else
+					itree_insert(&t, &ranges[i].node);
+				ranges[i].in_tree = !ranges[i].in_tree;
+			}
+		}
+
+		CUT_ASSERT_TRUE(check_max(t.rb.root));
+
+		for (i = 0; i < 300; i++) {
+			int64_t x = (int64_t)(next_rand() % (2 * SPAN)) - SPAN;
+			int64_t w = (int64_t)(next_rand() % 200);
+
+			CUT_ASSERT_TRUE(check_query(&t, ranges, N, x, x));
+			CUT_ASSERT_TRUE(check_query(&t, ranges, N, x, x + w));
+		}
+
+		CUT_ASSERT_TRUE(check_query(&t, ranges, N, INT64_MIN,
+					    INT64_MAX));
+	}
+
+	free(ranges);
+
+	return 0;
+}
+
+/* Test building from sorted and unsorted arrays, with duplicates. */
+
+static int test2(void)
+{
+	enum { N = 1500 };
+	struct range *ranges = calloc(N, sizeof(*ranges));
+	struct itree_node **nodes = calloc(N, sizeof(*nodes));
+	struct itree_node *x;
+	struct itree t;
+	int i, sorted;
+
+	CUT_ASSERT_NOT_NULL(ranges);
+	CUT_ASSERT_NOT_NULL(nodes);
+
+	for (sorted = 0; sorted < 2; sorted++) {
+		for (i = 0; i < N; i++) {
+			struct itree_node *r = &ranges[i].node;
+
+			if (sorted) {
+				r->start = i / 4;
+				r->last = r->start + i % 4;
+			} else {
+				r->start = (int64_t)(next_rand() % 300);
+				r->last = r->start;
+				r->last += (int64_t)(next_rand() % 20);
+			}
+			ranges[i].in_tree = 1;
+			nodes[i] = r;
+		}
+
+		itree_init(&t);
+		itree_build(&t, nodes, N);
+		CUT_ASSERT_EQUAL(N, itree_count(&t));
+		CUT_ASSERT_TRUE(check_max(t.rb.root));
+
+		for (i = 1; i < N; i++) {
+			const struct itree_node *a = nodes[i - 1];
+			const struct itree_node *b = nodes[i];
+
+			CUT_ASSERT_TRUE(a->start < b->start ||
+					(a->start == b->start &&
+					 a->last <= b->last));
+		}
+
+		for (i = -5; i < 330; i += 3) {
+			CUT_ASSERT_TRUE(check_query(&t, ranges, N, i,
+						    i + i % 7));
+		}
+
+		/* A built tree takes inserts and removes as usual. */
+
+		for (i = 0; i < N; i += 2) {
+			itree_remove(&t, &ranges[i].node);
+			ranges[i].in_tree = 0;
+		}
+
+		CUT_ASSERT_TRUE(check_max(t.rb.root));
+		CUT_ASSERT_EQUAL(N / 2, itree_count(&t));
+		for (i = -5; i < 330; i += 3)
+			CUT_ASSERT_TRUE(check_query(&t, ranges, N, i, i));
+
+		x = itree_first_overlap(&t, INT64_MIN, INT64_MAX);
+		for (i = 0; x != NULL; i++)
+			x = itree_next_overlap(x, INT64_MIN, INT64_MAX);
+		CUT_ASSERT_EQUAL(N / 2, i);
+	}
+
+	free(nodes);
+	free(ranges);
+
+	return 0;
+}
+
+CUT_BEGIN_TEST_HARNESS CUT_RUN_TEST(test1);
+CUT_RUN_TEST(test2);
+CUT_END_TEST_HARNESS
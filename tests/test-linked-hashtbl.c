@@ -34,6 +34,7 @@
 
 #include <c-hacks/hashtbl-funcs.h>
 #include <c-hacks/linked-hashtbl.h>
+#include <c-hacks/histogram.h>
 
 #ifndef LINKED_HASHTBL_MAX_LOAD_FACTOR
 #define LINKED_HASHTBL_MAX_LOAD_FACTOR	0.75f
@@ -1187,6 +1188,59 @@ static int test25(void)
 	return 0;
 }
 
+/* Test latency recording, including that evictions aren't removes. */
+
+static int test26_evict(const struct l_hashtbl *h, unsigned long count)
+{
+	UNUSED_PARAMETER(h);
+	return (count > 10) ? 1 : 0;
+}
+
+static int test26(void)
+{
+	struct l_hashtbl *h;
+	struct histogram hist;
+	intptr_t i;
+
+	h = l_hashtbl_create(16, LINKED_HASHTBL_MAX_LOAD_FACTOR, 1, 0,
+			     hashtbl_direct_hash, hashtbl_direct_equals, NULL,
+			     NULL, NULL, NULL, test26_evict);
+	CUT_ASSERT_NOT_NULL(h);
+
+	histogram_init(&hist);
+	CUT_ASSERT_EQUAL(1, l_hashtbl_latency(h, LINKED_HASHTBL_LATENCY_INSERT,
+					      &hist));
+
+	CUT_ASSERT_EQUAL(0, l_hashtbl_latency_enable(h, 0));
+	for (i = 1; i <= 100; i++)
+		CUT_ASSERT_EQUAL(0, l_hashtbl_insert(h, (void *)i, (void *)i));
+	CUT_ASSERT_EQUAL(10, l_hashtbl_count(h));
+	for (i = 91; i <= 100; i++)
+		CUT_ASSERT_EQUAL(i, (intptr_t) l_hashtbl_lookup(h, (void *)i));
+	for (i = 91; i <= 95; i++)
+		CUT_ASSERT_EQUAL(0, l_hashtbl_remove(h, (void *)i));
+
+	CUT_ASSERT_EQUAL(0, l_hashtbl_latency(h, LINKED_HASHTBL_LATENCY_INSERT,
+					      &hist));
+	CUT_ASSERT_EQUAL(100, histogram_count(&hist));
+	histogram_init(&hist);
+	CUT_ASSERT_EQUAL(0, l_hashtbl_latency(h, LINKED_HASHTBL_LATENCY_LOOKUP,
+					      &hist));
+	CUT_ASSERT_EQUAL(10, histogram_count(&hist));
+	histogram_init(&hist);
+	CUT_ASSERT_EQUAL(0, l_hashtbl_latency(h, LINKED_HASHTBL_LATENCY_REMOVE,
+					      &hist));
+	CUT_ASSERT_EQUAL(5, histogram_count(&hist));
+
+	l_hashtbl_latency_disable(h);
+	CUT_ASSERT_EQUAL(1, l_hashtbl_latency(h, LINKED_HASHTBL_LATENCY_REMOVE,
+					      &hist));
+
+	CUT_ASSERT_EQUAL(0, l_hashtbl_latency_enable(h, 2));
+	l_hashtbl_delete(h);
+	return 0;
+}
+
 CUT_BEGIN_TEST_HARNESS CUT_RUN_TEST(test1);
 CUT_RUN_TEST(test2);
 CUT_RUN_TEST(test3);
@@ -1212,4 +1266,5 @@ CUT_RUN_TEST(test22);
 CUT_RUN_TEST(test23);
 CUT_RUN_TEST(test24);
 CUT_RUN_TEST(test25);
+CUT_RUN_TEST(test26);
 CUT_END_TEST_HARNESS
@@ -0,0 +1,367 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* test-rbtree.c - unit tests for rbtree */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "CUnitTest.h"
+
+#include <c-hacks/rbtree.h>
+
+struct item {
+	int key;
+	int seq;
+	int size;		/* nodes in the subtree, when augmented */
+	struct rbtree_node node;
+};
+
+#define ITEM(N)		RBTREE_ENTRY(N, struct item, node)
+#define PARENT(N)	((struct rbtree_node *)((N)->parent_color & ~(uintptr_t)1))
+#define RED(N)		((N) != NULL && ((N)->parent_color & 1))
+
+static unsigned long rand_state = 1;
+
+static unsigned long next_rand(void)
+{
+	rand_state = rand_state * 6364136223846793005UL + 1442695040888963407UL;
+	return rand_state >> 33;
+}
+
+static int item_compare(const struct rbtree_node *a,
+			const struct rbtree_node *b)
+{
+	int x = ITEM(a)->key;
+	int y = ITEM(b)->key;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Returns the black height of the subtree at n, or -1 if it breaks a
+ * red-black or ordering rule.
+ */
+static int check_subtree(const struct rbtree_node *n,
+			 const struct rbtree_node *p)
+{
+	int lh, rh;
+
+	if (n == NULL)
+		return 0;
+
+	if (PARENT(n) != p || (RED(n) && (RED(n->left) || RED(n->right))))
+		return -1;
+	if (n->left != NULL && item_compare(n->left, n) > 0)
+		return -1;
+	if (n->right != NULL && item_compare(n->right, n) < 0)
+		return -1;
+
+	lh = check_subtree(n->left, n);
+	rh = check_subtree(n->right, n);
+	if (lh < 0 || lh != rh)
+		return -1;
+
+	return lh + !RED(n);
+}
+
+static int check_tree(const struct rbtree *t)
+{
+	return !RED(t->root) && check_subtree(t->root, NULL) >= 0;
+}
+
+/* Test unique keys against a model. */
+
+static int test1(void)
+{
+	enum { N = 1000, ROUNDS = 20 };
+	struct item *items = calloc(N, sizeof(*items));
+	char *present = calloc(N, 1);
+	struct rbtree t;
+	struct rbtree_node *n;
+	struct item probe;
+	int i, j, round, count = 0;
+
+	CUT_ASSERT_NOT_NULL(items);
+	rbtree_init(&t, item_compare);
+	CUT_ASSERT_NULL(rbtree_first(&t));
+	CUT_ASSERT_NULL(rbtree_last(&t));
+
+	/* Keys are even so that odd probes fall between them. */
+
+	for (i = 0; i < N; i++)
+		items[i].key = i * 2;
+
+	for (round = 0; round < ROUNDS; round++) {
+		for (i = 0; i < N; i++) {
+			j = (int)(next_rand() % N);
+
+			if ((int)(next_rand() % ROUNDS) >= round) {
+				n = rbtree_insert(&t, &items[j].node);
+				CUT_ASSERT_TRUE(n == (present[j] ? &items[j].node
+						      : NULL));
+				count += !present[j];
+				present[j] = 1;
+			} else if (present[j]) {
+				rbtree_remove(&t, &items[j].node);
+				count--;
+				present[j] = 0;
+			}
+		}
+
+		CUT_ASSERT_TRUE(check_tree(&t));
+		CUT_ASSERT_EQUAL(count, rbtree_count(&t));
+
+		/* Walk both ways against the model. */
+
+		n = rbtree_first(&t);
+		for (i = 0; i < N; i++) {
+			if (!present[i])
+				continue;
+			CUT_ASSERT_TRUE(n == &items[i].node);
+			n = rbtree_next(n);
+		}
+		CUT_ASSERT_NULL(n);
+
+		n = rbtree_last(&t);
+		for (i = N - 1; i >= 0; i--) {
+			if (!present[i])
+				continue;
+			CUT_ASSERT_TRUE(n == &items[i].node);
+			n = rbtree_prev(n);
+		}
+		CUT_ASSERT_NULL(n);
+
+		for (i = -1; i <= 2 * N; i++) {
+			struct rbtree_node *lb = NULL, *ub = NULL;
+
+			for (j = (i < 0) ? 0 : i / 2; j < N; j++) {
+				if (present[j] && items[j].key >= i && lb == NULL)
+					lb = &items[j].node;
+				if (present[j] && items[j].key > i) {
+					ub = &items[j].node;
+					break;
+				}
+			}
+
+			probe.key = i;
+			CUT_ASSERT_TRUE(rbtree_lower_bound(&t, &probe.node) == lb);
+			CUT_ASSERT_TRUE(rbtree_upper_bound(&t, &probe.node) == ub);
+			CUT_ASSERT_TRUE(rbtree_lookup(&t, &probe.node) ==
+					((i >= 0 && i % 2 == 0 && i < 2 * N &&
+					  present[i / 2]) ? lb : NULL));
+		}
+	}
+
+	/* Empty the tree from the front, as a timer queue would. */
+
+	while ((n = rbtree_first(&t)) != NULL) {
+		rbtree_remove(&t, n);
+		count--;
+		CUT_ASSERT_TRUE(check_tree(&t));
+	}
+
+	CUT_ASSERT_EQUAL(0, count);
+	CUT_ASSERT_EQUAL(0, rbtree_count(&t));
+	CUT_ASSERT_NULL(rbtree_last(&t));
+
+	free(items);
+	free(present);
+
+	return 0;
+}
+
+/* Test equal keys, which keep their insertion order. */
+
+static int test2(void)
+{
+	enum { N = 2000, KEYS = 50 };
+	struct item *items = calloc(N, sizeof(*items));
+	struct rbtree t;
+	struct rbtree_node *n, *next;
+	struct item probe;
+	int i, nleft = N;
+
+	CUT_ASSERT_NOT_NULL(items);
+	rbtree_init(&t, item_compare);
+
+	for (i = 0; i < N; i++) {
+		items[i].key = (int)(next_rand() % KEYS);
+		items[i].seq = i;
+		rbtree_insert_multi(&t, &items[i].node);
+	}
+
+	CUT_ASSERT_TRUE(check_tree(&t));
+	CUT_ASSERT_EQUAL(N, rbtree_count(&t));
+
+	/* Equal keys come out in the order they went in. */
+
+	for (n = rbtree_first(&t); (next = rbtree_next(n)) != NULL; n = next) {
+		CUT_ASSERT_TRUE(ITEM(n)->key < ITEM(next)->key ||
+				(ITEM(n)->key == ITEM(next)->key &&
+				 ITEM(n)->seq < ITEM(next)->seq));
+	}
+	CUT_ASSERT_TRUE(n == rbtree_last(&t));
+
+	/* Lookup and lower bound find the oldest of the equal nodes. */
+
+	for (i = 0; i < KEYS; i++) {
+		probe.key = i;
+		n = rbtree_lookup(&t, &probe.node);
+		CUT_ASSERT_NOT_NULL(n);
+		CUT_ASSERT_TRUE(rbtree_lower_bound(&t, &probe.node) == n);
+		CUT_ASSERT_TRUE(rbtree_prev(n) == NULL ||
+				ITEM(rbtree_prev(n))->key < i);
+		n = rbtree_upper_bound(&t, &probe.node);
+		CUT_ASSERT_TRUE((n == NULL) ? (i == KEYS - 1) :
+				(ITEM(n)->key == i + 1));
+	}
+
+	/* Remove every other node while iterating. */
+
+	for (n = rbtree_first(&t), i = 0; n != NULL; n = next, i++) {
+		next = rbtree_next(n);
+		if (i % 2 == 0) {
+			rbtree_remove(&t, n);
+			nleft--;
+		}
+	}
+
+	CUT_ASSERT_TRUE(check_tree(&t));
+	CUT_ASSERT_EQUAL(nleft, rbtree_count(&t));
+
+	while ((n = rbtree_last(&t)) != NULL)
+		rbtree_remove(&t, n);
+
+	CUT_ASSERT_NULL(rbtree_first(&t));
+	free(items);
+
+	return 0;
+}
+
+static void item_augment(struct rbtree_node *n)
+{
+	ITEM(n)->size = 1 + (n->left ? ITEM(n->left)->size : 0) +
+	    (n->right ? ITEM(n->right)->size : 0);
+}
+
+/* Returns 1 if every cached subtree size in the tree is right. */
+
+static int check_sizes(const struct rbtree_node *n)
+{
+	int size = 1;
+
+	if (n == NULL)
+		return 1;
+	if (n->left != NULL)
+		size += ITEM(n->left)->size;
+	if (n->right != NULL)
+		size += ITEM(n->right)->size;
+
+	return size == ITEM(n)->size && check_sizes(n->left) &&
+	    check_sizes(n->right);
+}
+
+static struct rbtree_node *next_item(void *client_data)
+{
+	struct item **pos = client_data;
+
+	return &(*pos)++->node;
+}
+
+/*
+ * Test bulk builds of every size up to a few levels, and subtree sizes
+ * kept by an augmented tree through inserts, removes and builds.
+ */
+static int test3(void)
+{
+	enum { N = 3000 };
+	struct item *items = calloc(N, sizeof(*items)), *pos;
+	struct rbtree t;
+	struct rbtree_node *n;
+	int i, size;
+
+	CUT_ASSERT_NOT_NULL(items);
+
+	for (size = 0; size <= 70; size++) {
+		for (i = 0; i < size; i++) {
+			items[i].key = i / 3;
+			items[i].seq = i;
+		}
+		rbtree_init_augmented(&t, item_compare, item_augment);
+		pos = items;
+		rbtree_build(&t, next_item, &pos, size);
+		CUT_ASSERT_TRUE(check_tree(&t));
+		CUT_ASSERT_TRUE(check_sizes(t.root));
+		CUT_ASSERT_EQUAL(size, rbtree_count(&t));
+		for (n = rbtree_first(&t), i = 0; n != NULL;
+		     n = rbtree_next(n), i++)
+			CUT_ASSERT_EQUAL(i, ITEM(n)->seq);
+		CUT_ASSERT_EQUAL(size, i);
+		CUT_ASSERT_TRUE((size == 0) ? (rbtree_last(&t) == NULL) :
+				(ITEM(rbtree_last(&t))->seq == size - 1));
+	}
+
+	/* Keep changing a built tree. */
+
+	for (i = 0; i < N; i++) {
+		items[i].key = i;
+		items[i].seq = (i < N / 2);	/* in the tree */
+	}
+	rbtree_init_augmented(&t, item_compare, item_augment);
+	pos = items;
+	rbtree_build(&t, next_item, &pos, N / 2);
+
+	for (i = 0; i < 20000; i++) {
+		struct item *it = &items[next_rand() % N];
+
+		if (it->seq) {
+			rbtree_remove(&t, &it->node);
+			it->seq = 0;
+		} else {
+			rbtree_insert(&t, &it->node);
+			it->seq = 1;
+		}
+
+		if (i % 1000 == 0) {
+			CUT_ASSERT_TRUE(check_tree(&t));
+			CUT_ASSERT_TRUE(check_sizes(t.root));
+		}
+	}
+
+	CUT_ASSERT_TRUE(check_sizes(t.root));
+	CUT_ASSERT_EQUAL(rbtree_count(&t), (t.root ? ITEM(t.root)->size : 0));
+	free(items);
+
+	return 0;
+}
+
+CUT_BEGIN_TEST_HARNESS CUT_RUN_TEST(test1);
+CUT_RUN_TEST(test2);
+CUT_RUN_TEST(test3);
+CUT_END_TEST_HARNESS
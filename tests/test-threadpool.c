@@ -0,0 +1,289 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* test-threadpool.c - unit tests for threadpool */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "CUnitTest.h"
+
+#include <c-hacks/threadpool.h>
+
+#define N	100000
+
+static atomic_int visits[N];
+static atomic_size_t longest;
+
+static void visit(size_t begin, size_t end, void *arg)
+{
+	size_t i, len = end - begin, max = atomic_load(&longest);
+
+	(void)arg;
+
+	while (len > max && !atomic_compare_exchange_weak(&longest, &max, len))
+		;
+
+	for (i = begin; i < end; i++)
+		atomic_fetch_add(&visits[i], 1);
+}
+
+/* Returns 1 if exactly the indices in [begin, end) were visited once. */
+
+static int visited_once(size_t begin, size_t end)
+{
+	size_t i;
+	int ok = 1;
+
+	for (i = 0; i < N; i++) {
+		if (atomic_load(&visits[i]) != (i >= begin && i < end))
+			ok = 0;
+		atomic_store(&visits[i], 0);
+	}
+
+	return ok;
+}
+
+/* Test that a parallel for visits every index once, in grain chunks. */
+
+static int test1(void)
+{
+	static const int nthreads[] = { 0, 1, 3 };
+	static const size_t grains[] = { 0, 1, 7, 1000, N, 2 * N };
+	unsigned int i, j;
+
+	for (i = 0; i < sizeof(nthreads) / sizeof(nthreads[0]); i++) {
+		struct threadpool *p = threadpool_create(nthreads[i], NULL,
+							 NULL);
+
+		CUT_ASSERT_NOT_NULL(p);
+		CUT_ASSERT_EQUAL(nthreads[i], threadpool_nthreads(p));
+
+		for (j = 0; j < sizeof(grains) / sizeof(grains[0]); j++) {
+			size_t grain = (grains[j] != 0) ? grains[j] : 1;
+
+			atomic_store(&longest, 0);
+			threadpool_parallel_for(p, 0, N, grains[j], visit,
+						NULL);
+			CUT_ASSERT_TRUE(visited_once(0, N));
+			CUT_ASSERT_TRUE(atomic_load(&longest) <= grain);
+			CUT_ASSERT_TRUE(atomic_load(&longest) > grain / 2 ||
+					atomic_load(&longest) == N);
+
+			threadpool_parallel_for(p, 10, 11, grains[j], visit,
+						NULL);
+			CUT_ASSERT_TRUE(visited_once(10, 11));
+
+			threadpool_parallel_for(p, 5, 5, grains[j], visit,
+						NULL);
+			CUT_ASSERT_TRUE(visited_once(0, 0));
+		}
+
+		threadpool_delete(p);
+	}
+
+	return 0;
+}
+
+struct fib {
+	struct threadpool *p;
+	int n;
+	long result;
+};
+
+static void fib_task(void *arg)
+{
+	struct fib *f = arg;
+	struct fib a, b;
+	struct threadpool_task t;
+
+	if (f->n < 2) {
+		f->result = f->n;
+		return;
+	}
+
+	a.p = b.p = f->p;
+	a.n = f->n - 1;
+	b.n = f->n - 2;
+
+	threadpool_fork(f->p, &t, fib_task, &a);
+	fib_task(&b);
+	threadpool_join(f->p, &t);
+
+	f->result = a.result + b.result;
+}
+
+/* Test nested fork/join from inside and outside threadpool_run(). */
+
+static int test2(void)
+{
+	static const int nthreads[] = { 0, 2 };
+	unsigned int i;
+
+	for (i = 0; i < sizeof(nthreads) / sizeof(nthreads[0]); i++) {
+		struct threadpool *p = threadpool_create(nthreads[i], NULL,
+							 NULL);
+		struct fib f;
+
+		CUT_ASSERT_NOT_NULL(p);
+
+		f.p = p;
+		f.n = 20;
+		threadpool_run(p, fib_task, &f);
+		CUT_ASSERT_EQUAL(6765, f.result);
+
+		/* Outside threadpool_run() forks go through the lock. */
+
+		f.n = 15;
+		fib_task(&f);
+		CUT_ASSERT_EQUAL(610, f.result);
+
+		threadpool_delete(p);
+	}
+
+	return 0;
+}
+
+struct counter {
+	atomic_int n;
+};
+
+static void bump(void *arg)
+{
+	struct counter *c = arg;
+
+	atomic_fetch_add(&c->n, 1);
+}
+
+struct spread {
+	struct threadpool *p;
+	struct counter *c;
+};
+
+/* Forks many tasks before joining any, to grow the deque. */
+
+static void spread_task(void *arg)
+{
+	struct spread *s = arg;
+	static struct threadpool_task tasks[1000];
+	int i;
+
+	for (i = 0; i < 1000; i++)
+		threadpool_fork(s->p, &tasks[i], bump, s->c);
+	for (i = 999; i >= 0; i--)
+		threadpool_join(s->p, &tasks[i]);
+}
+
+/* Test deque growth and the default pool. */
+
+static int test3(void)
+{
+	struct threadpool *p = threadpool_create(2, NULL, NULL);
+	struct counter c;
+	struct spread s;
+	int round;
+
+	CUT_ASSERT_NOT_NULL(p);
+
+	for (round = 0; round < 10; round++) {
+		atomic_init(&c.n, 0);
+		s.p = p;
+		s.c = &c;
+		threadpool_run(p, spread_task, &s);
+		CUT_ASSERT_EQUAL(1000, atomic_load(&c.n));
+	}
+
+	threadpool_delete(p);
+
+	CUT_ASSERT_NOT_NULL(threadpool_default());
+	CUT_ASSERT_TRUE(threadpool_default() == threadpool_default());
+
+	threadpool_parallel_for(NULL, 0, N, 100, visit, NULL);
+	CUT_ASSERT_TRUE(visited_once(0, N));
+
+	return 0;
+}
+
+#define NCALLERS	4
+
+struct caller {
+	pthread_t thread;
+	struct threadpool *p;
+	long result;
+};
+
+static void *caller_main(void *arg)
+{
+	struct caller *c = arg;
+	struct fib f;
+	int i;
+
+	c->result = 0;
+
+	for (i = 0; i < 20; i++) {
+		f.p = c->p;
+		f.n = 12;
+		threadpool_run(c->p, fib_task, &f);
+		c->result += f.result;
+	}
+
+	return NULL;
+}
+
+/* Test threads outside the pool using it at the same time. */
+
+static int test4(void)
+{
+	struct threadpool *p = threadpool_create(2, NULL, NULL);
+	struct caller callers[NCALLERS];
+	int i;
+
+	CUT_ASSERT_NOT_NULL(p);
+
+	for (i = 0; i < NCALLERS; i++) {
+		callers[i].p = p;
+		CUT_ASSERT_EQUAL(0, pthread_create(&callers[i].thread, NULL,
+						   caller_main, &callers[i]));
+	}
+
+	for (i = 0; i < NCALLERS; i++) {
+		pthread_join(callers[i].thread, NULL);
+		CUT_ASSERT_EQUAL(20 * 144, callers[i].result);
+	}
+
+	threadpool_delete(p);
+
+	return 0;
+}
+
+CUT_BEGIN_TEST_HARNESS CUT_RUN_TEST(test1);
+CUT_RUN_TEST(test2);
+CUT_RUN_TEST(test3);
+CUT_RUN_TEST(test4);
+CUT_END_TEST_HARNESS
@@ -0,0 +1,220 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* test-workload.c - unit tests for the benchmark workload generator */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "CUnitTest.h"
+
+#include "workload.h"
+
+#define NSAMPLES 200000
+
+/* Test the generators are deterministic and in range. */
+
+static int test1(void)
+{
+	struct workload_rng a, b;
+	int i;
+
+	workload_rng_seed(&a, 0);
+	workload_rng_seed(&b, 0);
+	CUT_ASSERT_TRUE((a.s[0] | a.s[1] | a.s[2] | a.s[3]) != 0);
+
+	for (i = 0; i < 1000; i++)
+		CUT_ASSERT_EQUAL(workload_rng_next(&a), workload_rng_next(&b));
+
+	workload_rng_seed(&b, 1);
+	CUT_ASSERT_TRUE(workload_rng_next(&a) != workload_rng_next(&b));
+
+	for (i = 0; i < 10000; i++) {
+		double d = workload_rng_double(&a);
+		CUT_ASSERT_TRUE(workload_rng_below(&a, 7) < 7);
+		CUT_ASSERT_TRUE(d >= 0.0 && d < 1.0);
+	}
+	return 0;
+}
+
+/* Checks the Zipf sampler against the exact probability of key 0. */
+
+static int check_zipf(uint64_t n, double skew)
+{
+	struct workload_rng r;
+	struct workload_zipf z;
+	unsigned long *counts = calloc(n, sizeof(*counts));
+	double harmonic = 0.0, p0;
+	uint64_t i;
+
+	for (i = 1; i <= n; i++)
+		harmonic += 1.0 / pow((double)i, skew);
+	p0 = 1.0 / harmonic;
+
+	workload_rng_seed(&r, 42);
+	workload_zipf_init(&z, n, skew);
+	for (i = 0; i < NSAMPLES; i++) {
+		uint64_t k = workload_zipf_next(&z, &r);
+		CUT_ASSERT_TRUE(k < n);
+		counts[k]++;
+	}
+
+	CUT_ASSERT_TRUE(fabs((double)counts[0] / NSAMPLES - p0) < 0.05 * p0);
+	/* Key 0 is 2^skew times as likely as key 1. */
+	CUT_ASSERT_TRUE(fabs((double)counts[0] / (double)counts[1] -
+			     pow(2.0, skew)) < 0.1 * pow(2.0, skew));
+	free(counts);
+	return 0;
+}
+
+static int test2(void)
+{
+	CUT_ASSERT_EQUAL(0, check_zipf(1000, 0.5));
+	CUT_ASSERT_EQUAL(0, check_zipf(1000, 0.99));
+	CUT_ASSERT_EQUAL(0, check_zipf(1000, 1.0));
+	CUT_ASSERT_EQUAL(0, check_zipf(100000, 1.2));
+	return 0;
+}
+
+/* Test the operation mix, sequential keys and invalid specs. */
+
+static int test3(void)
+{
+	struct workload_spec spec;
+	struct workload w;
+	unsigned long i, nops[3] = { 0, 0, 0 };
+
+	memset(&spec, 0, sizeof(spec));
+	spec.dist = WORKLOAD_UNIFORM;
+	spec.nkeys = 1000;
+	spec.nops = NSAMPLES;
+	spec.write_pct = 20;
+	spec.delete_pct = 5;
+
+	CUT_ASSERT_EQUAL(0, workload_generate(&w, &spec));
+	CUT_ASSERT_EQUAL(NSAMPLES, w.nops);
+	for (i = 0; i < w.nops; i++) {
+		CUT_ASSERT_TRUE(w.keys[i] < 1000);
+		nops[w.ops[i]]++;
+	}
+	CUT_ASSERT_TRUE(labs((long)nops[WORKLOAD_READ] - 150000) < 2000);
+	CUT_ASSERT_TRUE(labs((long)nops[WORKLOAD_WRITE] - 40000) < 2000);
+	CUT_ASSERT_TRUE(labs((long)nops[WORKLOAD_DELETE] - 10000) < 1000);
+	workload_free(&w);
+
+	spec.dist = WORKLOAD_SEQUENTIAL;
+	CUT_ASSERT_EQUAL(0, workload_generate(&w, &spec));
+	for (i = 0; i < w.nops; i++)
+		CUT_ASSERT_EQUAL(i % 1000, w.keys[i]);
+	workload_free(&w);
+
+	spec.write_pct = 90;
+	spec.delete_pct = 20;
+	CUT_ASSERT_EQUAL(1, workload_generate(&w, &spec));
+	spec.write_pct = 0;
+	spec.dist = WORKLOAD_ZIPF;
+	CUT_ASSERT_EQUAL(1, workload_generate(&w, &spec));
+	spec.dist = WORKLOAD_HOTSET;
+	CUT_ASSERT_EQUAL(1, workload_generate(&w, &spec));
+	spec.dist = WORKLOAD_UNIFORM;
+	spec.nkeys = 0;
+	CUT_ASSERT_EQUAL(1, workload_generate(&w, &spec));
+	return 0;
+}
+
+/* Test that the hot set receives its share and moves on. */
+
+static int test4(void)
+{
+	struct workload_spec spec;
+	struct workload w;
+	unsigned long i, nhot[2] = { 0, 0 };
+
+	memset(&spec, 0, sizeof(spec));
+	spec.dist = WORKLOAD_HOTSET;
+	spec.nkeys = 10000;
+	spec.nops = 20000;
+	spec.hot_fraction = 0.01;
+	spec.hot_probability = 0.9;
+	spec.shift_every = 10000;
+
+	CUT_ASSERT_EQUAL(0, workload_generate(&w, &spec));
+	for (i = 0; i < w.nops; i++) {
+		uint64_t lo = (i < 10000) ? 0 : 100;
+
+		if (w.keys[i] >= lo && w.keys[i] < lo + 100)
+			nhot[i / 10000]++;
+	}
+	/* 90% aimed at the hot set, plus its 1% of the rest. */
+	CUT_ASSERT_TRUE(nhot[0] > 8800 && nhot[0] < 9400);
+	CUT_ASSERT_TRUE(nhot[1] > 8800 && nhot[1] < 9400);
+	workload_free(&w);
+	return 0;
+}
+
+static int compare_strings(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Test string keys are distinct and of the requested lengths. */
+
+static int test5(void)
+{
+	struct workload_strings k;
+	char **sorted;
+	uint64_t i;
+
+	CUT_ASSERT_EQUAL(0, workload_string_keys(&k, 100000, 8, 24, 7));
+	CUT_ASSERT_EQUAL(100000, k.n);
+	for (i = 0; i < k.n; i++) {
+		size_t len = strlen(k.keys[i]);
+		CUT_ASSERT_TRUE(len >= 8 && len <= 24);
+	}
+
+	sorted = malloc(k.n * sizeof(*sorted));
+	memcpy(sorted, k.keys, k.n * sizeof(*sorted));
+	qsort(sorted, k.n, sizeof(*sorted), compare_strings);
+	for (i = 1; i < k.n; i++)
+		CUT_ASSERT_TRUE(strcmp(sorted[i - 1], sorted[i]) != 0);
+	free(sorted);
+	workload_strings_free(&k);
+
+	/* Too short for 100000 distinct keys: lengthened to fit. */
+	CUT_ASSERT_EQUAL(0, workload_string_keys(&k, 100000, 1, 1, 7));
+	CUT_ASSERT_EQUAL(3, strlen(k.keys[0]));
+	CUT_ASSERT_TRUE(strcmp(k.keys[0], k.keys[1]) != 0);
+	workload_strings_free(&k);
+	return 0;
+}
+
+CUT_BEGIN_TEST_HARNESS CUT_RUN_TEST(test1);
+CUT_RUN_TEST(test2);
+CUT_RUN_TEST(test3);
+CUT_RUN_TEST(test4);
+CUT_RUN_TEST(test5);
+CUT_END_TEST_HARNESS
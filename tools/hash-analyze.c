@@ -0,0 +1,581 @@
+/* Copyright (c) 2017 <Andrew McDermott>
+ *
+ * Source can be cloned from:
+ *
+ *     https://github.com/frobware/c-hacks.git
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * hash-analyze.c - how well does a hash function spread a set of keys?
+ *
+ * Usage: hash-analyze [-t type] [-f function] [-l library] [-n max]
+ *			keyfile
+ *
+ * Reads one key per line from keyfile ("-" for stdin), drops
+ * duplicates and empty lines, and reports on the hash function:
+ *
+ * avalanche  - flipping one bit of a key should flip each bit of the
+ *		hash with probability 1/2.  The bias of an (input bit,
+ *		output bit) pair is |2p - 1|; the mean and worst are
+ *		reported along with the bias pure sampling noise gives.
+ *		For strings, only bits in the first AVALANCHE_BYTES
+ *		bytes are flipped, but the whole key is hashed.
+ * collisions - keys whose full 32 bit hashes are equal, against the
+ *		number expected from a random function.
+ * buckets    - for several power of two table sizes, the keys are
+ *		put in bucket hv & (size - 1), as hashtbl does.  The
+ *		chi-square statistic of the bucket counts is reported
+ *		with its z-score (about 0 for a good function; above 3
+ *		is suspect), the longest chain against the longest
+ *		expected, and the fraction of empty buckets.
+ * throughput - nanoseconds per key to hash all the keys.
+ *
+ * The type says how to read each line and what the hash function is
+ * passed:
+ *
+ *   string - the line itself (const char *)
+ *   int    - a pointer to an int
+ *   int64  - a pointer to a long long
+ *   direct - the number itself, cast to a pointer
+ *
+ * The function is one of hashtbl-funcs.h's, named without the
+ * hashtbl_ prefix and _hash suffix, and defaults to the one for the
+ * type.  With -l, it is instead the name of a HASHTBL_HASH_FN
+ * exported by a shared library, so a custom function can be analyzed
+ * without rebuilding this tool:
+ *
+ *   cc -shared -fPIC -o myhash.so myhash.c
+ *   hash-analyze -t string -l ./myhash.so -f my_hash urls.txt
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <dlfcn.h>
+
+#include <c-hacks/hashtbl.h>
+#include <c-hacks/hashtbl-funcs.h>
+
+#define AVALANCHE_KEYS	2000
+#define AVALANCHE_BYTES	32
+#define MAX_INPUT_BITS	(AVALANCHE_BYTES * 8)
+#define THROUGHPUT_NS	200000000ULL
+
+enum key_type {
+	KEY_STRING,
+	KEY_INT,
+	KEY_INT64,
+	KEY_DIRECT
+};
+
+struct key {
+	const void *arg;		/* what the hash function is passed */
+	long long value;		/* for the integer types */
+};
+
+static const struct {
+	const char *name;
+	HASHTBL_HASH_FN fn;
+} builtins[] = {
+	{ "string", hashtbl_string_hash },
+	{ "int", hashtbl_int_hash },
+	{ "int64", hashtbl_int64_hash },
+	{ "direct", hashtbl_direct_hash },
+};
+
+static const char *const type_names[] = { "string", "int", "int64",
+	"direct"
+};
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: hash-analyze [-t string|int|int64|direct] "
+		"[-f function] [-l library] [-n max] keyfile\n");
+	exit(2);
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL +
+	    (unsigned long long)ts.tv_nsec;
+}
+
+static int compare_keys_string(const void *a, const void *b)
+{
+	return strcmp(((const struct key *)a)->arg,
+		      ((const struct key *)b)->arg);
+}
+
+static int compare_keys_value(const void *a, const void *b)
+{
+	long long x = ((const struct key *)a)->value;
+	long long y = ((const struct key *)b)->value;
+
+	return (x > y) - (x < y);
+}
+
+static int compare_uint(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a;
+	unsigned int y = *(const unsigned int *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Reads the keys, one per line.  Integer keys are stored in the
+ * struct key itself, so arg points into the returned array and the
+ * array must not move afterwards.
+ */
+static struct key *read_keys(FILE *fp, enum key_type type, size_t max,
+			     size_t *nkeys, size_t *nskipped)
+{
+	struct key *keys = NULL;
+	size_t n = 0, cap = 0, linecap = 0;
+	char *line = NULL, *end;
+	ssize_t len;
+
+	*nskipped = 0;
+
+	while (n < max && (len = getline(&line, &linecap, fp)) != -1) {
+		while (len > 0 && (line[len - 1] == '\n' ||
+				   line[len - 1] == '\r'))
+			line[--len] = '\0';
+		if (len == 0)
+			continue;
+		if (n == cap) {
+			cap = cap ? 2 * cap : 4096;
+			if ((keys = realloc(keys, cap * sizeof(*keys))) == NULL)
+				return NULL;
+		}
+		if (type == KEY_STRING) {
+			if ((keys[n].arg = strdup(line)) == NULL)
+				return NULL;
+			keys[n].value = 0;
+		} else {
+			keys[n].value = strtoll(line, &end, 0);
+			if (*end != '\0') {
+				(*nskipped)++;
+				continue;
+			}
+		}
+		n++;
+	}
+
+	free(line);
+	*nkeys = n;
+	return keys;
+}
+
+/* Sorts the keys, drops duplicates and points arg at each value. */
+static size_t unique_keys(struct key *keys, size_t n, enum key_type type)
+{
+	int (*cmp)(const void *, const void *) =
+	    (type == KEY_STRING) ? compare_keys_string : compare_keys_value;
+	size_t i, m = 0;
+
+	qsort(keys, n, sizeof(*keys), cmp);
+
+	for (i = 0; i < n; i++) {
+		if (m > 0 && cmp(&keys[m - 1], &keys[i]) == 0) {
+			if (type == KEY_STRING)
+				free((void *)keys[i].arg);
+			continue;
+		}
+		keys[m++] = keys[i];
+	}
+
+	for (i = 0; i < m; i++) {
+		if (type == KEY_INT) {
+			int v = (int)keys[i].value;
+			memcpy(&keys[i].value, &v, sizeof(v));
+			keys[i].arg = &keys[i].value;
+		} else if (type == KEY_INT64) {
+			keys[i].arg = &keys[i].value;
+		} else if (type == KEY_DIRECT) {
+			keys[i].arg = (const void *)(uintptr_t)keys[i].value;
+		}
+	}
+
+	return m;
+}
+
+/*
+ * Returns the hash of key with one input bit flipped.  *ok is 0 if
+ * that bit can't be flipped.  A string key is flipped in buf, a copy
+ * of it len bytes long.
+ */
+static unsigned int flipped_hash(HASHTBL_HASH_FN fn, enum key_type type,
+				 const struct key *key, int bit, char *buf,
+				 size_t len, int *ok)
+{
+	long long v = key->value;
+	char mask = (char)(1 << (bit % 8));
+	unsigned int h;
+	int iv;
+
+	*ok = 1;
+
+	switch (type) {
+	case KEY_STRING:
+		/* Don't shorten the key by flipping a byte to NUL. */
+		if ((size_t)(bit / 8) >= len || (buf[bit / 8] ^ mask) == 0) {
+			*ok = 0;
+			return 0;
+		}
+		buf[bit / 8] ^= mask;
+		h = fn(buf);
+		buf[bit / 8] ^= mask;
+		return h;
+	case KEY_INT:
+		memcpy(&iv, &key->value, sizeof(iv));
+		iv = (int)((unsigned int)iv ^ (1U << bit));
+		return fn(&iv);
+	case KEY_INT64:
+		v = (long long)((unsigned long long)v ^ (1ULL << bit));
+		return fn(&v);
+	case KEY_DIRECT:
+		return fn((const void *)(uintptr_t)
+			  ((uintptr_t)key->arg ^ ((uintptr_t)1 << bit)));
+	}
+
+	*ok = 0;
+	return 0;
+}
+
+static void avalanche(HASHTBL_HASH_FN fn, enum key_type type,
+		      const struct key *keys, size_t n)
+{
+	static unsigned long flips[MAX_INPUT_BITS][32];
+	static unsigned long trials[MAX_INPUT_BITS];
+	size_t i, step = (n > AVALANCHE_KEYS) ? n / AVALANCHE_KEYS : 1;
+	size_t bufsize = 0;
+	char *buf = NULL;
+	int nbits, in, out, worst_in = 0, worst_out = 0;
+	double sum = 0.0, worst = 0.0, noise = 0.0;
+	unsigned long ncells = 0;
+
+	switch (type) {
+	case KEY_STRING:
+		nbits = MAX_INPUT_BITS;
+		break;
+	case KEY_INT:
+		nbits = 32;
+		break;
+	default:
+		nbits = (int)(8 * sizeof(long long));
+		if (type == KEY_DIRECT && nbits > (int)(8 * sizeof(void *)))
+			nbits = (int)(8 * sizeof(void *));
+		break;
+	}
+
+	for (i = 0; i < n; i += step) {
+		size_t len = 0;
+		unsigned int h;
+
+		if (type == KEY_STRING) {
+			const char *s = keys[i].arg;
+			len = strlen(s);
+			if (len + 1 > bufsize) {
+				bufsize = 2 * (len + 1);
+				if ((buf = realloc(buf, bufsize)) == NULL)
+					return;
+			}
+			memcpy(buf, s, len + 1);
+		}
+
+		h = fn(keys[i].arg);
+
+		for (in = 0; in < nbits; in++) {
+			int ok;
+			unsigned int d = h ^ flipped_hash(fn, type, &keys[i],
+							  in, buf, len, &ok);
+			if (!ok)
+				continue;
+			trials[in]++;
+			for (out = 0; out < 32; out++)
+				flips[in][out] += (d >> out) & 1;
+		}
+	}
+
+	free(buf);
+
+	for (in = 0; in < nbits; in++) {
+		if (trials[in] == 0)
+			continue;
+		for (out = 0; out < 32; out++) {
+			double p = (double)flips[in][out] / trials[in];
+			double bias = fabs(2.0 * p - 1.0);
+
+			sum += bias;
+			noise += sqrt(2.0 / (M_PI * trials[in]));
+			ncells++;
+			if (bias > worst) {
+				worst = bias;
+				worst_in = in;
+				worst_out = out;
+			}
+		}
+	}
+
+	printf("avalanche:\n");
+	if (ncells == 0) {
+		printf("  no bits could be flipped\n");
+		return;
+	}
+	printf("  mean bias  %6.2f%%  (noise %.2f%%)\n", 100.0 * sum / ncells,
+	       100.0 * noise / ncells);
+	printf("  worst bias %6.2f%%  input bit %d -> output bit %d\n",
+	       100.0 * worst, worst_in, worst_out);
+}
+
+static void collisions(const unsigned int *hashes, size_t n)
+{
+	unsigned int *sorted = malloc(n * sizeof(*sorted) + 1);
+	size_t i, ncollisions = 0;
+	double expected = (double)n * ((double)n - 1.0) / 2.0 / 4294967296.0;
+
+	memcpy(sorted, hashes, n * sizeof(*sorted));
+	qsort(sorted, n, sizeof(*sorted), compare_uint);
+	for (i = 1; i < n; i++)
+		ncollisions += sorted[i] == sorted[i - 1];
+	free(sorted);
+
+	printf("collisions: %zu of 32 bit hashes (%.1f expected)\n",
+	       ncollisions, expected);
+}
+
+/*
+ * Expected longest chain, for n keys put in size buckets at random.
+ * A bucket's count is Poisson with mean n / size, and
+ *
+ *   E[max] = sum over m >= 1 of P(max >= m)
+ *	    = sum over m >= 1 of 1 - (1 - P(count >= m))^size.
+ */
+static double expected_max_chain(size_t n, size_t size)
+{
+	double lambda = (double)n / (double)size, tail = 0.0, e = 0.0;
+	int m, top = (int)(lambda + 20.0 * sqrt(lambda) + 50.0);
+	double *pmf = malloc((size_t)(top + 1) * sizeof(*pmf));
+
+	if (pmf == NULL)
+		return 0.0;
+
+	/* In logs: e^-lambda underflows for long chains. */
+	for (m = 0; m <= top; m++)
+		pmf[m] = exp(-lambda + m * log(lambda) - lgamma(m + 1.0));
+
+	/* Summing the tail from the top keeps the small terms. */
+	for (m = top; m >= 1; m--) {
+		tail += pmf[m];
+		e += -expm1((double)size * log1p(-(tail < 1.0 ? tail : 1.0)));
+	}
+
+	free(pmf);
+	return e;
+}
+
+static void buckets(const unsigned int *hashes, size_t n)
+{
+	unsigned long *counts;
+	int shifts[6], nshifts = 0, k, i, lg = 0;
+
+	while (((size_t)1 << lg) < n)
+		lg++;
+
+	/* A few small masks, then around a realistic load factor. */
+	for (k = 8; k <= 16; k += 4)
+		if (((size_t)1 << k) <= 4 * n)
+			shifts[nshifts++] = k;
+	for (k = lg - 1; k <= lg + 1; k++)
+		if (k > 16 && k <= 28)
+			shifts[nshifts++] = k;
+
+	printf("buckets:\n");
+	printf("  %9s %8s %8s %8s %5s %8s %7s %9s\n", "size", "load",
+	       "chi2/df", "z", "max", "exp max", "empty", "exp empty");
+
+	for (i = 0; i < nshifts; i++) {
+		size_t size = (size_t)1 << shifts[i], b, j;
+		double expect = (double)n / (double)size, chi2 = 0.0, df, z;
+		unsigned long max = 0, nempty = 0;
+
+		if ((counts = calloc(size, sizeof(*counts))) == NULL)
+			return;
+		for (j = 0; j < n; j++)
+			counts[hashes[j] & (size - 1)]++;
+		for (b = 0; b < size; b++) {
+			double d = (double)counts[b] - expect;
+			chi2 += d * d / expect;
+			if (counts[b] > max)
+				max = counts[b];
+			nempty += counts[b] == 0;
+		}
+		free(counts);
+
+		df = (double)size - 1.0;
+		z = (chi2 - df) / sqrt(2.0 * df);
+		printf("  %9zu %8.3f %8.3f %8.1f %5lu %8.1f %6.1f%% "
+		       "%8.1f%%%s\n", size, expect, chi2 / df, z, max,
+		       expected_max_chain(n, size), 100.0 * nempty / size,
+		       100.0 * exp(-expect), z > 3.0 ? " <--" : "");
+	}
+}
+
+static void throughput(HASHTBL_HASH_FN fn, const struct key *keys,
+		       size_t n, enum key_type type)
+{
+	unsigned long long start = now_ns(), ns, nhashed = 0, nbytes = 0;
+	static volatile unsigned int sink;
+	size_t i;
+
+	if (type == KEY_STRING)
+		for (i = 0; i < n; i++)
+			nbytes += strlen(keys[i].arg);
+
+	do {
+		for (i = 0; i < n; i++)
+			sink += fn(keys[i].arg);
+		nhashed += n;
+		ns = now_ns() - start;
+	} while (ns < THROUGHPUT_NS);
+
+	printf("throughput: %.2f ns/key", (double)ns / (double)nhashed);
+	if (type == KEY_STRING)
+		printf(", %.0f MB/s, mean key %.1f bytes",
+		       (double)nbytes * (nhashed / n) / ((double)ns / 1e9) /
+		       1e6, (double)nbytes / (double)n);
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	enum key_type type = KEY_STRING;
+	const char *fn_name = NULL, *lib = NULL;
+	size_t i, n, nread, nskipped, max = (size_t)-1;
+	HASHTBL_HASH_FN fn = NULL;
+	unsigned int *hashes;
+	struct key *keys;
+	FILE *fp;
+	int c;
+
+	while ((c = getopt(argc, argv, "t:f:l:n:h")) != -1) {
+		switch (c) {
+		case 't':
+			for (i = 0; i < 4; i++)
+				if (strcmp(optarg, type_names[i]) == 0)
+					break;
+			if (i == 4)
+				usage();
+			type = (enum key_type)i;
+			break;
+		case 'f':
+			fn_name = optarg;
+			break;
+		case 'l':
+			lib = optarg;
+			break;
+		case 'n':
+			max = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (optind != argc - 1)
+		usage();
+
+	if (lib != NULL) {
+		void *handle = dlopen(lib, RTLD_NOW);
+
+		if (handle == NULL || fn_name == NULL) {
+			fprintf(stderr, "hash-analyze: %s\n",
+				handle ? "-l needs -f" : dlerror());
+			return 1;
+		}
+		*(void **)&fn = dlsym(handle, fn_name);
+		if (fn == NULL) {
+			fprintf(stderr, "hash-analyze: %s\n", dlerror());
+			return 1;
+		}
+	} else {
+		if (fn_name == NULL)
+			fn_name = type_names[type];
+		for (i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++)
+			if (strcmp(fn_name, builtins[i].name) == 0)
+				fn = builtins[i].fn;
+		if (fn == NULL) {
+			fprintf(stderr, "hash-analyze: no function %s\n",
+				fn_name);
+			return 1;
+		}
+	}
+
+	fp = strcmp(argv[optind], "-") == 0 ? stdin : fopen(argv[optind], "r");
+	if (fp == NULL) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	if ((keys = read_keys(fp, type, max, &nread, &nskipped)) == NULL) {
+		fprintf(stderr, "hash-analyze: no keys\n");
+		return 1;
+	}
+	if (fp != stdin)
+		fclose(fp);
+
+	n = unique_keys(keys, nread, type);
+	printf("keys: %zu %s (%zu duplicates, %zu unparsable)\n", n,
+	       type_names[type], nread - n, nskipped);
+	printf("function: %s%s%s\n", fn_name, lib ? " from " : "",
+	       lib ? lib : "");
+	if (n == 0)
+		return 1;
+
+	hashes = malloc(n * sizeof(*hashes));
+	for (i = 0; i < n; i++)
+		hashes[i] = fn(keys[i].arg);
+
+	avalanche(fn, type, keys, n);
+	collisions(hashes, n);
+	buckets(hashes, n);
+	throughput(fn, keys, n, type);
+
+	free(hashes);
+	if (type == KEY_STRING)
+		for (i = 0; i < n; i++)
+			free((void *)keys[i].arg);
+	free(keys);
+
+	return 0;
+}